@@ -26,6 +26,9 @@ in the License.
 #endif
 #include <sgx_tkey_exchange.h>
 #include <sgx_tcrypto.h>
+#include <sgx_trts.h>
+#include <sgx_spinlock.h>
+#include <sgx_tseal.h>
 #include <stdio.h>
 #include <stdarg.h>
 
@@ -96,6 +99,37 @@ sgx_status_t get_report(sgx_report_t *report, sgx_target_info_t *target_info)
 #endif
 }
 
+/*
+ * As above, but bind the report to caller-supplied data. The host
+ * never picks the report data itself: we hash the caller's data behind
+ * a fixed tag, so it can't be made to match the SHA256(Ga||Gb||VK)
+ * that sgx_ra_get_msg3 puts in the report for an attestation.
+ */
+
+static const char user_data_tag[]= "SGX RA sample user report data";
+
+sgx_status_t get_report_user_data(sgx_report_t *report,
+	sgx_target_info_t *target_info, sgx_report_data_t *user_data)
+{
+	uint8_t msg[sizeof(user_data_tag)+sizeof(sgx_report_data_t)];
+	sgx_report_data_t report_data;
+	sgx_status_t status;
+
+	memcpy(msg, user_data_tag, sizeof(user_data_tag));
+	memcpy(&msg[sizeof(user_data_tag)], user_data, sizeof(sgx_report_data_t));
+
+	memset(&report_data, 0, sizeof(report_data));
+	status= sgx_sha256_msg(msg, (uint32_t) sizeof(msg),
+		(sgx_sha256_hash_t *) report_data.d);
+	if ( status != SGX_SUCCESS ) return status;
+
+#ifdef SGX_HW_SIM
+	return sgx_create_report(NULL, &report_data, report);
+#else
+	return sgx_create_report(target_info, &report_data, report);
+#endif
+}
+
 #ifdef _WIN32
 size_t get_pse_manifest_size ()
 {
@@ -252,21 +286,655 @@ const char *hexstring (const void *vsrc, size_t len)
 	return (const char *) _hex_buffer;
 }
 
-int dummy_prove(){
-	printf("Generating dummy proof for peer attestation.\n");
-	return 1997;
+/*
+ * Session keys that outlive the RA context. Once attestation succeeds
+ * the caller can move SK and MK into a session slot and close the RA
+ * context, and then refer to the keys by slot number. The keys never
+ * leave the enclave.
+ *
+ * Several threads can be in the enclave at once. sessions_lock covers
+ * the slot table: in_use, closing and refs. An ECALL takes a reference
+ * to its session with session_acquire(), which also takes the
+ * session's own lock, and gives both back with session_release(). A
+ * session that is closed while it's in use is only wiped, and its slot
+ * freed, when the last reference goes.
+ */
+
+#define MAX_SESSIONS	16
+
+typedef struct _session_struct {
+	int in_use;
+	int closing;
+	uint32_t refs;
+	sgx_spinlock_t lock;
+	uint32_t role;
+	sgx_ec_key_128bit_t sk;
+	sgx_ec_key_128bit_t mk;
+	int have_challenge;
+	sgx_quote_nonce_t challenge;
+	/* Secure channel */
+	int have_nonce;
+	sgx_quote_nonce_t nonce;
+	int have_rk;
+	sgx_aes_gcm_128bit_key_t rk;
+	uint64_t send_seq;
+	uint64_t recv_seq;
+} session_t;
+
+static session_t sessions[MAX_SESSIONS];
+static sgx_spinlock_t sessions_lock= SGX_SPINLOCK_INITIALIZER;
+
+static session_t *session_acquire(uint32_t sid)
+{
+	session_t *session;
+
+	if ( sid >= MAX_SESSIONS ) return NULL;
+
+	sgx_spin_lock(&sessions_lock);
+	session= &sessions[sid];
+	if ( ! session->in_use || session->closing ) {
+		sgx_spin_unlock(&sessions_lock);
+		return NULL;
+	}
+	++session->refs;
+	sgx_spin_unlock(&sessions_lock);
+
+	sgx_spin_lock(&session->lock);
+
+	return session;
+}
+
+static void session_release(session_t *session)
+{
+	sgx_spin_unlock(&session->lock);
+
+	sgx_spin_lock(&sessions_lock);
+	if ( --session->refs == 0 && session->closing )
+		memset(session, 0, sizeof(session_t));
+	sgx_spin_unlock(&sessions_lock);
+}
+
+static int memeq_consttime(const void *a, const void *b, size_t len)
+{
+	const unsigned char *pa= (const unsigned char *) a;
+	const unsigned char *pb= (const unsigned char *) b;
+	unsigned char diff= 0;
+	size_t i;
+
+	for (i= 0; i< len; ++i) diff|= pa[i]^pb[i];
+
+	return (diff == 0);
+}
+
+/* proof.mac = AES-CMAC(SK, ROLE || challenge || proof.nonce) */
+
+static sgx_status_t proof_mac(session_t *session, uint32_t role,
+	const sgx_quote_nonce_t *challenge, const sgx_quote_nonce_t *nonce,
+	sgx_mac_t *mac)
+{
+	uint8_t msg[sizeof(uint32_t)+2*sizeof(sgx_quote_nonce_t)];
+
+	memcpy(msg, &role, sizeof(uint32_t));
+	memcpy(&msg[sizeof(uint32_t)], challenge, sizeof(sgx_quote_nonce_t));
+	memcpy(&msg[sizeof(uint32_t)+sizeof(sgx_quote_nonce_t)], nonce,
+		sizeof(sgx_quote_nonce_t));
+
+	return sgx_rijndael128_cmac_msg(&session->sk, msg, sizeof(msg),
+		(sgx_cmac_128bit_tag_t *) mac);
+}
+
+static sgx_status_t session_alloc(const sgx_ec_key_128bit_t sk,
+	const sgx_ec_key_128bit_t mk, uint32_t role, uint32_t *sid)
+{
+	sgx_status_t status= SGX_ERROR_OUT_OF_MEMORY;
+	uint32_t i;
+
+	sgx_spin_lock(&sessions_lock);
+	for (i= 0; i< MAX_SESSIONS; ++i) {
+		if ( sessions[i].in_use ) continue;
+
+		memset(&sessions[i], 0, sizeof(session_t));
+		memcpy(sessions[i].sk, sk, sizeof(sgx_ec_key_128bit_t));
+		memcpy(sessions[i].mk, mk, sizeof(sgx_ec_key_128bit_t));
+		sessions[i].role= role;
+		sessions[i].in_use= 1;
+		*sid= i;
+		status= SGX_SUCCESS;
+		break;
+	}
+	sgx_spin_unlock(&sessions_lock);
+
+	return status;
+}
+
+sgx_status_t enclave_session_open(sgx_ra_context_t ctx, uint32_t *sid)
+{
+	sgx_status_t status;
+	sgx_ec_key_128bit_t sk, mk;
+
+	status= sgx_ra_get_keys(ctx, SGX_RA_KEY_SK, &sk);
+	if ( status != SGX_SUCCESS ) return status;
+	status= sgx_ra_get_keys(ctx, SGX_RA_KEY_MK, &mk);
+	if ( status != SGX_SUCCESS ) {
+		memset(sk, 0, sizeof(sk));
+		return status;
+	}
+
+	status= session_alloc(sk, mk, RA_PROOF_ROLE_CLIENT, sid);
+
+	memset(sk, 0, sizeof(sk));
+	memset(mk, 0, sizeof(mk));
+
+	return status;
+}
+
+sgx_status_t enclave_session_close(uint32_t sid)
+{
+	session_t *session;
+	sgx_status_t status= SGX_ERROR_INVALID_PARAMETER;
+
+	if ( sid >= MAX_SESSIONS ) return status;
+
+	sgx_spin_lock(&sessions_lock);
+	session= &sessions[sid];
+	if ( session->in_use && ! session->closing ) {
+		session->closing= 1;
+		if ( session->refs == 0 ) memset(session, 0, sizeof(session_t));
+		status= SGX_SUCCESS;
+	}
+	sgx_spin_unlock(&sessions_lock);
+
+	return status;
+}
+
+/*
+ * Seal a session's keys so the client can resume it after a restart.
+ * We use the MRENCLAVE policy so that only this exact enclave can get
+ * the keys back, not just any enclave from the same signer.
+ */
+
+sgx_status_t enclave_session_sealed_size(uint32_t *sz)
+{
+	*sz= sgx_calc_sealed_data_size(sizeof(sealed_session_info_t),
+		2*sizeof(sgx_ec_key_128bit_t));
+
+	return (*sz == UINT32_MAX) ? SGX_ERROR_UNEXPECTED : SGX_SUCCESS;
+}
+
+sgx_status_t enclave_session_seal(uint32_t sid, sealed_session_info_t *info,
+	uint8_t *sealed, uint32_t sz)
+{
+	session_t *session;
+	sgx_status_t status;
+	sgx_attributes_t mask;
+	uint8_t keys[2*sizeof(sgx_ec_key_128bit_t)];
+
+	session= session_acquire(sid);
+	if ( session == NULL ) return SGX_ERROR_INVALID_PARAMETER;
+
+	memcpy(keys, session->sk, sizeof(sgx_ec_key_128bit_t));
+	memcpy(&keys[sizeof(sgx_ec_key_128bit_t)], session->mk,
+		sizeof(sgx_ec_key_128bit_t));
+
+	session_release(session);
+
+	mask.flags= TSEAL_DEFAULT_FLAGSMASK;
+	mask.xfrm= 0;
+
+	status= sgx_seal_data_ex(SGX_KEYPOLICY_MRENCLAVE, mask,
+		TSEAL_DEFAULT_MISCMASK, sizeof(sealed_session_info_t),
+		(const uint8_t *) info, sizeof(keys), keys, sz,
+		(sgx_sealed_data_t *) sealed);
+
+	memset(keys, 0, sizeof(keys));
+
+	return status;
+}
+
+/*
+ * Unseal a session into a new slot. We have no trusted time source, so
+ * the expiry check uses the caller's clock. The service provider still
+ * enforces its own expiry on the session ticket.
+ */
+
+sgx_status_t enclave_session_unseal(uint8_t *sealed, uint32_t sz,
+	uint64_t now, sealed_session_info_t *info, uint32_t *sid)
+{
+	sgx_status_t status;
+	uint8_t keys[2*sizeof(sgx_ec_key_128bit_t)];
+	uint32_t keys_len= sizeof(keys);
+	uint32_t info_len= sizeof(sealed_session_info_t);
+	uint32_t need;
+
+	need= sgx_calc_sealed_data_size(sizeof(sealed_session_info_t),
+		sizeof(keys));
+	if ( need == UINT32_MAX || sz < need ) return SGX_ERROR_INVALID_PARAMETER;
+	if ( sgx_get_encrypt_txt_len((sgx_sealed_data_t *) sealed) != keys_len ||
+		sgx_get_add_mac_txt_len((sgx_sealed_data_t *) sealed) != info_len )
+		return SGX_ERROR_INVALID_PARAMETER;
+
+	status= sgx_unseal_data((sgx_sealed_data_t *) sealed, (uint8_t *) info,
+		&info_len, keys, &keys_len);
+	if ( status != SGX_SUCCESS ) return status;
+
+	if ( info->expires <= now ) {
+		memset(keys, 0, sizeof(keys));
+		return SGX_ERROR_INVALID_STATE;
+	}
+
+	status= session_alloc(keys, &keys[sizeof(sgx_ec_key_128bit_t)],
+		RA_PROOF_ROLE_CLIENT, sid);
+
+	memset(keys, 0, sizeof(keys));
+
+	return status;
+}
+
+/*
+ * Issue a challenge for the peer. The nonce is generated and remembered
+ * here so that untrusted code can't replay an old proof by supplying
+ * an old challenge. Each challenge can only be answered once.
+ */
+
+sgx_status_t enclave_proof_challenge(uint32_t sid,
+	sgx_quote_nonce_t *challenge)
+{
+	session_t *session;
+	sgx_status_t status;
+
+	session= session_acquire(sid);
+	if ( session == NULL ) return SGX_ERROR_INVALID_PARAMETER;
+
+	status= sgx_read_rand((unsigned char *) &session->challenge,
+		sizeof(sgx_quote_nonce_t));
+	if ( status == SGX_SUCCESS ) {
+		session->have_challenge= 1;
+		memcpy(challenge, &session->challenge, sizeof(sgx_quote_nonce_t));
+	}
+
+	session_release(session);
+
+	return status;
+}
+
+/*
+ * Answer the peer's challenge, proving we hold SK. role is our own role
+ * in the exchange.
+ */
+
+sgx_status_t enclave_proof_create(uint32_t sid, uint32_t role,
+	sgx_quote_nonce_t *challenge, ra_proof_t *proof)
+{
+	session_t *session;
+	sgx_status_t status;
+
+	session= session_acquire(sid);
+	if ( session == NULL ) return SGX_ERROR_INVALID_PARAMETER;
+
+	status= sgx_read_rand((unsigned char *) &proof->nonce,
+		sizeof(sgx_quote_nonce_t));
+	if ( status == SGX_SUCCESS )
+		status= proof_mac(session, role, challenge, &proof->nonce,
+			&proof->mac);
+
+	session_release(session);
+
+	return status;
+}
+
+/*
+ * Check the peer's answer to our outstanding challenge. role is the
+ * peer's role in the exchange.
+ */
+
+sgx_status_t enclave_proof_verify(uint32_t sid, uint32_t role,
+	ra_proof_t *proof, int *valid)
+{
+	session_t *session;
+	sgx_status_t status;
+	sgx_mac_t mac;
+
+	*valid= 0;
+
+	session= session_acquire(sid);
+	if ( session == NULL ) return SGX_ERROR_INVALID_PARAMETER;
+	if ( ! session->have_challenge ) {
+		session_release(session);
+		return SGX_ERROR_INVALID_STATE;
+	}
+
+	status= proof_mac(session, role, &session->challenge, &proof->nonce,
+		&mac);
+
+	session->have_challenge= 0;
+	memset(&session->challenge, 0, sizeof(sgx_quote_nonce_t));
+
+	session_release(session);
+
+	if ( status != SGX_SUCCESS ) return status;
+
+	*valid= memeq_consttime(mac, proof->mac, sizeof(sgx_mac_t));
+
+	return SGX_SUCCESS;
+}
+
+/*
+ * Secure channel (see protocol.h). enclave_channel_nonce() gives us a
+ * fresh nonce to send to the peer, and enclave_channel_keys() derives
+ * the record key once we have the peer's.
+ */
+
+sgx_status_t enclave_channel_nonce(uint32_t sid, sgx_quote_nonce_t *nonce)
+{
+	session_t *session;
+	sgx_status_t status;
+
+	session= session_acquire(sid);
+	if ( session == NULL ) return SGX_ERROR_INVALID_PARAMETER;
+
+	status= sgx_read_rand((unsigned char *) &session->nonce,
+		sizeof(sgx_quote_nonce_t));
+	if ( status == SGX_SUCCESS ) {
+		session->have_nonce= 1;
+		memcpy(nonce, &session->nonce, sizeof(sgx_quote_nonce_t));
+	}
+
+	session_release(session);
 
+	return status;
 }
 
-int dummy_verify(int proof){
-	printf("Here is the proof: %d\n", proof);
-	if (proof == 1997){
-		printf("Dummy proof from the peer is VERIFIED.\n");
+/* RK = AES-CMAC(SK, 0x01 || "RK" || Nc || Ns) */
+
+sgx_status_t enclave_channel_keys(uint32_t sid,
+	sgx_quote_nonce_t *peer_nonce)
+{
+	session_t *session;
+	sgx_status_t status;
+	uint8_t msg[3+2*sizeof(sgx_quote_nonce_t)];
+	sgx_quote_nonce_t *nc, *ns;
+
+	session= session_acquire(sid);
+	if ( session == NULL ) return SGX_ERROR_INVALID_PARAMETER;
+	if ( ! session->have_nonce ) {
+		session_release(session);
+		return SGX_ERROR_INVALID_STATE;
+	}
+
+	if ( session->role == RA_PROOF_ROLE_CLIENT ) {
+		nc= &session->nonce;
+		ns= peer_nonce;
 	} else {
-		printf("COULD NOT verify the proof from the peer.\n");
+		nc= peer_nonce;
+		ns= &session->nonce;
+	}
+
+	memcpy(msg, "\x01RK", 3);
+	memcpy(&msg[3], nc, sizeof(sgx_quote_nonce_t));
+	memcpy(&msg[3+sizeof(sgx_quote_nonce_t)], ns, sizeof(sgx_quote_nonce_t));
+
+	status= sgx_rijndael128_cmac_msg(&session->sk, msg, sizeof(msg),
+		(sgx_cmac_128bit_tag_t *) &session->rk);
+
+	session->have_nonce= 0;
+	memset(&session->nonce, 0, sizeof(sgx_quote_nonce_t));
+	if ( status == SGX_SUCCESS ) {
+		session->have_rk= 1;
+		session->send_seq= 0;
+		session->recv_seq= 0;
+	}
+
+	session_release(session);
+
+	return status;
+}
+
+/* IV = sender role (32 bits) || seq (64 bits) */
+
+static void record_iv(uint32_t role, uint64_t seq, uint8_t iv[12])
+{
+	memcpy(iv, &role, sizeof(uint32_t));
+	memcpy(&iv[sizeof(uint32_t)], &seq, sizeof(uint64_t));
+}
+
+static sgx_status_t record_seal(session_t *session, const uint8_t *pt,
+	uint32_t len, ra_record_header_t *hdr, uint8_t *ct)
+{
+	sgx_status_t status;
+	uint8_t iv[12];
+
+	if ( ! session->have_rk ) return SGX_ERROR_INVALID_STATE;
+	if ( len > RA_RECORD_MAX_LEN ) return SGX_ERROR_INVALID_PARAMETER;
+
+	hdr->type= RA_MSG_TYPE_RECORD;
+	hdr->len= len;
+	hdr->seq= session->send_seq;
+
+	record_iv(session->role, hdr->seq, iv);
+
+	status= sgx_rijndael128GCM_encrypt(&session->rk, pt, len, ct, iv,
+		sizeof(iv), (const uint8_t *) hdr, RA_RECORD_AAD_SIZE,
+		(sgx_aes_gcm_128bit_tag_t *) &hdr->tag);
+	if ( status == SGX_SUCCESS ) ++session->send_seq;
+
+	return status;
+}
+
+static sgx_status_t record_open(session_t *session,
+	const ra_record_header_t *hdr, const uint8_t *ct, uint32_t len,
+	uint8_t *pt)
+{
+	sgx_status_t status;
+	uint32_t peer;
+	uint8_t iv[12];
+
+	if ( ! session->have_rk ) return SGX_ERROR_INVALID_STATE;
+	if ( hdr->type != RA_MSG_TYPE_RECORD || hdr->len != len ||
+		len > RA_RECORD_MAX_LEN ) return SGX_ERROR_INVALID_PARAMETER;
+	if ( hdr->seq != session->recv_seq ) return SGX_ERROR_MAC_MISMATCH;
+
+	peer= (session->role == RA_PROOF_ROLE_CLIENT) ?
+		RA_PROOF_ROLE_SERVER : RA_PROOF_ROLE_CLIENT;
+	record_iv(peer, hdr->seq, iv);
+
+	status= sgx_rijndael128GCM_decrypt(&session->rk, ct, len, pt, iv,
+		sizeof(iv), (const uint8_t *) hdr, RA_RECORD_AAD_SIZE,
+		(const sgx_aes_gcm_128bit_tag_t *) &hdr->tag);
+	if ( status == SGX_SUCCESS ) ++session->recv_seq;
+
+	return status;
+}
+
+sgx_status_t enclave_record_seal(uint32_t sid, uint8_t *pt, uint32_t len,
+	ra_record_header_t *hdr, uint8_t *ct)
+{
+	session_t *session;
+	sgx_status_t status;
+
+	session= session_acquire(sid);
+	if ( session == NULL ) return SGX_ERROR_INVALID_PARAMETER;
+
+	status= record_seal(session, pt, len, hdr, ct);
+
+	session_release(session);
+
+	return status;
+}
+
+sgx_status_t enclave_record_open(uint32_t sid, ra_record_header_t *hdr,
+	uint8_t *ct, uint32_t len, uint8_t *pt)
+{
+	session_t *session;
+	sgx_status_t status;
+
+	session= session_acquire(sid);
+	if ( session == NULL ) return SGX_ERROR_INVALID_PARAMETER;
+
+	status= record_open(session, hdr, ct, len, pt);
+
+	session_release(session);
+
+	return status;
+}
+
+/*
+ * Batched versions of the above for many small records. The records
+ * are packed back to back in one buffer, so we pay for one enclave
+ * transition instead of one per record.
+ */
+
+sgx_status_t enclave_record_seal_batch(uint32_t sid, uint32_t n,
+	uint32_t *lens, uint8_t *pt, ra_record_header_t *hdrs, uint8_t *ct,
+	uint32_t total)
+{
+	session_t *session;
+	sgx_status_t status;
+	uint32_t i, off;
+
+	session= session_acquire(sid);
+	if ( session == NULL ) return SGX_ERROR_INVALID_PARAMETER;
+
+	status= SGX_SUCCESS;
+	for (i= 0, off= 0; i< n; ++i) {
+		if ( lens[i] > total-off ) {
+			status= SGX_ERROR_INVALID_PARAMETER;
+			break;
+		}
+
+		status= record_seal(session, &pt[off], lens[i], &hdrs[i], &ct[off]);
+		if ( status != SGX_SUCCESS ) break;
+
+		off+= lens[i];
+	}
+
+	session_release(session);
+
+	return status;
+}
+
+sgx_status_t enclave_record_open_batch(uint32_t sid, uint32_t n,
+	ra_record_header_t *hdrs, uint8_t *ct, uint8_t *pt, uint32_t total)
+{
+	session_t *session;
+	sgx_status_t status;
+	uint32_t i, off;
+
+	session= session_acquire(sid);
+	if ( session == NULL ) return SGX_ERROR_INVALID_PARAMETER;
+
+	status= SGX_SUCCESS;
+	for (i= 0, off= 0; i< n; ++i) {
+		if ( hdrs[i].len > total-off ) {
+			status= SGX_ERROR_INVALID_PARAMETER;
+			break;
+		}
+
+		status= record_open(session, &hdrs[i], &ct[off], hdrs[i].len,
+			&pt[off]);
+		if ( status != SGX_SUCCESS ) break;
+
+		off+= hdrs[i].len;
 	}
+
+	session_release(session);
+
+	return status;
 }
 
+/*
+ * Scatter-gather versions for bulk data. The descriptors and the
+ * records stay in untrusted memory and are encrypted or decrypted in
+ * place, so nothing is marshalled across the enclave boundary. That
+ * means we have to do the bounds checks the edger8r would otherwise
+ * do for us, and copy each descriptor and header in before using it
+ * so the untrusted side can't change them underneath us.
+ */
+
+static sgx_status_t record_iov_check(ra_record_iov_t *iov, uint32_t n)
+{
+	if ( n == 0 ) return SGX_SUCCESS;
+	if ( iov == NULL || n > UINT32_MAX/sizeof(ra_record_iov_t) )
+		return SGX_ERROR_INVALID_PARAMETER;
+	if ( ! sgx_is_outside_enclave(iov, n*sizeof(ra_record_iov_t)) )
+		return SGX_ERROR_INVALID_PARAMETER;
+
+	return SGX_SUCCESS;
+}
+
+static sgx_status_t record_iov_get(ra_record_iov_t *iov, uint32_t i,
+	ra_record_iov_t *desc)
+{
+	memcpy(desc, &iov[i], sizeof(ra_record_iov_t));
+
+	if ( desc->len > RA_RECORD_MAX_LEN ) return SGX_ERROR_INVALID_PARAMETER;
+	if ( desc->hdr == NULL || ! sgx_is_outside_enclave(desc->hdr,
+		sizeof(ra_record_header_t)) ) return SGX_ERROR_INVALID_PARAMETER;
+	if ( desc->len && ( desc->buf == NULL ||
+		! sgx_is_outside_enclave(desc->buf, desc->len) ) )
+		return SGX_ERROR_INVALID_PARAMETER;
+
+	return SGX_SUCCESS;
+}
+
+sgx_status_t enclave_record_seal_iov(uint32_t sid, ra_record_iov_t *iov,
+	uint32_t n)
+{
+	session_t *session;
+	sgx_status_t status;
+	ra_record_iov_t desc;
+	ra_record_header_t hdr;
+	uint32_t i;
+
+	status= record_iov_check(iov, n);
+	if ( status != SGX_SUCCESS ) return status;
+
+	session= session_acquire(sid);
+	if ( session == NULL ) return SGX_ERROR_INVALID_PARAMETER;
+
+	for (i= 0; i< n; ++i) {
+		status= record_iov_get(iov, i, &desc);
+		if ( status != SGX_SUCCESS ) break;
+
+		status= record_seal(session, desc.buf, desc.len, &hdr, desc.buf);
+		if ( status != SGX_SUCCESS ) break;
+
+		memcpy(desc.hdr, &hdr, sizeof(ra_record_header_t));
+	}
+
+	session_release(session);
+
+	return status;
+}
+
+sgx_status_t enclave_record_open_iov(uint32_t sid, ra_record_iov_t *iov,
+	uint32_t n)
+{
+	session_t *session;
+	sgx_status_t status;
+	ra_record_iov_t desc;
+	ra_record_header_t hdr;
+	uint32_t i;
+
+	status= record_iov_check(iov, n);
+	if ( status != SGX_SUCCESS ) return status;
+
+	session= session_acquire(sid);
+	if ( session == NULL ) return SGX_ERROR_INVALID_PARAMETER;
+
+	for (i= 0; i< n; ++i) {
+		status= record_iov_get(iov, i, &desc);
+		if ( status != SGX_SUCCESS ) break;
+
+		memcpy(&hdr, desc.hdr, sizeof(ra_record_header_t));
+
+		status= record_open(session, &hdr, desc.buf, desc.len, desc.buf);
+		if ( status != SGX_SUCCESS ) break;
+	}
+
+	session_release(session);
+
+	return status;
+}
 
 int process_msg01 (uint32_t msg0_extended_epid_group_id, sgx_ra_msg1_t *msg1)
 {
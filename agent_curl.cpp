@@ -40,11 +40,16 @@ static size_t _read_callback(char *buffer, size_t size, size_t nitems,
 
 string AgentCurl::name= "libcurl";
 
-AgentCurl::AgentCurl (IAS_Connection *conn_in) : Agent(conn_in)
+// The headers are parsed as libcurl hands them to us. libcurl has
+// already undone any transfer encoding by the time it gives us the body,
+// so that is appended to the response as-is.
+
+AgentCurl::AgentCurl (IAS_Connection *conn_in) : Agent(conn_in),
+	parser(true)
 {
 	curl= NULL;
-	sresponse= "";
-	header_len= header_pos= 0;
+	result= HttpResponseParser::ParsingIncompleted;
+	presponse= NULL;
 	flag_eoh= 0;
 }
 
@@ -76,23 +81,21 @@ int AgentCurl::initialize ()
 	if ( curl_easy_setopt(curl, CURLOPT_PROTOCOLS, CURLPROTO_HTTPS) !=
 		CURLE_OK ) return 0;
 
-	// Include the server response headers
-	if ( curl_easy_setopt(curl, CURLOPT_HEADER, 1L) != CURLE_OK ) return 0;
-
 #ifdef CURL_OPT_SUPPRESS_CONNECT_HEADERS
 	// Suppress the proxy CONNECT headers.
 	if ( curl_easy_setopt(curl, CURLOPT_SUPPRESS_CONNECT_HEADERS, 1L) !=
 		CURLE_OK ) return 0;
-#else
-	// Sigh. Our version of libcurl is too old so we need to detect
-	// proxy headers by hand.
+#endif
+
+	// The server response headers come to us one line at a time. Older
+	// versions of libcurl also give us the proxy headers, which we
+	// detect by hand.
 
 	if ( curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, _header_callback)
 		 != CURLE_OK) return 0;
 
 	if ( curl_easy_setopt(curl, CURLOPT_HEADERDATA, this) != CURLE_OK)
 		return 0;
-#endif
 
 	curl_easy_setopt(curl, CURLOPT_BUFFERSIZE, 102400L);
 	curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1L);
@@ -146,12 +149,12 @@ int AgentCurl::initialize ()
 int AgentCurl::request(string const &url, string const &postdata,
 	Response &response)
 {
-	sresponse= "";
-	HttpResponseParser parser;
-	HttpResponseParser::ParseResult result;
 	const char *bp;
 
-	header_len= header_pos= 0;
+	parser.reset();
+	response.clear();
+	presponse= &response;
+	result= HttpResponseParser::ParsingIncompleted;
 	flag_eoh= 0;
 	curl_slist *slist= NULL;
 
@@ -187,6 +190,7 @@ int AgentCurl::request(string const &url, string const &postdata,
 		return 0;
 
 	if ( curl_easy_perform(curl) != 0 ) {
+		presponse= NULL;
 		return 0;
 	}
 
@@ -195,42 +199,41 @@ int AgentCurl::request(string const &url, string const &postdata,
 		slist = NULL;
 	}
 
-	result= parser.parse(response, sresponse.substr(header_pos).c_str(),
-		sresponse.c_str()+sresponse.length());
+	presponse= NULL;
 
-    return ( result == HttpResponseParser::ParsingCompleted );
+	return ( result == HttpResponseParser::ParsingCompleted );
 }
 
 size_t AgentCurl::header_callback(char *ptr, size_t sz, size_t n)
 {
 	size_t len= sz*n;
-	string header;
-	size_t idx;
+	int blank= ( len == 0 || ptr[0] == '\r' || ptr[0] == '\n' );
 
 	// Look for a blank header that occurs in the middle of the
 	// headers: that's the separator between the proxy and server
 	// headers. We want the last header block.
 
-	header.assign(ptr, len);
-	// Find where newline chars begin
-	idx= header.find_first_of("\n\r");
-
 	if ( flag_eoh ) {
-		if ( idx != 0 )	{
+		if ( ! blank ) {
 			// We got a non-blank header line after receiving the
 			// end of a header block, so we have started a new
 			// header block.
 
-			header_pos= header_len;
+			parser.reset();
+			presponse->clear();
+			result= HttpResponseParser::ParsingIncompleted;
 			flag_eoh= 0;
 		} 
 	} else {
 		// If we have a blank line, we reached the end of a header
 		// block.
-		if ( idx == 0 ) flag_eoh= 1;
+		if ( blank ) flag_eoh= 1;
 	}
 
-	header_len+= len;
+	result= parser.parse(*presponse, ptr, ptr+len);
+
+	// Returning short makes libcurl abort the transfer
+	if ( result == HttpResponseParser::ParsingError ) return 0;
 
 	return len;
 }
@@ -238,7 +241,11 @@ size_t AgentCurl::header_callback(char *ptr, size_t sz, size_t n)
 size_t AgentCurl::write_callback(char *ptr, size_t sz, size_t n)
 {
 	size_t len= sz*n;
-	sresponse.append(ptr, len);
+
+	// The body can't start before the headers end
+	if ( result != HttpResponseParser::ParsingCompleted ) return 0;
+
+	presponse->content.append(ptr, len);
 	return len;
 }
 
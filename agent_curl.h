@@ -20,6 +20,7 @@ in the License.
 
 #include <curl/curl.h>
 #include "httpparser/response.h"
+#include "httpparser/httpresponseparser.h"
 #include "iasrequest.h"
 #include "agent.h"
 #include "settings.h"
@@ -31,9 +32,10 @@ using namespace std;
 class AgentCurl : protected Agent
 {
 	CURL *curl;
-	string sresponse;
+	HttpResponseParser parser;
+	HttpResponseParser::ParseResult result;
+	Response *presponse;
 	int flag_eoh;
-	size_t header_pos, header_len;
 
 public:
 	static string name;
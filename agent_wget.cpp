@@ -31,8 +31,10 @@ using namespace httpparser;
 
 #include <string>
 #include <vector>
+#include <mutex>
 
 static vector<string> wget_args;
+static mutex wget_args_lock;	/* sp's workers share wget_args */
 
 extern int debug, verbose;
 
@@ -47,10 +49,10 @@ int AgentWget::request (string const &url, string const &post,
 	 Response &response)
 {
 	HttpResponseParser parser;
+	HttpResponseParser::ParseResult result;
 	int pipefd[2];
 	pid_t pid;
 	string arg;
-	string sresponse;
 	int status;
 	char buffer[CHUNK_SZ];
 	size_t bread;
@@ -94,6 +96,7 @@ retry_write:
 	}
 
 	// Only need to initialize these once
+	wget_args_lock.lock();
 	if ( wget_args.size() == 0 ) {
 		wget_args.push_back("wget");
 
@@ -125,6 +128,7 @@ retry_write:
 			unsetenv("no_proxy");
 		} 
 	}
+	wget_args_lock.unlock();
 
 	/* Set up two pipes for reading from the child */
 
@@ -205,8 +209,13 @@ retry_dup:
 
 	close(pipefd[1]);
 
-	/* Read until eol */
+	/*
+	 * Read until eol, parsing as we go. Keep draining the pipe even
+	 * if the response is bad so wget isn't left blocked on it.
+	 */
 
+	response.clear();
+	result= HttpResponseParser::ParsingIncompleted;
 	repeat= 1;
 	while ( repeat ) {
 		bread= read(pipefd[0], buffer, CHUNK_SZ);
@@ -219,8 +228,8 @@ retry_dup:
 			}
 		} else if ( bread == 0 ) {
 			repeat= 0;
-		} else {
-			sresponse.append(buffer, bread);
+		} else if ( result == HttpResponseParser::ParsingIncompleted ) {
+			result= parser.parse(response, buffer, buffer+bread);
 		}
 	}
 
@@ -246,10 +255,6 @@ retry_wait:
 		}
 
 		else if ( exitcode == WGET_NO_ERROR || exitcode == WGET_SERVER_ERROR ) {
-			HttpResponseParser::ParseResult result;
-
-			result= parser.parse(response, sresponse.c_str(),
-				sresponse.c_str()+sresponse.length());
 			rv= ( result == HttpResponseParser::ParsingCompleted );
 		}
 	} else rv= 0;
@@ -49,11 +49,24 @@ using namespace std;
 #include <openssl/evp.h>
 #include <getopt.h>
 #include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #endif
 #include <sgx_uae_service.h>
 #include <sgx_ukey_exchange.h>
 #include <sgx_uae_quote_ex.h>
 #include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <random>
 #include "common.h"
 #include "protocol.h"
 #include "sgx_detect.h"
@@ -88,8 +101,71 @@ typedef struct config_struct
 	sgx_quote_nonce_t nonce;
 	char *server;
 	char *port;
+	uint32_t proof_rounds;
+	uint32_t resume_rounds;
+	char *session_file;
+	uint32_t session_validity;
+	uint32_t record_rounds;
+	uint32_t record_size;
+	uint32_t record_batch;
+	char record_iov;
+	char *token_file;
+	char *daemon_socket;
+	uint32_t ra_pool;
+	sgx_report_data_t report_data;
+	char *quote_batch;
+	char *verifiers;
+	uint32_t deadline;
+	int64_t deadline_ms;
+	char *peer;
+	char *peer_host;
+	char *peer_port;
+	char mutual;
+	uint32_t streams;
+	long peer_uid;
 } config_t;
 
+/* An RA context with msg0 and msg1 already generated */
+
+typedef struct ra_prepared_struct
+{
+	int ready;
+	sgx_ra_context_t ra_ctx;
+	uint32_t msg0_extended_epid_group_id;
+	sgx_ra_msg1_t msg1;
+} ra_prepared_t;
+
+/*
+ * A pool of prepared RA contexts, kept topped up by a background
+ * thread so attestations don't have to wait for msg1.
+ */
+
+/*
+ * Everything needed to generate quotes that doesn't depend on the
+ * report, so it can be reused across many quotes.
+ */
+
+typedef struct quote_service_struct
+{
+	int ready;
+	sgx_target_info_t target_info;
+	sgx_epid_group_id_t epid_gid;
+	uint32_t sz;
+	sgx_quote_t *quote;
+} quote_service_t;
+
+typedef struct ra_pool_struct
+{
+	sgx_enclave_id_t eid;
+	config_t *config;
+	uint32_t size;
+	deque<ra_prepared_t> ready;
+	mutex lock;
+	condition_variable cv;
+	bool stop;
+	thread worker;
+} ra_pool_t;
+
 int file_in_searchpath(const char *file, const char *search, char *fullpath,
 					   size_t len);
 
@@ -103,11 +179,45 @@ sgx_status_t sgx_create_enclave_search(
 
 void usage();
 int do_quote(sgx_enclave_id_t eid, config_t *config);
-int do_attestation(sgx_enclave_id_t eid, config_t *config);
-int do_attestation_old(sgx_enclave_id_t eid, config_t *config);
-void dummy_prover(sgx_enclave_id_t eid, config_t *config);
-void dummy_verifier(sgx_enclave_id_t eid, config_t *config);
+int quote_service_init(quote_service_t *qs);
+int quote_service_get(quote_service_t *qs, sgx_enclave_id_t eid,
+					  config_t *config, sgx_report_data_t *user_data,
+					  sgx_quote_nonce_t *nonce, sgx_report_t *qe_report);
+void quote_service_free(quote_service_t *qs);
+#ifndef _WIN32
+int do_quote_batch(sgx_enclave_id_t eid, config_t *config);
+#endif
+int do_attestation_old(sgx_enclave_id_t eid, config_t *config,
+					   ra_prepared_t *warm, int *trusted);
+int ra_prepare(sgx_enclave_id_t eid, config_t *config, ra_prepared_t *ra);
+int do_fanout(sgx_enclave_id_t eid, config_t *config);
+int do_streams(sgx_enclave_id_t eid, config_t *config);
+void ra_pool_start(ra_pool_t *pool, sgx_enclave_id_t eid, config_t *config,
+				   uint32_t size);
+int ra_pool_take(ra_pool_t *pool, ra_prepared_t *ra);
+void ra_pool_put(ra_pool_t *pool, ra_prepared_t *ra);
+void ra_pool_stop(ra_pool_t *pool);
+#ifndef _WIN32
+int do_daemon(sgx_enclave_id_t eid, config_t *config);
+#endif
+int token_load(char *file, sgx_launch_token_t *token);
+int token_save(char *file, sgx_launch_token_t *token);
 int do_verification(sgx_enclave_id_t eid, config_t *config);
+int do_mutual(sgx_enclave_id_t eid, config_t *config);
+int do_proof(sgx_enclave_id_t eid, uint32_t sid, MsgIO *msgio);
+int do_proof_bench(sgx_enclave_id_t eid, uint32_t sid, MsgIO *msgio,
+				   uint32_t rounds, double ra_usec);
+MsgIO *do_resume(sgx_enclave_id_t eid, uint32_t sid, ra_ticket_t *ticket,
+				 config_t *config);
+int do_resume_bench(sgx_enclave_id_t eid, uint32_t sid, ra_ticket_t *ticket,
+					config_t *config, double ra_usec);
+int do_channel_open(sgx_enclave_id_t eid, uint32_t sid, MsgIO *msgio);
+int do_record_bench(sgx_enclave_id_t eid, uint32_t sid, MsgIO *msgio,
+					config_t *config);
+void print_latency(const char *title, vector<double> &usec, double ra_usec);
+int session_save(sgx_enclave_id_t eid, uint32_t sid, ra_ticket_t *ticket,
+				 config_t *config);
+int session_resume(sgx_enclave_id_t eid, config_t *config);
 
 char debug = 0;
 char verbose = 0;
@@ -115,6 +225,12 @@ char verbose = 0;
 // Flag to be set to 0 if the device is a prover, 1 if verifier
 int prover_verifier_flag = -1;
 
+/* Where the verifier peer listens by default */
+#define DEFAULT_PEER_PORT "7778"
+
+/* Provers a verifier peer will handle at once */
+#define MAX_PEERS 64
+
 #define MODE_ATTEST 0x0
 #define MODE_EPID 0x1
 #define MODE_QUOTE 0x2
@@ -123,6 +239,37 @@ int prover_verifier_flag = -1;
 #define OPT_NONCE 0x02
 #define OPT_LINK 0x04
 #define OPT_PUBKEY 0x08
+#define OPT_REPORT_DATA 0x10
+
+/* How long a sealed session stays usable by default, in seconds */
+#define DEF_SESSION_VALIDITY 3600
+#define DEF_RECORD_SIZE 64
+#define MAX_RECORD_BATCH 1024
+
+/*
+ * The batch ECALLs copy a whole batch in and out of the enclave, so
+ * keep it well inside the enclave heap (see Enclave.config.xml).
+ */
+#define MAX_RECORD_BATCH_BYTES 0x40000
+
+/* Prepared RA contexts to keep on hand in daemon mode */
+#define DEF_RA_POOL 1
+#define MAX_RA_POOL 64
+
+/*
+ * Verifiers we'll attest to at once. Each one makes ECALLs from its
+ * own thread, so this can't exceed the TCS count in Enclave.config.xml.
+ */
+#define MAX_VERIFIERS 8
+
+/*
+ * Retries when the SP is too busy to attest us (see ra_busy_t). Each
+ * one waits what the SP asked for plus a random share of a window, in
+ * milliseconds, that doubles every time.
+ */
+#define BUSY_RETRIES 8
+#define BUSY_BACKOFF_BASE 100
+#define BUSY_BACKOFF_MAX 10000
 
 /* Macros to set, clear, and get the mode and options */
 
@@ -148,6 +295,7 @@ int main(int argc, char *argv[])
 	EVP_PKEY *service_public_key = NULL;
 	char have_spid = 0;
 	char flag_stdio = 0;
+	int rv = 0;
 
 	/* Create a logfile to capture debug output and actual msg data */
 	fplog = create_logfile("client.log");
@@ -179,6 +327,11 @@ int main(int argc, char *argv[])
 
 	memset(&config, 0, sizeof(config));
 	config.mode = MODE_ATTEST;
+	config.session_validity = DEF_SESSION_VALIDITY;
+	config.record_size = DEF_RECORD_SIZE;
+	config.record_batch = 1;
+	config.ra_pool = DEF_RA_POOL;
+	config.peer_uid = -1;
 
 	static struct option long_opt[] =
 		{
@@ -200,8 +353,32 @@ int main(int argc, char *argv[])
 			{"quote", no_argument, 0, 'q'},
 			{"verbose", no_argument, 0, 'v'},
 			{"stdio", no_argument, 0, 'z'},
-			{"prover-peer", no_argument, 0, 'P'},
-			{"verifier-peer", no_argument, 0, 'V'},
+			{"prover-peer", optional_argument, 0, 'P'},
+			{"verifier-peer", optional_argument, 0, 'V'},
+			{"mutual", no_argument, 0, 'M'},
+			{"streams", required_argument, 0, 'U'},
+#ifndef _WIN32
+			{"peer-uid", required_argument, 0, 'O'},
+#endif
+			{"proof-bench", required_argument, 0, 'B'},
+			{"resume-bench", required_argument, 0, 'R'},
+			{"session-file", required_argument, 0, 'F'},
+			{"session-validity", required_argument, 0, 'W'},
+			{"record-bench", required_argument, 0, 'E'},
+			{"record-size", required_argument, 0, 'L'},
+			{"record-batch", required_argument, 0, 'K'},
+			{"record-iov", no_argument, 0, 'I'},
+			{"token-file", required_argument, 0, 'T'},
+#ifndef _WIN32
+			{"daemon", required_argument, 0, 'D'},
+			{"ra-pool", required_argument, 0, 'A'},
+#endif
+			{"report-data", required_argument, 0, 'X'},
+			{"verifiers", required_argument, 0, 'G'},
+			{"deadline", required_argument, 0, 'Y'},
+#ifndef _WIN32
+			{"quote-batch", required_argument, 0, 'Q'},
+#endif
 			{0, 0, 0, 0}};
 
 	/* Parse our options */
@@ -212,7 +389,7 @@ int main(int argc, char *argv[])
 		int opt_index = 0;
 		unsigned char keyin[64];
 
-		c = getopt_long(argc, argv, "N:PVS:dehlmn:p:qrs:vz", long_opt,
+		c = getopt_long(argc, argv, "A:B:D:E:F:G:IK:L:MN:O:PQ:R:S:T:U:VW:X:Y:dehlmn:p:qrs:vz", long_opt,
 						&opt_index);
 		if (c == -1)
 			break;
@@ -224,10 +401,139 @@ int main(int argc, char *argv[])
 		// Prover peer
 		case 'P':
 			prover_verifier_flag = 0;
+			config.peer = optarg;
 			break;
 		// Verifier peer
 		case 'V':
 			prover_verifier_flag = 1;
+			config.peer = optarg;
+			break;
+		case 'M':
+			config.mutual = 1;
+			break;
+		case 'B':
+			config.proof_rounds = (uint32_t)strtoul(optarg, NULL, 10);
+			if (config.proof_rounds == 0)
+			{
+				fprintf(stderr, "proof-bench: rounds must be a positive integer\n");
+				exit(1);
+			}
+			break;
+		case 'R':
+			config.resume_rounds = (uint32_t)strtoul(optarg, NULL, 10);
+			if (config.resume_rounds == 0)
+			{
+				fprintf(stderr, "resume-bench: rounds must be a positive integer\n");
+				exit(1);
+			}
+			break;
+		case 'F':
+			config.session_file = optarg;
+			break;
+		case 'E':
+			config.record_rounds = (uint32_t)strtoul(optarg, NULL, 10);
+			if (config.record_rounds == 0)
+			{
+				fprintf(stderr, "record-bench: rounds must be a positive integer\n");
+				exit(1);
+			}
+			break;
+		case 'L':
+			config.record_size = (uint32_t)strtoul(optarg, NULL, 10);
+			if (config.record_size == 0 || config.record_size > RA_RECORD_MAX_LEN)
+			{
+				fprintf(stderr, "record-size: must be between 1 and %u\n",
+						RA_RECORD_MAX_LEN);
+				exit(1);
+			}
+			break;
+		case 'I':
+			config.record_iov = 1;
+			break;
+		case 'T':
+			config.token_file = optarg;
+			break;
+#ifndef _WIN32
+		case 'Q':
+			config.quote_batch = optarg;
+			config.mode = MODE_QUOTE;
+			break;
+#endif
+		case 'G':
+			config.verifiers = optarg;
+			break;
+#ifndef _WIN32
+		case 'O':
+		{
+			char *ep;
+
+			config.peer_uid = strtol(optarg, &ep, 10);
+			if (*ep != '\0' || config.peer_uid < 0)
+			{
+				fprintf(stderr, "peer-uid: must be a numeric user ID\n");
+				exit(1);
+			}
+			break;
+		}
+#endif
+		case 'U':
+			config.streams = (uint32_t)strtoul(optarg, NULL, 10);
+			if (config.streams == 0 || config.streams > RA_STREAM_MAX)
+			{
+				fprintf(stderr, "streams: must be between 1 and %u\n",
+						RA_STREAM_MAX);
+				exit(1);
+			}
+			break;
+		case 'Y':
+			config.deadline = (uint32_t)strtoul(optarg, NULL, 10);
+			if (config.deadline == 0)
+			{
+				fprintf(stderr, "deadline: must be a positive number of seconds\n");
+				exit(1);
+			}
+			break;
+		case 'X':
+			if (strlen(optarg) % 2 ||
+				strlen(optarg) > 2 * sizeof(sgx_report_data_t) ||
+				!from_hexstring((unsigned char *)&config.report_data,
+								(unsigned char *)optarg, strlen(optarg) / 2))
+			{
+				fprintf(stderr, "report data must be a hex string of up to 64 bytes\n");
+				exit(1);
+			}
+			SET_OPT(config.flags, OPT_REPORT_DATA);
+			break;
+#ifndef _WIN32
+		case 'D':
+			config.daemon_socket = optarg;
+			break;
+		case 'A':
+			config.ra_pool = (uint32_t)strtoul(optarg, NULL, 10);
+			if (config.ra_pool == 0 || config.ra_pool > MAX_RA_POOL)
+			{
+				fprintf(stderr, "ra-pool: must be between 1 and %u\n",
+						MAX_RA_POOL);
+				exit(1);
+			}
+			break;
+#endif
+		case 'K':
+			config.record_batch = (uint32_t)strtoul(optarg, NULL, 10);
+			if (config.record_batch == 0 || config.record_batch > MAX_RECORD_BATCH)
+			{
+				fprintf(stderr, "record-batch: must be between 1 and %u\n",
+						MAX_RECORD_BATCH);
+				exit(1);
+			}
+			break;
+		case 'W':
+			config.session_validity = (uint32_t)strtoul(optarg, NULL, 10);
+			if (config.session_validity == 0)
+			{
+				fprintf(stderr, "session-validity: must be a positive number of seconds\n");
+				exit(1);
+			}
 			break;
 		case 'N':
 			if (!from_hexstring_file((unsigned char *)&config.nonce,
@@ -371,10 +677,30 @@ int main(int argc, char *argv[])
 
 	if (flag_stdio && argc)
 		usage();
-	else if (prover_verifier_flag == 0 || prover_verifier_flag == 1)
+	else if (prover_verifier_flag == 0 && !config.mutual)
 	{
-		config.server = strdup("localhost");
-		config.port = "7777";
+		char *cp;
+
+		/* A prover attests to the verifier peer given as --prover-peer */
+
+		if (argc || flag_stdio)
+			usage();
+
+		config.server = strdup((config.peer == NULL) ? "localhost" : config.peer);
+		if (config.server == NULL)
+		{
+			perror("malloc");
+			return 1;
+		}
+
+		cp = (msgio_unix_address(config.server)) ? NULL : strchr(config.server, ':');
+		if (cp != NULL)
+		{
+			*cp++ = '\0';
+			config.port = cp;
+		}
+		else
+			config.port = (char *)DEFAULT_PEER_PORT;
 	}
 	else if (!flag_stdio && !argc)
 	{
@@ -398,7 +724,7 @@ int main(int argc, char *argv[])
 		}
 
 		/* If there's a : then we have a port, too */
-		cp = strchr(config.server, ':');
+		cp = (msgio_unix_address(config.server)) ? NULL : strchr(config.server, ':');
 		if (cp != NULL)
 		{
 			*cp++ = '\0';
@@ -406,6 +732,69 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	/*
+	 * In mutual mode the peer is given by --prover-peer or
+	 * --verifier-peer, and host[:port] is the service provider that
+	 * verifies the peer for us.
+	 */
+
+	if (config.mutual)
+	{
+		if (prover_verifier_flag == -1)
+		{
+			fprintf(stderr, "--mutual requires --prover-peer or --verifier-peer\n");
+			return 1;
+		}
+		if (flag_stdio)
+			usage();
+	}
+
+	/* A mutual prover connects to --prover-peer=HOST[:PORT] */
+
+	if (prover_verifier_flag == 0 && config.mutual)
+	{
+		char *cp;
+
+		config.peer_host = (config.peer == NULL) ? (char *)"localhost" : config.peer;
+		config.peer_port = (char *)DEFAULT_PEER_PORT;
+
+		cp = (msgio_unix_address(config.peer_host)) ? NULL : strchr(config.peer_host, ':');
+		if (cp != NULL)
+		{
+			*cp++ = '\0';
+			config.peer_port = cp;
+		}
+	}
+
+	if (config.peer_uid != -1 && prover_verifier_flag != 1)
+	{
+		fprintf(stderr, "--peer-uid requires --verifier-peer\n");
+		return 1;
+	}
+
+	/* A verifier peer listens on --verifier-peer=[host:]port */
+
+	if (prover_verifier_flag == 1)
+	{
+		char *cp;
+
+		if (flag_stdio)
+			usage();
+
+		if (config.peer != NULL)
+		{
+			cp = (msgio_unix_address(config.peer)) ? NULL : strchr(config.peer, ':');
+			if (cp != NULL)
+			{
+				*cp++ = '\0';
+				config.peer_host = config.peer;
+				config.peer_port = cp;
+			}
+			else
+				config.peer_port = config.peer;
+		}
+	}
+
 	if (!have_spid && config.mode != MODE_EPID)
 	{
 		fprintf(stderr, "SPID required. Use one of --spid or --spid-file \n");
@@ -442,7 +831,10 @@ int main(int argc, char *argv[])
 	}
 #endif
 
-	/* Launch the enclave */
+	/* Launch the enclave, reusing a saved launch token if we have one */
+
+	if (config.token_file != NULL)
+		token_load(config.token_file, &token);
 
 #ifdef _WIN32
 	status = sgx_create_enclave(ENCLAVE_NAME, SGX_DEBUG_FLAG,
@@ -466,22 +858,53 @@ int main(int argc, char *argv[])
 	}
 #endif
 
+	if (config.token_file != NULL && updated)
+		token_save(config.token_file, &token);
+
 	/* Are we attesting, or just spitting out a quote? */
-	if (prover_verifier_flag == 0)
+#ifndef _WIN32
+	if (config.daemon_socket != NULL)
+	{
+		if (prover_verifier_flag != -1 || config.mode != MODE_ATTEST)
+		{
+			fprintf(stderr, "--daemon can only be used to perform attestations\n");
+			return 1;
+		}
+		rv = do_daemon(eid, &config);
+	}
+	else
+#endif
+	if (prover_verifier_flag == 0 && config.mutual)
+	{
+		rv = do_mutual(eid, &config);
+	}
+	else if (prover_verifier_flag == 0)
 	{
-		printf("Calling hello prover function\n");
-		do_attestation(eid, &config);
+		rv = do_attestation_old(eid, &config, NULL, NULL);
 	}
 	else if (prover_verifier_flag == 1)
 	{
-		printf("Calling hello verifier function\n");
-		do_verification(eid, &config);
+		rv = do_verification(eid, &config);
+	}
+	else if (config.mode == MODE_ATTEST && config.verifiers != NULL)
+	{
+		rv = do_fanout(eid, &config);
+	}
+	else if (config.mode == MODE_ATTEST && config.streams)
+	{
+		rv = do_streams(eid, &config);
 	}
 	else if (config.mode == MODE_ATTEST)
 	{
 		printf("Calling do_attestation.\n");
-		do_attestation_old(eid, &config);
+		rv = do_attestation_old(eid, &config, NULL, NULL);
+	}
+#ifndef _WIN32
+	else if (config.mode == MODE_QUOTE && config.quote_batch != NULL)
+	{
+		rv = do_quote_batch(eid, &config);
 	}
+#endif
 	else if (config.mode == MODE_EPID || config.mode == MODE_QUOTE)
 	{
 		do_quote(eid, &config);
@@ -494,97 +917,790 @@ int main(int argc, char *argv[])
 
 	close_logfile(fplog);
 
-	return 0;
+	return rv;
 }
 
-void dummy_verifier(sgx_enclave_id_t eid, config_t *config)
+/*
+ * Verifier peer. Provers attest to us exactly as they would to a
+ * service provider, and we hand the exchange on to the service
+ * provider (which holds the IAS credentials and the service key) to
+ * do the verification. We check msg0 in our own enclave first, and
+ * learn each prover's result from msg4. Provers are handled
+ * concurrently, each in its own thread with its own connection to the
+ * service provider.
+ */
+
+typedef struct peer_server_struct
 {
-	int *proof;
-	int *verif_result;
-	MsgIO *msgio;
-	try
+	mutex lock;
+	condition_variable cv;
+	uint32_t active;
+	unsigned long next_id;
+	mutex ecall_lock;
+} peer_server_t;
+
+static peer_server_t peer_server;
+
+static const char *peer_status_names[] = {
+	"NOT TRUSTED",
+	"NOT TRUSTED (complicated)",
+	"TRUSTED (complicated)",
+	"TRUSTED"};
+
+static const char *peer_status_name(int status)
+{
+	if (status < NotTrusted || status > Trusted)
+		return "did not complete";
+
+	return peer_status_names[status];
+}
+
+/*
+ * Read one message from one side and pass it to the other. The message
+ * is returned so the caller can inspect it, and must be freed.
+ */
+
+static int peer_forward(MsgIO *from, MsgIO *to, const char *name,
+						void **msg, size_t *sz)
+{
+	int rv;
+
+	rv = from->read(msg, sz);
+	if (rv == 0)
 	{
-		msgio = new MsgIO(NULL, DEFAULT_PORT);
-		// msgio = new MsgIO(config->server, (config->port == NULL) ? DEFAULT_PORT : config->port);
+		eprintf("protocol error reading %s\n", name);
+		return 0;
 	}
-	catch (...)
+	else if (rv == -1)
 	{
-		exit(1);
+		eprintf("system error occurred while reading %s\n", name);
+		return 0;
 	}
-	while (msgio->server_loop())
-	{
-		int rv = msgio->read((void **)&proof, NULL);
-		if (rv == 0)
-		{
-			fprintf(stderr, "protocol error reading dummy proof\n");
-			delete msgio;
-			exit(1);
-		}
-		else if (rv == -1)
-		{
-			fprintf(stderr, "system error occurred while reading dummy proof\n");
-			delete msgio;
-			exit(1);
-		}
-		printf("Receiving proof: %d\n", *proof);
-		dummy_verify(eid, verif_result, *proof);
 
-	disconnect:
-		msgio->disconnect();
-	}
+	to->send(*msg, *sz / 2);
+
+	return 1;
 }
 
-void dummy_prover(sgx_enclave_id_t eid, config_t *config)
+static void peer_relay(sgx_enclave_id_t eid, config_t *config,
+					   MsgIO *prover, unsigned long id)
 {
-	int proof;
-	MsgIO *msgio;
+	MsgIO *sp = NULL;
+	ra_msg01_t *msg01 = NULL;
+	void *msg = NULL;
+	size_t sz = 0;
+	sgx_status_t status;
+	int ok = 0;
+	int trusted = -1;
+
+	/* msg0||msg1: check msg0 before involving the service provider */
+
+	if (prover->read((void **)&msg01, &sz) != 1)
+	{
+		eprintf("prover %lu: error reading msg0||msg1\n", id);
+		goto done;
+	}
+	if (sz / 2 != sizeof(ra_msg01_t))
+	{
+		eprintf("prover %lu: msg0||msg1 has wrong size\n", id);
+		goto done;
+	}
+
+	{
+		lock_guard<mutex> guard(peer_server.ecall_lock);
+
+		status = process_msg01(eid, &ok, msg01->msg0_extended_epid_group_id,
+							   &msg01->msg1);
+	}
+	if (status != SGX_SUCCESS || !ok)
+	{
+		eprintf("prover %lu: rejected msg0||msg1\n", id);
+		goto done;
+	}
+
 	try
 	{
-		msgio = new MsgIO(config->server, (config->port == NULL) ? DEFAULT_PORT : config->port);
+		sp = new MsgIO(config->server, (config->port == NULL) ? DEFAULT_PORT : config->port);
 	}
 	catch (...)
 	{
-		exit(1);
+		eprintf("prover %lu: could not connect to the service provider\n", id);
+		goto done;
 	}
 
-	dummy_prove(eid, &proof);
-	printf("Sending proof: %d\n", proof);
-	msgio->send(&proof, sizeof(proof));
+	sp->send(msg01, sizeof(ra_msg01_t));
+
+	if (!peer_forward(sp, prover, "msg2", &msg, &sz))
+		goto done;
+	free(msg);
+	msg = NULL;
+
+	if (!peer_forward(prover, sp, "msg3", &msg, &sz))
+		goto done;
+	free(msg);
+	msg = NULL;
+
+	if (!peer_forward(sp, prover, "msg4", &msg, &sz))
+		goto done;
+	if (sz / 2 >= sizeof(uint32_t))
+		trusted = ((ra_msg4_t *)msg)->status;
+
+done:
+	eprintf("prover %lu: %s\n", id, peer_status_name(trusted));
+
+	free(msg);
+	free(msg01);
+	delete sp;
+	delete prover;
+
+	lock_guard<mutex> guard(peer_server.lock);
+	--peer_server.active;
+	peer_server.cv.notify_one();
 }
 
-int do_attestation(sgx_enclave_id_t eid, config_t *config)
+/*
+ * Mutual attestation. Both sides run the same exchange over one
+ * connection, and each step sends one message before reading the
+ * peer's, so the two attestations proceed in lockstep:
+ *
+ *   msg0||msg1  ours out, theirs in (checked in our enclave)
+ *   msg2        theirs from our service provider out, ours in
+ *   msg3        ours out, theirs in and on to our service provider
+ *   msg4        theirs from our service provider out, ours in
+ *
+ * Each side verifies the other through its own service provider,
+ * which holds the IAS credentials and the service key. sp serves one
+ * connection at a time, so the two sides must not share one.
+ *
+ * On return *mine is our own result as reported by the peer, and
+ * *theirs is the peer's result from our service provider.
+ */
+
+static int mutual_handshake(sgx_enclave_id_t eid, config_t *config,
+							MsgIO *peer, int *mine, int *theirs)
 {
-	sgx_status_t status, sgxrv, pse_status;
-	sgx_ra_msg1_t msg1;
+	ra_prepared_t ra;
+	ra_msg01_t msg01;
+	ra_msg01_t *peer01 = NULL;
 	sgx_ra_msg2_t *msg2 = NULL;
 	sgx_ra_msg3_t *msg3 = NULL;
-	ra_msg4_t *msg4 = NULL;
-	uint32_t msg0_extended_epid_group_id = 0;
 	uint32_t msg3_sz;
-	uint32_t flags = config->flags;
-	sgx_ra_context_t ra_ctx = 0xdeadbeef;
-	int rv;
-	MsgIO *msgio;
-	size_t msg4sz = 0;
-	int enclaveTrusted = NotTrusted; // Not Trusted
-	int b_pse = OPT_ISSET(flags, OPT_PSE);
+	MsgIO *sp = NULL;
+	void *msg = NULL;
+	size_t sz = 0;
+	sgx_status_t status, sgxrv;
+	int ok = 0;
+	int rv = 0;
 
-	if (config->server == NULL)
+	*mine = *theirs = -1;
+
+	if (!ra_prepare(eid, config, &ra))
+		return 0;
+
+	/* msg0||msg1 */
+
+	msg01.msg0_extended_epid_group_id = ra.msg0_extended_epid_group_id;
+	memcpy(&msg01.msg1, &ra.msg1, sizeof(sgx_ra_msg1_t));
+	peer->send(&msg01, sizeof(ra_msg01_t));
+
+	if (peer->read((void **)&peer01, &sz) != 1)
 	{
-		msgio = new MsgIO();
+		eprintf("error reading the peer's msg0||msg1\n");
+		goto done;
 	}
-	else
+	if (sz / 2 != sizeof(ra_msg01_t))
 	{
-		try
-		{
-			msgio = new MsgIO(config->server, (config->port == NULL) ? DEFAULT_PORT : config->port);
+		eprintf("the peer's msg0||msg1 has wrong size\n");
+		goto done;
+	}
+
+	{
+		lock_guard<mutex> guard(peer_server.ecall_lock);
+
+		status = process_msg01(eid, &ok, peer01->msg0_extended_epid_group_id,
+							   &peer01->msg1);
+	}
+	if (status != SGX_SUCCESS || !ok)
+	{
+		eprintf("rejected the peer's msg0||msg1\n");
+		goto done;
+	}
+
+	/* msg2 */
+
+	try
+	{
+		sp = new MsgIO(config->server, (config->port == NULL) ? DEFAULT_PORT : config->port);
+	}
+	catch (...)
+	{
+		eprintf("could not connect to the service provider\n");
+		goto done;
+	}
+
+	sp->send(peer01, sizeof(ra_msg01_t));
+
+	if (!peer_forward(sp, peer, "the peer's msg2", &msg, &sz))
+		goto done;
+	free(msg);
+	msg = NULL;
+
+	if (peer->read((void **)&msg2, &sz) != 1)
+	{
+		eprintf("error reading msg2\n");
+		goto done;
+	}
+	if (sz / 2 < sizeof(sgx_ra_msg2_t) ||
+		sz / 2 != sizeof(sgx_ra_msg2_t) + msg2->sig_rl_size)
+	{
+		if (sz / 2 == sizeof(ra_busy_t) &&
+			((ra_busy_t *)msg2)->type == RA_MSG_TYPE_BUSY)
+			eprintf("the peer's service provider is busy\n");
+		else
+			eprintf("msg2 has wrong size\n");
+		goto done;
+	}
+
+	/* msg3 */
+
+	status = sgx_ra_proc_msg2(ra.ra_ctx, eid,
+							  sgx_ra_proc_msg2_trusted, sgx_ra_get_msg3_trusted, msg2,
+							  sizeof(sgx_ra_msg2_t) + msg2->sig_rl_size,
+							  &msg3, &msg3_sz);
+	if (status != SGX_SUCCESS)
+	{
+		eprintf("sgx_ra_proc_msg2: %08x\n", status);
+		goto done;
+	}
+
+	peer->send(msg3, msg3_sz);
+
+	if (!peer_forward(peer, sp, "the peer's msg3", &msg, &sz))
+		goto done;
+	free(msg);
+	msg = NULL;
+
+	/* msg4 */
+
+	if (!peer_forward(sp, peer, "the peer's msg4", &msg, &sz))
+		goto done;
+	if (sz / 2 >= sizeof(uint32_t))
+		*theirs = ((ra_msg4_t *)msg)->status;
+	free(msg);
+	msg = NULL;
+
+	if (peer->read(&msg, &sz) != 1)
+	{
+		eprintf("error reading msg4\n");
+		goto done;
+	}
+	if (sz / 2 >= sizeof(uint32_t))
+		*mine = ((ra_msg4_t *)msg)->status;
+
+	rv = 1;
+
+done:
+	free(msg);
+	free(msg3);
+	free(msg2);
+	free(peer01);
+	delete sp;
+	enclave_ra_close(eid, &sgxrv, ra.ra_ctx);
+
+	return rv;
+}
+
+static void peer_mutual(sgx_enclave_id_t eid, config_t *config,
+						MsgIO *peer, unsigned long id)
+{
+	int mine, theirs;
+
+	mutual_handshake(eid, config, peer, &mine, &theirs);
+
+	eprintf("peer %lu: %s, us: %s\n", id, peer_status_name(theirs),
+			peer_status_name(mine));
+
+	delete peer;
+
+	lock_guard<mutex> guard(peer_server.lock);
+	--peer_server.active;
+	peer_server.cv.notify_one();
+}
+
+int do_verification(sgx_enclave_id_t eid, config_t *config)
+{
+	MsgIO *listener;
+	const char *port = (config->peer_port == NULL) ? DEFAULT_PEER_PORT : config->peer_port;
+	/* Mutual peers make ECALLs throughout, so they're bound by the TCS count */
+	uint32_t max_peers = (config->mutual) ? MAX_VERIFIERS : MAX_PEERS;
+
+	try
+	{
+		listener = new MsgIO(config->peer_host, port, true);
+	}
+	catch (...)
+	{
+		return 1;
+	}
+
+#ifndef _WIN32
+	if (config->peer_uid != -1)
+		listener->require_peer_uid((uid_t)config->peer_uid);
+#endif
+
+	eprintf("Verifying %s through the service provider at %s:%s\n",
+			(config->mutual) ? "mutual peers" : "provers", config->server,
+			(config->port == NULL) ? DEFAULT_PORT : config->port);
+
+	while (1)
+	{
+		MsgIO *prover;
+
+		{
+			unique_lock<mutex> guard(peer_server.lock);
+
+			while (peer_server.active >= max_peers)
+				peer_server.cv.wait(guard);
 		}
-		catch (...)
+
+		prover = listener->accept_client();
+		if (prover == NULL)
+			continue;
+
+		lock_guard<mutex> guard(peer_server.lock);
+		++peer_server.active;
+		if (config->mutual)
+			thread(peer_mutual, eid, config, prover, ++peer_server.next_id).detach();
+		else
+			thread(peer_relay, eid, config, prover, ++peer_server.next_id).detach();
+	}
+
+	delete listener;
+
+	return 0;
+}
+
+int do_mutual(sgx_enclave_id_t eid, config_t *config)
+{
+	MsgIO *peer;
+	int mine, theirs;
+
+	try
+	{
+		peer = new MsgIO(config->peer_host, config->peer_port);
+	}
+	catch (...)
+	{
+		return 1;
+	}
+
+	mutual_handshake(eid, config, peer, &mine, &theirs);
+	delete peer;
+
+	eprintf("peer: %s, us: %s\n", peer_status_name(theirs),
+			peer_status_name(mine));
+
+	return (mine == Trusted && theirs == Trusted) ? 0 : 1;
+}
+
+static int64_t deadline_now_ms()
+{
+	return chrono::duration_cast<chrono::milliseconds>(
+			   chrono::steady_clock::now().time_since_epoch())
+		.count();
+}
+
+/*
+ * How long to wait before trying a busy SP again. The jitter keeps
+ * clients that were turned away together from all coming back at once.
+ */
+
+static unsigned int busy_backoff(unsigned int tries, uint32_t retry_after)
+{
+	static thread_local mt19937 rng(random_device{}());
+	unsigned int window = BUSY_BACKOFF_MAX;
+
+	if (tries < 16 && (BUSY_BACKOFF_BASE << tries) < BUSY_BACKOFF_MAX)
+		window = BUSY_BACKOFF_BASE << tries;
+
+	return retry_after + uniform_int_distribution<unsigned int>(0, window)(rng);
+}
+
+/*
+ * State shared between do_fanout() and its threads. It's reference
+ * counted because threads that miss the deadline are left to finish
+ * on their own.
+ */
+
+typedef struct fanout_verifier_struct
+{
+	config_t config;
+	int rv;
+	int trusted;
+	double usec;
+	bool done;
+} fanout_verifier_t;
+
+typedef struct fanout_struct
+{
+	sgx_enclave_id_t eid;
+	vector<fanout_verifier_t> verifiers;
+	size_t pending;
+	mutex lock;
+	condition_variable cv;
+} fanout_t;
+
+static void fanout_run(shared_ptr<fanout_t> fo, size_t i)
+{
+	fanout_verifier_t *v = &fo->verifiers[i];
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	int trusted;
+	int rv;
+
+	rv = do_attestation_old(fo->eid, &v->config, NULL, &trusted);
+
+	lock_guard<mutex> guard(fo->lock);
+	v->rv = rv;
+	v->trusted = trusted;
+	v->usec = chrono::duration<double, micro>(
+				  chrono::steady_clock::now() - start)
+				  .count();
+	v->done = true;
+	--fo->pending;
+	fo->cv.notify_one();
+}
+
+/*
+ * Attest to each of the verifiers in config->verifiers (a comma-
+ * separated list of host[:port]) at the same time, each with its own
+ * RA context and connection, and report how each one went. With
+ * config->deadline set, verifiers that haven't finished by then are
+ * reported as timed out. Returns 0 if every verifier trusts us.
+ */
+
+int do_fanout(sgx_enclave_id_t eid, config_t *config)
+{
+	static const char *status_names[] = {
+		"NOT TRUSTED",
+		"NOT TRUSTED (complicated)",
+		"TRUSTED (complicated)",
+		"TRUSTED"};
+	shared_ptr<fanout_t> fo = make_shared<fanout_t>();
+	vector<thread> threads;
+	string list = config->verifiers;
+	size_t i, pos = 0;
+	int64_t deadline_ms = 0;
+	int rv = 0;
+
+	fo->eid = eid;
+
+	while (pos <= list.length())
+	{
+		size_t end = list.find(',', pos);
+		string host;
+		fanout_verifier_t v;
+
+		if (end == string::npos)
+			end = list.length();
+		host = list.substr(pos, end - pos);
+		pos = end + 1;
+		if (host.empty())
+			continue;
+
+		memcpy(&v.config, config, sizeof(config_t));
+		v.config.server = strdup(host.c_str());
+		if (v.config.server == NULL)
+		{
+			perror("malloc");
+			return 1;
+		}
+		v.config.port = (msgio_unix_address(v.config.server)) ? NULL : strchr(v.config.server, ':');
+		if (v.config.port != NULL)
+			*v.config.port++ = '\0';
+
+		/* Just the attestation: the extras don't make sense here */
+
+		v.config.verifiers = NULL;
+		v.config.session_file = NULL;
+		v.config.proof_rounds = 0;
+		v.config.resume_rounds = 0;
+		v.config.record_rounds = 0;
+
+		v.rv = 1;
+		v.trusted = -1;
+		v.usec = 0;
+		v.done = false;
+		fo->verifiers.push_back(v);
+	}
+
+	if (fo->verifiers.empty() || fo->verifiers.size() > MAX_VERIFIERS)
+	{
+		eprintf("verifiers: need between 1 and %u verifiers\n",
+				MAX_VERIFIERS);
+		return 1;
+	}
+
+	if (config->deadline)
+	{
+		deadline_ms = deadline_now_ms() + 1000 * (int64_t)config->deadline;
+		for (i = 0; i < fo->verifiers.size(); ++i)
+			fo->verifiers[i].config.deadline_ms = deadline_ms;
+	}
+
+	fo->pending = fo->verifiers.size();
+	for (i = 0; i < fo->verifiers.size(); ++i)
+		threads.push_back(thread(fanout_run, fo, i));
+
+	{
+		unique_lock<mutex> guard(fo->lock);
+
+		while (fo->pending)
+		{
+			if (!deadline_ms)
+				fo->cv.wait(guard);
+			else if (fo->cv.wait_until(guard,
+										chrono::steady_clock::time_point(
+											chrono::milliseconds(deadline_ms))) ==
+					 cv_status::timeout)
+				break;
+		}
+
+		edividerWithText("Verifier Results");
+		for (i = 0; i < fo->verifiers.size(); ++i)
+		{
+			fanout_verifier_t *v = &fo->verifiers[i];
+			const char *port = (v->config.port == NULL) ? DEFAULT_PORT : v->config.port;
+
+			if (!v->done)
+				eprintf("%s:%s: timed out\n", v->config.server, port);
+			else if (v->rv != 0 || v->trusted < NotTrusted || v->trusted > Trusted)
+				eprintf("%s:%s: error (%.1f ms)\n", v->config.server, port,
+						v->usec / 1000);
+			else
+				eprintf("%s:%s: %s (%.1f ms)\n", v->config.server, port,
+						status_names[v->trusted], v->usec / 1000);
+
+			if (!v->done || v->rv != 0 || v->trusted != Trusted)
+				rv = 1;
+		}
+		edivider();
+
+		/* Stragglers give up on their own when their sockets time out */
+
+		for (i = 0; i < fo->verifiers.size(); ++i)
+		{
+			if (fo->verifiers[i].done)
+				threads[i].join();
+			else
+				threads[i].detach();
+		}
+	}
+
+	return rv;
+}
+
+/*
+ * Attest config->streams times at once over a single connection, the
+ * way a gateway attesting on behalf of many enclaves would, with each
+ * attestation in its own stream (see protocol.h). One thread drives
+ * them all, handling whichever stream the service provider answers
+ * next. Returns 0 if every attestation is trusted.
+ */
+
+typedef struct stream_session_struct
+{
+	ra_prepared_t ra;
+	int state;
+	int trusted;
+	chrono::steady_clock::time_point start;
+} stream_session_t;
+
+#define STREAM_WAIT_MSG2 0
+#define STREAM_WAIT_MSG4 1
+#define STREAM_DONE 2
+
+int do_streams(sgx_enclave_id_t eid, config_t *config)
+{
+	vector<stream_session_t> sessions(config->streams);
+	vector<double> usec;
+	chrono::steady_clock::time_point start;
+	MsgIO *msgio;
+	uint32_t i, id, pending = 0, ntrusted = 0;
+	sgx_status_t status, sgxrv;
+	int rv = 1;
+
+	try
+	{
+		msgio = new MsgIO(config->server, (config->port == NULL) ? DEFAULT_PORT : config->port);
+	}
+	catch (...)
+	{
+		return 1;
+	}
+
+	start = chrono::steady_clock::now();
+
+	/* Open every stream with its msg0||msg1 */
+
+	for (i = 0; i < sessions.size(); ++i)
+	{
+		stream_session_t *ss = &sessions[i];
+		ra_msg01_t msg01;
+
+		ss->state = STREAM_DONE;
+		ss->trusted = -1;
+		ss->start = chrono::steady_clock::now();
+		if (!ra_prepare(eid, config, &ss->ra))
+			continue;
+
+		msg01.msg0_extended_epid_group_id = ss->ra.msg0_extended_epid_group_id;
+		memcpy(&msg01.msg1, &ss->ra.msg1, sizeof(sgx_ra_msg1_t));
+
+		msgio->set_stream(i + 1);
+		if (msgio->send(&msg01, sizeof(ra_msg01_t)) == -1)
+		{
+			eprintf("error sending to the service provider\n");
+			break;
+		}
+		ss->state = STREAM_WAIT_MSG2;
+		++pending;
+	}
+
+	while (pending)
+	{
+		stream_session_t *ss;
+		void *msg = NULL;
+		size_t sz = 0;
+
+		if (msgio->read_stream(&id, &msg, &sz) != 1)
+		{
+			eprintf("error reading from the service provider\n");
+			break;
+		}
+		if (id == 0 || id > sessions.size() ||
+			sessions[id - 1].state == STREAM_DONE)
+		{
+			eprintf("stream %u: unexpected message\n", id);
+			free(msg);
+			break;
+		}
+
+		ss = &sessions[id - 1];
+
+		if (msg == NULL)
+		{
+			eprintf("stream %u: closed by the service provider\n", id);
+		}
+		else if (ss->state == STREAM_WAIT_MSG2)
+		{
+			sgx_ra_msg2_t *msg2 = (sgx_ra_msg2_t *)msg;
+			sgx_ra_msg3_t *msg3 = NULL;
+			uint32_t msg3_sz;
+
+			if (sz / 2 < sizeof(sgx_ra_msg2_t) ||
+				sz / 2 != sizeof(sgx_ra_msg2_t) + msg2->sig_rl_size)
+			{
+				if (sz / 2 == sizeof(ra_busy_t) &&
+					((ra_busy_t *)msg)->type == RA_MSG_TYPE_BUSY)
+					eprintf("stream %u: service provider is busy\n", id);
+				else
+					eprintf("stream %u: msg2 has wrong size\n", id);
+				free(msg);
+				if (msgio->close_stream(id) == -1)
+					break;
+				ss->state = STREAM_DONE;
+				--pending;
+				continue;
+			}
+
+			status = sgx_ra_proc_msg2(ss->ra.ra_ctx, eid,
+									  sgx_ra_proc_msg2_trusted, sgx_ra_get_msg3_trusted, msg2,
+									  sizeof(sgx_ra_msg2_t) + msg2->sig_rl_size,
+									  &msg3, &msg3_sz);
+			free(msg);
+			if (status != SGX_SUCCESS)
+			{
+				eprintf("stream %u: sgx_ra_proc_msg2: %08x\n", id, status);
+				if (msgio->close_stream(id) == -1)
+					break;
+				ss->state = STREAM_DONE;
+				--pending;
+				continue;
+			}
+
+			msgio->set_stream(id);
+			if (msgio->send(msg3, msg3_sz) == -1)
+			{
+				eprintf("stream %u: error sending msg3\n", id);
+				free(msg3);
+				break;
+			}
+			free(msg3);
+			ss->state = STREAM_WAIT_MSG4;
+			continue;
+		}
+		else
 		{
-			exit(1);
+			if (sz / 2 >= sizeof(uint32_t))
+				ss->trusted = ((ra_msg4_t *)msg)->status;
+			free(msg);
+
+			usec.push_back(chrono::duration<double, micro>(
+							   chrono::steady_clock::now() - ss->start)
+							   .count());
+			if (ss->trusted == Trusted)
+				++ntrusted;
+
+			/* We're done with the stream, so let the SP drop it */
+			if (msgio->close_stream(id) == -1)
+				break;
 		}
+
+		ss->state = STREAM_DONE;
+		--pending;
+	}
+
+	if (!pending)
+	{
+		double total = chrono::duration<double, micro>(
+						   chrono::steady_clock::now() - start)
+						   .count();
+
+		eprintf("%u of %u attestations trusted in %.1f ms over one connection\n",
+				ntrusted, config->streams, total / 1000);
+		print_latency("Multiplexed Attestation Latency", usec, 0);
+
+		if (ntrusted == config->streams)
+			rv = 0;
+	}
+
+	for (i = 0; i < sessions.size(); ++i)
+	{
+		if (sessions[i].ra.ready)
+			enclave_ra_close(eid, &sgxrv, sessions[i].ra.ra_ctx);
 	}
 
+	delete msgio;
+
+	return rv;
+}
+
+/*
+ * Create an RA context and generate msg0 and msg1. None of this
+ * depends on the service provider, so it can be done ahead of time
+ * (see do_daemon()). Returns 1 on success, 0 on failure.
+ */
+
+int ra_prepare(sgx_enclave_id_t eid, config_t *config, ra_prepared_t *ra)
+{
+	sgx_status_t status, sgxrv, pse_status;
+	uint32_t flags = config->flags;
+	int b_pse = OPT_ISSET(flags, OPT_PSE);
+
+	ra->ready = 0;
+	ra->ra_ctx = 0xdeadbeef;
+	ra->msg0_extended_epid_group_id = 0;
+
 	/*
 	 * WARNING! Normally, the public key would be hardcoded into the
 	 * enclave, not passed in as a parameter. Hardcoding prevents
@@ -601,13 +1717,13 @@ int do_attestation(sgx_enclave_id_t eid, config_t *config)
 		if (debug)
 			fprintf(stderr, "+++ using supplied public key\n");
 		status = enclave_ra_init(eid, &sgxrv, config->pubkey, b_pse,
-								 &ra_ctx, &pse_status);
+								 &ra->ra_ctx, &pse_status);
 	}
 	else
 	{
 		if (debug)
 			fprintf(stderr, "+++ using default public key\n");
-		status = enclave_ra_init_def(eid, &sgxrv, b_pse, &ra_ctx,
+		status = enclave_ra_init_def(eid, &sgxrv, b_pse, &ra->ra_ctx,
 									 &pse_status);
 	}
 
@@ -615,8 +1731,7 @@ int do_attestation(sgx_enclave_id_t eid, config_t *config)
 	if (status != SGX_SUCCESS)
 	{
 		fprintf(stderr, "enclave_ra_init: %08x\n", status);
-		delete msgio;
-		return 1;
+		return 0;
 	}
 
 #ifdef _WIN32
@@ -626,8 +1741,7 @@ int do_attestation(sgx_enclave_id_t eid, config_t *config)
 		if (pse_status != SGX_SUCCESS)
 		{
 			fprintf(stderr, "pse_session: %08x\n", pse_status);
-			delete msgio;
-			return 1;
+			return 0;
 		}
 	}
 #endif
@@ -636,19 +1750,17 @@ int do_attestation(sgx_enclave_id_t eid, config_t *config)
 	if (sgxrv != SGX_SUCCESS)
 	{
 		fprintf(stderr, "sgx_ra_init: %08x\n", sgxrv);
-		delete msgio;
-		return 1;
+		return 0;
 	}
 
 	/* Generate msg0 */
 
-	status = sgx_get_extended_epid_group_id(&msg0_extended_epid_group_id);
+	status = sgx_get_extended_epid_group_id(&ra->msg0_extended_epid_group_id);
 	if (status != SGX_SUCCESS)
 	{
-		enclave_ra_close(eid, &sgxrv, ra_ctx);
+		enclave_ra_close(eid, &sgxrv, ra->ra_ctx);
 		fprintf(stderr, "sgx_get_extended_epid_group_id: %08x\n", status);
-		delete msgio;
-		return 1;
+		return 0;
 	}
 	if (verbose)
 	{
@@ -656,9 +1768,9 @@ int do_attestation(sgx_enclave_id_t eid, config_t *config)
 		dividerWithText(fplog, "Msg0 Details");
 		fprintf(stderr, "Extended Epid Group ID: ");
 		fprintf(fplog, "Extended Epid Group ID: ");
-		print_hexstring(stderr, &msg0_extended_epid_group_id,
+		print_hexstring(stderr, &ra->msg0_extended_epid_group_id,
 						sizeof(uint32_t));
-		print_hexstring(fplog, &msg0_extended_epid_group_id,
+		print_hexstring(fplog, &ra->msg0_extended_epid_group_id,
 						sizeof(uint32_t));
 		fprintf(stderr, "\n");
 		fprintf(fplog, "\n");
@@ -668,14 +1780,13 @@ int do_attestation(sgx_enclave_id_t eid, config_t *config)
 
 	/* Generate msg1 */
 
-	status = sgx_ra_get_msg1(ra_ctx, eid, sgx_ra_get_ga, &msg1);
+	status = sgx_ra_get_msg1(ra->ra_ctx, eid, sgx_ra_get_ga, &ra->msg1);
 	if (status != SGX_SUCCESS)
 	{
-		enclave_ra_close(eid, &sgxrv, ra_ctx);
+		enclave_ra_close(eid, &sgxrv, ra->ra_ctx);
 		fprintf(stderr, "sgx_ra_get_msg1: %08x\n", status);
 		fprintf(fplog, "sgx_ra_get_msg1: %08x\n", status);
-		delete msgio;
-		return 1;
+		return 0;
 	}
 
 	if (verbose)
@@ -684,243 +1795,209 @@ int do_attestation(sgx_enclave_id_t eid, config_t *config)
 		dividerWithText(fplog, "Msg1 Details");
 		fprintf(stderr, "msg1.g_a.gx = ");
 		fprintf(fplog, "msg1.g_a.gx = ");
-		print_hexstring(stderr, msg1.g_a.gx, 32);
-		print_hexstring(fplog, msg1.g_a.gx, 32);
+		print_hexstring(stderr, ra->msg1.g_a.gx, 32);
+		print_hexstring(fplog, ra->msg1.g_a.gx, 32);
 		fprintf(stderr, "\nmsg1.g_a.gy = ");
 		fprintf(fplog, "\nmsg1.g_a.gy = ");
-		print_hexstring(stderr, msg1.g_a.gy, 32);
-		print_hexstring(fplog, msg1.g_a.gy, 32);
+		print_hexstring(stderr, ra->msg1.g_a.gy, 32);
+		print_hexstring(fplog, ra->msg1.g_a.gy, 32);
 		fprintf(stderr, "\nmsg1.gid    = ");
 		fprintf(fplog, "\nmsg1.gid    = ");
-		print_hexstring(stderr, msg1.gid, 4);
-		print_hexstring(fplog, msg1.gid, 4);
+		print_hexstring(stderr, ra->msg1.gid, 4);
+		print_hexstring(fplog, ra->msg1.gid, 4);
 		fprintf(stderr, "\n");
 		fprintf(fplog, "\n");
 		divider(stderr);
 		divider(fplog);
 	}
 
-	/*
-	 * Send msg0 and msg1 concatenated together (msg0||msg1). We do
-	 * this for efficiency, to eliminate an additional round-trip
-	 * between client and server. The assumption here is that most
-	 * clients have the correct extended_epid_group_id so it's
-	 * a waste to send msg0 separately when the probability of a
-	 * rejection is astronomically small.
-	 *
-	 * If it /is/ rejected, then the client has only wasted a tiny
-	 * amount of time generating keys that won't be used.
-	 */
-
-	dividerWithText(fplog, "Msg0||Msg1 ==> SP");
-	fsend_msg_partial(fplog, &msg0_extended_epid_group_id,
-					  sizeof(msg0_extended_epid_group_id));
-	fsend_msg(fplog, &msg1, sizeof(msg1));
-	divider(fplog);
+	ra->ready = 1;
 
-	dividerWithText(stderr, "Copy/Paste Msg0||Msg1 Below to SP");
-	msgio->send_partial(&msg0_extended_epid_group_id,
-						sizeof(msg0_extended_epid_group_id));
-	msgio->send(&msg1, sizeof(msg1));
-	divider(stderr);
-
-	fprintf(stderr, "Waiting for msg2 here.\n");
 	return 1;
 }
 
-int do_verification(sgx_enclave_id_t eid, config_t *config)
+static void ra_pool_run(ra_pool_t *pool)
 {
-	struct msg01_struct
-	{
-		uint32_t msg0_extended_epid_group_id;
-		sgx_ra_msg1_t msg1;
-	} *msg01;
-	int rv;
-	int *verif_result;
-	MsgIO *msgio;
-	try
-	{
-		msgio = new MsgIO(NULL, DEFAULT_PORT);
-	}
-	catch (...)
-	{
-		exit(1);
-	}
+	unique_lock<mutex> guard(pool->lock);
 
-	while (msgio->server_loop())
+	while (!pool->stop)
 	{
-		fprintf(stderr, "Waiting for msg0||msg1\n");
+		ra_prepared_t ra;
+		int ok;
 
-		rv = msgio->read((void **)&msg01, NULL);
-		if (rv == -1)
-		{
-			eprintf("system error reading msg0||msg1\n");
-			return 0;
-		}
-		else if (rv == 0)
+		if (pool->ready.size() >= pool->size)
 		{
-			eprintf("protocol error reading msg0||msg1\n");
-			return 0;
+			pool->cv.wait(guard);
+			continue;
 		}
 
-		if (verbose)
+		guard.unlock();
+		ok = ra_prepare(pool->eid, pool->config, &ra);
+		guard.lock();
+
+		if (ok)
+			pool->ready.push_back(ra);
+		else
 		{
-			edividerWithText("Msg0 Details (from Client)");
-			eprintf("msg0.extended_epid_group_id = %u\n",
-					msg01->msg0_extended_epid_group_id);
-			edivider();
+			/* Don't spin if the platform can't give us a msg1 */
+
+			eprintf("could not prepare an RA context in advance\n");
+			pool->cv.wait_for(guard, chrono::seconds(1));
 		}
-		process_msg01(eid, verif_result, msg01->msg0_extended_epid_group_id, &msg01->msg1);
 	}
 }
 
-int do_attestation_old(sgx_enclave_id_t eid, config_t *config)
+void ra_pool_start(ra_pool_t *pool, sgx_enclave_id_t eid, config_t *config,
+				   uint32_t size)
 {
-	sgx_status_t status, sgxrv, pse_status;
+	pool->eid = eid;
+	pool->config = config;
+	pool->size = size;
+	pool->stop = false;
+	pool->worker = thread(ra_pool_run, pool);
+}
+
+/* Take a prepared context if one is ready. This never blocks. */
+
+int ra_pool_take(ra_pool_t *pool, ra_prepared_t *ra)
+{
+	lock_guard<mutex> guard(pool->lock);
+
+	ra->ready = 0;
+	if (pool->ready.empty())
+		return 0;
+
+	*ra = pool->ready.front();
+	pool->ready.pop_front();
+	pool->cv.notify_one();
+
+	return 1;
+}
+
+/* Return a context that wasn't used */
+
+void ra_pool_put(ra_pool_t *pool, ra_prepared_t *ra)
+{
+	lock_guard<mutex> guard(pool->lock);
+	sgx_status_t sgxrv;
+
+	if (!ra->ready)
+		return;
+
+	if (pool->ready.size() < pool->size)
+		pool->ready.push_front(*ra);
+	else
+		enclave_ra_close(pool->eid, &sgxrv, ra->ra_ctx);
+	ra->ready = 0;
+}
+
+void ra_pool_stop(ra_pool_t *pool)
+{
+	sgx_status_t sgxrv;
+
+	{
+		lock_guard<mutex> guard(pool->lock);
+		pool->stop = true;
+		pool->cv.notify_one();
+	}
+	pool->worker.join();
+
+	while (!pool->ready.empty())
+	{
+		enclave_ra_close(pool->eid, &sgxrv, pool->ready.front().ra_ctx);
+		pool->ready.pop_front();
+	}
+}
+
+int do_attestation_old(sgx_enclave_id_t eid, config_t *config,
+					   ra_prepared_t *warm, int *trusted)
+{
+	sgx_status_t status, sgxrv;
+	ra_prepared_t ra;
 	sgx_ra_msg1_t msg1;
 	sgx_ra_msg2_t *msg2 = NULL;
 	sgx_ra_msg3_t *msg3 = NULL;
 	ra_msg4_t *msg4 = NULL;
 	uint32_t msg0_extended_epid_group_id = 0;
 	uint32_t msg3_sz;
-	uint32_t flags = config->flags;
 	sgx_ra_context_t ra_ctx = 0xdeadbeef;
 	int rv;
 	MsgIO *msgio;
+	msgio_iov_t iov[2];
+	size_t msg2sz = 0;
+	unsigned int busy_tries = 0;
 	size_t msg4sz = 0;
 	int enclaveTrusted = NotTrusted; // Not Trusted
-	int b_pse = OPT_ISSET(flags, OPT_PSE);
+	chrono::steady_clock::time_point ra_start = chrono::steady_clock::now();
+	double ra_usec;
+	ra_ticket_t ticket;
+	int have_ticket = 0;
 
-	if (config->server == NULL)
-	{
-		msgio = new MsgIO();
-	}
-	else
+	if (trusted != NULL)
+		*trusted = -1;
+
+	/* Skip the attestation if we have a sealed session we can resume */
+
+	if (config->session_file != NULL && config->server != NULL)
 	{
-		try
-		{
-			msgio = new MsgIO(config->server, (config->port == NULL) ? DEFAULT_PORT : config->port);
-		}
-		catch (...)
+		if (session_resume(eid, config))
 		{
-			exit(1);
+			if (trusted != NULL)
+				*trusted = Trusted;
+			return 0;
 		}
 	}
 
 	/*
-	 * WARNING! Normally, the public key would be hardcoded into the
-	 * enclave, not passed in as a parameter. Hardcoding prevents
-	 * the enclave using an unauthorized key.
-	 *
-	 * This is diagnostic/test application, however, so we have
-	 * the flexibility of a dynamically assigned key.
+	 * Use the RA context we were handed if it's ready to go, otherwise
+	 * create one now.
 	 */
 
-	/* Executes an ECALL that runs sgx_ra_init() */
-
-	if (OPT_ISSET(flags, OPT_PUBKEY))
+	if (warm != NULL && warm->ready)
 	{
-		if (debug)
-			fprintf(stderr, "+++ using supplied public key\n");
-		status = enclave_ra_init(eid, &sgxrv, config->pubkey, b_pse,
-								 &ra_ctx, &pse_status);
+		memcpy(&ra, warm, sizeof(ra_prepared_t));
+		warm->ready = 0;
 	}
-	else
+	else if (!ra_prepare(eid, config, &ra))
 	{
-		if (debug)
-			fprintf(stderr, "+++ using default public key\n");
-		status = enclave_ra_init_def(eid, &sgxrv, b_pse, &ra_ctx,
-									 &pse_status);
+		return 1;
 	}
 
-	/* Did the ECALL succeed? */
-	if (status != SGX_SUCCESS)
+	/* We come back here, with the same msg1, if the SP is busy */
+
+connect:
+	if (config->server == NULL)
 	{
-		fprintf(stderr, "enclave_ra_init: %08x\n", status);
-		delete msgio;
-		return 1;
+		msgio = new MsgIO();
 	}
-
-#ifdef _WIN32
-	/* If we asked for a PSE session, did that succeed? */
-	if (b_pse)
+	else
 	{
-		if (pse_status != SGX_SUCCESS)
+		try
 		{
-			fprintf(stderr, "pse_session: %08x\n", pse_status);
-			delete msgio;
+			msgio = new MsgIO(config->server, (config->port == NULL) ? DEFAULT_PORT : config->port);
+		}
+		catch (...)
+		{
+			enclave_ra_close(eid, &sgxrv, ra.ra_ctx);
 			return 1;
 		}
 	}
-#endif
-
-	/* Did sgx_ra_init() succeed? */
-	if (sgxrv != SGX_SUCCESS)
-	{
-		fprintf(stderr, "sgx_ra_init: %08x\n", sgxrv);
-		delete msgio;
-		return 1;
-	}
-
-	/* Generate msg0 */
 
-	status = sgx_get_extended_epid_group_id(&msg0_extended_epid_group_id);
-	if (status != SGX_SUCCESS)
-	{
-		enclave_ra_close(eid, &sgxrv, ra_ctx);
-		fprintf(stderr, "sgx_get_extended_epid_group_id: %08x\n", status);
-		delete msgio;
-		return 1;
-	}
-	if (verbose)
+	if (config->deadline_ms)
 	{
-		dividerWithText(stderr, "Msg0 Details");
-		dividerWithText(fplog, "Msg0 Details");
-		fprintf(stderr, "Extended Epid Group ID: ");
-		fprintf(fplog, "Extended Epid Group ID: ");
-		print_hexstring(stderr, &msg0_extended_epid_group_id,
-						sizeof(uint32_t));
-		print_hexstring(fplog, &msg0_extended_epid_group_id,
-						sizeof(uint32_t));
-		fprintf(stderr, "\n");
-		fprintf(fplog, "\n");
-		divider(stderr);
-		divider(fplog);
-	}
-
-	/* Generate msg1 */
+		int64_t left = config->deadline_ms - deadline_now_ms();
 
-	status = sgx_ra_get_msg1(ra_ctx, eid, sgx_ra_get_ga, &msg1);
-	if (status != SGX_SUCCESS)
-	{
-		enclave_ra_close(eid, &sgxrv, ra_ctx);
-		fprintf(stderr, "sgx_ra_get_msg1: %08x\n", status);
-		fprintf(fplog, "sgx_ra_get_msg1: %08x\n", status);
-		delete msgio;
-		return 1;
+		if (left <= 0 || !msgio->set_timeout((unsigned int)left))
+		{
+			enclave_ra_close(eid, &sgxrv, ra.ra_ctx);
+			delete msgio;
+			return 1;
+		}
 	}
 
-	if (verbose)
-	{
-		dividerWithText(stderr, "Msg1 Details");
-		dividerWithText(fplog, "Msg1 Details");
-		fprintf(stderr, "msg1.g_a.gx = ");
-		fprintf(fplog, "msg1.g_a.gx = ");
-		print_hexstring(stderr, msg1.g_a.gx, 32);
-		print_hexstring(fplog, msg1.g_a.gx, 32);
-		fprintf(stderr, "\nmsg1.g_a.gy = ");
-		fprintf(fplog, "\nmsg1.g_a.gy = ");
-		print_hexstring(stderr, msg1.g_a.gy, 32);
-		print_hexstring(fplog, msg1.g_a.gy, 32);
-		fprintf(stderr, "\nmsg1.gid    = ");
-		fprintf(fplog, "\nmsg1.gid    = ");
-		print_hexstring(stderr, msg1.gid, 4);
-		print_hexstring(fplog, msg1.gid, 4);
-		fprintf(stderr, "\n");
-		fprintf(fplog, "\n");
-		divider(stderr);
-		divider(fplog);
-	}
+	ra_ctx = ra.ra_ctx;
+	msg0_extended_epid_group_id = ra.msg0_extended_epid_group_id;
+	memcpy(&msg1, &ra.msg1, sizeof(sgx_ra_msg1_t));
 
 	/*
 	 * Send msg0 and msg1 concatenated together (msg0||msg1). We do
@@ -941,9 +2018,17 @@ int do_attestation_old(sgx_enclave_id_t eid, config_t *config)
 	divider(fplog);
 
 	dividerWithText(stderr, "Copy/Paste Msg0||Msg1 Below to SP");
-	msgio->send_partial(&msg0_extended_epid_group_id,
-						sizeof(msg0_extended_epid_group_id));
-	msgio->send(&msg1, sizeof(msg1));
+	iov[0].base = &msg0_extended_epid_group_id;
+	iov[0].len = sizeof(msg0_extended_epid_group_id);
+	iov[1].base = &msg1;
+	iov[1].len = sizeof(msg1);
+	if (msgio->sendv(iov, 2) == -1)
+	{
+		enclave_ra_close(eid, &sgxrv, ra_ctx);
+		fprintf(stderr, "system error occurred while sending msg0||msg1\n");
+		delete msgio;
+		return 1;
+	}
 	divider(stderr);
 
 	fprintf(stderr, "Waiting for msg2\n");
@@ -954,20 +2039,49 @@ int do_attestation_old(sgx_enclave_id_t eid, config_t *config)
 	 * the end. msg2 is malloc'd in readZ_msg do free it when done.
 	 */
 
-	rv = msgio->read((void **)&msg2, NULL);
+	rv = msgio->read((void **)&msg2, &msg2sz);
 	if (rv == 0)
 	{
 		enclave_ra_close(eid, &sgxrv, ra_ctx);
 		fprintf(stderr, "protocol error reading msg2\n");
 		delete msgio;
-		exit(1);
+		return 1;
 	}
 	else if (rv == -1)
 	{
 		enclave_ra_close(eid, &sgxrv, ra_ctx);
 		fprintf(stderr, "system error occurred while reading msg2\n");
 		delete msgio;
-		exit(1);
+		return 1;
+	}
+
+	/*
+	 * The SP may be too busy to attest us right now and ask us to
+	 * come back later instead of sending msg2.
+	 */
+
+	if (msg2sz / 2 == sizeof(ra_busy_t) &&
+		((ra_busy_t *)msg2)->type == RA_MSG_TYPE_BUSY)
+	{
+		unsigned int wait = busy_backoff(busy_tries,
+										 ((ra_busy_t *)msg2)->retry_after);
+
+		free(msg2);
+		msg2 = NULL;
+		delete msgio;
+
+		if (config->server == NULL || busy_tries++ == BUSY_RETRIES ||
+			(config->deadline_ms &&
+			 deadline_now_ms() + wait >= config->deadline_ms))
+		{
+			enclave_ra_close(eid, &sgxrv, ra_ctx);
+			eprintf("service provider is busy, giving up\n");
+			return 1;
+		}
+
+		eprintf("service provider is busy, retrying in %u ms\n", wait);
+		this_thread::sleep_for(chrono::milliseconds(wait));
+		goto connect;
 	}
 
 	if (verbose)
@@ -1089,7 +2203,14 @@ int do_attestation_old(sgx_enclave_id_t eid, config_t *config)
 	}
 
 	dividerWithText(stderr, "Copy/Paste Msg3 Below to SP");
-	msgio->send(msg3, msg3_sz);
+	if (msgio->send(msg3, msg3_sz) == -1)
+	{
+		enclave_ra_close(eid, &sgxrv, ra_ctx);
+		fprintf(stderr, "system error occurred while sending msg3\n");
+		free(msg3);
+		delete msgio;
+		return 1;
+	}
 	divider(stderr);
 
 	dividerWithText(fplog, "Msg3 ==> SP");
@@ -1110,22 +2231,40 @@ int do_attestation_old(sgx_enclave_id_t eid, config_t *config)
 		enclave_ra_close(eid, &sgxrv, ra_ctx);
 		fprintf(stderr, "protocol error reading msg4\n");
 		delete msgio;
-		exit(1);
+		return 1;
 	}
 	else if (rv == -1)
 	{
 		enclave_ra_close(eid, &sgxrv, ra_ctx);
 		fprintf(stderr, "system error occurred while reading msg4\n");
 		delete msgio;
-		exit(1);
+		return 1;
 	}
 
+	ra_usec = chrono::duration<double, micro>(
+				  chrono::steady_clock::now() - ra_start)
+				  .count();
+
 	edividerWithText("Enclave Trust Status from Service Provider");
 
 	enclaveTrusted = msg4->status;
+	if (trusted != NULL)
+		*trusted = enclaveTrusted;
 	if (enclaveTrusted == Trusted)
 	{
 		eprintf("Enclave TRUSTED\n");
+
+		/* A Trusted msg4 may carry a session ticket after the PIB */
+
+		if (msg4sz / 2 >= RA_MSG4_WIRE_SIZE + sizeof(ra_ticket_t))
+		{
+			memcpy(&ticket, (unsigned char *)msg4 + RA_MSG4_WIRE_SIZE,
+				   sizeof(ra_ticket_t));
+			have_ticket = 1;
+			if (verbose)
+				eprintf("Session ticket %s received\n",
+						hexstring(&ticket.id, sizeof(ticket.id)));
+		}
 	}
 	else if (enclaveTrusted == NotTrusted)
 	{
@@ -1198,72 +2337,998 @@ int do_attestation_old(sgx_enclave_id_t eid, config_t *config)
 				eprintf("    OEM for a BIOS Update.\n");
 			}
 
-			if (update_info.ucodeUpdate)
-			{
-				eprintf("  * The CPU Microcode needs to be updated.  Contact your OEM for a platform\n");
-				eprintf("    BIOS Update.\n");
-			}
-			eprintf("\n");
-			edivider();
-		}
+			if (update_info.ucodeUpdate)
+			{
+				eprintf("  * The CPU Microcode needs to be updated.  Contact your OEM for a platform\n");
+				eprintf("    BIOS Update.\n");
+			}
+			eprintf("\n");
+			edivider();
+		}
+	}
+
+	/*
+	 * If the enclave is trusted, fetch a hash of the the MK and SK from
+	 * the enclave to show proof of a shared secret with the service
+	 * provider.
+	 */
+
+	if (enclaveTrusted == Trusted)
+	{
+		sgx_status_t key_status, sha_status;
+		sgx_sha256_hash_t mkhash, skhash;
+
+		// First the MK
+
+		if (debug)
+			eprintf("+++ fetching SHA256(MK)\n");
+		status = enclave_ra_get_key_hash(eid, &sha_status, &key_status, ra_ctx,
+										 SGX_RA_KEY_MK, &mkhash);
+		if (debug)
+			eprintf("+++ ECALL enclage_ra_get_key_hash (MK) ret= 0x%04x\n",
+					status);
+
+		if (debug)
+			eprintf("+++ sgx_ra_get_keys (MK) ret= 0x%04x\n", key_status);
+		// Then the SK
+
+		if (debug)
+			eprintf("+++ fetching SHA256(SK)\n");
+		status = enclave_ra_get_key_hash(eid, &sha_status, &key_status, ra_ctx,
+										 SGX_RA_KEY_SK, &skhash);
+		if (debug)
+			eprintf("+++ ECALL enclage_ra_get_key_hash (MK) ret= 0x%04x\n",
+					status);
+
+		if (debug)
+			eprintf("+++ sgx_ra_get_keys (MK) ret= 0x%04x\n", key_status);
+		if (verbose)
+		{
+			eprintf("SHA256(MK) = ");
+			print_hexstring(stderr, mkhash, sizeof(mkhash));
+			print_hexstring(fplog, mkhash, sizeof(mkhash));
+			eprintf("\n");
+			eprintf("SHA256(SK) = ");
+			print_hexstring(stderr, skhash, sizeof(skhash));
+			print_hexstring(fplog, skhash, sizeof(skhash));
+			eprintf("\n");
+		}
+	}
+
+	/*
+	 * Move the session keys out of the RA context and prove to the
+	 * service provider that we hold them. This is much cheaper than
+	 * running a new attestation.
+	 */
+
+	if (enclaveTrusted == Trusted &&
+		(config->proof_rounds || config->resume_rounds ||
+		 config->record_rounds || config->session_file != NULL))
+	{
+		sgx_status_t session_status;
+		uint32_t sid;
+
+		status = enclave_session_open(eid, &session_status, ra_ctx, &sid);
+		if (status != SGX_SUCCESS || session_status != SGX_SUCCESS)
+		{
+			eprintf("enclave_session_open: %08x %08x\n", status,
+					session_status);
+		}
+		else
+		{
+			if (config->session_file != NULL && have_ticket)
+				session_save(eid, sid, &ticket, config);
+			else if (config->session_file != NULL)
+				eprintf("The service provider did not issue a session ticket\n");
+
+			if (config->proof_rounds)
+				do_proof_bench(eid, sid, msgio, config->proof_rounds, ra_usec);
+
+			if (config->record_rounds)
+				do_record_bench(eid, sid, msgio, config);
+
+			if (config->resume_rounds && have_ticket)
+				do_resume_bench(eid, sid, &ticket, config, ra_usec);
+			else if (config->resume_rounds)
+				eprintf("The service provider did not issue a session ticket\n");
+
+			enclave_session_close(eid, &session_status, sid);
+		}
+	}
+
+	free(msg4);
+
+	enclave_ra_close(eid, &sgxrv, ra_ctx);
+	delete msgio;
+
+	return 0;
+}
+
+/*
+ * Run one proof-of-possession round with the service provider over an
+ * attested connection (see protocol.h). Returns 1 if both sides proved
+ * they hold SK, 0 otherwise.
+ */
+
+int do_proof(sgx_enclave_id_t eid, uint32_t sid, MsgIO *msgio)
+{
+	sgx_status_t status, sgxrv;
+	ra_proof_request_t req;
+	ra_proof_t *sp_proof = NULL;
+	ra_proof_t proof;
+	attestation_status_t *result = NULL;
+	size_t sz;
+	int rv, valid = 0;
+
+	req.type = RA_MSG_TYPE_PROOF;
+	status = enclave_proof_challenge(eid, &sgxrv, sid, &req.challenge);
+	if (status != SGX_SUCCESS || sgxrv != SGX_SUCCESS)
+	{
+		eprintf("enclave_proof_challenge: %08x %08x\n", status, sgxrv);
+		return 0;
+	}
+
+	if (msgio->send(&req, sizeof(req)) == -1)
+	{
+		eprintf("system error sending proof challenge\n");
+		return 0;
+	}
+
+	rv = msgio->read((void **)&sp_proof, &sz);
+	if (rv == 0)
+	{
+		eprintf("protocol error reading proof\n");
+		return 0;
+	}
+	else if (rv == -1)
+	{
+		eprintf("system error occurred while reading proof\n");
+		return 0;
+	}
+	if (sz / 2 != sizeof(ra_proof_t))
+	{
+		eprintf("proof has wrong size\n");
+		free(sp_proof);
+		return 0;
+	}
+
+	status = enclave_proof_verify(eid, &sgxrv, sid, RA_PROOF_ROLE_SERVER,
+								  sp_proof, &valid);
+	if (status != SGX_SUCCESS || sgxrv != SGX_SUCCESS)
+	{
+		eprintf("enclave_proof_verify: %08x %08x\n", status, sgxrv);
+		free(sp_proof);
+		return 0;
+	}
+	if (!valid)
+	{
+		eprintf("service provider proof of possession FAILED\n");
+		free(sp_proof);
+		return 0;
+	}
+
+	/* The SP's nonce is its challenge to us */
+
+	status = enclave_proof_create(eid, &sgxrv, sid, RA_PROOF_ROLE_CLIENT,
+								  &sp_proof->nonce, &proof);
+	free(sp_proof);
+	if (status != SGX_SUCCESS || sgxrv != SGX_SUCCESS)
+	{
+		eprintf("enclave_proof_create: %08x %08x\n", status, sgxrv);
+		return 0;
+	}
+
+	if (msgio->send(&proof, sizeof(proof)) == -1)
+	{
+		eprintf("system error sending proof\n");
+		return 0;
+	}
+
+	rv = msgio->read((void **)&result, &sz);
+	if (rv == 0)
+	{
+		eprintf("protocol error reading proof result\n");
+		return 0;
+	}
+	else if (rv == -1)
+	{
+		eprintf("system error occurred while reading proof result\n");
+		return 0;
+	}
+	if (sz / 2 != sizeof(attestation_status_t))
+	{
+		eprintf("proof result has wrong size\n");
+		free(result);
+		return 0;
+	}
+
+	valid = (*result == Trusted);
+	free(result);
+
+	return valid;
+}
+
+/*
+ * Time repeated proof rounds so they can be compared against the
+ * cost of a full remote attestation.
+ */
+
+int do_proof_bench(sgx_enclave_id_t eid, uint32_t sid, MsgIO *msgio,
+				   uint32_t rounds, double ra_usec)
+{
+	vector<double> usec;
+	uint32_t i;
+
+	usec.reserve(rounds);
+
+	for (i = 0; i < rounds; ++i)
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+		if (!do_proof(eid, sid, msgio))
+		{
+			eprintf("proof round %u failed\n", i + 1);
+			return 0;
+		}
+
+		usec.push_back(chrono::duration<double, micro>(
+						   chrono::steady_clock::now() - start)
+						   .count());
+	}
+
+	print_latency("Proof of Possession Latency", usec, ra_usec);
+
+	return 1;
+}
+
+/*
+ * Resume an attested session on a new connection by presenting its
+ * session ticket and answering the service provider's challenge (see
+ * protocol.h). This takes two round trips instead of msg0 through
+ * msg4. Returns the new connection, or NULL if the service provider
+ * wouldn't resume the session.
+ */
+
+MsgIO *do_resume(sgx_enclave_id_t eid, uint32_t sid, ra_ticket_t *ticket,
+				 config_t *config)
+{
+	sgx_status_t status, sgxrv;
+	ra_resume_request_t req;
+	ra_resume_challenge_t *challenge = NULL;
+	ra_resume_response_t *resp = NULL;
+	ra_proof_t proof;
+	MsgIO *msgio;
+	size_t sz;
+	int rv, valid = 0;
+
+	req.type = RA_MSG_TYPE_RESUME;
+	memcpy(&req.ticket, ticket, sizeof(ra_ticket_t));
+
+	status = enclave_proof_challenge(eid, &sgxrv, sid, &req.challenge);
+	if (status != SGX_SUCCESS || sgxrv != SGX_SUCCESS)
+	{
+		eprintf("enclave_proof_challenge: %08x %08x\n", status, sgxrv);
+		return NULL;
+	}
+
+	try
+	{
+		msgio = new MsgIO(config->server, (config->port == NULL) ? DEFAULT_PORT : config->port);
+	}
+	catch (...)
+	{
+		return NULL;
+	}
+
+	if (msgio->send(&req, sizeof(req)) == -1)
+	{
+		eprintf("system error sending resume request\n");
+		delete msgio;
+		return NULL;
+	}
+
+	/*
+	 * The SP challenges us to prove we hold SK, unless it has already
+	 * refused the ticket.
+	 */
+
+	rv = msgio->read((void **)&challenge, &sz);
+	if (rv == 0)
+	{
+		eprintf("protocol error reading resume challenge\n");
+		delete msgio;
+		return NULL;
+	}
+	else if (rv == -1)
+	{
+		eprintf("system error occurred while reading resume challenge\n");
+		delete msgio;
+		return NULL;
+	}
+	if (sz / 2 == sizeof(ra_resume_response_t))
+	{
+		eprintf("service provider refused to resume the session\n");
+		free(challenge);
+		delete msgio;
+		return NULL;
+	}
+	if (sz / 2 != sizeof(ra_resume_challenge_t))
+	{
+		eprintf("resume challenge has wrong size\n");
+		free(challenge);
+		delete msgio;
+		return NULL;
+	}
+
+	status = enclave_proof_create(eid, &sgxrv, sid, RA_PROOF_ROLE_CLIENT,
+								  &challenge->challenge, &proof);
+	free(challenge);
+	if (status != SGX_SUCCESS || sgxrv != SGX_SUCCESS)
+	{
+		eprintf("enclave_proof_create: %08x %08x\n", status, sgxrv);
+		delete msgio;
+		return NULL;
+	}
+
+	if (msgio->send(&proof, sizeof(proof)) == -1)
+	{
+		eprintf("system error sending resume proof\n");
+		delete msgio;
+		return NULL;
+	}
+
+	rv = msgio->read((void **)&resp, &sz);
+	if (rv == 0)
+	{
+		eprintf("protocol error reading resume response\n");
+		delete msgio;
+		return NULL;
+	}
+	else if (rv == -1)
+	{
+		eprintf("system error occurred while reading resume response\n");
+		delete msgio;
+		return NULL;
+	}
+	if (sz / 2 != sizeof(ra_resume_response_t))
+	{
+		eprintf("resume response has wrong size\n");
+		free(resp);
+		delete msgio;
+		return NULL;
+	}
+	if (resp->status != Trusted)
+	{
+		eprintf("service provider refused to resume the session\n");
+		free(resp);
+		delete msgio;
+		return NULL;
+	}
+
+	status = enclave_proof_verify(eid, &sgxrv, sid, RA_PROOF_ROLE_SERVER,
+								  &resp->proof, &valid);
+	free(resp);
+	if (status != SGX_SUCCESS || sgxrv != SGX_SUCCESS)
+	{
+		eprintf("enclave_proof_verify: %08x %08x\n", status, sgxrv);
+		delete msgio;
+		return NULL;
+	}
+	if (!valid)
+	{
+		eprintf("service provider proof of possession FAILED\n");
+		delete msgio;
+		return NULL;
+	}
+
+	return msgio;
+}
+
+/*
+ * Time repeated session resumptions, each on a fresh connection, so
+ * they can be compared against the cost of a full remote attestation.
+ */
+
+int do_resume_bench(sgx_enclave_id_t eid, uint32_t sid, ra_ticket_t *ticket,
+					config_t *config, double ra_usec)
+{
+	vector<double> usec;
+	uint32_t i;
+
+	if (config->server == NULL)
+	{
+		eprintf("resume-bench needs a network connection to the service provider\n");
+		return 0;
+	}
+
+	usec.reserve(config->resume_rounds);
+
+	for (i = 0; i < config->resume_rounds; ++i)
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		MsgIO *msgio = do_resume(eid, sid, ticket, config);
+
+		if (msgio == NULL)
+		{
+			eprintf("resume %u failed\n", i + 1);
+			return 0;
+		}
+
+		usec.push_back(chrono::duration<double, micro>(
+						   chrono::steady_clock::now() - start)
+						   .count());
+		delete msgio;
+	}
+
+	print_latency("Session Resumption Latency", usec, ra_usec);
+
+	return 1;
+}
+
+/*
+ * Open the secure channel (see protocol.h): exchange nonces with the
+ * service provider and derive the record key for this connection.
+ */
+
+int do_channel_open(sgx_enclave_id_t eid, uint32_t sid, MsgIO *msgio)
+{
+	sgx_status_t status, sgxrv;
+	ra_channel_request_t req;
+	sgx_quote_nonce_t *peer_nonce = NULL;
+	size_t sz;
+	int rv;
+
+	req.type = RA_MSG_TYPE_CHANNEL;
+
+	status = enclave_channel_nonce(eid, &sgxrv, sid, &req.nonce);
+	if (status != SGX_SUCCESS || sgxrv != SGX_SUCCESS)
+	{
+		eprintf("enclave_channel_nonce: %08x %08x\n", status, sgxrv);
+		return 0;
+	}
+
+	if (msgio->send(&req, sizeof(req)) == -1)
+	{
+		eprintf("system error sending channel nonce\n");
+		return 0;
+	}
+
+	rv = msgio->read((void **)&peer_nonce, &sz);
+	if (rv == 0)
+	{
+		eprintf("protocol error reading channel nonce\n");
+		return 0;
+	}
+	else if (rv == -1)
+	{
+		eprintf("system error occurred while reading channel nonce\n");
+		return 0;
+	}
+	if (sz / 2 != sizeof(sgx_quote_nonce_t))
+	{
+		eprintf("channel nonce has wrong size\n");
+		free(peer_nonce);
+		return 0;
+	}
+
+	status = enclave_channel_keys(eid, &sgxrv, sid, peer_nonce);
+	free(peer_nonce);
+	if (status != SGX_SUCCESS || sgxrv != SGX_SUCCESS)
+	{
+		eprintf("enclave_channel_keys: %08x %08x\n", status, sgxrv);
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Push records through the secure channel and time the round trips.
+ * The service provider echoes each record back. With a batch size of
+ * 1 every record costs two ECALLs; with a larger batch, a whole batch
+ * is sealed and opened with one ECALL each and written to the socket
+ * in one go. With record_iov set, the batch is encrypted in place in
+ * our own buffers instead of being copied through the enclave.
+ *
+ * Time spent inside the ECALLs is reported separately so the ECALL
+ * variants can be compared without the network in the way.
+ */
+
+int do_record_bench(sgx_enclave_id_t eid, uint32_t sid, MsgIO *msgio,
+					config_t *config)
+{
+	sgx_status_t status, sgxrv;
+	uint32_t len = config->record_size;
+	uint32_t batch = config->record_batch;
+	uint32_t total = len * batch;
+	vector<ra_record_header_t> hdrs(batch);
+	vector<uint32_t> lens(batch, len);
+	vector<ra_record_iov_t> iov(batch);
+	vector<unsigned char> pt(total), ct(total), out(total);
+	vector<double> usec;
+	uint32_t i, j, batches;
+	double elapsed = 0, ecall = 0;
+	int ok = 0;
+
+	if ((uint64_t)len * batch > MAX_RECORD_BATCH_BYTES)
+	{
+		eprintf("record-bench: a batch can't exceed %u bytes\n",
+				MAX_RECORD_BATCH_BYTES);
+		return 0;
+	}
+
+	if (!do_channel_open(eid, sid, msgio))
+		return 0;
+
+	for (i = 0; i < total; ++i)
+		pt[i] = (unsigned char)i;
+
+	for (j = 0; j < batch; ++j)
+	{
+		iov[j].hdr = &hdrs[j];
+		iov[j].buf = &ct[j * len];
+		iov[j].len = len;
+	}
+
+	batches = (config->record_rounds + batch - 1) / batch;
+	usec.reserve(batches);
+
+	for (i = 0; i < batches; ++i)
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		chrono::steady_clock::time_point ecall_start;
+
+		if (config->record_iov)
+			memcpy(&ct[0], &pt[0], total);
+
+		ecall_start = chrono::steady_clock::now();
+		if (config->record_iov)
+			status = enclave_record_seal_iov(eid, &sgxrv, sid, &iov[0], batch);
+		else if (batch == 1)
+		{
+			status = enclave_record_seal(eid, &sgxrv, sid, &pt[0], len,
+										 &hdrs[0], &ct[0]);
+		}
+		else
+		{
+			status = enclave_record_seal_batch(eid, &sgxrv, sid, batch,
+											   &lens[0], &pt[0], &hdrs[0],
+											   &ct[0], total);
+		}
+		ecall += chrono::duration<double, micro>(
+					 chrono::steady_clock::now() - ecall_start)
+					 .count();
+		if (status != SGX_SUCCESS || sgxrv != SGX_SUCCESS)
+		{
+			eprintf("enclave_record_seal: %08x %08x\n", status, sgxrv);
+			goto done;
+		}
+
+		for (j = 0; j < batch; ++j)
+			msgio->send_record(&hdrs[j], &ct[j * len], false);
+		if (msgio->flush() == -1)
+		{
+			eprintf("system error sending records\n");
+			goto done;
+		}
+
+		for (j = 0; j < batch; ++j)
+		{
+			ra_record_header_t *rec = NULL;
+			int rv = msgio->read_record(&rec);
+
+			if (rv != 1)
+			{
+				eprintf("error reading record\n");
+				goto done;
+			}
+			if (rec->len != len)
+			{
+				eprintf("record has wrong length\n");
+				free(rec);
+				goto done;
+			}
+
+			memcpy(&hdrs[j], rec, sizeof(ra_record_header_t));
+			memcpy(&ct[j * len], rec + 1, len);
+			free(rec);
+		}
+
+		ecall_start = chrono::steady_clock::now();
+		if (config->record_iov)
+			status = enclave_record_open_iov(eid, &sgxrv, sid, &iov[0], batch);
+		else if (batch == 1)
+		{
+			status = enclave_record_open(eid, &sgxrv, sid, &hdrs[0], &ct[0],
+										 len, &out[0]);
+		}
+		else
+		{
+			status = enclave_record_open_batch(eid, &sgxrv, sid, batch,
+											   &hdrs[0], &ct[0], &out[0],
+											   total);
+		}
+		ecall += chrono::duration<double, micro>(
+					 chrono::steady_clock::now() - ecall_start)
+					 .count();
+		if (status != SGX_SUCCESS || sgxrv != SGX_SUCCESS)
+		{
+			eprintf("enclave_record_open: %08x %08x\n", status, sgxrv);
+			goto done;
+		}
+		if ((config->record_iov ? ct : out) != pt)
+		{
+			eprintf("echoed records do not match\n");
+			goto done;
+		}
+
+		usec.push_back(chrono::duration<double, micro>(
+						   chrono::steady_clock::now() - start)
+						   .count());
+		elapsed += usec.back();
+	}
+
+	ok = 1;
+
+	print_latency("Secure Channel Round-Trip Latency", usec, 0);
+	eprintf("record size = %u bytes, batch = %u%s\n", len, batch,
+			config->record_iov ? " (scatter-gather)" : "");
+	eprintf("throughput  = %.0f records/s, %.2f MB/s\n",
+			(double)batches * batch * 1e6 / elapsed,
+			(double)batches * total / elapsed);
+	eprintf("enclave     = %.0f records/s, %.2f MB/s\n",
+			(double)batches * batch * 2e6 / ecall,
+			(double)batches * total * 2 / ecall);
+	edivider();
+
+done:
+	return ok;
+}
+
+void print_latency(const char *title, vector<double> &usec, double ra_usec)
+{
+	size_t n = usec.size();
+	double total = 0;
+	size_t i;
+
+	if (n == 0)
+		return;
+
+	for (i = 0; i < n; ++i)
+		total += usec[i];
+
+	sort(usec.begin(), usec.end());
+
+	edividerWithText(title);
+	eprintf("rounds = %zu\n", n);
+	eprintf("min    = %.1f us\n", usec.front());
+	eprintf("mean   = %.1f us\n", total / n);
+	eprintf("p50    = %.1f us\n", usec[n / 2]);
+	eprintf("p99    = %.1f us\n", usec[(n * 99) / 100]);
+	eprintf("max    = %.1f us\n", usec.back());
+	if (ra_usec > 0)
+		eprintf("full remote attestation = %.1f us\n", ra_usec);
+	edivider();
+}
+
+/*
+ * Seal the session keys, along with the session ticket and an expiry
+ * time, to config->session_file.
+ */
+
+int session_save(sgx_enclave_id_t eid, uint32_t sid, ra_ticket_t *ticket,
+				 config_t *config)
+{
+	sgx_status_t status, sgxrv;
+	sealed_session_info_t info;
+	unsigned char *sealed;
+	uint32_t sz;
+	int rv;
+
+	info.expires = (uint64_t)time(NULL) + config->session_validity;
+	memcpy(&info.ticket, ticket, sizeof(ra_ticket_t));
+
+	status = enclave_session_sealed_size(eid, &sgxrv, &sz);
+	if (status != SGX_SUCCESS || sgxrv != SGX_SUCCESS)
+	{
+		eprintf("enclave_session_sealed_size: %08x %08x\n", status, sgxrv);
+		return 0;
+	}
+
+	sealed = (unsigned char *)malloc(sz);
+	if (sealed == NULL)
+	{
+		perror("malloc");
+		return 0;
+	}
+
+	status = enclave_session_seal(eid, &sgxrv, sid, &info, sealed, sz);
+	if (status != SGX_SUCCESS || sgxrv != SGX_SUCCESS)
+	{
+		eprintf("enclave_session_seal: %08x %08x\n", status, sgxrv);
+		free(sealed);
+		return 0;
+	}
+
+	rv = to_file(sealed, config->session_file, sz);
+	free(sealed);
+
+	if (rv && verbose)
+		eprintf("Session sealed to %s\n", config->session_file);
+
+	return rv;
+}
+
+/*
+ * Unseal the session in config->session_file and resume it with the
+ * service provider. Returns 1 if the session was resumed, and 0 if we
+ * need to do a full attestation instead.
+ */
+
+int session_resume(sgx_enclave_id_t eid, config_t *config)
+{
+	sgx_status_t status, sgxrv;
+	sealed_session_info_t info;
+	unsigned char *sealed;
+	struct stat sb;
+	off_t sz;
+	uint32_t sid;
+	MsgIO *msgio;
+
+	if (stat(config->session_file, &sb) != 0)
+		return 0;
+
+	if (!from_file(NULL, config->session_file, &sz))
+		return 0;
+
+	sealed = (unsigned char *)malloc(sz);
+	if (sealed == NULL)
+	{
+		perror("malloc");
+		return 0;
+	}
+
+	if (!from_file(sealed, config->session_file, &sz))
+	{
+		free(sealed);
+		return 0;
+	}
+
+	status = enclave_session_unseal(eid, &sgxrv, sealed, (uint32_t)sz,
+									(uint64_t)time(NULL), &info, &sid);
+	free(sealed);
+	if (status != SGX_SUCCESS)
+	{
+		eprintf("enclave_session_unseal: %08x\n", status);
+		return 0;
+	}
+	if (sgxrv == SGX_ERROR_INVALID_STATE)
+	{
+		eprintf("%s: sealed session has expired\n", config->session_file);
+		return 0;
+	}
+	else if (sgxrv != SGX_SUCCESS)
+	{
+		eprintf("%s: could not unseal session: %08x\n",
+				config->session_file, sgxrv);
+		return 0;
+	}
+
+	msgio = do_resume(eid, sid, &info.ticket, config);
+	if (msgio == NULL)
+	{
+		enclave_session_close(eid, &sgxrv, sid);
+		return 0;
+	}
+
+	edividerWithText("Enclave Trust Status from Service Provider");
+	eprintf("Enclave TRUSTED (session resumed from %s)\n",
+			config->session_file);
+	edivider();
+
+	if (config->proof_rounds)
+		do_proof_bench(eid, sid, msgio, config->proof_rounds, 0);
+
+	if (config->record_rounds)
+		do_record_bench(eid, sid, msgio, config);
+
+	delete msgio;
+	enclave_session_close(eid, &sgxrv, sid);
+
+	return 1;
+}
+
+/*
+ * The launch token only changes when the platform or the enclave
+ * does, so save it between runs to skip regenerating it.
+ */
+
+int token_load(char *file, sgx_launch_token_t *token)
+{
+	struct stat sb;
+	off_t sz = sizeof(sgx_launch_token_t);
+
+	/* No token yet is fine: the URTS will make one */
+
+	if (stat(file, &sb) != 0 || sb.st_size != sz)
+		return 0;
+
+	if (!from_file((unsigned char *)token, file, &sz))
+	{
+		memset(token, 0, sizeof(sgx_launch_token_t));
+		return 0;
+	}
+
+	if (debug)
+		eprintf("+++ launch token loaded from %s\n", file);
+
+	return 1;
+}
+
+int token_save(char *file, sgx_launch_token_t *token)
+{
+	if (!to_file((unsigned char *)token, file, sizeof(sgx_launch_token_t)))
+	{
+		eprintf("%s: could not save the launch token\n", file);
+		return 0;
+	}
+
+	if (debug)
+		eprintf("+++ launch token saved to %s\n", file);
+
+	return 1;
+}
+
+#ifndef _WIN32
+
+static volatile sig_atomic_t daemon_stop = 0;
+
+static void daemon_signal(int sig)
+{
+	daemon_stop = 1;
+}
+
+/*
+ * Keep the enclave loaded and serve attestation requests on a local
+ * (Unix domain) socket. Each request is one line:
+ *
+ *   attest    Attest to the service provider given on the command line
+ *
+ * and the reply is one line with the result: the attestation status
+ * from msg4 (Trusted, NotTrusted, Trusted_ItsComplicated or
+ * NotTrusted_ItsComplicated), or "error".
+ *
+ * A background thread keeps a pool of RA contexts with msg0 and msg1
+ * already generated, so a request only has to do the exchange with the
+ * service provider. Requests are handled one at a time.
+ */
+
+int do_daemon(sgx_enclave_id_t eid, config_t *config)
+{
+	static const char *status_names[] = {
+		"NotTrusted",
+		"NotTrusted_ItsComplicated",
+		"Trusted_ItsComplicated",
+		"Trusted"};
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	ra_pool_t pool;
+	int ls;
+
+	if (strlen(config->daemon_socket) >= sizeof(addr.sun_path))
+	{
+		eprintf("%s: socket path is too long\n", config->daemon_socket);
+		return 1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, config->daemon_socket, sizeof(addr.sun_path) - 1);
+
+	ls = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (ls == -1)
+	{
+		perror("socket");
+		return 1;
+	}
+
+	unlink(config->daemon_socket);
+	if (bind(ls, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+	{
+		perror(config->daemon_socket);
+		close(ls);
+		return 1;
+	}
+	if (listen(ls, SOMAXCONN) == -1)
+	{
+		perror("listen");
+		close(ls);
+		unlink(config->daemon_socket);
+		return 1;
 	}
 
-	/*
-	 * If the enclave is trusted, fetch a hash of the the MK and SK from
-	 * the enclave to show proof of a shared secret with the service
-	 * provider.
-	 */
+	/* No SA_RESTART, so a signal breaks us out of accept() */
 
-	if (enclaveTrusted == Trusted)
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = daemon_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	ra_pool_start(&pool, eid, config, config->ra_pool);
+
+	eprintf("Listening for requests on %s\n", config->daemon_socket);
+
+	while (!daemon_stop)
 	{
-		sgx_status_t key_status, sha_status;
-		sgx_sha256_hash_t mkhash, skhash;
+		char line[64];
+		size_t len = 0;
+		int trusted, cs;
+		const char *reply;
 
-		// First the MK
+		cs = accept(ls, NULL, NULL);
+		if (cs == -1)
+		{
+			if (errno != EINTR)
+				perror("accept");
+			continue;
+		}
 
-		if (debug)
-			eprintf("+++ fetching SHA256(MK)\n");
-		status = enclave_ra_get_key_hash(eid, &sha_status, &key_status, ra_ctx,
-										 SGX_RA_KEY_MK, &mkhash);
-		if (debug)
-			eprintf("+++ ECALL enclage_ra_get_key_hash (MK) ret= 0x%04x\n",
-					status);
+		/* Read one line */
 
-		if (debug)
-			eprintf("+++ sgx_ra_get_keys (MK) ret= 0x%04x\n", key_status);
-		// Then the SK
+		while (len < sizeof(line) - 1)
+		{
+			ssize_t n = recv(cs, &line[len], sizeof(line) - 1 - len, 0);
 
-		if (debug)
-			eprintf("+++ fetching SHA256(SK)\n");
-		status = enclave_ra_get_key_hash(eid, &sha_status, &key_status, ra_ctx,
-										 SGX_RA_KEY_SK, &skhash);
-		if (debug)
-			eprintf("+++ ECALL enclage_ra_get_key_hash (MK) ret= 0x%04x\n",
-					status);
+			if (n <= 0)
+				break;
+			len += n;
+			if (memchr(line, '\n', len) != NULL)
+				break;
+		}
+		line[len] = '\0';
+		line[strcspn(line, "\r\n")] = '\0';
 
-		if (debug)
-			eprintf("+++ sgx_ra_get_keys (MK) ret= 0x%04x\n", key_status);
-		if (verbose)
+		if (strcmp(line, "attest") == 0)
 		{
-			eprintf("SHA256(MK) = ");
-			print_hexstring(stderr, mkhash, sizeof(mkhash));
-			print_hexstring(fplog, mkhash, sizeof(mkhash));
-			eprintf("\n");
-			eprintf("SHA256(SK) = ");
-			print_hexstring(stderr, skhash, sizeof(skhash));
-			print_hexstring(fplog, skhash, sizeof(skhash));
-			eprintf("\n");
+			ra_prepared_t ra;
+
+			/* If the pool has run dry we'll just make one inline */
+
+			ra_pool_take(&pool, &ra);
+			if (do_attestation_old(eid, config, &ra, &trusted) == 0 &&
+				trusted >= NotTrusted && trusted <= Trusted)
+				reply = status_names[trusted];
+			else
+				reply = "error";
+
+			/* A resumed session doesn't use the RA context */
+
+			ra_pool_put(&pool, &ra);
+		}
+		else
+		{
+			eprintf("unknown request: %s\n", line);
+			reply = "error";
 		}
+
+		if (send(cs, reply, strlen(reply), 0) == -1 ||
+			send(cs, "\n", 1, 0) == -1)
+			perror("send");
+		close(cs);
 	}
 
-	free(msg4);
+	ra_pool_stop(&pool);
 
-	enclave_ra_close(eid, &sgxrv, ra_ctx);
-	delete msgio;
+	close(ls);
+	unlink(config->daemon_socket);
 
 	return 0;
 }
 
+#endif
+
 /*----------------------------------------------------------------------
  * do_quote()
  *
@@ -1297,16 +3362,13 @@ int do_attestation_old(sgx_enclave_id_t eid, config_t *config)
 
 int do_quote(sgx_enclave_id_t eid, config_t *config)
 {
-	sgx_status_t status, sgxrv;
 	sgx_quote_t *quote;
-	sgx_report_t report;
 	sgx_report_t qe_report;
-	sgx_target_info_t target_info;
-	sgx_epid_group_id_t epid_gid;
+	quote_service_t qs;
 	uint32_t sz = 0;
 	uint32_t flags = config->flags;
-	sgx_quote_sign_type_t linkable = SGX_UNLINKABLE_SIGNATURE;
 #ifdef _WIN32
+	sgx_status_t status, sgxrv;
 	sgx_ps_cap_t ps_cap;
 	char *pse_manifest = NULL;
 	size_t pse_manifest_sz;
@@ -1316,13 +3378,9 @@ int do_quote(sgx_enclave_id_t eid, config_t *config)
 	DWORD sz_b64manifest = 0;
 #else
 	char *b64quote = NULL;
-	char *b64manifest = NULL;
 #endif
 
-	if (OPT_ISSET(flags, OPT_LINK))
-		linkable = SGX_LINKABLE_SIGNATURE;
-
-		/* Platform services info. Win32 only. */
+	/* Platform services info. Win32 only. */
 #ifdef _WIN32
 	if (OPT_ISSET(flags, OPT_PSE))
 	{
@@ -1354,66 +3412,26 @@ int do_quote(sgx_enclave_id_t eid, config_t *config)
 
 	/* Get our quote */
 
-	memset(&report, 0, sizeof(report));
-
-	status = sgx_init_quote(&target_info, &epid_gid);
-	if (status != SGX_SUCCESS)
-	{
-		fprintf(stderr, "sgx_init_quote: %08x\n", status);
+	if (!quote_service_init(&qs))
 		return 1;
-	}
 
 	/* Did they ask for just the EPID? */
 	if (config->mode == MODE_EPID)
 	{
-		printf("%08x\n", *(uint32_t *)epid_gid);
+		printf("%08x\n", *(uint32_t *)qs.epid_gid);
 		exit(0);
 	}
 
-	status = get_report(eid, &sgxrv, &report, &target_info);
-	if (status != SGX_SUCCESS)
-	{
-		fprintf(stderr, "get_report: %08x\n", status);
-		return 1;
-	}
-	if (sgxrv != SGX_SUCCESS)
-	{
-		fprintf(stderr, "sgx_create_report: %08x\n", sgxrv);
-		return 1;
-	}
-
-	// sgx_get_quote_size() has been deprecated, but our PSW may be too old
-	// so use a wrapper function.
-
-	if (!get_quote_size(&status, &sz))
-	{
-		fprintf(stderr, "PSW missing sgx_get_quote_size() and sgx_calc_quote_size()\n");
-		return 1;
-	}
-	if (status != SGX_SUCCESS)
-	{
-		fprintf(stderr, "SGX error while getting quote size: %08x\n", status);
-		return 1;
-	}
-
-	quote = (sgx_quote_t *)malloc(sz);
-	if (quote == NULL)
-	{
-		fprintf(stderr, "out of memory\n");
-		return 1;
-	}
-
-	memset(quote, 0, sz);
-	status = sgx_get_quote(&report, linkable, &config->spid,
+	if (!quote_service_get(&qs, eid, config,
+						   (OPT_ISSET(flags, OPT_REPORT_DATA)) ? &config->report_data : NULL,
 						   (OPT_ISSET(flags, OPT_NONCE)) ? &config->nonce : NULL,
-						   NULL, 0,
-						   (OPT_ISSET(flags, OPT_NONCE)) ? &qe_report : NULL,
-						   quote, sz);
-	if (status != SGX_SUCCESS)
+						   &qe_report))
 	{
-		fprintf(stderr, "sgx_get_quote: %08x\n", status);
+		quote_service_free(&qs);
 		return 1;
 	}
+	quote = qs.quote;
+	sz = qs.sz;
 
 	/* Print our quote */
 
@@ -1497,10 +3515,287 @@ int do_quote(sgx_enclave_id_t eid, config_t *config)
 	if (b64manifest != NULL)
 		free(b64manifest);
 #endif
+	quote_service_free(&qs);
+
+	return 0;
+}
+
+#ifndef _WIN32
+
+/* Longest input line: report data, a space, a nonce and a CRLF */
+#define QUOTE_BATCH_LINE (2 * sizeof(sgx_report_data_t) + 1 + \
+						  2 * sizeof(sgx_quote_nonce_t) + 2)
+
+/*
+ * Parse one line of quote-batch input:
+ *
+ *   REPORT_DATA [NONCE]
+ *
+ * Both are hex strings. The report data can be up to 64 bytes and is
+ * zero-padded (the enclave hashes it into the quote's report data); the nonce, if present, must be 16 bytes. Returns 1 if
+ * the line holds a request, 0 if it's blank or a comment, and -1 if
+ * it's malformed.
+ */
+
+static int quote_batch_parse(char *line, sgx_report_data_t *report_data,
+							 sgx_quote_nonce_t *nonce, int *have_nonce)
+{
+	char *rd, *nc, *extra;
+	size_t len;
+
+	rd = strtok(line, " \t\r\n");
+	if (rd == NULL || rd[0] == '#')
+		return 0;
+	nc = strtok(NULL, " \t\r\n");
+	extra = strtok(NULL, " \t\r\n");
+	if (extra != NULL)
+		return -1;
+
+	memset(report_data, 0, sizeof(sgx_report_data_t));
+	len = strlen(rd);
+	if (len % 2 || len > 2 * sizeof(sgx_report_data_t) ||
+		!from_hexstring((unsigned char *)report_data, (unsigned char *)rd,
+						len / 2))
+		return -1;
+
+	*have_nonce = 0;
+	if (nc != NULL)
+	{
+		if (strlen(nc) != 2 * sizeof(sgx_quote_nonce_t) ||
+			!from_hexstring((unsigned char *)nonce, (unsigned char *)nc,
+							sizeof(sgx_quote_nonce_t)))
+			return -1;
+		*have_nonce = 1;
+	}
+
+	return 1;
+}
+
+/*
+ * Generate one quote per line of config->quote_batch ("-" for stdin)
+ * and write each one to stdout as it's made, as one line of JSON that
+ * can be sent to IAS as-is (newline-delimited JSON). The enclave and
+ * the QE state are set up once for the whole batch. Malformed input
+ * lines are reported and skipped.
+ */
+
+int do_quote_batch(sgx_enclave_id_t eid, config_t *config)
+{
+	quote_service_t qs;
+	sgx_report_t qe_report;
+	sgx_report_data_t report_data;
+	sgx_quote_nonce_t nonce;
+	char line[QUOTE_BATCH_LINE + 1];
+	static char obuf[64 * 1024];
+	unsigned long lineno = 0, count = 0;
+	FILE *fp;
+	int rv = 1;
+
+	if (strcmp(config->quote_batch, "-") == 0)
+		fp = stdin;
+	else if ((fp = fopen(config->quote_batch, "r")) == NULL)
+	{
+		perror(config->quote_batch);
+		return 1;
+	}
+
+	if (!quote_service_init(&qs))
+		goto cleanup;
+
+	/* Let stdio batch up our output instead of writing per line */
+
+	setvbuf(stdout, obuf, _IOFBF, sizeof(obuf));
+
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		char *b64quote;
+		int have_nonce, status;
+
+		++lineno;
+		if (strchr(line, '\n') == NULL && !feof(fp))
+		{
+			int c;
+
+			eprintf("%s:%lu: line too long\n", config->quote_batch, lineno);
+			while ((c = fgetc(fp)) != EOF && c != '\n')
+				;
+			continue;
+		}
+
+		status = quote_batch_parse(line, &report_data, &nonce, &have_nonce);
+		if (status == 0)
+			continue;
+		if (status == -1)
+		{
+			eprintf("%s:%lu: expected REPORT_DATA [NONCE] in hex\n",
+					config->quote_batch, lineno);
+			continue;
+		}
+
+		if (!quote_service_get(&qs, eid, config, &report_data,
+							   have_nonce ? &nonce : NULL, &qe_report))
+			goto cleanup;
+
+		b64quote = base64_encode((char *)qs.quote, qs.sz);
+		if (b64quote == NULL)
+		{
+			eprintf("Could not base64 encode quote\n");
+			goto cleanup;
+		}
+
+		fputs("{\"isvEnclaveQuote\":\"", stdout);
+		fputs(b64quote, stdout);
+		if (have_nonce)
+		{
+			fputs("\",\"nonce\":\"", stdout);
+			print_hexstring(stdout, &nonce, sizeof(nonce));
+		}
+		fputs("\"}\n", stdout);
+		free(b64quote);
+
+		++count;
+	}
+
+	if (ferror(fp))
+		perror(config->quote_batch);
+	else
+		rv = 0;
+
+cleanup:
+	fflush(stdout);
+	if (verbose)
+		eprintf("%lu quotes generated\n", count);
+#ifdef SGX_HW_SIM
+	fprintf(stderr, "WARNING! Built in h/w simulation mode. These quotes will not be verifiable.\n");
+#endif
+	quote_service_free(&qs);
+	if (fp != stdin)
+		fclose(fp);
+
+	return rv;
+}
+
+#endif
+
+/*
+ * Get the QE's target info, our EPID group ID and the quote size.
+ * These only change if the QE or the platform's EPID blob does, so
+ * they are fetched once and reused for every quote.
+ */
+
+int quote_service_init(quote_service_t *qs)
+{
+	sgx_status_t status;
+	uint32_t sz;
+
+	memset(qs, 0, sizeof(quote_service_t));
+
+	status = sgx_init_quote(&qs->target_info, &qs->epid_gid);
+	if (status != SGX_SUCCESS)
+	{
+		fprintf(stderr, "sgx_init_quote: %08x\n", status);
+		return 0;
+	}
+
+	// sgx_get_quote_size() has been deprecated, but our PSW may be too old
+	// so use a wrapper function.
+
+	if (!get_quote_size(&status, &sz))
+	{
+		fprintf(stderr, "PSW missing sgx_get_quote_size() and sgx_calc_quote_size()\n");
+		return 0;
+	}
+	if (status != SGX_SUCCESS)
+	{
+		fprintf(stderr, "SGX error while getting quote size: %08x\n", status);
+		return 0;
+	}
+
+	qs->quote = (sgx_quote_t *)malloc(sz);
+	if (qs->quote == NULL)
+	{
+		fprintf(stderr, "out of memory\n");
+		return 0;
+	}
+	qs->sz = sz;
+	qs->ready = 1;
+
+	return 1;
+}
+
+/*
+ * Generate a quote into qs->quote, bound to user_data if it isn't
+ * NULL (the enclave hashes it into the report data). If the QE tells us our report or EPID blob is stale, the
+ * platform has changed underneath us, so refresh and try once more.
+ */
+
+int quote_service_get(quote_service_t *qs, sgx_enclave_id_t eid,
+					  config_t *config, sgx_report_data_t *user_data,
+					  sgx_quote_nonce_t *nonce, sgx_report_t *qe_report)
+{
+	sgx_status_t status, sgxrv;
+	sgx_report_t report;
+	sgx_quote_sign_type_t linkable = SGX_UNLINKABLE_SIGNATURE;
+	int retry;
+
+	if (OPT_ISSET(config->flags, OPT_LINK))
+		linkable = SGX_LINKABLE_SIGNATURE;
+
+	for (retry = 0; retry < 2; ++retry)
+	{
+		if (!qs->ready)
+		{
+			quote_service_free(qs);
+			if (!quote_service_init(qs))
+				return 0;
+		}
 
+		memset(&report, 0, sizeof(report));
+		if (user_data == NULL)
+			status = get_report(eid, &sgxrv, &report, &qs->target_info);
+		else
+			status = get_report_user_data(eid, &sgxrv, &report,
+										  &qs->target_info, user_data);
+		if (status != SGX_SUCCESS)
+		{
+			fprintf(stderr, "get_report: %08x\n", status);
+			return 0;
+		}
+		if (sgxrv != SGX_SUCCESS)
+		{
+			fprintf(stderr, "sgx_create_report: %08x\n", sgxrv);
+			return 0;
+		}
+
+		memset(qs->quote, 0, qs->sz);
+		status = sgx_get_quote(&report, linkable, &config->spid, nonce,
+							   NULL, 0, (nonce != NULL) ? qe_report : NULL,
+							   qs->quote, qs->sz);
+		if (status == SGX_SUCCESS)
+			return 1;
+
+		if (status != SGX_ERROR_MAC_MISMATCH &&
+			status != SGX_ERROR_AE_INVALID_EPIDBLOB)
+			break;
+
+		if (debug)
+			eprintf("+++ sgx_get_quote: %08x, refreshing QE target info\n",
+					status);
+		qs->ready = 0;
+	}
+
+	fprintf(stderr, "sgx_get_quote: %08x\n", status);
 	return 0;
 }
 
+void quote_service_free(quote_service_t *qs)
+{
+	free(qs->quote);
+	qs->quote = NULL;
+	qs->sz = 0;
+	qs->ready = 0;
+}
+
 /*
  * Search for the enclave file and then try and load it.
  */
@@ -1603,12 +3898,71 @@ void usage()
 {
 	fprintf(stderr, "usage: client [ options ] [ host[:port] ]\n\n");
 	fprintf(stderr, "Required:\n");
+#ifndef _WIN32
+	fprintf(stderr, "  -A, --ra-pool=N          In daemon mode, keep N RA contexts with msg1\n");
+	fprintf(stderr, "                             already generated (default: 1).\n");
+#endif
+	fprintf(stderr, "  -B, --proof-bench=N      After a trusted attestation, run N proof-of-\n");
+	fprintf(stderr, "                             possession rounds with the service provider\n");
+	fprintf(stderr, "                             and report their latency.\n");
+#ifndef _WIN32
+	fprintf(stderr, "  -D, --daemon=SOCKET      Keep the enclave loaded and serve attestation\n");
+	fprintf(stderr, "                             requests on the Unix socket SOCKET.\n");
+#endif
+	fprintf(stderr, "  -E, --record-bench=N     After a trusted attestation, send N records\n");
+	fprintf(stderr, "                             over the secure channel and report their\n");
+	fprintf(stderr, "                             latency and throughput.\n");
+	fprintf(stderr, "  -F, --session-file=FILE  Resume the session sealed in FILE if it is still\n");
+	fprintf(stderr, "                             valid, and seal the session there after a\n");
+	fprintf(stderr, "                             trusted attestation.\n");
+	fprintf(stderr, "  -G, --verifiers=LIST     Attest to each host[:port] in the comma-\n");
+	fprintf(stderr, "                             separated LIST at the same time (up to 8).\n");
+	fprintf(stderr, "  -I, --record-iov         Encrypt and decrypt record batches in place\n");
+	fprintf(stderr, "                             with the scatter-gather ECALLs.\n");
+	fprintf(stderr, "  -K, --record-batch=K     Seal and open records K at a time in the\n");
+	fprintf(stderr, "                             record benchmark (default: 1).\n");
+	fprintf(stderr, "  -L, --record-size=BYTES  Record size for the record benchmark\n");
+	fprintf(stderr, "                             (default: 64).\n");
+	fprintf(stderr, "  -M, --mutual             With -P or -V, attest in both directions on\n");
+	fprintf(stderr, "                             the one connection, verifying the peer\n");
+	fprintf(stderr, "                             through the service provider.\n");
 	fprintf(stderr, "  -N, --nonce-file=FILE    Set a nonce from a file containing a 32-byte\n");
 	fprintf(stderr, "                             ASCII hex string\n");
-	fprintf(stderr, "  -P, --pubkey-file=FILE   File containing the public key of the service\n");
-	fprintf(stderr, "                             provider.\n");
+#ifndef _WIN32
+	fprintf(stderr, "  -O, --peer-uid=UID       With -V, only accept provers running as UID\n");
+	fprintf(stderr, "                             on the local host (Unix sockets only).\n");
+#endif
+	fprintf(stderr, "  -P, --prover-peer[=HOST[:PORT]]\n");
+	fprintf(stderr, "                           Attest to the verifier peer at HOST:PORT\n");
+	fprintf(stderr, "                             (default: localhost:%s).\n", DEFAULT_PEER_PORT);
+#ifndef _WIN32
+	fprintf(stderr, "  -Q, --quote-batch=FILE   Generate one quote per line of FILE (\"-\" for\n");
+	fprintf(stderr, "                             stdin), where each line is REPORT_DATA\n");
+	fprintf(stderr, "                             [NONCE] in hex, and write them to stdout\n");
+	fprintf(stderr, "                             as newline-delimited JSON.\n");
+#endif
+	fprintf(stderr, "  -R, --resume-bench=N     After a trusted attestation, resume the session\n");
+	fprintf(stderr, "                             from its ticket on N new connections and\n");
+	fprintf(stderr, "                             report their latency.\n");
 	fprintf(stderr, "  -S, --spid-file=FILE     Set the SPID from a file containing a 32-byte\n");
 	fprintf(stderr, "                             ASCII hex string\n");
+	fprintf(stderr, "  -T, --token-file=FILE    Load the enclave launch token from FILE, and\n");
+	fprintf(stderr, "                             save it there when it changes.\n");
+	fprintf(stderr, "  -U, --streams=N          Run N attestations at once over a single\n");
+	fprintf(stderr, "                             connection, each in its own stream, and\n");
+	fprintf(stderr, "                             report their latency.\n");
+	fprintf(stderr, "  -V, --verifier-peer[=[HOST:]PORT]\n");
+	fprintf(stderr, "                           Accept provers on HOST:PORT (default: all\n");
+	fprintf(stderr, "                             addresses, port %s) and verify them\n", DEFAULT_PEER_PORT);
+	fprintf(stderr, "                             through the service provider.\n");
+	fprintf(stderr, "  -W, --session-validity=SECS\n");
+	fprintf(stderr, "                           How long a sealed session can be resumed\n");
+	fprintf(stderr, "                             (default: 3600).\n");
+	fprintf(stderr, "  -X, --report-data=HEX    Bind the quote to up to 64 bytes of data. The\n");
+	fprintf(stderr, "                             enclave puts a tagged SHA-256 hash of it\n");
+	fprintf(stderr, "                             in the report data (--quote only).\n");
+	fprintf(stderr, "  -Y, --deadline=SECS      Give up on verifiers that haven't finished\n");
+	fprintf(stderr, "                             within SECS seconds (--verifiers only).\n");
 	fprintf(stderr, "  -d, --debug              Show debugging information\n");
 	fprintf(stderr, "  -e, --epid-gid           Get the EPID Group ID instead of performing\n");
 	fprintf(stderr, "                             an attestation.\n");
@@ -1617,6 +3971,8 @@ void usage()
 	fprintf(stderr, "  -m, --pse-manifest       Include the PSE manifest in the quote\n");
 #endif
 	fprintf(stderr, "  -n, --nonce=HEXSTRING    Set a nonce from a 32-byte ASCII hex string\n");
+	fprintf(stderr, "      --pubkey-file=FILE   File containing the public key of the service\n");
+	fprintf(stderr, "                             provider.\n");
 	fprintf(stderr, "  -p, --pubkey=HEXSTRING   Specify the public key of the service provider\n");
 	fprintf(stderr, "                             as an ASCII hex string instead of using the\n");
 	fprintf(stderr, "                             default.\n");
@@ -1628,6 +3984,9 @@ void usage()
 	fprintf(stderr, "  -z                       Read from stdin and write to stdout instead\n");
 	fprintf(stderr, "                             connecting to a server.\n");
 	fprintf(stderr, "\nOne of --spid OR --spid-file is required for generating a quote or doing\nremote attestation.\n");
+#ifndef _WIN32
+	fprintf(stderr, "\nAny HOST:PORT can instead be a Unix domain socket, given as unix:PATH\n(or unixpacket:PATH for SOCK_SEQPACKET), with an @ at the start of PATH\nfor the abstract namespace.\n");
+#endif
 	exit(1);
 }
 
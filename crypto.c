@@ -31,14 +31,28 @@ in the License.
 #include "crypto.h"
 #include "hexutil.h"
 
-static enum _error_type {
+/*
+ * The error state is per thread: the service provider runs these
+ * functions from several worker threads at once, and one thread's
+ * failure must not be cleared by another's success.
+ */
+
+#ifdef _WIN32
+# define THREAD_LOCAL __declspec(thread)
+#else
+# define THREAD_LOCAL __thread
+#endif
+
+enum _error_type {
 	e_none,
 	e_crypto,
 	e_system,
 	e_api
-} error_type= e_none;
+};
 
-static const char *ep= NULL;
+static THREAD_LOCAL enum _error_type error_type= e_none;
+
+static THREAD_LOCAL const char *ep= NULL;
 
 void crypto_init ()
 {
@@ -554,6 +568,93 @@ cleanup:
 	return (error_type == e_none);
 }
 
+/*==========================================================================
+ * AES-GCM
+ *========================================================================== */
+
+int aes128gcm_encrypt(unsigned char key[16], unsigned char iv[12],
+	unsigned char *aad, size_t aadlen, unsigned char *pt, size_t len,
+	unsigned char *ct, unsigned char tag[16])
+{
+	int outlen;
+	error_type= e_none;
+
+	EVP_CIPHER_CTX *ctx= EVP_CIPHER_CTX_new();
+	if ( ctx == NULL ) {
+		error_type= e_crypto;
+		goto cleanup;
+	}
+
+	if ( ! EVP_EncryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, key, iv) ) {
+		error_type= e_crypto;
+		goto cleanup;
+	}
+
+	if ( aadlen && ! EVP_EncryptUpdate(ctx, NULL, &outlen, aad, (int) aadlen) ) {
+		error_type= e_crypto;
+		goto cleanup;
+	}
+
+	if ( len && ! EVP_EncryptUpdate(ctx, ct, &outlen, pt, (int) len) ) {
+		error_type= e_crypto;
+		goto cleanup;
+	}
+
+	if ( ! EVP_EncryptFinal_ex(ctx, ct, &outlen) ) {
+		error_type= e_crypto;
+		goto cleanup;
+	}
+
+	if ( ! EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, 16, tag) )
+		error_type= e_crypto;
+
+cleanup:
+	if ( ctx != NULL ) EVP_CIPHER_CTX_free(ctx);
+	return (error_type == e_none);
+}
+
+/* Returns 0 if the tag doesn't verify. Nothing in pt should be used then. */
+
+int aes128gcm_decrypt(unsigned char key[16], unsigned char iv[12],
+	unsigned char *aad, size_t aadlen, unsigned char *ct, size_t len,
+	unsigned char *pt, unsigned char tag[16])
+{
+	int outlen;
+	error_type= e_none;
+
+	EVP_CIPHER_CTX *ctx= EVP_CIPHER_CTX_new();
+	if ( ctx == NULL ) {
+		error_type= e_crypto;
+		goto cleanup;
+	}
+
+	if ( ! EVP_DecryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, key, iv) ) {
+		error_type= e_crypto;
+		goto cleanup;
+	}
+
+	if ( aadlen && ! EVP_DecryptUpdate(ctx, NULL, &outlen, aad, (int) aadlen) ) {
+		error_type= e_crypto;
+		goto cleanup;
+	}
+
+	if ( len && ! EVP_DecryptUpdate(ctx, pt, &outlen, ct, (int) len) ) {
+		error_type= e_crypto;
+		goto cleanup;
+	}
+
+	if ( ! EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, 16, tag) ) {
+		error_type= e_crypto;
+		goto cleanup;
+	}
+
+	if ( EVP_DecryptFinal_ex(ctx, pt, &outlen) <= 0 ) error_type= e_crypto;
+
+cleanup:
+	if ( ctx != NULL ) EVP_CIPHER_CTX_free(ctx);
+	return (error_type == e_none);
+}
+
 /*==========================================================================
  * SHA
  *========================================================================== */
@@ -41,6 +41,15 @@ void crypto_perror (const char *prefix);
 int cmac128(unsigned char key[16], unsigned char *message, size_t mlen,
 	unsigned char mac[16]);
 
+/* AES-GCM */
+
+int aes128gcm_encrypt(unsigned char key[16], unsigned char iv[12],
+	unsigned char *aad, size_t aadlen, unsigned char *pt, size_t len,
+	unsigned char *ct, unsigned char tag[16]);
+int aes128gcm_decrypt(unsigned char key[16], unsigned char iv[12],
+	unsigned char *aad, size_t aadlen, unsigned char *ct, size_t len,
+	unsigned char *pt, unsigned char tag[16]);
+
 /* EC key operations */
 
 int key_load_file (EVP_PKEY **key, const char *filename, int type);
@@ -0,0 +1,462 @@
+/*
+
+Copyright 2018 Intel Corporation
+
+This software and the related documents are Intel copyrighted materials,
+and your use of them is governed by the express license under which they
+were provided to you (License). Unless the License provides otherwise,
+you may not use, modify, copy, publish, distribute, disclose or transmit
+this software or the related documents without Intel's prior written
+permission.
+
+This software and the related documents are provided as is, with no
+express or implied warranties, other than those that are expressly stated
+in the License.
+
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <inttypes.h>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "common.h"
+#include "hexutil.h"
+#include "settings.h"
+#include "enclave_verify.h"
+#include "enclave_policy.h"
+
+using namespace std;
+
+extern char verbose;
+
+/*
+ * The policy file uses the same KEY=VALUE lines as the 'policy' file
+ * that the build generates, so that file is a policy with one rule.
+ * Each MRSIGNER starts a new rule, and the keys that follow it, on the
+ * same line or on later ones, belong to that rule:
+ *
+ *   MRSIGNER=<hex> [MRENCLAVE=<hex>] [PRODID=n] [MIN_ISVSVN=n]
+ *       [ALLOW_DEBUG=0|1]
+ *
+ * PRODID and MIN_ISVSVN default to 0, and ALLOW_DEBUG to 0. Everything
+ * after a '#' is a comment.
+ *
+ * Rules are kept in an open-addressing hash table with linear probing,
+ * keyed by product ID and the measurement the rule matches on:
+ * MRENCLAVE for rules that name one, MRSIGNER for the rest. A report is
+ * checked against the rule for its MRENCLAVE if there is one, and the
+ * rule for its MRSIGNER otherwise, so a lookup costs the same however
+ * many rules there are.
+ *
+ * A table is never changed once it's built. Reloading the policy builds
+ * a new table and swaps it in, and checks already in progress finish
+ * with the table they started with. Each enclave_policy_t has a table
+ * of its own, so sp can keep its policy with the rest of a
+ * configuration.
+ */
+
+#define POLICY_LINE_MAX	1024
+
+#define KEY_MRSIGNER	0
+#define KEY_MRENCLAVE	1
+
+typedef struct policy_slot_struct {
+	int used;
+	int kind;
+	enclave_rule_t rule;
+} policy_slot_t;
+
+typedef struct policy_table_struct {
+	vector<policy_slot_t> slots;	/* a power of 2, at most half full */
+	size_t mask;
+	size_t nrules;
+	string path;					/* empty if not loaded from a file */
+	struct stat st;
+} policy_table_t;
+
+struct enclave_policy_struct {
+	shared_ptr<const policy_table_t> current;
+	atomic<time_t> next_check;
+};
+
+static mutex reload_mutex;
+
+static const sgx_measurement_t *rule_key(const enclave_rule_t *rule, int kind)
+{
+	return ( kind == KEY_MRENCLAVE ) ? &rule->mr_enclave : &rule->mr_signer;
+}
+
+static size_t policy_hash(int kind, const sgx_measurement_t *mr,
+	sgx_prod_id_t prodid)
+{
+	uint64_t h;
+
+	/* Measurements are SHA-256 digests, so any 8 bytes are well mixed */
+
+	memcpy(&h, mr->m, sizeof(h));
+	h^= ((uint64_t) prodid << 1 | kind) * 0x9e3779b97f4a7c15ULL;
+
+	return (size_t) h;
+}
+
+/* Returns the rule's slot, or the free slot where it belongs */
+
+static const policy_slot_t *policy_probe(const policy_table_t *table,
+	int kind, const sgx_measurement_t *mr, sgx_prod_id_t prodid)
+{
+	size_t i= policy_hash(kind, mr, prodid) & table->mask;
+
+	while (1) {
+		const policy_slot_t *slot= &table->slots[i];
+
+		if ( ! slot->used ) return slot;
+		if ( slot->kind == kind && slot->rule.isv_prod_id == prodid &&
+			memcmp(rule_key(&slot->rule, kind), mr,
+			sizeof(sgx_measurement_t)) == 0 ) return slot;
+
+		i= (i+1) & table->mask;
+	}
+}
+
+static const policy_slot_t *policy_find(const policy_table_t *table,
+	int kind, const sgx_measurement_t *mr, sgx_prod_id_t prodid)
+{
+	const policy_slot_t *slot= policy_probe(table, kind, mr, prodid);
+
+	return ( slot->used ) ? slot : NULL;
+}
+
+static policy_table_t *policy_build(const vector<enclave_rule_t> &rules,
+	const char *path)
+{
+	policy_table_t *table= new policy_table_t;
+	size_t size= 8;
+	size_t i;
+
+	while ( size < 2*rules.size() ) size*= 2;
+
+	table->slots.resize(size);
+	memset(&table->slots[0], 0, size*sizeof(policy_slot_t));
+	table->mask= size-1;
+	table->nrules= rules.size();
+	memset(&table->st, 0, sizeof(table->st));
+	if ( path != NULL ) table->path= path;
+
+	for (i= 0; i< rules.size(); ++i) {
+		const enclave_rule_t *rule= &rules[i];
+		int kind= ( rule->have_mr_enclave ) ? KEY_MRENCLAVE : KEY_MRSIGNER;
+		policy_slot_t *slot= (policy_slot_t *) policy_probe(table, kind,
+			rule_key(rule, kind), rule->isv_prod_id);
+
+		if ( slot->used ) {
+			eprintf("%s: more than one rule for %s %s, product ID %u\n",
+				( path == NULL ) ? "policy" : path,
+				( kind == KEY_MRENCLAVE ) ? "MRENCLAVE" : "MRSIGNER",
+				hexstring(rule_key(rule, kind), sizeof(sgx_measurement_t)),
+				rule->isv_prod_id);
+			delete table;
+			return NULL;
+		}
+
+		slot->used= 1;
+		slot->kind= kind;
+		memcpy(&slot->rule, rule, sizeof(enclave_rule_t));
+	}
+
+	return table;
+}
+
+static int policy_set_key(vector<enclave_rule_t> &rules, const char *key,
+	const char *val)
+{
+	enclave_rule_t *rule;
+	char *eptr= NULL;
+	unsigned long n;
+
+	if ( strcmp(key, "MRSIGNER") == 0 ) {
+		enclave_rule_t r;
+
+		memset(&r, 0, sizeof(r));
+		if ( strlen(val) != 64 ||
+			! from_hexstring((unsigned char *) &r.mr_signer, val, 32) ) {
+
+			eprintf("MRSIGNER must be 64-byte hex string\n");
+			return 0;
+		}
+		rules.push_back(r);
+
+		return 1;
+	}
+
+	if ( rules.empty() ) {
+		eprintf("%s must follow an MRSIGNER\n", key);
+		return 0;
+	}
+	rule= &rules.back();
+
+	if ( strcmp(key, "MRENCLAVE") == 0 ) {
+		if ( strlen(val) != 64 ||
+			! from_hexstring((unsigned char *) &rule->mr_enclave, val, 32) ) {
+
+			eprintf("MRENCLAVE must be 64-byte hex string\n");
+			return 0;
+		}
+		rule->have_mr_enclave= 1;
+
+		return 1;
+	}
+
+	n= strtoul(val, &eptr, 10);
+	if ( *val == '\0' || *eptr != '\0' ) {
+		eprintf("%s must be a positive integer\n", key);
+		return 0;
+	}
+
+	if ( strcmp(key, "PRODID") == 0 ) {
+		if ( n > 0xFFFF ) {
+			eprintf("Product Id must be a positive integer <= 65535\n");
+			return 0;
+		}
+		rule->isv_prod_id= (sgx_prod_id_t) n;
+	} else if ( strcmp(key, "MIN_ISVSVN") == 0 ) {
+		if ( n > 0xFFFF ) {
+			eprintf("Minimum ISV SVN must be a positive integer <= 65535\n");
+			return 0;
+		}
+		rule->min_isvsvn= (sgx_isv_svn_t) n;
+	} else if ( strcmp(key, "ALLOW_DEBUG") == 0 ) {
+		if ( n > 1 ) {
+			eprintf("ALLOW_DEBUG must be 0 or 1\n");
+			return 0;
+		}
+		rule->allow_debug= (int) n;
+	} else {
+		eprintf("unknown key %s\n", key);
+		return 0;
+	}
+
+	return 1;
+}
+
+static int policy_parse(FILE *fp, const char *path,
+	vector<enclave_rule_t> &rules)
+{
+	char line[POLICY_LINE_MAX];
+	int lineno= 0;
+
+	while ( fgets(line, sizeof(line), fp) != NULL ) {
+		char *p= line;
+
+		++lineno;
+		if ( strchr(line, '\n') == NULL && ! feof(fp) ) {
+			eprintf("%s:%d: line too long\n", path, lineno);
+			return 0;
+		}
+
+		if ( (p= strchr(line, '#')) != NULL ) *p= 0;
+		p= line;
+
+		while (1) {
+			char *key, *val;
+			size_t len;
+
+			p+= strspn(p, " \t\r\n");
+			if ( *p == 0 ) break;
+
+			len= strcspn(p, " \t\r\n");
+			key= p;
+			p+= len;
+			if ( *p ) *p++= 0;
+
+			val= strchr(key, '=');
+			if ( val == NULL ) {
+				eprintf("%s:%d: expected KEY=VALUE, saw '%s'\n", path,
+					lineno, key);
+				return 0;
+			}
+			*val++= 0;
+
+			if ( ! policy_set_key(rules, key, val) ) {
+				eprintf("%s:%d: invalid policy rule\n", path, lineno);
+				return 0;
+			}
+		}
+	}
+
+	if ( ferror(fp) ) {
+		eprintf("%s: %s\n", path, strerror(errno));
+		return 0;
+	}
+
+	if ( rules.empty() ) {
+		eprintf("%s: no enclave policy rules\n", path);
+		return 0;
+	}
+
+	return 1;
+}
+
+static int policy_reload(enclave_policy_t *policy, const char *path)
+{
+	lock_guard<mutex> lock(reload_mutex);
+	vector<enclave_rule_t> rules;
+	policy_table_t *table;
+	struct stat st;
+	FILE *fp;
+	int rv;
+
+	fp= fopen(path, "r");
+	if ( fp == NULL ) {
+		eprintf("%s: %s\n", path, strerror(errno));
+		return 0;
+	}
+
+	if ( fstat(fileno(fp), &st) == -1 ) {
+		eprintf("%s: %s\n", path, strerror(errno));
+		fclose(fp);
+		return 0;
+	}
+
+	rv= policy_parse(fp, path, rules);
+	fclose(fp);
+
+	/*
+	 * Remember the file we tried even if it's bad, so we don't retry
+	 * it until it changes again.
+	 */
+
+	if ( ! rv || (table= policy_build(rules, path)) == NULL ) {
+		shared_ptr<const policy_table_t> old= atomic_load(&policy->current);
+
+		if ( old != nullptr ) {
+			policy_table_t *keep= new policy_table_t(*old);
+
+			keep->st= st;
+			atomic_store(&policy->current,
+				shared_ptr<const policy_table_t>(keep));
+		}
+		return 0;
+	}
+
+	table->st= st;
+	atomic_store(&policy->current, shared_ptr<const policy_table_t>(table));
+
+	if ( verbose ) eprintf("+++ loaded %lu enclave policy rules from %s\n",
+		(unsigned long) table->nrules, path);
+
+	return 1;
+}
+
+enclave_policy_t *enclave_policy_load(const char *path)
+{
+	enclave_policy_t *policy= new enclave_policy_t;
+
+	policy->next_check= time(NULL)+SP_POLICY_RECHECK;
+	if ( ! policy_reload(policy, path) ) {
+		delete policy;
+		return NULL;
+	}
+
+	return policy;
+}
+
+enclave_policy_t *enclave_policy_new(const enclave_rule_t *rule)
+{
+	vector<enclave_rule_t> rules(1, *rule);
+	policy_table_t *table= policy_build(rules, NULL);
+	enclave_policy_t *policy;
+
+	if ( table == NULL ) return NULL;
+
+	policy= new enclave_policy_t;
+	policy->next_check= 0;
+	policy->current= shared_ptr<const policy_table_t>(table);
+
+	return policy;
+}
+
+void enclave_policy_free(enclave_policy_t *policy)
+{
+	delete policy;
+}
+
+/*
+ * Reload the policy file if it has changed. Only one thread checks,
+ * at most once every SP_POLICY_RECHECK seconds.
+ */
+
+static void policy_refresh(enclave_policy_t *policy)
+{
+	shared_ptr<const policy_table_t> table;
+	time_t now= time(NULL);
+	time_t when= policy->next_check.load();
+	struct stat st;
+
+	if ( now < when ) return;
+	if ( ! policy->next_check.compare_exchange_strong(when,
+		now+SP_POLICY_RECHECK) ) return;
+
+	table= atomic_load(&policy->current);
+	if ( table == nullptr || table->path.empty() ) return;
+
+	/* Keep the policy we have if the file has gone missing */
+
+	if ( stat(table->path.c_str(), &st) == -1 ) return;
+
+	if ( st.st_mtime == table->st.st_mtime &&
+		st.st_size == table->st.st_size && st.st_ino == table->st.st_ino )
+		return;
+
+	if ( policy_reload(policy, table->path.c_str()) )
+		eprintf("reloaded enclave policy from %s\n", table->path.c_str());
+	else
+		eprintf("%s: keeping the current enclave policy\n",
+			table->path.c_str());
+}
+
+int enclave_policy_verify(enclave_policy_t *policy,
+	sgx_report_body_t *report, int allow_debug)
+{
+	shared_ptr<const policy_table_t> table;
+	const policy_slot_t *slot;
+
+	if ( policy == NULL ) {
+		eprintf("No enclave policy loaded\n");
+		return 0;
+	}
+
+	policy_refresh(policy);
+
+	table= atomic_load(&policy->current);
+	if ( table == nullptr ) {
+		eprintf("No enclave policy loaded\n");
+		return 0;
+	}
+
+	slot= policy_find(table.get(), KEY_MRENCLAVE, &report->mr_enclave,
+		report->isv_prod_id);
+	if ( slot == NULL ) slot= policy_find(table.get(), KEY_MRSIGNER,
+		&report->mr_signer, report->isv_prod_id);
+
+	if ( slot == NULL ) {
+		eprintf("No policy rule for MRSIGNER %s",
+			hexstring(&report->mr_signer, sizeof(sgx_measurement_t)));
+		eprintf(", MRENCLAVE %s, ISV Product Id %u\n",
+			hexstring(&report->mr_enclave, sizeof(sgx_measurement_t)),
+			report->isv_prod_id);
+		return 0;
+	}
+
+	return verify_enclave_identity(slot->rule.mr_signer,
+		slot->rule.isv_prod_id, slot->rule.min_isvsvn,
+		slot->rule.allow_debug && allow_debug, report);
+}
@@ -0,0 +1,62 @@
+/*
+
+Copyright 2018 Intel Corporation
+
+This software and the related documents are Intel copyrighted materials,
+and your use of them is governed by the express license under which they
+were provided to you (License). Unless the License provides otherwise,
+you may not use, modify, copy, publish, distribute, disclose or transmit
+this software or the related documents without Intel's prior written
+permission.
+
+This software and the related documents are provided as is, with no
+express or implied warranties, other than those that are expressly stated
+in the License.
+
+*/
+
+#ifndef __ENCLAVE_POLICY__H
+#define __ENCLAVE_POLICY__H
+
+#include <sgx_report.h>
+
+/*
+ * The set of enclaves sp accepts. Each rule allows the enclaves signed
+ * by one MRSIGNER with one ISV Product Id, and optionally only the one
+ * build with a given MRENCLAVE.
+ */
+
+typedef struct enclave_rule_struct {
+	sgx_measurement_t mr_signer;
+	sgx_measurement_t mr_enclave;
+	int have_mr_enclave;
+	sgx_prod_id_t isv_prod_id;
+	sgx_isv_svn_t min_isvsvn;
+	int allow_debug;
+} enclave_rule_t;
+
+typedef struct enclave_policy_struct enclave_policy_t;
+
+/*
+ * Load a policy from a file. Returns NULL if the file can't be parsed.
+ * A policy that's loaded from a file is reloaded when the file changes,
+ * and stays as it was if the new file can't be parsed.
+ */
+
+enclave_policy_t *enclave_policy_load(const char *path);
+
+/* A policy with a single rule */
+
+enclave_policy_t *enclave_policy_new(const enclave_rule_t *rule);
+
+void enclave_policy_free(enclave_policy_t *policy);
+
+/*
+ * Returns 1 if the enclave that produced the report is allowed. Debug
+ * enclaves are only allowed if both allow_debug and the rule say so.
+ */
+
+int enclave_policy_verify(enclave_policy_t *policy,
+	sgx_report_body_t *report, int allow_debug);
+
+#endif
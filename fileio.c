@@ -60,6 +60,29 @@ int from_file (unsigned char *dest, char *file, off_t *len)
 	return 1;
 }
 
+int to_file (unsigned char *src, char *file, size_t len)
+{
+	FILE *fp;
+
+#ifdef _WIN32
+	if (fopen_s(&fp, file, "wb") != 0) {
+		fprintf(stderr, "fopen_s: ");
+#else
+	if ( (fp= fopen(file, "wb")) == NULL ) {
+		fprintf(stderr, "fopen: ");
+#endif
+		perror(file);
+		return 0;
+	}
+	if ( fwrite(src, len, 1, fp) != 1 ) {
+		fclose(fp);
+		return 0;
+	}
+	fclose(fp);
+
+	return 1;
+}
+
 int from_hexstring_file (unsigned char *dest, char *file, size_t len)
 {
 	unsigned char *sbuf;
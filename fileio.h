@@ -25,6 +25,7 @@ extern "C" {
 #endif
 
 int from_file(unsigned char *dest, char *file, off_t *len);
+int to_file(unsigned char *src, char *file, size_t len);
 
 int from_hexstring_file(unsigned char *dest, char *file, size_t len);
 int to_hexstring_file(unsigned char *dest, char *file, size_t len);
@@ -20,8 +20,16 @@ in the License.
 #include <stdlib.h>
 #include <stdio.h>
 
-static char *_hex_buffer= NULL;
-static size_t _hex_buffer_size= 0;
+/* hexstring() returns this buffer, so each thread gets its own */
+
+#ifdef _WIN32
+# define HEX_THREAD_LOCAL __declspec(thread)
+#else
+# define HEX_THREAD_LOCAL __thread
+#endif
+
+static HEX_THREAD_LOCAL char *_hex_buffer= NULL;
+static HEX_THREAD_LOCAL size_t _hex_buffer_size= 0;
 
 int from_hexstring (unsigned char *dest, const void *vsrc, size_t len)
 {
@@ -56,7 +64,7 @@ void print_hexstring_nl (FILE *fp, const void *src, size_t len)
 	fprintf(fp, "\n");
 }
 
-/* Not thread-safe */
+/* The result is overwritten by the next call from the same thread */
 
 const char _hextable[]= "0123456789abcdef";
 
@@ -25,11 +25,14 @@ namespace httpparser
 class HttpResponseParser
 {
 public:
-    HttpResponseParser()
+    // In headersOnly mode parsing is complete at the end of the headers,
+    // and the caller collects the body itself.
+    explicit HttpResponseParser(bool headersOnly = false)
         : state(ResponseStatusStart),
           contentSize(0),
           chunkSize(0),
-          chunked(false)
+          chunked(false),
+          headersOnly(headersOnly)
     {
     }
 
@@ -39,15 +42,39 @@ public:
         ParsingError
     };
 
+    // Input can be given in pieces, as it arrives.
     ParseResult parse(Response &resp, const char *begin, const char *end)
     {
         return consume(resp, begin, end);
     }
 
+    // Start over on a new response.
+    void reset()
+    {
+        state = ResponseStatusStart;
+        contentSize = 0;
+        chunkSizeStr.clear();
+        chunkSize = 0;
+        chunked = false;
+        spans.clear();
+    }
+
 private:
-    static bool checkIfConnection(const Response::HeaderItem &item)
+    // Where a header is in Response::headerData while we're still adding
+    // to it. The views are made once the headers are complete.
+    struct HeaderSpan
+    {
+        size_t name, nameLen, value, valueLen;
+    };
+
+    static StringView spanName(const Response &resp, const HeaderSpan &span)
     {
-        return strcasecmp(item.name.c_str(), "Connection") == 0;
+        return StringView(resp.headerData.data() + span.name, span.nameLen);
+    }
+
+    static StringView spanValue(const Response &resp, const HeaderSpan &span)
+    {
+        return StringView(resp.headerData.data() + span.value, span.valueLen);
     }
 
     ParseResult consume(Response &resp, const char *begin, const char *end)
@@ -233,7 +260,7 @@ private:
                 {
                     state = ExpectingNewline_3;
                 }
-                else if( !resp.headers.empty() && (input == ' ' || input == '\t') )
+                else if( !spans.empty() && (input == ' ' || input == '\t') )
                 {
                     state = HeaderLws;
                 }
@@ -243,10 +270,10 @@ private:
                 }
                 else
                 {
-                    resp.headers.push_back(Response::HeaderItem());
-                    resp.headers.back().name.reserve(16);
-                    resp.headers.back().value.reserve(16);
-                    resp.headers.back().name.push_back(input);
+                    HeaderSpan span = { resp.headerData.size(), 1, 0, 0 };
+
+                    spans.push_back(span);
+                    resp.headerData.push_back(input);
                     state = HeaderName;
                 }
                 break;
@@ -265,7 +292,8 @@ private:
                 else
                 {
                     state = HeaderValue;
-                    resp.headers.back().value.push_back(input);
+                    resp.headerData.push_back(input);
+                    ++spans.back().valueLen;
                 }
                 break;
             case HeaderName:
@@ -279,12 +307,14 @@ private:
                 }
                 else
                 {
-                    resp.headers.back().name.push_back(input);
+                    resp.headerData.push_back(input);
+                    ++spans.back().nameLen;
                 }
                 break;
             case SpaceBeforeHeaderValue:
                 if( input == ' ' )
                 {
+                    spans.back().value = resp.headerData.size();
                     state = HeaderValue;
                 }
                 else
@@ -295,16 +325,19 @@ private:
             case HeaderValue:
                 if( input == '\r' )
                 {
-                    Response::HeaderItem &h = resp.headers.back();
+                    StringView name = spanName(resp, spans.back());
+                    StringView value = spanValue(resp, spans.back());
 
-                    if( strcasecmp(h.name.c_str(), "Content-Length") == 0 )
+                    if( name.equals_ncase("Content-Length") )
                     {
-                        contentSize = atoi(h.value.c_str());
+                        contentSize = 0;
+                        for(size_t i = 0; i < value.size() && isDigit(value.data()[i]); ++i)
+                            contentSize = contentSize * 10 + value.data()[i] - '0';
                         resp.content.reserve( contentSize );
                     }
-                    else if( strcasecmp(h.name.c_str(), "Transfer-Encoding") == 0 )
+                    else if( name.equals_ncase("Transfer-Encoding") )
                     {
-                        if(strcasecmp(h.value.c_str(), "chunked") == 0)
+                        if( value.equals_ncase("chunked") )
                             chunked = true;
                     }
                     state = ExpectingNewline_2;
@@ -315,7 +348,8 @@ private:
                 }
                 else
                 {
-                    resp.headers.back().value.push_back(input);
+                    resp.headerData.push_back(input);
+                    ++spans.back().valueLen;
                 }
                 break;
             case ExpectingNewline_2:
@@ -329,27 +363,43 @@ private:
                 }
                 break;
             case ExpectingNewline_3: {
-                std::vector<Response::HeaderItem>::iterator it = std::find_if(resp.headers.begin(),
-                                                                    resp.headers.end(),
-                                                                    checkIfConnection);
+                // headerData is complete, so it's safe to make the views.
+                bool haveConnection = false;
 
-                if( it != resp.headers.end() )
+                resp.headers.clear();
+                resp.headers.reserve(spans.size());
+                for(std::vector<HeaderSpan>::const_iterator it = spans.begin();
+                    it != spans.end(); ++it)
                 {
-                    if( strcasecmp(it->value.c_str(), "Keep-Alive") == 0 )
-                    {
-                        resp.keepAlive = true;
-                    }
-                    else  // == Close
+                    Response::HeaderItem item;
+
+                    item.name = spanName(resp, *it);
+                    item.value = spanValue(resp, *it);
+                    resp.headers.push_back(item);
+
+                    if( !haveConnection && item.name.equals_ncase("Connection") )
                     {
-                        resp.keepAlive = false;
+                        haveConnection = true;
+                        // Keep-Alive, or Close
+                        resp.keepAlive = item.value.equals_ncase("Keep-Alive");
                     }
                 }
-                else
+
+                if( !haveConnection )
                 {
                     if( resp.versionMajor > 1 || (resp.versionMajor == 1 && resp.versionMinor == 1) )
                         resp.keepAlive = true;
                 }
 
+                if( headersOnly )
+                {
+                    if( input != '\n' )
+                        return ParsingError;
+
+                    state = Done;
+                    return ParsingCompleted;
+                }
+
                 if( chunked )
                 {
                     state = ChunkSize;
@@ -357,7 +407,10 @@ private:
                 else if( contentSize == 0 )
                 {
                     if( input == '\n')
+                    {
+                        state = Done;
                         return ParsingCompleted;
+                    }
                     else
                         return ParsingError;
                 }
@@ -368,15 +421,21 @@ private:
                 }
                 break;
             }
-            case Post:
-                --contentSize;
-                resp.content.push_back(input);
+            case Post: {
+                // Take as much of the body as we have in one go.
+                size_t n = std::min(contentSize, (size_t) (end - begin) + 1);
+
+                resp.content.append(begin - 1, n);
+                begin += n - 1;
+                contentSize -= n;
 
                 if( contentSize == 0 )
                 {
+                    state = Done;
                     return ParsingCompleted;
                 }
                 break;
+            }
             case ChunkSize:
                 if( isalnum(input) )
                 {
@@ -461,6 +520,7 @@ private:
             case ChunkSizeNewLine_3:
                 if( input == '\n' )
                 {
+                    state = Done;
                     return ParsingCompleted;
                 }
                 else
@@ -496,14 +556,19 @@ private:
                     return ParsingError;
                 }
                 break;
-            case ChunkData:
-                resp.content.push_back(input);
+            case ChunkData: {
+                size_t n = std::min(chunkSize, (size_t) (end - begin) + 1);
+
+                resp.content.append(begin - 1, n);
+                begin += n - 1;
+                chunkSize -= n;
 
-                if( --chunkSize == 0 )
+                if( chunkSize == 0 )
                 {
                     state = ChunkDataNewLine_1;
                 }
                 break;
+            }
             case ChunkDataNewLine_1:
                 if( input == '\r' )
                 {
@@ -524,6 +589,9 @@ private:
                     return ParsingError;
                 }
                 break;
+            case Done:
+                // Anything after the response is ignored.
+                return ParsingCompleted;
             default:
                 return ParsingError;
             }
@@ -602,12 +670,15 @@ private:
         ChunkDataNewLine_1,
         ChunkDataNewLine_2,
         ChunkData,
+        Done,
     } state;
 
     size_t contentSize;
     std::string chunkSizeStr;
     size_t chunkSize;
     bool chunked;
+    bool headersOnly;
+    std::vector<HeaderSpan> spans;
 };
 
 } // namespace httpparser
@@ -12,30 +12,98 @@
 #include <vector>
 #include <algorithm> // Added by JM
 #include <sstream>
+#include <ctype.h>
+#include <string.h>
 
 namespace httpparser
 {
 
+// A read-only view of characters owned by someone else, since we
+// can't count on C++17's std::string_view.
+
+class StringView
+{
+public:
+    StringView() : ptr(NULL), len(0) {}
+    StringView(const char *data, size_t size) : ptr(data), len(size) {}
+
+    const char *data() const { return ptr; }
+    size_t size() const { return len; }
+    bool empty() const { return len == 0; }
+    std::string str() const { return std::string(ptr, len); }
+
+    // Case-insensitive comparison
+    bool equals_ncase(const char *s, size_t slen) const
+    {
+        if ( slen != len ) return false;
+        for (size_t i = 0; i < len; ++i)
+        {
+            if ( ::tolower((unsigned char) ptr[i]) !=
+                ::tolower((unsigned char) s[i]) ) return false;
+        }
+        return true;
+    }
+
+    bool equals_ncase(const char *s) const
+    {
+        return equals_ncase(s, strlen(s));
+    }
+
+    bool equals_ncase(const std::string &s) const
+    {
+        return equals_ncase(s.data(), s.length());
+    }
+
+private:
+    const char *ptr;
+    size_t len;
+};
+
+inline std::ostream &operator<<(std::ostream &os, const StringView &sv)
+{
+    return os.write(sv.data(), sv.size());
+}
+
+// The header names and values are views into headerData, so a Response
+// can't be copied. clear() empties it for another response while keeping
+// what it has allocated.
+
 struct Response {
     Response()
         : versionMajor(0), versionMinor(0), keepAlive(false), statusCode(0)
     {}
-    
+
     struct HeaderItem
     {
-        std::string name;
-        std::string value;
+        StringView name;
+        StringView value;
     };
 
     int versionMajor;
     int versionMinor;
     std::vector<HeaderItem> headers;
-    std::vector<char> content;
+    std::string content;
     bool keepAlive;
-    
+
     unsigned int statusCode;
     std::string status;
 
+    std::string headerData;
+
+    Response(const Response &) = delete;
+    Response &operator=(const Response &) = delete;
+
+    void clear()
+    {
+        versionMajor = versionMinor = 0;
+        headers.clear();
+        content.clear();
+        keepAlive = false;
+        statusCode = 0;
+        status.clear();
+        headerData.clear();
+    }
+
     std::string inspect() const
     {
         std::stringstream stream;
@@ -48,21 +116,15 @@ struct Response {
             stream << it->name << ": " << it->value << "\n";
         }
 
-        std::string data(content.begin(), content.end());
 		// Added "\n" so it prints like its received. - JM
-        stream << "\n" << data << "\n";
+        stream << "\n" << content << "\n";
         return stream.str();
     }
 
 	// content_string() by JM
 	std::string content_string() const
 	{
-        std::stringstream stream;
-
-        std::string data(content.begin(), content.end());
-        stream << data;
-
-		return stream.str();
+		return content;
 	}
 
 	// headers_as_string() by JM
@@ -73,23 +135,14 @@ struct Response {
 		for(std::vector<Response::HeaderItem>::const_iterator it = headers.begin();
             it != headers.end(); ++it)
 		{
-			if ( is_equal_ncase(it->name, name) ) stream << it->value << "\n";
+			if ( it->name.equals_ncase(name) ) stream << it->value << "\n";
 		}
 
 		return stream.str();
 	}
 
-	// Case-insensitive string comparison - JM
-	bool is_equal_ncase(std::string a, std::string b) const
-	{
-		transform(a.begin(), a.end(), a.begin(), ::toupper);
-		transform(b.begin(), b.end(), b.begin(), ::toupper);
-		return ( a == b );
-	}
-
 };
 
 } // namespace httpparser
 
 #endif // HTTPPARSER_RESPONSE_H
-
@@ -0,0 +1,305 @@
+/*
+
+Copyright 2018 Intel Corporation
+
+This software and the related documents are Intel copyrighted materials,
+and your use of them is governed by the express license under which they
+were provided to you (License). Unless the License provides otherwise,
+you may not use, modify, copy, publish, distribute, disclose or transmit
+this software or the related documents without Intel's prior written
+permission.
+
+This software and the related documents are provided as is, with no
+express or implied warranties, other than those that are expressly stated
+in the License.
+
+*/
+
+#include <string.h>
+#include <stddef.h>
+#include "iasreport.h"
+
+/*
+ * The report is a flat object, so the parser only has to know the
+ * top-level keys. Values under any other key are checked and skipped,
+ * with a limit on how deeply they can nest.
+ */
+
+#define MAX_DEPTH	16
+
+typedef struct parser_struct {
+	const char *p;
+	const char *end;
+} parser_t;
+
+typedef struct field_struct {
+	const char *name;
+	size_t offset;
+} field_t;
+
+#define FIELD(x) { #x, offsetof(ias_report_t, x) }
+
+static const field_t fields[]= {
+	FIELD(id),
+	FIELD(timestamp),
+	FIELD(isvEnclaveQuoteStatus),
+	FIELD(isvEnclaveQuoteBody),
+	FIELD(platformInfoBlob),
+	FIELD(revocationReason),
+	FIELD(pseManifestStatus),
+	FIELD(pseManifestHash),
+	FIELD(nonce),
+	FIELD(epidPseudonym),
+	FIELD(advisoryURL)
+};
+
+#define NFIELDS (sizeof(fields)/sizeof(field_t))
+
+static int parse_value(parser_t *ps, ias_report_str_t *value, int depth);
+
+static void skip_ws(parser_t *ps)
+{
+	while ( ps->p < ps->end && (*ps->p == ' ' || *ps->p == '\t' ||
+		*ps->p == '\n' || *ps->p == '\r') ) ++ps->p;
+}
+
+static int is_hex(char c)
+{
+	return ( (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') ||
+		(c >= 'A' && c <= 'F') );
+}
+
+static int expect(parser_t *ps, char c)
+{
+	skip_ws(ps);
+	if ( ps->p == ps->end || *ps->p != c ) return 0;
+	++ps->p;
+
+	return 1;
+}
+
+/* The string's contents, without the quotes */
+
+static int parse_string(parser_t *ps, ias_report_str_t *value)
+{
+	const char *start;
+
+	if ( ! expect(ps, '"') ) return 0;
+
+	start= ps->p;
+	while ( ps->p < ps->end ) {
+		unsigned char c= (unsigned char) *ps->p++;
+
+		if ( c == '"' ) {
+			value->str= start;
+			value->len= (size_t) (ps->p - start - 1);
+			return 1;
+		}
+
+		if ( c < 0x20 ) return 0;
+
+		if ( c == '\\' ) {
+			if ( ps->p == ps->end ) return 0;
+			c= (unsigned char) *ps->p++;
+			if ( c == 'u' ) {
+				int i;
+
+				for (i= 0; i< 4; ++i) {
+					if ( ps->p == ps->end || ! is_hex(*ps->p) ) return 0;
+					++ps->p;
+				}
+			} else if ( c == 0 || ! strchr("\"\\/bfnrt", c) ) return 0;
+		}
+	}
+
+	return 0;
+}
+
+static int parse_literal(parser_t *ps, const char *lit, ias_report_str_t *value)
+{
+	size_t len= strlen(lit);
+
+	if ( (size_t) (ps->end - ps->p) < len || memcmp(ps->p, lit, len) )
+		return 0;
+
+	value->str= ps->p;
+	value->len= len;
+	ps->p+= len;
+
+	return 1;
+}
+
+static int parse_number(parser_t *ps, ias_report_str_t *value)
+{
+	const char *start= ps->p;
+
+	while ( ps->p < ps->end && *ps->p != 0 &&
+		strchr("+-.0123456789eE", *ps->p) ) ++ps->p;
+
+	if ( ps->p == start ) return 0;
+
+	value->str= start;
+	value->len= (size_t) (ps->p - start);
+
+	return 1;
+}
+
+static int skip_array(parser_t *ps, int depth)
+{
+	ias_report_str_t dummy;
+
+	if ( ! expect(ps, '[') ) return 0;
+	if ( expect(ps, ']') ) return 1;
+
+	do {
+		if ( ! parse_value(ps, &dummy, depth) ) return 0;
+	} while ( expect(ps, ',') );
+
+	return expect(ps, ']');
+}
+
+static int skip_object(parser_t *ps, int depth)
+{
+	ias_report_str_t dummy;
+
+	if ( ! expect(ps, '{') ) return 0;
+	if ( expect(ps, '}') ) return 1;
+
+	do {
+		if ( ! parse_string(ps, &dummy) ) return 0;
+		if ( ! expect(ps, ':') ) return 0;
+		if ( ! parse_value(ps, &dummy, depth) ) return 0;
+	} while ( expect(ps, ',') );
+
+	return expect(ps, '}');
+}
+
+/*
+ * Scalars are returned as a slice of the buffer. null gives a NULL str,
+ * and objects and arrays are skipped.
+ */
+
+static int parse_value(parser_t *ps, ias_report_str_t *value, int depth)
+{
+	value->str= NULL;
+	value->len= 0;
+
+	skip_ws(ps);
+	if ( ps->p == ps->end ) return 0;
+
+	switch (*ps->p) {
+	case '"':
+		return parse_string(ps, value);
+	case '{':
+		if ( depth == MAX_DEPTH ) return 0;
+		return skip_object(ps, depth+1);
+	case '[':
+		if ( depth == MAX_DEPTH ) return 0;
+		return skip_array(ps, depth+1);
+	case 't':
+		return parse_literal(ps, "true", value);
+	case 'f':
+		return parse_literal(ps, "false", value);
+	case 'n':
+		if ( ! parse_literal(ps, "null", value) ) return 0;
+		value->str= NULL;
+		value->len= 0;
+		return 1;
+	}
+
+	return parse_number(ps, value);
+}
+
+static int parse_version(parser_t *ps, ias_report_t *report)
+{
+	ias_report_str_t value;
+	unsigned int version= 0;
+	size_t i;
+
+	skip_ws(ps);
+	if ( ps->p == ps->end || *ps->p < '0' || *ps->p > '9' ) return 0;
+	if ( ! parse_number(ps, &value) ) return 0;
+
+	for (i= 0; i< value.len; ++i) {
+		if ( value.str[i] < '0' || value.str[i] > '9' ) return 0;
+		if ( version > 0xffff ) return 0;
+		version= version*10 + (unsigned int) (value.str[i] - '0');
+	}
+
+	report->have_version= 1;
+	report->version= version;
+
+	return 1;
+}
+
+static int parse_advisories(parser_t *ps, ias_report_t *report)
+{
+	ias_report_str_t id;
+
+	report->nadvisories= 0;
+	report->advisories_truncated= 0;
+
+	if ( ! expect(ps, '[') ) return 0;
+	if ( expect(ps, ']') ) return 1;
+
+	do {
+		if ( ! parse_string(ps, &id) ) return 0;
+
+		if ( report->nadvisories == IAS_REPORT_MAX_ADVISORIES )
+			report->advisories_truncated= 1;
+		else
+			report->advisoryIDs[report->nadvisories++]= id;
+	} while ( expect(ps, ',') );
+
+	return expect(ps, ']');
+}
+
+int ias_report_parse(ias_report_t *report, const char *json, size_t len)
+{
+	parser_t ps;
+
+	memset(report, 0, sizeof(ias_report_t));
+
+	ps.p= json;
+	ps.end= json+len;
+
+	if ( ! expect(&ps, '{') ) return 0;
+
+	if ( ! expect(&ps, '}') ) {
+		do {
+			ias_report_str_t key, value;
+			size_t i;
+
+			if ( ! parse_string(&ps, &key) ) return 0;
+			if ( ! expect(&ps, ':') ) return 0;
+
+			if ( key.len == 7 && memcmp(key.str, "version", 7) == 0 ) {
+				if ( ! parse_version(&ps, report) ) return 0;
+				continue;
+			}
+
+			if ( key.len == 11 && memcmp(key.str, "advisoryIDs", 11) == 0 ) {
+				if ( ! parse_advisories(&ps, report) ) return 0;
+				continue;
+			}
+
+			if ( ! parse_value(&ps, &value, 0) ) return 0;
+
+			for (i= 0; i< NFIELDS; ++i) {
+				if ( strlen(fields[i].name) == key.len &&
+					memcmp(fields[i].name, key.str, key.len) == 0 ) {
+
+					*(ias_report_str_t *) ((char *) report +
+						fields[i].offset)= value;
+					break;
+				}
+			}
+		} while ( expect(&ps, ',') );
+
+		if ( ! expect(&ps, '}') ) return 0;
+	}
+
+	skip_ws(&ps);
+
+	return ( ps.p == ps.end );
+}
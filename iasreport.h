@@ -0,0 +1,74 @@
+/*
+
+Copyright 2018 Intel Corporation
+
+This software and the related documents are Intel copyrighted materials,
+and your use of them is governed by the express license under which they
+were provided to you (License). Unless the License provides otherwise,
+you may not use, modify, copy, publish, distribute, disclose or transmit
+this software or the related documents without Intel's prior written
+permission.
+
+This software and the related documents are provided as is, with no
+express or implied warranties, other than those that are expressly stated
+in the License.
+
+*/
+
+#ifndef __IASREPORT__H
+#define __IASREPORT__H
+
+#include <sys/types.h>
+
+/*
+ * The fields of an IAS attestation verification report, parsed in one
+ * pass without allocating. Each field points into the buffer that was
+ * parsed, so it is only good for as long as that buffer is. Strings
+ * are left as they appear in the JSON, escapes and all: none of the
+ * fields we act on are allowed to contain them. A field that's absent
+ * or null has a NULL str.
+ */
+
+#define IAS_REPORT_MAX_ADVISORIES	32
+
+typedef struct ias_report_str_struct {
+	const char *str;
+	size_t len;
+} ias_report_str_t;
+
+typedef struct ias_report_struct {
+	int have_version;
+	unsigned int version;
+	ias_report_str_t id;
+	ias_report_str_t timestamp;
+	ias_report_str_t isvEnclaveQuoteStatus;
+	ias_report_str_t isvEnclaveQuoteBody;
+	ias_report_str_t platformInfoBlob;
+	ias_report_str_t revocationReason;
+	ias_report_str_t pseManifestStatus;
+	ias_report_str_t pseManifestHash;
+	ias_report_str_t nonce;
+	ias_report_str_t epidPseudonym;
+	ias_report_str_t advisoryURL;
+	unsigned int nadvisories;
+	ias_report_str_t advisoryIDs[IAS_REPORT_MAX_ADVISORIES];
+	int advisories_truncated;	/* there were more than we could keep */
+} ias_report_t;
+
+/* A field's arguments for a "%.*s" format */
+
+#define REPORT_FIELD(f) (int) (f).len, ((f).str == NULL) ? "" : (f).str
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Returns 0 if the report isn't a well-formed JSON object */
+
+int ias_report_parse(ias_report_t *report, const char *json, size_t len);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -43,6 +43,7 @@ in the License.
 #include "base64.h"
 #include "hexutil.h"
 #include "settings.h"
+#include "spcache.h"
 
 using namespace std;
 using namespace httpparser;
@@ -83,10 +84,21 @@ IAS_Connection::IAS_Connection(int server_idx, uint32_t flags, char *priSubscrip
 	c_agent_name= "";
 	c_proxy_port= 80;
 	c_store= NULL;
+	memset(c_store_id, 0, sizeof(c_store_id));
 	setSubscriptionKey(SubscriptionKeyID::Primary, priSubscriptionKey); 
 	setSubscriptionKey(SubscriptionKeyID::Secondary, secSubscriptionKey); 
 }
 
+/* Replace both keys, and go back to using the primary */
+
+void IAS_Connection::setSubscriptionKeys(char *priSubscriptionKey,
+	char *secSubscriptionKey)
+{
+	setSubscriptionKey(SubscriptionKeyID::Primary, priSubscriptionKey);
+	setSubscriptionKey(SubscriptionKeyID::Secondary, secSubscriptionKey);
+	currentKeyID= SubscriptionKeyID::Primary;
+}
+
 IAS_Connection::~IAS_Connection()
 {
 }
@@ -330,7 +342,7 @@ ias_error_t IAS_Request::sigrl(uint32_t gid, string &sigrl)
 		}
 
 		if ( response.statusCode == IAS_OK ) {
-			sigrl= response.content_string();
+			sigrl.swap(response.content);
 		} 
 
 	} else {
@@ -349,7 +361,7 @@ ias_error_t IAS_Request::report(map<string,string> &payload, string &content,
 	Response response;
 	map<string,string>::iterator imap;
 	string url= r_conn->base_url();
-	string certchain;
+	string certchain, chainkey;
 	string body= "{\n";
 	size_t cstart, cend, count, i;
 	vector<X509 *> certvec;
@@ -361,6 +373,7 @@ ias_error_t IAS_Request::report(map<string,string> &payload, string &content,
 	ias_error_t status;
 	int rv;
 	unsigned char *sig= NULL;
+	unsigned char chainhash[32];
 	EVP_PKEY *pkey= NULL;
 	Agent *agent= r_conn->new_agent();
 	
@@ -495,17 +508,32 @@ ias_error_t IAS_Request::report(map<string,string> &payload, string &content,
 		goto cleanup;
 	}
 
-	// Now verify the signing certificate
+	// Now verify the signing certificate, unless we already have
+	// against this CA
 
-	rv= cert_verify(this->conn()->cert_store(), stack);
-
-	if ( ! rv ) {
-		crypto_perror("cert_stack_build");
-		eprintf("certificate verification failure\n");
-		status= IAS_BAD_CERTIFICATE;
+	chainkey= string((const char *) r_conn->cert_store_id(), 32)+certchain;
+	if ( ! sha256_digest((const unsigned char *) chainkey.c_str(),
+		chainkey.length(), chainhash) ) {
+		crypto_perror("sha256_digest");
+		status= IAS_INTERNAL_ERROR;
 		goto cleanup;
+	}
+
+	if ( spcache_chain_verified(chainhash) ) {
+		if ( debug ) eprintf("+++ certificate chain verified (cached)\n");
 	} else {
-		if ( debug ) eprintf("+++ certificate chain verified\n", rv);
+		rv= cert_verify(this->conn()->cert_store(), stack);
+
+		if ( ! rv ) {
+			crypto_perror("cert_stack_build");
+			eprintf("certificate verification failure\n");
+			status= IAS_BAD_CERTIFICATE;
+			goto cleanup;
+		} else {
+			if ( debug ) eprintf("+++ certificate chain verified\n", rv);
+		}
+
+		spcache_chain_put(chainhash);
 	}
 
 	// The signing cert is valid, so extract and verify the signature
@@ -548,7 +576,9 @@ ias_error_t IAS_Request::report(map<string,string> &payload, string &content,
 		goto cleanup;
 	}
 
-	content= response.content_string();
+	// Take the body rather than copying it
+
+	content.swap(response.content);
 
 	if ( debug ) {
 		eprintf("+++ Verifying signature over report body\n");
@@ -556,7 +586,7 @@ ias_error_t IAS_Request::report(map<string,string> &payload, string &content,
 		eputs(content.c_str());
 		eprintf("\n");
 		edivider();
-		eprintf("Content-length: %lu bytes\n", response.content_string().length());
+		eprintf("Content-length: %lu bytes\n", content.length());
 		edivider();
 	}
 
@@ -20,6 +20,7 @@ in the License.
 
 #include <sys/types.h>
 #include <inttypes.h>
+#include <string.h>
 #include <openssl/x509.h>
 #include "agent.h"
 #include "settings.h"
@@ -108,6 +109,7 @@ private:
 	int c_proxy_mode;
 	uint32_t c_flags;
 	X509_STORE *c_store;
+	unsigned char c_store_id[32];
 	Agent *c_agent;
 	string c_agent_name;
 
@@ -125,6 +127,7 @@ public:
 	int agent(const char *agent_name);
 
 	string getSubscriptionKey(); 
+	void setSubscriptionKeys(char *priSubscriptionKey, char *secSubscriptionKey);
  	SubscriptionKeyID getSubscriptionKeyID() { return currentKeyID; }
 	void SetSubscriptionKeyID(SubscriptionKeyID id) { currentKeyID = id;}
 
@@ -139,9 +142,17 @@ public:
 	void ca_bundle(const char *file) { c_ca_file= file; }
 	string ca_bundle() { return c_ca_file; }
 
-	/* Internal cert store for verifying the IAS Signing certificate */
-	void cert_store(X509_STORE *store) { c_store= store; }
+	/*
+	 * Internal cert store for verifying the IAS Signing certificate,
+	 * and an ID for its contents (a SHA-256 of the CA certificate) so
+	 * cached verifications can't outlive a change of CA.
+	 */
+	void cert_store(X509_STORE *store, const unsigned char id[32]) {
+		c_store= store;
+		memcpy(c_store_id, id, sizeof(c_store_id));
+	}
 	X509_STORE *cert_store() { return c_store; }
+	const unsigned char *cert_store_id() { return c_store_id; }
 
 	Agent* new_agent();
 	Agent* agent();
@@ -36,8 +36,17 @@ typedef DWORD ssize_t;
 # pragma comment(lib, "AdvApi32.lib")
 #else
 # include <arpa/inet.h>
+# include <netinet/in.h>
+# include <netinet/tcp.h>
 # include <sys/socket.h>
+# include <sys/stat.h>
+# include <sys/time.h>
+# include <sys/uio.h>
+# include <sys/un.h>
+# include <stddef.h>
 # include <netdb.h>
+# include <fcntl.h>
+# include <poll.h>
 # include <unistd.h>
 #endif
 #include <exception>
@@ -45,6 +54,7 @@ typedef DWORD ssize_t;
 #include <string>
 #include "hexutil.h"
 #include "msgio.h"
+#include "protocol.h"
 #include "common.h"
 
 using namespace std;
@@ -52,12 +62,53 @@ using namespace std;
 static char *buffer = NULL;
 static uint32_t buffer_size = MSGIO_BUFFER_SZ;
 
+/*
+ * Seconds a listening socket waits for a client's first message before
+ * handing us the connection. Our clients always speak first.
+ */
+#define MSGIO_DEFER_ACCEPT	5
+
+/*
+ * Hex encode onto the end of a buffer. Unlike hexstring() this doesn't
+ * go through a shared buffer.
+ */
+
+static void hex_append(string &dest, const void *vsrc, size_t len)
+{
+	static const char hextable[]= "0123456789abcdef";
+	const unsigned char *src= (const unsigned char *) vsrc;
+	size_t i, pos= dest.length();
+
+	dest.resize(pos+2*len);
+	for (i= 0; i< len; ++i) {
+		dest[pos++]= hextable[src[i]>>4];
+		dest[pos++]= hextable[src[i]&0xf];
+	}
+}
+
+/* Our messages are small and every one is waited on, so don't delay them */
+
+static void set_nodelay(SOCKET sock)
+{
+	int enable= 1;
+
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char *) &enable,
+		sizeof(enable));
+}
+
 #ifndef _WIN32
 # ifndef INVALID_SOCKET
 #  define INVALID_SOCKET -1
 # endif
 #endif
 
+#ifndef MSG_DONTWAIT
+# define MSG_DONTWAIT 0
+#endif
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL 0
+#endif
+
 /* With no arguments, we read/write to stdin/stdout using stdio */
 
 MsgIO::MsgIO()
@@ -65,20 +116,68 @@ MsgIO::MsgIO()
 	use_stdio = true;
 	s= -1;
 	ls= -1;
+	muxed= 0;
+	stream= 0;
+	conn= NULL;
+	shared= false;
+	mux_rv= 1;
+	limits_init();
+#ifndef _WIN32
+	check_uid= false;
+#endif
+}
+
+/*
+ * Unix domain sockets are given as unix:PATH, or unixpacket:PATH for
+ * SOCK_SEQPACKET, in place of a host (or, when listening, a port). A
+ * PATH starting with @ is in the abstract namespace.
+ */
+
+bool msgio_unix_address(const char *addr)
+{
+#ifdef _WIN32
+	return false;
+#else
+	if ( addr == NULL ) return false;
+
+	return strncmp(addr, "unix:", 5) == 0 ||
+		strncmp(addr, "unixpacket:", 11) == 0;
+#endif
 }
 
-/* Connect to a remote server and port, and use socket IO */
+/*
+ * Connect to a remote server and port, and use socket IO. With passive
+ * set, or no peer, listen on the given address and port instead.
+ */
 
-MsgIO::MsgIO(const char *peer, const char *port)
+MsgIO::MsgIO(const char *peer, const char *port, bool passive, int backlog)
 {
 #ifdef _WIN32
 	WSADATA wsa;
 #endif
 	int rv, proto;
 	struct addrinfo *addrs, *addr, hints;
+	bool server= passive || peer == NULL;
 	s= ls= -1;
+	muxed= -1;
+	stream= 0;
+	conn= NULL;
+	shared= false;
+	mux_rv= 1;
+	limits_init();
 
 	use_stdio= false;
+#ifndef _WIN32
+	check_uid= false;
+
+	if ( msgio_unix_address(peer) ) {
+		unix_socket(peer, server, backlog);
+		return;
+	} else if ( peer == NULL && msgio_unix_address(port) ) {
+		unix_socket(port, true, backlog);
+		return;
+	}
+#endif
 #ifdef _WIN32
 	rv = WSAStartup(MAKEWORD(2, 2), &wsa);
 	if (rv != 0) {
@@ -90,7 +189,7 @@ MsgIO::MsgIO(const char *peer, const char *port)
 	memset(&hints, 0, sizeof(hints));
 	hints.ai_family = AF_UNSPEC;
 	hints.ai_socktype = SOCK_STREAM;
-	if (peer == NULL) hints.ai_flags = AI_PASSIVE; // Server here
+	if (server) hints.ai_flags = AI_PASSIVE; // Server here
 	hints.ai_protocol = IPPROTO_TCP;
 
 	rv= getaddrinfo(peer, port, &hints, &addrs);
@@ -109,7 +208,7 @@ MsgIO::MsgIO(const char *peer, const char *port)
 			continue;
 		}
 
-		if ( peer == NULL ) { 	// We're the server
+		if ( server ) { 	// We're the server
 			int enable = 1;			
 
 			setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (char *)&enable, sizeof(enable));
@@ -140,7 +239,7 @@ MsgIO::MsgIO(const char *peer, const char *port)
 	freeaddrinfo(addrs);
 
 	if ( s == INVALID_SOCKET ) {
-		if ( peer == NULL ) {
+		if ( server ) {
 #ifdef _WIN32
 			eprintf("bind: failed on error %ld\n", WSAGetLastError());
 #else
@@ -157,12 +256,14 @@ MsgIO::MsgIO(const char *peer, const char *port)
 		throw std::runtime_error("could not establish socket");
 	}
 
-	if ( peer == NULL ) {	// Server here. Create our listening socket.
-		int enable= 1;
+	if ( server ) {	// Server here. Create our listening socket.
+#ifdef TCP_DEFER_ACCEPT
+		int defer= MSGIO_DEFER_ACCEPT;
+#endif
 		ls= s;				// Use 'ls' to refer to the listening socket
 		s = INVALID_SOCKET;	// and 's' as the session socket.
 
-		if ( listen(ls, 5) == -1 ) { // The "traditional" backlog value in UNIX
+		if ( listen(ls, backlog) == -1 ) {
 			perror("listen");
 #ifdef _WIN32
 			closesocket(ls);
@@ -171,17 +272,185 @@ MsgIO::MsgIO(const char *peer, const char *port)
 #endif
 			throw std::runtime_error("could not listen on socket");
 		}
-		
-		// We have a very simple server: it will block until we get a 
-		// connection.
+
+#ifdef TCP_DEFER_ACCEPT
+		setsockopt(ls, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer, sizeof(defer));
+#endif
 
 		eprintf("Listening for connections on port %s\n", port);
 	} else { // Client here
+		set_nodelay(s);
+	}
+}
+
+/* Wrap a connection we accepted */
+
+MsgIO::MsgIO(SOCKET cs)
+{
+	use_stdio= false;
+	s= cs;
+	ls= -1;
+	muxed= -1;
+	stream= 0;
+	conn= NULL;
+	shared= false;
+	mux_rv= 1;
+	limits_init();
+#ifndef _WIN32
+	check_uid= false;
+#endif
+}
+
+/* One stream of a multiplexed connection (see open_stream()) */
+
+MsgIO::MsgIO(MsgIO *parent, uint32_t id)
+{
+	use_stdio= false;
+	s= ls= -1;
+	muxed= 1;
+	stream= id;
+	conn= parent;
+	shared= false;
+	mux_rv= 1;
+	limits_init();
+#ifndef _WIN32
+	check_uid= false;
+#endif
+}
+
+#ifndef _WIN32
+void MsgIO::unix_socket(const char *addr, bool server, int backlog)
+{
+	struct sockaddr_un sun;
+	socklen_t slen;
+	const char *path;
+	int type;
+
+	if ( strncmp(addr, "unixpacket:", 11) == 0 ) {
+		type= SOCK_SEQPACKET;
+		path= &addr[11];
+	} else {
+		type= SOCK_STREAM;
+		path= &addr[5];
+	}
+
+	if ( path[0] == '\0' || strlen(path) >= sizeof(sun.sun_path) ) {
+		eprintf("%s: bad socket path\n", addr);
+		throw std::runtime_error("bad socket path");
+	}
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family= AF_UNIX;
+	strncpy(sun.sun_path, path, sizeof(sun.sun_path)-1);
+	slen= (socklen_t) (offsetof(struct sockaddr_un, sun_path)+strlen(path));
+	if ( path[0] == '@' ) sun.sun_path[0]= '\0';	// Abstract namespace
+	else ++slen;
+
+	s= socket(AF_UNIX, type, 0);
+	if ( s == -1 ) {
+		perror("socket");
+		throw std::runtime_error("could not create socket");
+	}
+
+	if ( ! server ) {
+		if ( connect(s, (sockaddr *) &sun, slen) == -1 ) {
+			eprintf("%s: ", addr);
+			perror("connect");
+			close(s);
+			s= -1;
+			throw std::runtime_error("could not establish socket");
+		}
+		return;
+	}
+
+	/* Clear out a socket left behind by an earlier server */
+
+	if ( path[0] != '@' ) {
+		struct stat sb;
+
+		if ( stat(path, &sb) == 0 && S_ISSOCK(sb.st_mode) ) unlink(path);
+	}
+
+	if ( bind(s, (sockaddr *) &sun, slen) == -1 ) {
+		eprintf("%s: ", addr);
+		perror("bind");
+		close(s);
+		s= -1;
+		throw std::runtime_error("could not establish socket");
+	}
+
+	ls= s;
+	s= -1;
+
+	if ( listen(ls, backlog) == -1 ) {
+		perror("listen");
+		close(ls);
+		ls= -1;
+		throw std::runtime_error("could not listen on socket");
+	}
+
+	eprintf("Listening for connections on %s\n", addr);
+}
+
+/*
+ * Only accept connections from processes running as uid. The peer's
+ * credentials come from the kernel, so this only works for Unix domain
+ * sockets and other connections are refused.
+ */
+
+void MsgIO::require_peer_uid(uid_t uid)
+{
+	check_uid= true;
+	allow_uid= uid;
+}
+
+bool MsgIO::peer_allowed(SOCKET cs)
+{
+# ifdef SO_PEERCRED
+	struct ucred cred;
+	socklen_t len= sizeof(cred);
+# else
+	uid_t uid;
+	gid_t gid;
+# endif
+
+	if ( ! check_uid ) return true;
+
+# ifdef SO_PEERCRED
+	if ( getsockopt(cs, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1 ) {
+		perror("getsockopt: SO_PEERCRED");
+		return false;
 	}
+	if ( cred.uid == allow_uid ) return true;
+
+	eprintf("Refusing connection from uid %u (pid %d)\n",
+		(unsigned int) cred.uid, (int) cred.pid);
+# else
+	if ( getpeereid(cs, &uid, &gid) == -1 ) {
+		perror("getpeereid");
+		return false;
+	}
+	if ( uid == allow_uid ) return true;
+
+	eprintf("Refusing connection from uid %u\n", (unsigned int) uid);
+# endif
+
+	return false;
 }
+#endif
 
 MsgIO::~MsgIO()
 {
+	if ( conn ) {
+		lock_guard<mutex> lock(conn->mux_lock);
+
+		conn->drop_stream(stream);
+		conn->claimed.erase(stream);
+		return;
+	}
+
+	mux_reset();
+
 	// Shutdown our socket(s)
 	if ( s != -1 ) {
 #ifdef _WIN32
@@ -204,41 +473,182 @@ MsgIO::~MsgIO()
 	}
 }
 
+/*
+ * Give up on reads and writes that block for longer than msec
+ * milliseconds (0 waits forever). A timed out read or write fails
+ * as a system error.
+ */
 
-int MsgIO::server_loop ()
+int MsgIO::set_timeout(unsigned int msec)
 {
-	int proto;
-	struct sockaddr_in6 cliaddr; // Large enough for an IP4 or IP6 peer
-	socklen_t slen = sizeof(struct sockaddr_in6);
+#ifdef _WIN32
+	DWORD tv= msec;
+#else
+	struct timeval tv;
+
+	tv.tv_sec= msec/1000;
+	tv.tv_usec= (msec%1000)*1000;
+#endif
 
 	if ( use_stdio ) return 1;
 
-	// This will block until we get a client.
+	if ( setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (char *) &tv,
+		sizeof(tv)) == -1 || setsockopt(s, SOL_SOCKET, SO_SNDTIMEO,
+		(char *) &tv, sizeof(tv)) == -1 ) {
+		perror("setsockopt");
+		return 0;
+	}
 
-	printf("Waiting for a client to connect...\n");
-	fflush(stdout);
+	return 1;
+}
+
+void MsgIO::limits_init()
+{
+	has_deadline= false;
+	deadline_ms= 0;
+	write_timeout= 0;
+	max_line= 0;
+	rscan= 0;
+	wfailed= false;
+}
+
+/*
+ * Reads must finish within msec milliseconds from now (0 clears the
+ * deadline). Unlike set_timeout() this bounds the whole message and
+ * not each recv(), so a peer can't hold us by trickling in a byte at
+ * a time. A read that misses the deadline fails as a system error.
+ * A connection isn't idle while other threads are serving its streams
+ * (see open_stream()), so its deadline starts over until they finish.
+ */
+
+void MsgIO::set_deadline(unsigned int msec)
+{
+	deadline_ms= msec;
+	has_deadline= ( msec != 0 );
+	if ( has_deadline ) deadline= chrono::steady_clock::now()+
+		chrono::milliseconds(msec);
+}
+
+/* Each message we write has msec milliseconds to go out (0 waits forever) */
+
+void MsgIO::set_write_timeout(unsigned int msec)
+{
+	write_timeout= msec;
+}
+
+/*
+ * Refuse incoming messages larger than sz bytes (0 for no limit). An
+ * oversized message is a protocol error, and we stop buffering it as
+ * soon as we can tell. There's room for a stream header on top of sz.
+ * For a stream's MsgIO the limit only applies to that stream, and the
+ * connection has to allow messages that large as well.
+ */
+
+void MsgIO::set_max_message(size_t sz)
+{
+	max_line= ( sz ) ? 2*(sz+sizeof(ra_stream_header_t))+1 : 0;
+}
+
+/*
+ * Wait until the socket is readable (or writable, with wr set). Returns
+ * 1 when it is, 0 if until passes first, and -1 on an error.
+ */
+
+int MsgIO::wait_ready(bool wr, chrono::steady_clock::time_point until)
+{
+	struct pollfd pfd;
+	long long msec;
+	int rv;
+
+	pfd.fd= s;
+	pfd.events= ( wr ) ? POLLOUT : POLLIN;
+
+	while (1) {
+		msec= chrono::duration_cast<chrono::milliseconds>(until-
+			chrono::steady_clock::now()).count();
+		if ( msec <= 0 ) return 0;
 
-	s = accept(ls, (sockaddr *) &cliaddr, &slen);
-	if (s == INVALID_SOCKET) {
 #ifdef _WIN32
-		closesocket(ls);
-		eprintf("accept: %d\n", WSAGetLastError());
+		rv= WSAPoll(&pfd, 1, (int) msec);
 #else
-		close(ls);
-		perror("accept");
+		rv= poll(&pfd, 1, (int) msec);
 #endif
+		if ( rv == -1 ) {
+			if ( errno == EINTR ) continue;
+			perror("poll");
+			return -1;
+		}
+		/* Errors and hangups show up in the recv() or send() */
+		if ( rv ) return 1;
+	}
+}
+
+/*
+ * A send failed. Returns 1 if it should be tried again, because it was
+ * interrupted or the socket has room before the write deadline, and 0
+ * if we should give up.
+ */
+
+int MsgIO::write_failed(const char *what,
+	chrono::steady_clock::time_point until)
+{
+	if ( errno == EINTR ) return 1;
+
+	if ( write_timeout && (errno == EAGAIN || errno == EWOULDBLOCK) ) {
+		switch (wait_ready(true, until)) {
+		case 1:
+			return 1;
+		case 0:
+			eprintf("timed out writing to peer\n");
+		}
 		return 0;
 	}
 
-	proto = cliaddr.sin6_family;
+	perror(what);
+	return 0;
+}
 
-	eprintf("Connection from ");
+/*
+ * Accept a connection. Accepted sockets aren't inherited across exec,
+ * and TCP ones have Nagle turned off.
+ */
+
+static SOCKET accept_conn(SOCKET ls, struct sockaddr_in6 *cliaddr,
+	socklen_t *slen)
+{
+	SOCKET cs;
+
+#if defined(__linux__) && defined(SOCK_CLOEXEC)
+	cs = accept4(ls, (sockaddr *) cliaddr, slen, SOCK_CLOEXEC);
+#else
+	cs = accept(ls, (sockaddr *) cliaddr, slen);
+#endif
+	if ( cs == INVALID_SOCKET ) return cs;
+
+#if !defined(_WIN32) && !defined(__linux__)
+	/* Some systems pass on a non-blocking listener's O_NONBLOCK */
+	fcntl(cs, F_SETFL, fcntl(cs, F_GETFL) & ~O_NONBLOCK);
+#endif
+
+	if ( cliaddr->sin6_family == AF_INET || cliaddr->sin6_family == AF_INET6 )
+		set_nodelay(cs);
+
+	return cs;
+}
+
+/* Log where a client connected from */
 
-	// A client has connected.
+static void print_client(struct sockaddr_in6 *cliaddr)
+{
+	int proto = cliaddr->sin6_family;
+
+	if ( ! verbose ) return;
+
+	eprintf("Connection from ");
 
 	if ( proto == AF_INET ) {
 		char clihost[INET_ADDRSTRLEN];		
-		sockaddr_in *sa = (sockaddr_in *) &cliaddr;
+		sockaddr_in *sa = (sockaddr_in *) cliaddr;
 
 		memset(clihost, 0, sizeof(clihost));
 
@@ -252,21 +662,140 @@ int MsgIO::server_loop ()
 
 		memset(clihost, 0, sizeof(clihost));
 
-		if ( inet_ntop(proto, &cliaddr.sin6_addr, clihost,
+		if ( inet_ntop(proto, &cliaddr->sin6_addr, clihost,
 		sizeof(clihost)) != NULL ) {
 
 			eprintf("%s", clihost);
 		} else eprintf("(could not translate network address)");
+	} else if ( proto == AF_UNIX ) {
+		eprintf("a local process");
 	}
 	eprintf("\n");
+}
+
+int MsgIO::server_loop ()
+{
+	struct sockaddr_in6 cliaddr; // Large enough for an IP4 or IP6 peer
+	socklen_t slen = sizeof(struct sockaddr_in6);
+
+	if ( use_stdio ) return 1;
+
+	// This will block until we get a client.
+
+	printf("Waiting for a client to connect...\n");
+	fflush(stdout);
+
+	while (1) {
+		slen = sizeof(struct sockaddr_in6);
+		s = accept_conn(ls, &cliaddr, &slen);
+		if (s == INVALID_SOCKET) {
+#ifdef _WIN32
+			closesocket(ls);
+			eprintf("accept: %d\n", WSAGetLastError());
+#else
+			/* A signal, such as sp's SIGHUP for a reload */
+			if ( errno == EINTR ) continue;
+
+			/* Someone else took it (see set_accept_nowait()) */
+			if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+				struct pollfd pfd;
+
+				pfd.fd= ls;
+				pfd.events= POLLIN;
+				poll(&pfd, 1, -1);
+				continue;
+			}
+			close(ls);
+			perror("accept");
+#endif
+			return 0;
+		}
+
+		print_client(&cliaddr);
+
+#ifndef _WIN32
+		if ( ! peer_allowed(s) ) {
+			close(s);
+			s = INVALID_SOCKET;
+			continue;
+		}
+#endif
+
+		return 1;
+	}
+}
+
+/*
+ * Accept a connection on our listening socket and return it as a new
+ * MsgIO, so a server can handle several clients at once. Returns NULL
+ * if accept() fails.
+ */
+
+MsgIO *MsgIO::accept_client ()
+{
+	struct sockaddr_in6 cliaddr; // Large enough for an IP4 or IP6 peer
+	socklen_t slen = sizeof(struct sockaddr_in6);
+	SOCKET cs;
+
+	if ( use_stdio || ls == -1 ) return NULL;
+
+	cs = accept_conn(ls, &cliaddr, &slen);
+	if (cs == INVALID_SOCKET) {
+#ifdef _WIN32
+		eprintf("accept: %d\n", WSAGetLastError());
+#else
+		if ( errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK )
+			perror("accept");
+#endif
+		return NULL;
+	}
+
+	print_client(&cliaddr);
+
+#ifndef _WIN32
+	if ( ! peer_allowed(cs) ) {
+		close(cs);
+		return NULL;
+	}
+#endif
+
+	return new MsgIO(cs);
+}
+
+#ifndef _WIN32
+/*
+ * Let more than one thread accept connections on our listening socket.
+ * accept_client() returns NULL instead of blocking if another thread
+ * got there first, and server_loop() goes back to waiting.
+ */
+
+int MsgIO::set_accept_nowait()
+{
+	int flags;
+
+	if ( use_stdio || ls == -1 ) return 0;
+
+	flags= fcntl(ls, F_GETFL);
+	if ( flags == -1 || fcntl(ls, F_SETFL, flags|O_NONBLOCK) == -1 ) {
+		perror("fcntl");
+		return 0;
+	}
 
 	return 1;
 }
+#endif
 
 void MsgIO::disconnect ()
 {
 	if ( use_stdio ) return;
 
+	mux_reset();
+	rbuffer.clear();
+	wbuffer.clear();
+	has_deadline= false;
+	rscan= 0;
+	wfailed= false;
+
 	if ( s != -1 ) {
 #ifdef _WIN32
 		shutdown(s, 2);
@@ -275,104 +804,441 @@ void MsgIO::disconnect ()
 		shutdown(s, SHUT_RDWR);
 		close(s);
 #endif
+		s= -1;
 	}
 }
 
+/*
+ * Read a message. On a multiplexed connection this is the next message
+ * on the current stream (see set_stream()), and 0 is returned once
+ * the peer closes the stream.
+ */
+
 int MsgIO::read(void **dest, size_t *sz)
+{
+	uint32_t id= stream;
+	int rv;
+
+	if ( conn ) return conn->stream_read(this, dest, sz);
+
+	if ( ! stream ) {
+		if ( muxed == -1 ) muxed= 0;
+		return read_line(dest, sz);
+	}
+
+	rv= take_frame(&id, dest, sz);
+	if ( rv == 1 && *dest == NULL ) return 0;
+
+	return rv;
+}
+
+/* Read one line from the connection, whatever it carries */
+
+int MsgIO::read_line(void **dest, size_t *sz)
 {
 	ssize_t bread= 0;
-	bool repeat= true;
-	int ws;
 
 	if (use_stdio) return read_msg(dest, sz);
 
+	/* Whatever the peer sends now can't be an answer to what we sent */
+	if ( wfailed ) return -1;
+
 	/* 
 	 * We don't know how many bytes are coming, so read until we find a
-	 * newline.
+	 * newline. The peer may have sent more than one message, so check
+	 * what we already have before reading from the socket again.
 	 */
 
 	if ( sz ) *sz= 0;
 
-	while (repeat) {
-again:
-		bread= recv(s, lbuffer, sizeof(lbuffer), 0);
-		if ( bread == -1 ) {
-			if ( errno == EINTR ) goto again;
-			perror("recv");
-			return -1;
-		}
-		if ( bread > 0 ) {
-			size_t idx;
+	while (1) {
+		size_t idx, len;
+		int ws;
 
-			if ( debug ) eprintf("+++ read %ld bytes from socket\n", bread);
-			rbuffer.append(lbuffer, bread);
-			idx= rbuffer.find("\r\n");
-			if ( idx == string::npos ) {
-				idx= rbuffer.find('\n');
-				if ( idx == string::npos ) continue;
-				ws= 1;
-			} else ws= 2;
-
-			if ( idx == 0 ) return 1;
-			else if ( idx %2 ) {
-				eprintf("read odd byte count %zu\n", idx);
+		idx= rbuffer.find('\n', rscan);
+		if ( idx == string::npos ) {
+			rscan= rbuffer.length();
+			if ( max_line && rscan > max_line ) {
+				eprintf("message too large\n");
 				return 0;
 			}
-			if ( sz != NULL ) *sz= idx;
 
-			*dest= (char *) malloc(idx/2);
-			if ( *dest == NULL ) {
-				perror("malloc");
+			/* Don't leave stream credits unsent while we wait */
+			if ( muxed == 1 && wbuffer.length() && flush() == -1 )
+				return -1;
+			/*
+			 * Threads serving our streams carry on while we wait.
+			 * Only this thread reads from the socket.
+			 */
+			if ( shared ) mux_lock.unlock();
+			bread= recv_some();
+			if ( shared ) mux_lock.lock();
+
+			if ( bread == -2 ) {
+				if ( ! claimed.empty() ) {
+					set_deadline(deadline_ms);
+					continue;
+				}
+				eprintf("timed out waiting for peer\n");
 				return -1;
 			}
+			if ( bread == -1 ) return -1;
+			if ( bread == 0 ) return 0;
 
-			if (debug) {
-				edividerWithText("read buffer");
-				fwrite(rbuffer.c_str(), 1, idx, stdout);
-				printf("\n");
-				edivider();
-			}
+			if ( debug ) eprintf("+++ read %ld bytes from socket\n", bread);
+			rbuffer.append(lbuffer, bread);
+			continue;
+		}
+
+		rscan= 0;
+		if ( max_line && idx > max_line ) {
+			eprintf("message too large\n");
+			return 0;
+		}
 
-			from_hexstring((unsigned char *) *dest, rbuffer.c_str(), idx/2);
-			rbuffer.erase(0, idx+ws);
+		if ( idx > 0 && rbuffer[idx-1] == '\r' ) {
+			len= idx-1;
+			ws= 2;
+		} else {
+			len= idx;
+			ws= 1;
+		}
 
-			return 1;
-		} else return 0;
+		if ( len == 0 ) {	/* Skip blank lines */
+			rbuffer.erase(0, ws);
+			continue;
+		} else if ( len %2 ) {
+			eprintf("read odd byte count %zu\n", len);
+			return 0;
+		}
+		if ( sz != NULL ) *sz= len;
+
+		*dest= (char *) malloc(len/2);
+		if ( *dest == NULL ) {
+			perror("malloc");
+			return -1;
+		}
+
+		if (debug) {
+			edividerWithText("read buffer");
+			fwrite(rbuffer.c_str(), 1, len, stdout);
+			printf("\n");
+			edivider();
+		}
+
+		from_hexstring((unsigned char *) *dest, rbuffer.c_str(), len/2);
+		rbuffer.erase(0, len+ws);
+
+		return 1;
 	}
-	
-	return -1;
 }
 
-void MsgIO::send(void *src, size_t sz)
+/*
+ * Wait for data (until the read deadline, if there is one) and read
+ * what's there into lbuffer. Returns the number of bytes read, 0 at
+ * EOF, -1 on an error, and -2 if the deadline passed.
+ */
+
+int MsgIO::recv_some()
 {
+	ssize_t bread;
+
+again:
+	if ( has_deadline ) {
+		int rv= wait_ready(false, deadline);
+
+		if ( rv != 1 ) return ( rv == 0 ) ? -2 : -1;
+	}
+#ifdef _WIN32
+	bread= recv(s, lbuffer, sizeof(lbuffer), 0);
+#else
+	/*
+	 * On a SOCK_SEQPACKET socket, whatever of a packet doesn't fit in
+	 * the buffer is thrown away, so check for that rather than lose
+	 * the rest of the message.
+	 */
+	{
+		struct iovec rvec;
+		struct msghdr mh;
+
+		rvec.iov_base= lbuffer;
+		rvec.iov_len= sizeof(lbuffer);
+		memset(&mh, 0, sizeof(mh));
+		mh.msg_iov= &rvec;
+		mh.msg_iovlen= 1;
+		bread= recvmsg(s, &mh, 0);
+		if ( bread > 0 && (mh.msg_flags & MSG_TRUNC) ) {
+			eprintf("message truncated by the socket\n");
+			return -1;
+		}
+	}
+#endif
+	if ( bread == -1 ) {
+		if ( errno == EINTR ) goto again;
+		perror("recv");
+		return -1;
+	}
+
+	return (int) bread;
+}
+
+int MsgIO::send(void *src, size_t sz)
+{
+	msgio_iov_t iov;
+
+	iov.base= src;
+	iov.len= sz;
+
+	return sendv(&iov, 1);
+}
+
+/*
+ * Send a message made up of several fragments, along with anything
+ * queued by send_partial(). Each fragment is hex encoded into its own
+ * segment and the lot goes out with a single sendmsg() instead of
+ * being copied into one buffer first.
+ *
+ * Returns 1 on success and -1 if the message couldn't be sent. Once a
+ * write has failed partway through a message, the peer can't find the
+ * start of the next one, so every later send and read fails too until
+ * the connection is closed with disconnect().
+ */
+
+int MsgIO::sendv(const msgio_iov_t *iov, int iovcnt)
+{
+#ifndef _WIN32
+	struct iovec vec[MSGIO_IOV_MAX+2], *vp;
+	struct msghdr mh;
+	chrono::steady_clock::time_point until;
 	ssize_t bsent;
-	size_t len;
+	int n= 0, flags= MSG_NOSIGNAL;
+#endif
+	int i, rv;
 
 	if (use_stdio) {
-		send_msg(src, sz);
-		return;
+		for (i= 0; i< iovcnt; ++i)
+			send_msg_partial((void *) iov[i].base, iov[i].len);
+		send_msg(NULL, 0);
+		return 1;
 	}
 
-	wbuffer.append(hexstring(src, sz));
-	wbuffer.append("\n");
+	if ( conn ) return conn->stream_sendv(this, iov, iovcnt);
+
+	if ( wfailed ) return -1;
+
+	if ( stream ) {
+		for (i= 0; i< iovcnt; ++i) hex_append(mbuffer, iov[i].base, iov[i].len);
+		rv= send_frame(stream, RA_STREAM_DATA,
+			(uint32_t) mbuffer.length()/2, mbuffer);
+		mbuffer.clear();
+		if ( rv != 1 ) return -1;
+	}
+
+#ifndef _WIN32
+	if ( stream == 0 && iovcnt <= MSGIO_IOV_MAX ) {
+		if ( wsegs.size() < (size_t) iovcnt ) wsegs.resize(iovcnt);
+
+		if ( wbuffer.length() ) {
+			vec[n].iov_base= (void *) wbuffer.data();
+			vec[n++].iov_len= wbuffer.length();
+		}
+		for (i= 0; i< iovcnt; ++i) {
+			wsegs[i].clear();
+			hex_append(wsegs[i], iov[i].base, iov[i].len);
+			vec[n].iov_base= (void *) wsegs[i].data();
+			vec[n++].iov_len= wsegs[i].length();
+		}
+		vec[n].iov_base= (void *) "\n";
+		vec[n++].iov_len= 1;
+
+		if (debug) {
+			edividerWithText("write buffer");
+			for (i= 0; i< n; ++i)
+				fwrite(vec[i].iov_base, 1, vec[i].iov_len, stdout);
+			edivider();
+		}
+
+		if ( write_timeout ) {
+			until= chrono::steady_clock::now()+
+				chrono::milliseconds(write_timeout);
+			flags|= MSG_DONTWAIT;
+		}
+
+		/* Pick up where a short write left off */
+
+		memset(&mh, 0, sizeof(mh));
+		vp= vec;
+		while ( n ) {
+			mh.msg_iov= vp;
+			mh.msg_iovlen= n;
+			bsent= sendmsg(s, &mh, flags);
+			if ( bsent == -1 ) {
+				if ( write_failed("sendmsg", until) ) continue;
+				write_lost();
+				return -1;
+			}
+			while ( n && (size_t) bsent >= vp->iov_len ) {
+				bsent-= vp->iov_len;
+				++vp;
+				--n;
+			}
+			if ( n ) {
+				vp->iov_base= (char *) vp->iov_base + bsent;
+				vp->iov_len-= bsent;
+			}
+		}
+
+		wbuffer.clear();
+		return 1;
+	}
+#endif
+
+	if ( stream == 0 ) {
+		for (i= 0; i< iovcnt; ++i) hex_append(wbuffer, iov[i].base, iov[i].len);
+		wbuffer.append("\n");
+	}
+	if (debug) {
+		edividerWithText("write buffer");
+		fwrite(wbuffer.c_str(), 1, wbuffer.length(), stdout);
+		edivider();
+	}
+
+	return flush();
+}
+
+/*
+ * Write out everything we've queued up with send_partial() and friends.
+ * Unlike send(), this doesn't echo the data to stdout, which matters
+ * when moving a lot of records. Returns 1 on success and -1 on a
+ * failure, as sendv() does.
+ */
+
+int MsgIO::flush()
+{
+	chrono::steady_clock::time_point until;
+	ssize_t bsent;
+	size_t len;
+	int flags= MSG_NOSIGNAL;
+
+	if (use_stdio) return 1;
+
+	if ( conn ) {
+		lock_guard<mutex> lock(conn->mux_lock);
+
+		return conn->flush();
+	}
+
+	if ( wfailed ) {
+		wbuffer.clear();
+		return -1;
+	}
+
+	if ( write_timeout ) {
+		until= chrono::steady_clock::now()+
+			chrono::milliseconds(write_timeout);
+		flags|= MSG_DONTWAIT;
+	}
 
 	while ( len= wbuffer.length() ) {
-again:
-		bsent= ::send(s, wbuffer.c_str(), (int) len, 0);
+		bsent= ::send(s, wbuffer.c_str(), (int) len, flags);
 		if ( bsent == -1 ) {
-			if (errno == EINTR) goto again;
-			perror("send");
-			return;
+			if ( write_failed("send", until) ) continue;
+			write_lost();
+			return -1;
 		}
-		fwrite(wbuffer.c_str(), 1, bsent, stdout);
-
 		if ( bsent == len ) {
 			wbuffer.clear();
-			return;
+			return 1;
 		}
 		
 		wbuffer.erase(0, bsent);
 	}
+
+	return 1;
+}
+
+/*
+ * A write failed partway through a message, so the peer has lost the
+ * framing. If other threads are serving our streams, stop reading as
+ * well, so the thread waiting on the socket finds out.
+ */
+
+void MsgIO::write_lost()
+{
+	wbuffer.clear();
+	wfailed= true;
+
+	if ( shared ) {
+#ifdef _WIN32
+		shutdown(s, SD_RECEIVE);
+#else
+		shutdown(s, SHUT_RD);
+#endif
+	}
+}
+
+/*
+ * Secure channel records (see protocol.h). A record is sent as a
+ * single message: the header followed by the ciphertext. Set flush_now
+ * to false to queue up several records and send them with one write.
+ */
+
+int MsgIO::send_record(ra_record_header_t *hdr, void *payload, bool flush_now)
+{
+	if (use_stdio) {
+		send_msg_partial(hdr, sizeof(ra_record_header_t));
+		send_msg(payload, hdr->len);
+		return 1;
+	}
+
+	if ( conn ) return conn->stream_record(this, hdr, payload, flush_now);
+
+	if ( wfailed ) return -1;
+
+	if ( stream ) {
+		string frame;
+
+		hex_append(frame, hdr, sizeof(ra_record_header_t));
+		hex_append(frame, payload, hdr->len);
+		if ( send_frame(stream, RA_STREAM_DATA,
+			(uint32_t) sizeof(ra_record_header_t)+hdr->len, frame) != 1 )
+			return -1;
+	} else {
+		hex_append(wbuffer, hdr, sizeof(ra_record_header_t));
+		hex_append(wbuffer, payload, hdr->len);
+		wbuffer.append("\n");
+	}
+
+	return ( flush_now ) ? flush() : 1;
+}
+
+/*
+ * Read a record. The ciphertext immediately follows the header in the
+ * returned buffer. Returns 1 on success, 0 on a protocol error, and -1
+ * on a system error.
+ */
+
+int MsgIO::read_record(ra_record_header_t **rec)
+{
+	size_t sz;
+	int rv;
+
+	rv= read((void **) rec, &sz);
+	if ( rv != 1 ) return rv;
+
+	sz/= 2;
+	if ( sz < sizeof(ra_record_header_t) ||
+		(*rec)->type != RA_MSG_TYPE_RECORD ||
+		(*rec)->len > RA_RECORD_MAX_LEN ||
+		sz != sizeof(ra_record_header_t) + (*rec)->len ) {
+
+		eprintf("malformed record\n");
+		free(*rec);
+		*rec= NULL;
+		return 0;
+	}
+
+	return 1;
 }
 
 void MsgIO::send_partial(void *src, size_t sz)
@@ -382,7 +1248,442 @@ void MsgIO::send_partial(void *src, size_t sz)
 		return;
 	}
 
-	wbuffer.append(hexstring(src, sz));
+	if ( stream ) hex_append(mbuffer, src, sz);
+	else hex_append(wbuffer, src, sz);
+}
+
+/*
+ * Stream multiplexing (see protocol.h). Streams aren't supported over
+ * stdio.
+ */
+
+static msgio_stream_t stream_init()
+{
+	msgio_stream_t st;
+
+	st.queued= 0;
+	st.credit= RA_STREAM_WINDOW;
+	st.closed= false;
+
+	return st;
+}
+
+/*
+ * Send and read messages on the given stream from now on, which makes
+ * this a multiplexed connection. Stream 0 is the connection itself.
+ */
+
+void MsgIO::set_stream(uint32_t id)
+{
+	if ( use_stdio ) return;
+
+	mbuffer.clear();
+	stream= id;
+	if ( id ) muxed= 1;
+}
+
+/*
+ * Read the next message on any stream. A connection becomes
+ * multiplexed if the first message on it is a stream frame; until
+ * then (and over stdio) this reads plain messages and sets *id to 0.
+ * If the peer closed a stream, *dest is set to NULL.
+ */
+
+int MsgIO::read_stream(uint32_t *id, void **dest, size_t *sz)
+{
+	int rv;
+
+	*id= 0;
+	if ( use_stdio || muxed == 0 ) return read(dest, sz);
+
+	if ( muxed == -1 ) {
+		rv= read_line(dest, sz);
+		if ( rv != 1 ) return rv;
+
+		if ( *sz/2 < sizeof(ra_stream_header_t) ||
+			*(uint32_t *) *dest != RA_MSG_TYPE_STREAM ) {
+
+			muxed= 0;
+			return 1;
+		}
+
+		muxed= 1;
+		rv= demux(*dest, *sz);
+		if ( rv != 1 ) return rv;
+	}
+
+	if ( shared ) {
+		lock_guard<mutex> lock(mux_lock);
+
+		return take_frame(id, dest, sz);
+	}
+
+	return take_frame(id, dest, sz);
+}
+
+/*
+ * Close a stream and drop anything we haven't read from it. Returns -1
+ * if the peer couldn't be told, in which case the whole connection
+ * has to go.
+ */
+
+int MsgIO::close_stream(uint32_t id)
+{
+	if ( conn ) {
+		lock_guard<mutex> lock(conn->mux_lock);
+
+		return conn->drop_stream(stream);
+	}
+
+	if ( shared ) {
+		lock_guard<mutex> lock(mux_lock);
+
+		return drop_stream(id);
+	}
+
+	return drop_stream(id);
+}
+
+int MsgIO::drop_stream(uint32_t id)
+{
+	map<uint32_t, msgio_stream_t>::iterator st= streams.find(id);
+	deque<msgio_frame_t>::iterator it;
+	int rv= 1;
+
+	if ( use_stdio || st == streams.end() ) return ( wfailed ) ? -1 : 1;
+
+	if ( ! st->second.closed ) {
+		send_frame(id, RA_STREAM_CLOSE, 0, "");
+		rv= flush();
+	}
+
+	for (it= mqueue.begin(); it != mqueue.end(); ) {
+		if ( it->stream == id ) {
+			free(it->msg);
+			it= mqueue.erase(it);
+		} else ++it;
+	}
+
+	streams.erase(st);
+	if ( stream == id ) stream= 0;
+
+	return rv;
+}
+
+/*
+ * Claim the next message on stream *id, or on any stream if *id is 0,
+ * reading frames until there is one. Streams that other threads are
+ * serving don't count as any stream. Reading a message gives the
+ * peer credit to send another.
+ */
+
+int MsgIO::take_frame(uint32_t *id, void **dest, size_t *sz)
+{
+	deque<msgio_frame_t>::iterator it;
+	msgio_frame_t frame;
+	int rv;
+
+	while (1) {
+		for (it= mqueue.begin(); it != mqueue.end(); ++it) {
+			if ( it->stream == *id ) break;
+			if ( *id == 0 && claimed.find(it->stream) == claimed.end() )
+				break;
+		}
+		if ( it != mqueue.end() ) break;
+
+		if ( *id && streams.find(*id) == streams.end() ) return 0;
+
+		rv= read_frame();
+		if ( rv != 1 ) return rv;
+	}
+
+	frame= *it;
+	mqueue.erase(it);
+
+	*id= frame.stream;
+	*dest= frame.msg;
+	if ( sz != NULL ) *sz= frame.sz;
+
+	if ( frame.msg == NULL ) {
+		streams.erase(frame.stream);
+		return 1;
+	}
+
+	--streams[frame.stream].queued;
+	if ( ! streams[frame.stream].closed )
+		send_frame(frame.stream, RA_STREAM_CREDIT, 1, "");
+
+	return 1;
+}
+
+int MsgIO::read_frame()
+{
+	void *msg;
+	size_t sz;
+	int rv;
+
+	rv= read_line(&msg, &sz);
+	if ( rv == 1 ) rv= demux(msg, sz);
+
+	/* Wake up the threads serving our streams, even if we've failed */
+	if ( shared ) {
+		if ( rv != 1 ) mux_rv= rv;
+		mux_ready.notify_all();
+	}
+
+	return rv;
+}
+
+/*
+ * Queue a frame we've read for whoever reads its stream, or apply it
+ * if it's a control frame. Takes ownership of msg.
+ */
+
+int MsgIO::demux(void *msg, size_t sz)
+{
+	ra_stream_header_t *hdr= (ra_stream_header_t *) msg;
+	map<uint32_t, msgio_stream_t>::iterator it;
+	msgio_frame_t frame;
+	size_t len;
+
+	sz/= 2;
+	if ( sz < sizeof(ra_stream_header_t) ||
+		hdr->type != RA_MSG_TYPE_STREAM || hdr->stream == 0 ) goto bad;
+
+	len= sz - sizeof(ra_stream_header_t);
+	if ( hdr->flags == RA_STREAM_DATA ) {
+		if ( len == 0 || len != hdr->len ) goto bad;
+	} else if ( hdr->flags == RA_STREAM_CREDIT ||
+		hdr->flags == RA_STREAM_CLOSE ) {
+
+		if ( len ) goto bad;
+	} else goto bad;
+
+	it= streams.find(hdr->stream);
+
+	if ( hdr->flags == RA_STREAM_CREDIT ) {
+		if ( it != streams.end() ) it->second.credit+= hdr->len;
+		free(msg);
+		return 1;
+	}
+
+	if ( hdr->flags == RA_STREAM_CLOSE ) {
+		if ( it != streams.end() && ! it->second.closed ) {
+			it->second.closed= true;
+			frame.stream= hdr->stream;
+			frame.msg= NULL;
+			frame.sz= 0;
+			mqueue.push_back(frame);
+		}
+		free(msg);
+		return 1;
+	}
+
+	if ( it == streams.end() ) {
+		if ( streams.size() >= RA_STREAM_MAX ) {
+			eprintf("stream %u: too many streams\n", hdr->stream);
+			send_frame(hdr->stream, RA_STREAM_CLOSE, 0, "");
+			free(msg);
+			return 1;
+		}
+		it= streams.insert(make_pair(hdr->stream, stream_init())).first;
+	} else if ( it->second.closed ) {
+		free(msg);
+		return 1;
+	}
+
+	if ( it->second.queued >= RA_STREAM_WINDOW ) {
+		eprintf("stream %u: peer ignored flow control\n", hdr->stream);
+		free(msg);
+		return 0;
+	}
+
+	frame.stream= hdr->stream;
+	frame.sz= 2*len;
+	frame.msg= msg;
+	memmove(msg, hdr+1, len);
+
+	++it->second.queued;
+	mqueue.push_back(frame);
+
+	return 1;
+
+bad:
+	eprintf("malformed stream frame\n");
+	free(msg);
+	return 0;
+}
+
+/*
+ * Queue a frame. A data frame has to wait until the peer has given us
+ * credit on its stream, so we may have to read (and queue) frames for
+ * other streams first. If other threads are serving our streams, the
+ * connection's own thread does the reading and we wait for it, for
+ * up to the write timeout. Returns 0 if it never gets any.
+ */
+
+int MsgIO::send_frame(uint32_t id, uint32_t flags, uint32_t len,
+	const string &payload)
+{
+	map<uint32_t, msgio_stream_t>::iterator it;
+	chrono::steady_clock::time_point until;
+	ra_stream_header_t hdr;
+
+	if ( flags == RA_STREAM_DATA ) {
+		it= streams.find(id);
+		if ( it == streams.end() )
+			it= streams.insert(make_pair(id, stream_init())).first;
+
+		until= chrono::steady_clock::now()+
+			chrono::milliseconds(write_timeout);
+		while ( it->second.credit == 0 ) {
+			if ( it->second.closed ) goto nocredit;
+
+			if ( ! shared ) {
+				if ( read_frame() != 1 ) goto nocredit;
+			} else if ( mux_rv != 1 ) goto nocredit;
+			else if ( ! write_timeout ) mux_ready.wait(mux_lock);
+			else if ( mux_ready.wait_until(mux_lock, until) ==
+				cv_status::timeout ) goto nocredit;
+
+			it= streams.find(id);
+			if ( it == streams.end() ) goto nocredit;
+		}
+		--it->second.credit;
+	}
+
+	hdr.type= RA_MSG_TYPE_STREAM;
+	hdr.stream= id;
+	hdr.flags= flags;
+	hdr.len= len;
+
+	hex_append(wbuffer, &hdr, sizeof(ra_stream_header_t));
+	wbuffer.append(payload);
+	wbuffer.append("\n");
+
+	return 1;
+
+nocredit:
+	eprintf("stream %u: can't send without credit\n", id);
+	return 0;
+}
+
+void MsgIO::mux_reset()
+{
+	deque<msgio_frame_t>::iterator it;
+
+	for (it= mqueue.begin(); it != mqueue.end(); ++it) free(it->msg);
+
+	mqueue.clear();
+	streams.clear();
+	mbuffer.clear();
+	stream= 0;
+	muxed= ( use_stdio ) ? 0 : -1;
+	claimed.clear();
+	shared= false;
+	mux_rv= 1;
+}
+
+/*
+ * Serve a stream of a multiplexed connection from another thread. The
+ * returned MsgIO reads and sends on just that stream, and read_stream()
+ * on the connection passes it over. Only the connection's own thread
+ * reads from the socket, so it has to keep calling read_stream() for
+ * the stream to get any messages. Deleting the stream's MsgIO closes
+ * the stream, and that has to happen before the connection is closed.
+ */
+
+MsgIO *MsgIO::open_stream(uint32_t id)
+{
+	lock_guard<mutex> lock(mux_lock);
+
+	if ( use_stdio || conn || muxed != 1 || id == 0 ) return NULL;
+
+	shared= true;
+	claimed.insert(id);
+
+	return new MsgIO(this, id);
+}
+
+/*
+ * The read(), sendv() and send_record() of a stream's MsgIO. The
+ * stream has its own read deadline and message limit, while writes go
+ * out under the connection's write timeout.
+ */
+
+int MsgIO::stream_read(MsgIO *view, void **dest, size_t *sz)
+{
+	unique_lock<mutex> lock(mux_lock);
+	deque<msgio_frame_t>::iterator it;
+	uint32_t id= view->stream;
+	size_t len;
+	int rv;
+
+	while (1) {
+		for (it= mqueue.begin(); it != mqueue.end(); ++it) {
+			if ( it->stream == id ) break;
+		}
+		if ( it != mqueue.end() ) break;
+
+		if ( streams.find(id) == streams.end() ) return 0;
+		if ( mux_rv != 1 ) return mux_rv;
+
+		if ( ! view->has_deadline ) mux_ready.wait(lock);
+		else if ( mux_ready.wait_until(lock, view->deadline) ==
+			cv_status::timeout ) {
+
+			eprintf("stream %u: timed out waiting for peer\n", id);
+			return -1;
+		}
+	}
+
+	len= it->sz;
+	rv= take_frame(&id, dest, sz);
+	if ( rv != 1 ) return rv;
+	if ( *dest == NULL ) return 0;
+
+	if ( view->max_line && 2*sizeof(ra_stream_header_t)+len > view->max_line ) {
+		eprintf("stream %u: message too large\n", id);
+		free(*dest);
+		*dest= NULL;
+		return 0;
+	}
+
+	/* The reader may be blocked on the socket, so send the credit now */
+	if ( flush() == -1 ) {
+		free(*dest);
+		*dest= NULL;
+		return -1;
+	}
+
+	return 1;
+}
+
+int MsgIO::stream_sendv(MsgIO *view, const msgio_iov_t *iov, int iovcnt)
+{
+	lock_guard<mutex> lock(mux_lock);
+	int rv;
+
+	mbuffer.swap(view->mbuffer);
+	stream= view->stream;
+	rv= sendv(iov, iovcnt);
+	stream= 0;
+	view->mbuffer.clear();
+
+	return rv;
+}
+
+int MsgIO::stream_record(MsgIO *view, ra_record_header_t *hdr,
+	void *payload, bool flush_now)
+{
+	lock_guard<mutex> lock(mux_lock);
+	int rv;
+
+	stream= view->stream;
+	rv= send_record(hdr, payload, flush_now);
+	stream= 0;
+
+	return rv;
 }
 
 /*
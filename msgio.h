@@ -29,6 +29,14 @@ in the License.
 #include <WS2tcpip.h>
 #endif
 #include <string>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+#include "protocol.h"
 using namespace std;
 
 #define STRUCT_INCLUDES_PSIZE	0
@@ -39,30 +47,138 @@ using namespace std;
 
 #define DEFAULT_PORT	"7777"		// A C string for getaddrinfo()
 
+/* Pending connections a listening socket will queue */
+#define MSGIO_BACKLOG	128
+
+/* Most fragments one sendv() call can gather */
+#define MSGIO_IOV_MAX	16
+
 #ifndef _WIN32
 typedef int SOCKET;
 #endif
 
+/* One fragment of a message sent with MsgIO::sendv() */
+
+typedef struct msgio_iov_struct {
+	const void *base;
+	size_t len;
+} msgio_iov_t;
+
+/* A message read from a multiplexed connection that hasn't been claimed */
+
+typedef struct msgio_frame_struct {
+	uint32_t stream;
+	void *msg;			/* NULL if the peer closed the stream */
+	size_t sz;
+} msgio_frame_t;
+
+typedef struct msgio_stream_struct {
+	uint32_t queued;	/* messages from the peer we haven't read */
+	uint32_t credit;	/* messages we can still send */
+	bool closed;
+} msgio_stream_t;
+
 class MsgIO {
 	string wbuffer, rbuffer;
+	vector<string> wsegs;
 	char lbuffer[MSGIO_BUFFER_SZ];
 	bool use_stdio;
 	SOCKET ls, s;
+#ifndef _WIN32
+	bool check_uid;
+	uid_t allow_uid;
+#endif
+
+	/* Deadlines and limits (see set_deadline()) */
+	bool has_deadline;
+	chrono::steady_clock::time_point deadline;
+	unsigned int deadline_ms;
+	unsigned int write_timeout;
+	size_t max_line;	/* longest line we'll buffer, in hex chars */
+	size_t rscan;		/* rbuffer bytes already searched for a newline */
+	bool wfailed;		/* a write failed, so the peer has lost framing */
+
+	/* Stream multiplexing (see protocol.h) */
+	int muxed;
+	uint32_t stream;
+	string mbuffer;
+	deque<msgio_frame_t> mqueue;
+	map<uint32_t, msgio_stream_t> streams;
+
+	/* Streams served by other threads (see open_stream()) */
+	MsgIO *conn;		/* for a stream's MsgIO, the connection it's on */
+	bool shared;
+	set<uint32_t> claimed;
+	int mux_rv;			/* why the connection stopped reading, or 1 */
+	mutex mux_lock;
+	condition_variable_any mux_ready;
+
+	MsgIO(SOCKET cs);
+	MsgIO(MsgIO *parent, uint32_t id);
+
+	void limits_init();
+	int wait_ready(bool wr, chrono::steady_clock::time_point until);
+	int write_failed(const char *what,
+		chrono::steady_clock::time_point until);
+	int read_line(void **dest, size_t *sz);
+	int recv_some();
+	void write_lost();
+	int read_frame();
+	int demux(void *msg, size_t sz);
+	int take_frame(uint32_t *id, void **dest, size_t *sz);
+	int send_frame(uint32_t id, uint32_t flags, uint32_t len,
+		const string &payload);
+	int drop_stream(uint32_t id);
+	void mux_reset();
+	int stream_read(MsgIO *view, void **dest, size_t *sz);
+	int stream_sendv(MsgIO *view, const msgio_iov_t *iov, int iovcnt);
+	int stream_record(MsgIO *view, ra_record_header_t *hdr, void *payload,
+		bool flush_now);
+#ifndef _WIN32
+	void unix_socket(const char *addr, bool server, int backlog);
+	bool peer_allowed(SOCKET cs);
+#endif
 
 public:
 	MsgIO();
-	MsgIO(const char *server, const char *port);
+	MsgIO(const char *server, const char *port, bool passive= false,
+		int backlog= MSGIO_BACKLOG);
 	~MsgIO();
 
 	int server_loop();
+	MsgIO *accept_client();
+#ifndef _WIN32
+	int set_accept_nowait();
+	SOCKET listen_socket() { return ls; }
+#endif
 	void disconnect();
+	int set_timeout(unsigned int msec);
+	void set_deadline(unsigned int msec);
+	void set_write_timeout(unsigned int msec);
+	void set_max_message(size_t sz);
+#ifndef _WIN32
+	void require_peer_uid(uid_t uid);
+#endif
 
 	int read(void **dest, size_t *sz);
 
 	void send_partial(void *buf, size_t f_size);
-	void send(void *buf, size_t f_size);
+	int send(void *buf, size_t f_size);
+	int sendv(const msgio_iov_t *iov, int iovcnt);
+	int flush();
+
+	int read_record(ra_record_header_t **rec);
+	int send_record(ra_record_header_t *hdr, void *payload,
+		bool flush_now= true);
+
+	void set_stream(uint32_t id);
+	int read_stream(uint32_t *id, void **dest, size_t *sz);
+	int close_stream(uint32_t id);
+	MsgIO *open_stream(uint32_t id);
 };
 
+bool msgio_unix_address(const char *addr);
+
 #ifdef __cplusplus
 extern "C" {
 #endif
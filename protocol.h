@@ -20,6 +20,7 @@ in the License.
 
 #include <inttypes.h>
 #include <sgx_quote.h>
+#include <sgx_key_exchange.h>
 
 /*
  * Define a structure to be used to transfer the Attestation Status 
@@ -47,5 +48,226 @@ typedef struct _ra_msg4_struct {
 	sgx_platform_info_t platformInfoBlob;
 } ra_msg4_t;
 
+/*
+ * msg4 is sent as status || platformInfoBlob without any structure
+ * padding. A Trusted msg4 is followed by a session ticket.
+ */
+
+#define RA_MSG4_WIRE_SIZE \
+	(sizeof(attestation_status_t)+sizeof(sgx_platform_info_t))
+
+/*
+ * Every message a client opens an exchange with starts with a 32-bit
+ * word. For msg0||msg1 that word is the extended EPID group ID, which
+ * must be zero, so the service provider has always rejected anything
+ * else. Nonzero values are used to tag our own protocol extensions,
+ * which are only accepted on a connection that has already completed
+ * remote attestation.
+ */
+
+#define RA_MSG_TYPE_MSG01	0x00000000
+#define RA_MSG_TYPE_PROOF	0x80000001
+#define RA_MSG_TYPE_RESUME	0x80000002
+#define RA_MSG_TYPE_CHANNEL	0x80000003
+#define RA_MSG_TYPE_RECORD	0x80000004
+#define RA_MSG_TYPE_STREAM	0x80000005
+#define RA_MSG_TYPE_BUSY	0x80000006
+
+typedef struct _ra_msg01_struct {
+	uint32_t msg0_extended_epid_group_id;
+	sgx_ra_msg1_t msg1;
+} ra_msg01_t;
+
+/*
+ * An SP that is too busy to start another attestation answers
+ * msg0||msg1 with this instead of msg2, then ends the connection (or
+ * stream). The client should try again after at least retry_after
+ * milliseconds. It can't be mistaken for msg2, which is always longer.
+ */
+
+typedef struct _ra_busy_struct {
+	uint32_t type;
+	uint32_t retry_after;
+} ra_busy_t;
+
+/*
+ * Proof of possession of the session key (SK) negotiated during
+ * remote attestation. Each side challenges the other with a fresh
+ * nonce and the responder proves knowledge of SK with:
+ *
+ *   proof.mac = AES-CMAC(SK, ROLE || challenge || proof.nonce)
+ *
+ * where ROLE is the 32-bit role of the party generating the proof.
+ * Including the role keeps a proof from being reflected back at the
+ * party that issued the challenge.
+ *
+ * The exchange, after a Trusted msg4, is:
+ *
+ *   client -> SP     ra_proof_request_t (client challenge)
+ *   SP     -> client ra_proof_t (SP proof, which carries the SP challenge)
+ *   client -> SP     ra_proof_t (client proof)
+ *   SP     -> client attestation_status_t
+ */
+
+#define RA_PROOF_ROLE_CLIENT	0x01
+#define RA_PROOF_ROLE_SERVER	0x02
+
+typedef struct _ra_proof_request_struct {
+	uint32_t type;
+	sgx_quote_nonce_t challenge;
+} ra_proof_request_t;
+
+typedef struct _ra_proof_struct {
+	sgx_quote_nonce_t nonce;
+	sgx_mac_t mac;
+} ra_proof_t;
+
+/*
+ * Session tickets let a client that has already been attested resume
+ * its session on a new connection without going through msg0-msg4
+ * (and IAS) again.
+ *
+ * The ticket is opaque to the client. The SP encrypts the ticket body
+ * with AES-128-GCM under a key that only it knows. The first 12 bytes
+ * of the ticket ID are the IV and the whole ID is the AAD.
+ */
+
+typedef struct _ra_ticket_body_struct {
+	uint8_t sk[16];
+	uint8_t mk[16];
+	uint64_t expires;			/* seconds since the epoch */
+	sgx_report_body_t report_body;
+} ra_ticket_body_t;
+
+typedef struct _ra_ticket_struct {
+	sgx_quote_nonce_t id;
+	uint8_t body[sizeof(ra_ticket_body_t)];
+	sgx_mac_t tag;
+} ra_ticket_t;
+
+/*
+ * To resume, the client presents the ticket along with a challenge for
+ * the SP. The SP answers with a fresh challenge of its own, and the
+ * client proves possession of the SK sealed in the ticket by answering
+ * it. Finally, the SP replies with the session status and, if Trusted,
+ * its own proof:
+ *
+ *   client -> SP     ra_resume_request_t (ticket, client challenge)
+ *   SP     -> client ra_resume_challenge_t (SP challenge)
+ *   client -> SP     ra_proof_t (client proof)
+ *   SP     -> client ra_resume_response_t (status, SP proof)
+ *
+ * Since every attempt answers a new challenge, a captured exchange
+ * can't be replayed. If the ticket is forged, expired or no longer
+ * passes the SP's policy, the SP skips its challenge and sends a
+ * ra_resume_response_t with a status other than Trusted.
+ */
+
+typedef struct _ra_resume_request_struct {
+	uint32_t type;
+	ra_ticket_t ticket;
+	sgx_quote_nonce_t challenge;
+} ra_resume_request_t;
+
+typedef struct _ra_resume_challenge_struct {
+	sgx_quote_nonce_t challenge;
+} ra_resume_challenge_t;
+
+typedef struct _ra_resume_response_struct {
+	attestation_status_t status;
+	ra_proof_t proof;
+} ra_resume_response_t;
+
+/*
+ * Secure channel. Application data on an attested connection is sent
+ * as AES-128-GCM records under a record key (RK) that is unique to the
+ * connection, since the same SK can be used on many connections once
+ * sessions are resumed. The channel is opened with one round trip:
+ *
+ *   client -> SP     ra_channel_request_t (client nonce Nc)
+ *   SP     -> client sgx_quote_nonce_t (SP nonce Ns)
+ *
+ *   RK = AES-CMAC(SK, 0x01 || "RK" || Nc || Ns)
+ *
+ * Each record is a header followed by len bytes of ciphertext:
+ *
+ *   IV  = sender role (32 bits) || seq (64 bits)
+ *   AAD = type || len || seq
+ *
+ * Each direction has its own sequence number starting at zero, and a
+ * receiver only accepts the next one, so records can't be replayed,
+ * dropped or reordered without being detected.
+ */
+
+#define RA_RECORD_MAX_LEN	16384
+#define RA_RECORD_AAD_SIZE	16
+
+typedef struct _ra_channel_request_struct {
+	uint32_t type;
+	sgx_quote_nonce_t nonce;
+} ra_channel_request_t;
+
+typedef struct _ra_record_header_struct {
+	uint32_t type;
+	uint32_t len;
+	uint64_t seq;
+	sgx_mac_t tag;
+} ra_record_header_t;
+
+/*
+ * Describes one record in untrusted memory for the scatter-gather
+ * record ECALLs. This never goes on the wire.
+ */
+
+typedef struct _ra_record_iov_struct {
+	ra_record_header_t *hdr;
+	uint8_t *buf;
+	uint32_t len;
+} ra_record_iov_t;
+
+/*
+ * Stream multiplexing. A gateway can run many RA sessions over one
+ * connection by sending every message as a stream frame, and a
+ * connection whose first message is a stream frame is multiplexed
+ * from then on:
+ *
+ *   ra_stream_header_t || message
+ *
+ * where message is exactly what would be sent on a connection of its
+ * own. Streams are opened by the first frame with a new ID (which
+ * can't be zero) and are independent of each other, each with its
+ * own session on the SP. Either side ends a stream with a CLOSE frame.
+ *
+ * Flow control is per stream and counted in messages. Each side may
+ * have up to RA_STREAM_WINDOW messages on a stream that the other has
+ * not yet read, and the reader grants more with CREDIT frames, which
+ * carry the number of messages in len and have no payload.
+ */
+
+#define RA_STREAM_DATA		0x0
+#define RA_STREAM_CREDIT	0x1
+#define RA_STREAM_CLOSE		0x2
+
+#define RA_STREAM_WINDOW	4
+#define RA_STREAM_MAX		256
+
+typedef struct _ra_stream_header_struct {
+	uint32_t type;
+	uint32_t stream;
+	uint32_t flags;
+	uint32_t len;
+} ra_stream_header_t;
+
+/*
+ * A client can persist its session across restarts by sealing SK and
+ * MK in the enclave. This is stored in the clear, but authenticated,
+ * alongside the sealed keys.
+ */
+
+typedef struct _sealed_session_info_struct {
+	uint64_t expires;			/* seconds since the epoch */
+	ra_ticket_t ticket;
+} sealed_session_info_t;
+
 #endif
 
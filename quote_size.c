@@ -34,52 +34,56 @@ static HINSTANCE h_service = NULL;
 typedef sgx_status_t(SGXAPI *fp_sgx_get_quote_size_t)(const uint8_t *p_sig_rl, uint32_t *p_quote_size);
 typedef sgx_status_t(SGXAPI *fp_sgx_calc_quote_size_t)(const uint8_t *p_sig_rl, uint32_t p_sigrl_size, uint32_t *p_quote_size);
 
+/*
+ * Look the functions up once. They can't change while we're running, and
+ * a dlsym per quote adds up when generating quotes in bulk.
+ */
+
+static fp_sgx_get_quote_size_t fp_sgx_get_quote_size = NULL;
+static fp_sgx_calc_quote_size_t fp_sgx_calc_quote_size = NULL;
+static int resolved= 0;
+
 int get_quote_size(sgx_status_t *status, uint32_t *qsz)
 {
-	fp_sgx_get_quote_size_t fp_sgx_get_quote_size = NULL;
-	fp_sgx_calc_quote_size_t fp_sgx_calc_quote_size = NULL;
-
 	// Does our PSW have the newer sgx_calc_quote_size?
 
+	if ( ! resolved ) {
 #ifdef _WIN32
-	if (h_service == NULL) {
-		// We already did this in sgx_detect_win.cpp, so this should lib already
-		// be open and loaded.
-		h_service = LoadLibrary("sgx_uae_service.dll");
 		if (h_service == NULL) {
-			// We wouldn't get this far if the DLL isn't loaded, so something
-			//horrible has happened if this is NULL.
-			return 0;
+			// We already did this in sgx_detect_win.cpp, so this should lib already
+			// be open and loaded.
+			h_service = LoadLibrary("sgx_uae_service.dll");
+			if (h_service == NULL) {
+				// We wouldn't get this far if the DLL isn't loaded, so something
+				//horrible has happened if this is NULL.
+				return 0;
+			}
 		}
-	}
-
-	fp_sgx_calc_quote_size = (fp_sgx_calc_quote_size_t)GetProcAddress(h_service, "sgx_calc_quote_size");
-	if (fp_sgx_calc_quote_size == NULL) {
-		// Then fall back to sgx_get_quote_size
-		fp_sgx_get_quote_size= (fp_sgx_get_quote_size_t)GetProcAddress(h_service, "sgx_get_quote_size");
-		if (fp_sgx_get_quote_size == NULL) return 0;
-		*status= fp_sgx_get_quote_size(NULL, qsz);
-		return 1;
-	} 
-
-	*status= fp_sgx_calc_quote_size(NULL, 0, qsz);
 
+		fp_sgx_calc_quote_size = (fp_sgx_calc_quote_size_t)GetProcAddress(h_service, "sgx_calc_quote_size");
+		if (fp_sgx_calc_quote_size == NULL) {
+			// Then fall back to sgx_get_quote_size
+			fp_sgx_get_quote_size= (fp_sgx_get_quote_size_t)GetProcAddress(h_service, "sgx_get_quote_size");
+		}
 #else
+		/* These stub functions abort if something goes horribly wrong */
+		fp_sgx_calc_quote_size= (fp_sgx_calc_quote_size_t) get_sgx_ufunction("sgx_calc_quote_size");
+		if ( fp_sgx_calc_quote_size == NULL ) {
+			fp_sgx_get_quote_size= (fp_sgx_get_quote_size_t) get_sgx_ufunction("sgx_get_quote_size");
+		}
+#endif
+		resolved= 1;
+	}
 
-	/* These stub functions abort if something goes horribly wrong */
-	fp_sgx_calc_quote_size= (fp_sgx_calc_quote_size_t) get_sgx_ufunction("sgx_calc_quote_size");
 	if ( fp_sgx_calc_quote_size != NULL ) {
 		*status= (*fp_sgx_calc_quote_size)(NULL, 0, qsz);
 		return 1;
 	}
-		
-	fp_sgx_get_quote_size= (fp_sgx_get_quote_size_t) get_sgx_ufunction("sgx_get_quote_size");
+
 	if ( fp_sgx_get_quote_size == NULL ) return 0;
 
 	*status= (*fp_sgx_get_quote_size)(NULL, qsz);
 
-#endif
-
 	return 1;
 }
 
@@ -0,0 +1,160 @@
+/*
+
+Copyright 2018 Intel Corporation
+
+This software and the related documents are Intel copyrighted materials,
+and your use of them is governed by the express license under which they
+were provided to you (License). Unless the License provides otherwise,
+you may not use, modify, copy, publish, distribute, disclose or transmit
+this software or the related documents without Intel's prior written
+permission.
+
+This software and the related documents are provided as is, with no
+express or implied warranties, other than those that are expressly stated
+in the License.
+
+*/
+
+#include <string.h>
+#include "quote_trust.h"
+
+/*
+ * This sample's attestation policy is based on isvEnclaveQuoteStatus:
+ *
+ *   1) if "OK" then return "Trusted"
+ *
+ *   2) if "CONFIGURATION_NEEDED", then return
+ *      "NotTrusted_ItsComplicated" when in --strict-trust-mode
+ *      and "Trusted_ItsComplicated" otherwise. In strict mode, a
+ *      report that lists advisories, all of which have been allowed
+ *      (--allow-advisory), is "Trusted_ItsComplicated".
+ *
+ *   3) if "GROUP_OUT_OF_DATE", then return "NotTrusted_ItsComplicated"
+ *
+ *   4) return "NotTrusted" for all other responses, including
+ *      "SW_HARDENING_NEEDED" and "CONFIGURATION_AND_SW_HARDENING_NEEDED"
+ *
+ * In case #2, this is ultimatly a policy decision. Do you want to
+ * trust a client that is running with a configuration that weakens
+ * its security posture? Even if you ultimately choose to trust the
+ * client, the "Trusted_ItsComplicated" response is intended to
+ * tell the client "I'll trust you (for now), but inform the user
+ * that I may not trust them in the future unless they take some
+ * action". A real service would provide some guidance to the
+ * end user based on the advisory URLs and advisory IDs.
+ *
+ * The whole policy is worked out ahead of time in the table below,
+ * indexed by strict mode, status, and the report's advisories: none at
+ * all, only ones that have been allowed, or at least one that hasn't.
+ */
+
+static const attestation_status_t decision[2][QUOTE_STATUS_MAX][3]= {
+	{	/* Not strict */
+		{ Trusted, Trusted, Trusted },									/* OK */
+		{ NotTrusted, NotTrusted, NotTrusted },							/* SIGNATURE_INVALID */
+		{ NotTrusted, NotTrusted, NotTrusted },							/* GROUP_REVOKED */
+		{ NotTrusted, NotTrusted, NotTrusted },							/* SIGNATURE_REVOKED */
+		{ NotTrusted, NotTrusted, NotTrusted },							/* KEY_REVOKED */
+		{ NotTrusted, NotTrusted, NotTrusted },							/* SIGRL_VERSION_MISMATCH */
+		{ NotTrusted_ItsComplicated, NotTrusted_ItsComplicated,
+			NotTrusted_ItsComplicated },								/* GROUP_OUT_OF_DATE */
+		{ Trusted_ItsComplicated, Trusted_ItsComplicated,
+			Trusted_ItsComplicated },									/* CONFIGURATION_NEEDED */
+		{ NotTrusted, NotTrusted, NotTrusted },							/* SW_HARDENING_NEEDED */
+		{ NotTrusted, NotTrusted, NotTrusted },							/* CONFIGURATION_AND_SW_HARDENING_NEEDED */
+		{ NotTrusted, NotTrusted, NotTrusted }							/* anything else */
+	},
+	{	/* Strict */
+		{ Trusted, Trusted, Trusted },
+		{ NotTrusted, NotTrusted, NotTrusted },
+		{ NotTrusted, NotTrusted, NotTrusted },
+		{ NotTrusted, NotTrusted, NotTrusted },
+		{ NotTrusted, NotTrusted, NotTrusted },
+		{ NotTrusted, NotTrusted, NotTrusted },
+		{ NotTrusted_ItsComplicated, NotTrusted_ItsComplicated,
+			NotTrusted_ItsComplicated },
+		{ NotTrusted_ItsComplicated, Trusted_ItsComplicated,
+			NotTrusted_ItsComplicated },
+		{ NotTrusted, NotTrusted, NotTrusted },
+		{ NotTrusted, NotTrusted, NotTrusted },
+		{ NotTrusted, NotTrusted, NotTrusted }
+	}
+};
+
+/* In quote_status_t order */
+
+static const char *status_names[QUOTE_STATUS_UNKNOWN]= {
+	"OK",
+	"SIGNATURE_INVALID",
+	"GROUP_REVOKED",
+	"SIGNATURE_REVOKED",
+	"KEY_REVOKED",
+	"SIGRL_VERSION_MISMATCH",
+	"GROUP_OUT_OF_DATE",
+	"CONFIGURATION_NEEDED",
+	"SW_HARDENING_NEEDED",
+	"CONFIGURATION_AND_SW_HARDENING_NEEDED"
+};
+
+void quote_trust_init(quote_trust_t *trust)
+{
+	memset(trust, 0, sizeof(quote_trust_t));
+}
+
+int quote_trust_allow(quote_trust_t *trust, const char *id)
+{
+	size_t len= strlen(id);
+	uint64_t bit;
+
+	if ( len == 0 || len >= QUOTE_TRUST_ADVISORY_LEN ) return 0;
+
+	bit= quote_trust_advisory(trust, id, len);
+	if ( bit == QUOTE_TRUST_OTHER_ADVISORY ) {
+		if ( trust->nadvisories == QUOTE_TRUST_MAX_ADVISORIES ) return 0;
+
+		bit= (uint64_t) 1 << trust->nadvisories;
+		memcpy(trust->advisories[trust->nadvisories++], id, len+1);
+	}
+
+	trust->allowed|= bit;
+
+	return 1;
+}
+
+quote_status_t quote_status_lookup(const char *status, size_t len)
+{
+	int i;
+
+	for (i= 0; i< QUOTE_STATUS_UNKNOWN; ++i) {
+		if ( strlen(status_names[i]) == len &&
+			memcmp(status_names[i], status, len) == 0 )
+			return (quote_status_t) i;
+	}
+
+	return QUOTE_STATUS_UNKNOWN;
+}
+
+uint64_t quote_trust_advisory(const quote_trust_t *trust, const char *id,
+	size_t len)
+{
+	unsigned int i;
+
+	if ( len >= QUOTE_TRUST_ADVISORY_LEN ) return QUOTE_TRUST_OTHER_ADVISORY;
+
+	for (i= 0; i< trust->nadvisories; ++i) {
+		if ( memcmp(trust->advisories[i], id, len) == 0 &&
+			trust->advisories[i][len] == 0 )
+			return (uint64_t) 1 << i;
+	}
+
+	return QUOTE_TRUST_OTHER_ADVISORY;
+}
+
+attestation_status_t quote_trust_decide(const quote_trust_t *trust,
+	int strict, quote_status_t status, uint64_t advisories)
+{
+	/* 0 for no advisories, 1 if they're all allowed, and 2 otherwise */
+
+	return decision[strict != 0][status][(advisories != 0) +
+		((advisories & ~trust->allowed) != 0)];
+}
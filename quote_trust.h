@@ -0,0 +1,88 @@
+/*
+
+Copyright 2018 Intel Corporation
+
+This software and the related documents are Intel copyrighted materials,
+and your use of them is governed by the express license under which they
+were provided to you (License). Unless the License provides otherwise,
+you may not use, modify, copy, publish, distribute, disclose or transmit
+this software or the related documents without Intel's prior written
+permission.
+
+This software and the related documents are provided as is, with no
+express or implied warranties, other than those that are expressly stated
+in the License.
+
+*/
+
+#ifndef __QUOTE_TRUST__H
+#define __QUOTE_TRUST__H
+
+#include <sys/types.h>
+#include <inttypes.h>
+#include "protocol.h"
+
+/*
+ * Turns the isvEnclaveQuoteStatus and advisoryIDs of an IAS report into
+ * the attestation status we send in msg4.
+ */
+
+typedef enum {
+	QUOTE_STATUS_OK = 0,
+	QUOTE_STATUS_SIGNATURE_INVALID,
+	QUOTE_STATUS_GROUP_REVOKED,
+	QUOTE_STATUS_SIGNATURE_REVOKED,
+	QUOTE_STATUS_KEY_REVOKED,
+	QUOTE_STATUS_SIGRL_VERSION_MISMATCH,
+	QUOTE_STATUS_GROUP_OUT_OF_DATE,
+	QUOTE_STATUS_CONFIGURATION_NEEDED,
+	QUOTE_STATUS_SW_HARDENING_NEEDED,
+	QUOTE_STATUS_CONFIGURATION_AND_SW_HARDENING_NEEDED,
+	QUOTE_STATUS_UNKNOWN,
+	QUOTE_STATUS_MAX
+} quote_status_t;
+
+/*
+ * Advisory IDs we accept are interned to a bit number. Bit 63 stands
+ * for every advisory that isn't in the table, so it's never allowed.
+ */
+
+#define QUOTE_TRUST_MAX_ADVISORIES	63
+#define QUOTE_TRUST_ADVISORY_LEN	32
+#define QUOTE_TRUST_OTHER_ADVISORY	((uint64_t) 1 << 63)
+
+typedef struct quote_trust_struct {
+	unsigned int nadvisories;
+	char advisories[QUOTE_TRUST_MAX_ADVISORIES][QUOTE_TRUST_ADVISORY_LEN];
+	uint64_t allowed;
+} quote_trust_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void quote_trust_init(quote_trust_t *trust);
+
+/*
+ * Accept the advisory id when a report has a status that's trusted,
+ * but complicated, even in strict trust mode. Returns 0 if the ID is
+ * too long or the table is full.
+ */
+
+int quote_trust_allow(quote_trust_t *trust, const char *id);
+
+quote_status_t quote_status_lookup(const char *status, size_t len);
+
+/* The bit for an advisory ID in the report */
+
+uint64_t quote_trust_advisory(const quote_trust_t *trust, const char *id,
+	size_t len);
+
+attestation_status_t quote_trust_decide(const quote_trust_t *trust,
+	int strict, quote_status_t status, uint64_t advisories);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -30,5 +30,128 @@
 /* Default CA bundle file on Windows */
 #define DEFAULT_CA_BUNDLE_WIN32	"C:\\Program Files\\cURL\\bin\\curl-ca-bundle.crt"
 
+/*----------------------------------------------------------------------
+ * Server sockets
+ *----------------------------------------------------------------------
+ * sp can serve clients from several worker threads. Each worker has its
+ * own listening socket on the same port (SO_REUSEPORT), so the kernel
+ * spreads new connections across them, and its own IAS connection.
+ * Where SO_REUSEPORT isn't available sp runs a single worker.
+ *
+ * SP_LISTEN_BACKLOG is how many pending connections each listening
+ * socket will queue.
+ *
+ * On Unix, sp can also fork SP_PROCESSES worker processes, each running
+ * SP_WORKERS threads with listening sockets on the same port. They share
+ * the SigRL and certificate caches below.
+ *
+ * SP_WORKERS, SP_PROCESSES and SP_LISTEN_BACKLOG are the defaults for
+ * sp's -w, -n and -b options.
+ *
+ * A worker process that exits is replaced. One that exits within
+ * SP_RESPAWN_DELAY seconds of starting is replaced only after that
+ * long, so a worker that can't start doesn't have sp forking in a loop.
+ */
+
+#define SP_WORKERS			1
+#define SP_MAX_WORKERS		64
+#define SP_LISTEN_BACKLOG	128
+#define SP_PROCESSES		1
+#define SP_MAX_PROCESSES	64
+#define SP_RESPAWN_DELAY	1
+
+/*----------------------------------------------------------------------
+ * IAS result caches
+ *----------------------------------------------------------------------
+ * sp keeps the SigRLs it fetches from IAS, for up to SP_SIGRL_TTL
+ * seconds, for SP_SIGRL_CACHE_SLOTS EPID groups. SigRLs larger than
+ * SP_SIGRL_CACHE_SIZE bytes are always fetched.
+ *
+ * Once the IAS report signing certificate chain has been verified, it
+ * is trusted for SP_CHAIN_TTL seconds without being verified again.
+ * The report signature is still checked every time.
+ */
+
+#define SP_SIGRL_TTL			300
+#define SP_SIGRL_CACHE_SLOTS	16
+#define SP_SIGRL_CACHE_SIZE		65536
+#define SP_CHAIN_TTL			3600
+#define SP_CHAIN_CACHE_SLOTS	4
+
+/*
+ * Trusted attestation results are kept by quote for SP_REPORT_CACHE_TTL
+ * seconds (the default for sp's --report-cache-ttl), so the same quote
+ * presented again (for instance, by a client retrying msg3) doesn't go
+ * back to IAS. Results that aren't trusted, and IAS errors, are never
+ * kept. SP_REPORT_CACHE_SLOTS results are kept, least recently used
+ * first out. Report bodies larger than SP_REPORT_CACHE_SIZE bytes
+ * aren't kept, but the result still is.
+ */
+
+#define SP_REPORT_CACHE_TTL		600
+#define SP_REPORT_CACHE_SLOTS	256
+#define SP_REPORT_CACHE_SIZE	4096
+
+/*----------------------------------------------------------------------
+ * Connection deadlines and limits
+ *----------------------------------------------------------------------
+ * How long, in milliseconds, sp waits for each part of a client
+ * connection before dropping it. The whole message has to arrive in
+ * time, so a client can't hold a worker by sending it a byte at a time.
+ *
+ *   SP_MSG01_TIMEOUT    the first request after connecting
+ *   SP_MSG3_TIMEOUT     msg3, after we've sent msg2
+ *   SP_IDLE_TIMEOUT     the next request once a client is attested
+ *   SP_WRITE_TIMEOUT    sending any one reply
+ *
+ * A timeout of 0 waits forever.
+ *
+ * SP_REQUEST_MAX and SP_MSG3_MAX are the largest messages, in bytes,
+ * sp accepts. The biggest request is a secure channel record. A quote
+ * grows by 160 bytes for each entry in the SigRL, so msg3 is allowed
+ * much more room.
+ */
+
+#define SP_MSG01_TIMEOUT	10000
+#define SP_MSG3_TIMEOUT		30000
+#define SP_IDLE_TIMEOUT		60000
+#define SP_WRITE_TIMEOUT	10000
+
+#define SP_REQUEST_MAX		32768
+#define SP_MSG3_MAX			(1024*1024)
+
+/*----------------------------------------------------------------------
+ * Admission control
+ *----------------------------------------------------------------------
+ * Each worker serves one connection at a time. When every worker in a
+ * process is busy, sp answers the first message of a new connection
+ * with a busy reply instead of leaving it in the listen queue, waiting
+ * up to SP_BUSY_READ_TIMEOUT milliseconds for that message. A worker
+ * also turns away a new attestation when the workers in its process
+ * together already have SP_MAX_SESSIONS attestations, or
+ * SP_MAX_IAS_REQUESTS requests to IAS, in progress (the defaults for
+ * --max-sessions and --max-ias-requests). Either way the client is told
+ * to come back after SP_RETRY_AFTER milliseconds, rather than waiting
+ * in line behind IAS. A worker always lets a session resume through,
+ * since resuming doesn't involve IAS.
+ */
+
+#define SP_MAX_SESSIONS		32
+#define SP_MAX_IAS_REQUESTS	16
+#define SP_RETRY_AFTER		250
+#define SP_BUSY_READ_TIMEOUT	1000
+
+/*----------------------------------------------------------------------
+ * Enclave policy
+ *----------------------------------------------------------------------
+ * When sp loads its enclave policy from a file (-E), it looks at the
+ * file at most every SP_POLICY_RECHECK seconds and reloads it if it has
+ * changed. Replace the file with rename(2) so a reload never sees it
+ * half written. A policy that fails to load is ignored and the current
+ * one kept.
+ */
+
+#define SP_POLICY_RECHECK	5
+
 
 #endif
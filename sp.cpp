@@ -24,6 +24,7 @@ in the License.
 #include <stdio.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <time.h>
 #include <sys/types.h>
 #ifdef _WIN32
 #include <intrin.h>
@@ -33,12 +34,16 @@ in the License.
 #include <signal.h>
 #include <getopt.h>
 #include <unistd.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <poll.h>
 #endif
 #include <sgx_key_exchange.h>
 #include <sgx_report.h>
 #include <openssl/evp.h>
 #include <openssl/pem.h>
-#include "json.hpp"
+#include <openssl/rand.h>
 #include "common.h"
 #include "hexutil.h"
 #include "fileio.h"
@@ -50,35 +55,30 @@ in the License.
 #include "iasrequest.h"
 #include "logfile.h"
 #include "settings.h"
-#include "enclave_verify.h"
+#include "spcache.h"
+#include "enclave_policy.h"
+#include "quote_trust.h"
+#include "iasreport.h"
 
-using namespace json;
 using namespace std;
 
 #include <map>
 #include <string>
 #include <iostream>
 #include <algorithm>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 #ifdef _WIN32
 #define strdup(x) _strdup(x)
 #endif
 
-// TODO: Clean up the constants below, get them externally instead of hard-coding here.
-
-// These constants are taken from the 'settings' file.
-// Modify them with the correct values
-#define SPID "347A02ABAE509A6E43E376C7250FAE99"
-#define IAS_PRIMARY_SUBSCRIPTION_KEY "a86c71cb05af4c33a7bf9ec34e8ccd64"
-#define IAS_SECONDARY_SUBSCRIPTION_KEY "bc86eeb48ae144d0926d98f74228b8e2"
-#define IAS_REPORT_SIGNING_CA_FILE "/home/cerkoc01/Workspace/careful-whisper-sgx/Intel_SGX_Attestation_RootCA.pem"
-
-// Similarly, the constants below are taken from the 'policy'file.
-// Modify them for a different policy file, if needed.
-#define MRSIGNER "bd71c6380ef77c5417e8b2d1ce2d4b6504b9f418e5049342440cfff2443d95bd"
-#define PRODID "0"
-#define MIN_ISVSVN "1"
-#define ALLOW_DEBUG "1"
+// How long a session ticket can be used to resume a session, in seconds.
+#define TICKET_LIFETIME 3600
 
 static const unsigned char def_service_private_key[32] = {
 	0x90, 0xe7, 0x6c, 0xbb, 0x2d, 0x52, 0xa1, 0xce,
@@ -95,8 +95,22 @@ typedef struct ra_session_struct
 	unsigned char sk[16];
 	unsigned char mk[16];
 	unsigned char vk[16];
+	attestation_status_t status;
+	/* Secure channel */
+	int have_rk;
+	unsigned char rk[16];
+	uint64_t send_seq;
+	uint64_t recv_seq;
 } ra_session_t;
 
+/* Protocol state for a connection, or for one stream of a multiplexed one */
+
+typedef struct ra_conn_struct
+{
+	ra_session_t session;
+	int attested;
+} ra_conn_t;
+
 typedef struct config_struct
 {
 	sgx_spid_t spid;
@@ -111,61 +125,180 @@ typedef struct config_struct
 	unsigned char kdk[16];
 	X509_STORE *store;
 	X509 *signing_ca;
+	unsigned char signing_ca_hash[32];
 	unsigned int apiver;
 	int strict_trust;
+	quote_trust_t trust;
 	sgx_measurement_t req_mrsigner;
 	sgx_prod_id_t req_isv_product_id;
 	sgx_isv_svn_t min_isvsvn;
 	int allow_debug_enclave;
+	char *policy_file;
+	enclave_policy_t *policy; /* built from the settings above */
+	unsigned char ticket_key[16];
+	unsigned int ticket_lifetime;
+	unsigned int report_cache_ttl;
+	unsigned int workers;
+	unsigned int processes;
+	int backlog;
+	unsigned int max_sessions;
+	unsigned int max_ias_requests;
+	unsigned int have;
 } config_t;
 
+/* Required settings we've been given, in config_t.have */
+
+#define CONFIG_HAVE_SPID		0x01
+#define CONFIG_HAVE_CA			0x02
+#define CONFIG_HAVE_MRSIGNER	0x04
+#define CONFIG_HAVE_PRODID		0x08
+#define CONFIG_HAVE_MIN_ISVSVN	0x10
+
+/* An IAS connection, and the configuration it was last given */
+
+typedef struct ias_slot_struct
+{
+	IAS_Connection *ias;
+	shared_ptr<const config_t> applied;
+} ias_slot_t;
+
+/*
+ * The streams of a multiplexed connection. Each one is served by its
+ * own thread, so a stream that's waiting on IAS doesn't hold up the
+ * rest. A worker keeps the IAS connections its stream threads are done
+ * with for the next ones.
+ */
+
+typedef struct stream_set_struct
+{
+	mutex lock;
+	condition_variable done;
+	unsigned int active;
+	vector<ias_slot_t> idle;
+} stream_set_t;
+
 void usage();
 #ifndef _WIN32
 void cleanup_and_exit(int signo);
+int fork_workers(unsigned int n);
+void stop_workers(int signo);
+void reload_workers(int signo);
+void reload_config(int signo);
 #endif
 
+int config_set(config_t *config, int opt, const char *val);
+int config_load_file(config_t *config, const char *path);
+int config_check(const config_t *config);
+int config_file_apply(config_t *config);
+int config_load_policy(config_t *config);
+config_t *config_dup(const config_t *src);
+void config_free(config_t *config);
+int config_reload();
+shared_ptr<const config_t> config_current();
+
 int derive_kdk(EVP_PKEY *Gb, unsigned char kdk[16], sgx_ec256_public_t g_a,
-			   config_t *config);
+			   const config_t *config);
 
-int process_msg01(MsgIO *msg, IAS_Connection *ias, sgx_ra_msg1_t *msg1,
-				  sgx_ra_msg2_t *msg2, char **sigrl, config_t *config,
-				  ra_session_t *session);
+int process_msg01(ra_msg01_t *msg01, IAS_Connection *ias,
+				  sgx_ra_msg1_t *msg1, sgx_ra_msg2_t *msg2, char **sigrl,
+				  const config_t *config, ra_session_t *session);
 
 int process_msg3(MsgIO *msg, IAS_Connection *ias, sgx_ra_msg1_t *msg1,
-				 ra_msg4_t *msg4, config_t *config, ra_session_t *session);
+				 ra_msg4_t *msg4, const config_t *config, ra_session_t *session);
+
+int serve_message(MsgIO *msgio, IAS_Connection *ias, const config_t *config,
+				  ra_conn_t *conn, char **sigrl, void *msg, size_t sz);
+
+void serve_clients(MsgIO *msgio, IAS_Connection *ias);
+int start_stream(MsgIO *msgio, stream_set_t *streams, uint32_t id,
+				 void *msg, size_t sz);
+void serve_stream(MsgIO *stream, stream_set_t *streams, void *msg, size_t sz);
+
+IAS_Connection *ias_connect(const config_t *config, int production, int noproxy);
+void ias_apply_config(IAS_Connection *ias, const config_t *config);
+
+int process_proof(MsgIO *msg, ra_proof_request_t *req,
+				  ra_session_t *session);
+
+int process_resume(MsgIO *msg, ra_resume_request_t *req, const config_t *config,
+				   ra_session_t *session);
+
+int process_channel(MsgIO *msg, ra_channel_request_t *req,
+					ra_session_t *session);
+
+int process_record(MsgIO *msg, ra_record_header_t *rec,
+				   ra_session_t *session);
+
+int ticket_issue(const config_t *config, ra_session_t *session,
+				 sgx_report_body_t *r, ra_ticket_t *ticket);
+
+int ticket_open(const config_t *config, ra_ticket_t *ticket,
+				ra_ticket_body_t *body);
 
 int get_sigrl(IAS_Connection *ias, int version, sgx_epid_group_id_t gid,
 			  char **sigrl, uint32_t *msg2);
 
 int get_attestation_report(IAS_Connection *ias, int version,
-						   const char *b64quote, sgx_ps_sec_prop_desc_t sec_prop, ra_msg4_t *msg4,
-						   int strict_trust);
+						   const char *b64quote, ra_msg4_t *msg4,
+						   int strict_trust, const quote_trust_t *trust,
+						   unsigned int cache_ttl);
 
 int get_proxy(char **server, unsigned int *port, const char *url);
 
+int admit_session(MsgIO *msgio, const config_t *config);
+void send_busy(MsgIO *msgio);
+#ifndef _WIN32
+void turn_away_clients();
+#endif
+
 char debug = 0;
 char verbose = 0;
-/* Need a global for the signal handler */
-MsgIO *msgio = NULL;
+/* Need a global for the signal handler: one listener per worker */
+static MsgIO *listeners[SP_MAX_WORKERS];
+static unsigned int nlisteners = 0;
+
+#ifndef _WIN32
+/* Worker processes, in the parent */
+static pid_t children[SP_MAX_PROCESSES];
+static time_t started[SP_MAX_PROCESSES];
+static unsigned int nchildren = 0;
+static volatile sig_atomic_t stopping = 0;
+#endif
+
+/* Work in progress across all workers, for admission control */
+static atomic<unsigned int> sessions_inflight(0);
+static atomic<unsigned int> ias_inflight(0);
+/* Workers serving a connection, and a wakeup for when that's all of them */
+static atomic<unsigned int> busy_workers(0);
+static mutex busy_mutex;
+static condition_variable all_busy;
+
+/*
+ * The running configuration, enclave policy included. It's never
+ * modified: a reload builds a new one from the command line settings
+ * and the config file, and swaps it in. Each request holds on to the
+ * one it started with.
+ */
+static shared_ptr<const config_t> current_config;
+static const config_t *cmdline_config = NULL;
+/* Command line options that the config file can also set, in order */
+static vector<pair<int, string>> cmdline_opts;
+static const char *config_file = NULL;
+static mutex config_mutex;
+static atomic<int> reload_requested(0);
+/* For the IAS connections that stream threads make */
+static char flag_noproxy = 0;
+static char flag_prod = 0;
 
 int main(int argc, char *argv[])
 {
-	char flag_spid = 0;
-	char flag_pubkey = 0;
-	char flag_api_key = 0;
-	char flag_ca = 0;
-	char flag_usage = 0;
-	char flag_noproxy = 0;
-	char flag_prod = 0;
 	char flag_stdio = 0;
-	char flag_isv_product_id = 0;
-	char flag_min_isvsvn = 0;
-	char flag_mrsigner = 0;
-	char *sigrl = NULL;
 	config_t config;
-	int oops;
-	IAS_Connection *ias = NULL;
+	config_t *running;
+	IAS_Connection *ias[SP_MAX_WORKERS];
+	vector<thread> workers;
 	char *port = NULL;
+	unsigned int i;
 #ifndef _WIN32
 	struct sigaction sact;
 #endif
@@ -176,17 +309,24 @@ int main(int argc, char *argv[])
 		{
 			{"ias-signing-cafile", required_argument, 0, 'A'},
 			{"ca-bundle", required_argument, 0, 'B'},
+			{"config-file", required_argument, 0, 'C'},
 			{"no-debug-enclave", no_argument, 0, 'D'},
+			{"enclave-policy", required_argument, 0, 'E'},
 			{"list-agents", no_argument, 0, 'G'},
 			{"ias-pri-api-key-file", required_argument, 0, 'I'},
 			{"ias-sec-api-key-file", required_argument, 0, 'J'},
 			{"service-key-file", required_argument, 0, 'K'},
+			{"max-sessions", required_argument, 0, 'M'},
 			{"mrsigner", required_argument, 0, 'N'},
 			{"production", no_argument, 0, 'P'},
+			{"max-ias-requests", required_argument, 0, 'Q'},
 			{"isv-product-id", required_argument, 0, 'R'},
 			{"spid-file", required_argument, 0, 'S'},
+			{"report-cache-ttl", required_argument, 0, 'T'},
 			{"min-isv-svn", required_argument, 0, 'V'},
 			{"strict-trust-mode", no_argument, 0, 'X'},
+			{"allow-advisory", required_argument, 0, 'a'},
+			{"backlog", required_argument, 0, 'b'},
 			{"debug", no_argument, 0, 'd'},
 			{"user-agent", required_argument, 0, 'g'},
 			{"help", no_argument, 0, 'h'},
@@ -194,10 +334,12 @@ int main(int argc, char *argv[])
 			{"ias-sec-api-key", required_argument, 0, 'j'},
 			{"key", required_argument, 0, 'k'},
 			{"linkable", no_argument, 0, 'l'},
+			{"processes", required_argument, 0, 'n'},
 			{"proxy", required_argument, 0, 'p'},
 			{"api-version", required_argument, 0, 'r'},
 			{"spid", required_argument, 0, 's'},
 			{"verbose", no_argument, 0, 'v'},
+			{"workers", required_argument, 0, 'w'},
 			{"no-proxy", no_argument, 0, 'x'},
 			{"stdio", no_argument, 0, 'z'},
 			{0, 0, 0, 0}};
@@ -219,6 +361,17 @@ int main(int argc, char *argv[])
 	 */
 	config.allow_debug_enclave = 1;
 
+	quote_trust_init(&config.trust);
+
+	config.ticket_lifetime = TICKET_LIFETIME;
+	config.report_cache_ttl = SP_REPORT_CACHE_TTL;
+
+	config.workers = SP_WORKERS;
+	config.processes = SP_PROCESSES;
+	config.backlog = SP_LISTEN_BACKLOG;
+	config.max_sessions = SP_MAX_SESSIONS;
+	config.max_ias_requests = SP_MAX_IAS_REQUESTS;
+
 	/* Parse our options */
 
 	while (1)
@@ -231,378 +384,231 @@ int main(int argc, char *argv[])
 		unsigned long val;
 
 		c = getopt_long(argc, argv,
-						"A:B:DGI:J:K:N:PR:S:V:X:dg:hk:lp:r:s:i:j:vxz",
+						"A:B:C:DE:GI:J:K:M:N:PQ:R:S:T:V:Xa:b:dg:hi:j:k:ln:p:r:s:vw:xz",
 						long_opt, &opt_index);
 		if (c == -1)
 			break;
 
-		// Case s
-		if (strlen(SPID) < 32)
-		{
-			eprintf("SPID must be 32-byte hex string\n");
-			return 1;
-		}
-		if (!from_hexstring((unsigned char *)&config.spid, (unsigned char *)SPID, 16))
+		switch (c)
 		{
-			eprintf("SPID must be 32-byte hex string\n");
-			return 1;
-		}
-		++flag_spid;
 
-		// Case i
-		if (strlen(IAS_PRIMARY_SUBSCRIPTION_KEY) != IAS_SUBSCRIPTION_KEY_SIZE)
-		{
-			eprintf("IAS Subscription Key must be %d-byte hex string\n", IAS_SUBSCRIPTION_KEY_SIZE);
-			return 1;
-		}
+		case 0:
+			break;
 
-		strncpy((char *)config.pri_subscription_key, IAS_PRIMARY_SUBSCRIPTION_KEY, IAS_SUBSCRIPTION_KEY_SIZE);
+		/* These can also be set in the config file */
+
+		case 'A':
+		case 'D':
+		case 'E':
+		case 'K':
+		case 'N':
+		case 'R':
+		case 'T':
+		case 'V':
+		case 'X':
+		case 'a':
+		case 'i':
+		case 'j':
+		case 'k':
+		case 'l':
+		case 's':
+			if (!config_set(&config, c, optarg))
+				return 1;
+			cmdline_opts.push_back(make_pair(c,
+											 string((optarg == NULL) ? "" : optarg)));
+			break;
 
-		// Case j
-		if (strlen(IAS_SECONDARY_SUBSCRIPTION_KEY) != IAS_SUBSCRIPTION_KEY_SIZE)
-		{
-			eprintf("IAS Secondary Subscription Key must be %d-byte hex string\n",
-					IAS_SUBSCRIPTION_KEY_SIZE);
-			return 1;
-		}
+		case 'B':
+			config.ca_bundle = strdup(optarg);
+			if (config.ca_bundle == NULL)
+			{
+				perror("strdup");
+				return 1;
+			}
 
-		strncpy((char *)config.sec_subscription_key, IAS_SECONDARY_SUBSCRIPTION_KEY, IAS_SUBSCRIPTION_KEY_SIZE);
+			break;
 
-		// Case A
-		if (!cert_load_file(&config.signing_ca, IAS_REPORT_SIGNING_CA_FILE))
-		{
-			crypto_perror("cert_load_file");
-			eprintf("%s: could not load IAS Signing Cert CA\n", IAS_REPORT_SIGNING_CA_FILE);
-			return 1;
-		}
+		case 'C':
+			config_file = optarg;
+			break;
 
-		config.store = cert_init_ca(config.signing_ca);
-		if (config.store == NULL)
-		{
-			eprintf("%s: could not initialize certificate store\n", IAS_REPORT_SIGNING_CA_FILE);
+		case 'G':
+			ias_list_agents(stdout);
 			return 1;
-		}
-		++flag_ca;
-		
-		// Case N
-		if (!from_hexstring((unsigned char *)&config.req_mrsigner,
-							MRSIGNER, 32))
-		{
 
-			eprintf("MRSIGNER must be 64-byte hex string\n");
-			return 1;
-		}
-		++flag_mrsigner;
+		case 'I':
+			// Get Size of File, should be IAS_SUBSCRIPTION_KEY_SIZE + EOF
+			ret = from_file(NULL, optarg, &offset);
 
-		// Case V
-		eptr = NULL;
-		val = strtoul(MIN_ISVSVN, &eptr, 10);
-		if (*eptr != '\0' || val > (unsigned long)0xFFFF)
-		{
-			eprintf("Minimum ISV SVN must be a positive integer <= 65535\n");
-			return 1;
-		}
-		config.min_isvsvn = val;
-		++flag_min_isvsvn;
+			if ((offset != IAS_SUBSCRIPTION_KEY_SIZE + 1) || (ret == 0))
+			{
+				eprintf("IAS Primary Subscription Key must be %d-byte hex string.\n",
+						IAS_SUBSCRIPTION_KEY_SIZE);
+				return 1;
+			}
 
-		// Case R
-		eptr = NULL;
-		val = strtoul(PRODID, &eptr, 10);
-		if (*eptr != '\0' || val > 0xFFFF)
-		{
-			eprintf("Product Id must be a positive integer <= 65535\n");
-			return 1;
+			// Remove the EOF
+			offset--;
+
+			// Read the contents of the file
+			if (!from_file((unsigned char *)&config.pri_subscription_key, optarg, &offset))
+			{
+				eprintf("IAS Primary Subscription Key must be %d-byte hex string.\n",
+						IAS_SUBSCRIPTION_KEY_SIZE);
+				return 1;
+			}
+			break;
+
+		case 'J':
+			// Get Size of File, should be IAS_SUBSCRIPTION_KEY_SIZE + EOF
+			ret = from_file(NULL, optarg, &offset);
+
+			if ((offset != IAS_SUBSCRIPTION_KEY_SIZE + 1) || (ret == 0))
+			{
+				eprintf("IAS Secondary Subscription Key must be %d-byte hex string.\n",
+						IAS_SUBSCRIPTION_KEY_SIZE);
+				return 1;
+			}
+
+			// Remove the EOF
+			offset--;
+
+			// Read the contents of the file
+			if (!from_file((unsigned char *)&config.sec_subscription_key, optarg, &offset))
+			{
+				eprintf("IAS Secondary Subscription Key must be %d-byte hex string.\n",
+						IAS_SUBSCRIPTION_KEY_SIZE);
+				return 1;
+			}
+
+			break;
+
+		case 'M':
+			eptr = NULL;
+			val = strtoul(optarg, &eptr, 10);
+			if (*eptr != '\0' || val == 0 || val > UINT_MAX)
+			{
+				eprintf("Max sessions must be a positive integer\n");
+				return 1;
+			}
+			config.max_sessions = (unsigned int)val;
+			break;
+
+		case 'P':
+			flag_prod = 1;
+			break;
+
+		case 'Q':
+			eptr = NULL;
+			val = strtoul(optarg, &eptr, 10);
+			if (*eptr != '\0' || val == 0 || val > UINT_MAX)
+			{
+				eprintf("Max IAS requests must be a positive integer\n");
+				return 1;
+			}
+			config.max_ias_requests = (unsigned int)val;
+			break;
+
+		case 'S':
+			if (!from_hexstring_file((unsigned char *)&config.spid, optarg, 16))
+			{
+				eprintf("SPID must be 32-byte hex string\n");
+				return 1;
+			}
+			config.have |= CONFIG_HAVE_SPID;
+
+			break;
+
+		case 'b':
+			eptr = NULL;
+			val = strtoul(optarg, &eptr, 10);
+			if (*eptr != '\0' || val == 0 || val > INT_MAX)
+			{
+				eprintf("Backlog must be a positive integer\n");
+				return 1;
+			}
+			config.backlog = (int)val;
+			break;
+
+		case 'd':
+			debug = 1;
+			break;
+
+		case 'g':
+			config.user_agent = strdup(optarg);
+			if (config.user_agent == NULL)
+			{
+				perror("malloc");
+				return 1;
+			}
+			break;
+
+		case 'n':
+			eptr = NULL;
+			val = strtoul(optarg, &eptr, 10);
+			if (*eptr != '\0' || val == 0 || val > SP_MAX_PROCESSES)
+			{
+				eprintf("Processes must be between 1 and %d\n",
+						SP_MAX_PROCESSES);
+				return 1;
+			}
+			config.processes = (unsigned int)val;
+			break;
+
+		case 'p':
+			if (flag_noproxy)
+				usage();
+			if (!get_proxy(&config.proxy_server, &config.proxy_port, optarg))
+			{
+				eprintf("%s: could not extract proxy info\n", optarg);
+				return 1;
+			}
+			// Break the URL into host and port. This is a simplistic algorithm.
+			break;
+
+		case 'r':
+			config.apiver = atoi(optarg);
+			if (config.apiver < IAS_MIN_VERSION || config.apiver >
+													   IAS_MAX_VERSION)
+			{
+
+				eprintf("version must be between %d and %d\n",
+						IAS_MIN_VERSION, IAS_MAX_VERSION);
+				return 1;
+			}
+			break;
+
+		case 'v':
+			verbose = 1;
+			break;
+
+		case 'w':
+			eptr = NULL;
+			val = strtoul(optarg, &eptr, 10);
+			if (*eptr != '\0' || val == 0 || val > SP_MAX_WORKERS)
+			{
+				eprintf("Workers must be between 1 and %d\n",
+						SP_MAX_WORKERS);
+				return 1;
+			}
+			config.workers = (unsigned int)val;
+			break;
+
+		case 'x':
+			if (config.proxy_server != NULL)
+				usage();
+			flag_noproxy = 1;
+			break;
+
+		case 'z':
+			flag_stdio = 1;
+			break;
+
+		case 'h':
+		case '?':
+		default:
+			usage();
 		}
-		config.req_isv_product_id = val;
-		++flag_isv_product_id;
-		
-		// Case d
-		debug=1;
-		// case v
-		verbose=1;
-
-
-
-		// switch (c)
-		// {
-
-		// case 0:
-		// 	break;
-
-		// case 'A':
-		// 	printf("Case A\n");
-		// 	if (!cert_load_file(&config.signing_ca, optarg))
-		// 	{
-		// 		crypto_perror("cert_load_file");
-		// 		eprintf("%s: could not load IAS Signing Cert CA\n", optarg);
-		// 		return 1;
-		// 	}
-
-		// 	config.store = cert_init_ca(config.signing_ca);
-		// 	if (config.store == NULL)
-		// 	{
-		// 		eprintf("%s: could not initialize certificate store\n", optarg);
-		// 		return 1;
-		// 	}
-		// 	++flag_ca;
-
-		// 	break;
-
-		// case 'B':
-		// 	printf("Case B");
-		// 	config.ca_bundle = strdup(optarg);
-		// 	if (config.ca_bundle == NULL)
-		// 	{
-		// 		perror("strdup");
-		// 		return 1;
-		// 	}
-
-		// 	break;
-
-		// case 'D':
-		// 	printf("Case D\n");
-		// 	config.allow_debug_enclave = 0;
-		// 	break;
-		// case 'G':
-		// 	printf("Case G\n");
-		// 	ias_list_agents(stdout);
-		// 	return 1;
-
-		// case 'I':
-		// 	printf("Case I\n");
-		// 	// Get Size of File, should be IAS_SUBSCRIPTION_KEY_SIZE + EOF
-		// 	ret = from_file(NULL, optarg, &offset);
-
-		// 	if ((offset != IAS_SUBSCRIPTION_KEY_SIZE + 1) || (ret == 0))
-		// 	{
-		// 		eprintf("IAS Primary Subscription Key must be %d-byte hex string.\n",
-		// 				IAS_SUBSCRIPTION_KEY_SIZE);
-		// 		return 1;
-		// 	}
-
-		// 	// Remove the EOF
-		// 	offset--;
-
-		// 	// Read the contents of the file
-		// 	if (!from_file((unsigned char *)&config.pri_subscription_key, optarg, &offset))
-		// 	{
-		// 		eprintf("IAS Primary Subscription Key must be %d-byte hex string.\n",
-		// 				IAS_SUBSCRIPTION_KEY_SIZE);
-		// 		return 1;
-		// 	}
-		// 	break;
-
-		// case 'J':
-		// 	printf("Case J\n");
-		// 	// Get Size of File, should be IAS_SUBSCRIPTION_KEY_SIZE + EOF
-		// 	ret = from_file(NULL, optarg, &offset);
-
-		// 	if ((offset != IAS_SUBSCRIPTION_KEY_SIZE + 1) || (ret == 0))
-		// 	{
-		// 		eprintf("IAS Secondary Subscription Key must be %d-byte hex string.\n",
-		// 				IAS_SUBSCRIPTION_KEY_SIZE);
-		// 		return 1;
-		// 	}
-
-		// 	// Remove the EOF
-		// 	offset--;
-
-		// 	// Read the contents of the file
-		// 	if (!from_file((unsigned char *)&config.sec_subscription_key, optarg, &offset))
-		// 	{
-		// 		eprintf("IAS Secondary Subscription Key must be %d-byte hex string.\n",
-		// 				IAS_SUBSCRIPTION_KEY_SIZE);
-		// 		return 1;
-		// 	}
-
-		// 	break;
-
-		// case 'K':
-		// 	printf("Case K\n");
-		// 	if (!key_load_file(&config.service_private_key, optarg, KEY_PRIVATE))
-		// 	{
-		// 		crypto_perror("key_load_file");
-		// 		eprintf("%s: could not load EC private key\n", optarg);
-		// 		return 1;
-		// 	}
-		// 	break;
-
-		// case 'N':
-		// 	printf("Case N\n");
-		// 	if (!from_hexstring((unsigned char *)&config.req_mrsigner,
-		// 						optarg, 32))
-		// 	{
-
-		// 		eprintf("MRSIGNER must be 64-byte hex string\n");
-		// 		return 1;
-		// 	}
-		// 	++flag_mrsigner;
-		// 	break;
-
-		// case 'P':
-		// 	printf("Case P");
-		// 	flag_prod = 1;
-		// 	break;
-
-		// case 'R':
-		// 	printf("Case R\n");
-		// 	eptr = NULL;
-		// 	val = strtoul(optarg, &eptr, 10);
-		// 	if (*eptr != '\0' || val > 0xFFFF)
-		// 	{
-		// 		eprintf("Product Id must be a positive integer <= 65535\n");
-		// 		return 1;
-		// 	}
-		// 	config.req_isv_product_id = val;
-		// 	++flag_isv_product_id;
-		// 	break;
-
-		// case 'S':
-		// 	printf("Case S\n");
-		// 	if (!from_hexstring_file((unsigned char *)&config.spid, optarg, 16))
-		// 	{
-		// 		eprintf("SPID must be 32-byte hex string\n");
-		// 		return 1;
-		// 	}
-		// 	++flag_spid;
-
-		// 	break;
-
-		// case 'V':
-		// 	printf("Case V\n");
-		// 	eptr = NULL;
-		// 	val = strtoul(optarg, &eptr, 10);
-		// 	if (*eptr != '\0' || val > (unsigned long)0xFFFF)
-		// 	{
-		// 		eprintf("Minimum ISV SVN must be a positive integer <= 65535\n");
-		// 		return 1;
-		// 	}
-		// 	config.min_isvsvn = val;
-		// 	++flag_min_isvsvn;
-		// 	break;
-
-		// case 'X':
-		// 	printf("Case X\n");
-		// 	config.strict_trust = 1;
-		// 	break;
-
-		// case 'd':
-		// 	printf("Case d\n");
-		// 	debug = 1;
-		// 	break;
-
-		// case 'g':
-		// 	printf("Case g\n");
-		// 	config.user_agent = strdup(optarg);
-		// 	if (config.user_agent == NULL)
-		// 	{
-		// 		perror("malloc");
-		// 		return 1;
-		// 	}
-		// 	break;
-
-		// case 'i':
-		// 	printf("Case i\n");
-		// 	if (strlen(optarg) != IAS_SUBSCRIPTION_KEY_SIZE)
-		// 	{
-		// 		eprintf("IAS Subscription Key must be %d-byte hex string\n", IAS_SUBSCRIPTION_KEY_SIZE);
-		// 		return 1;
-		// 	}
-
-		// 	strncpy((char *)config.pri_subscription_key, optarg, IAS_SUBSCRIPTION_KEY_SIZE);
-
-		// 	break;
-
-		// case 'j':
-		// 	printf("Case j\n");
-		// 	if (strlen(optarg) != IAS_SUBSCRIPTION_KEY_SIZE)
-		// 	{
-		// 		eprintf("IAS Secondary Subscription Key must be %d-byte hex string\n",
-		// 				IAS_SUBSCRIPTION_KEY_SIZE);
-		// 		return 1;
-		// 	}
-
-		// 	strncpy((char *)config.sec_subscription_key, optarg, IAS_SUBSCRIPTION_KEY_SIZE);
-
-		// 	break;
-
-		// case 'k':
-		// 	printf("Case k\n");
-		// 	if (!key_load(&config.service_private_key, optarg, KEY_PRIVATE))
-		// 	{
-		// 		crypto_perror("key_load");
-		// 		eprintf("%s: could not load EC private key\n", optarg);
-		// 		return 1;
-		// 	}
-		// 	break;
-
-		// case 'l':
-		// 	printf("Case l\n");
-		// 	config.quote_type = SGX_LINKABLE_SIGNATURE;
-		// 	break;
-
-		// case 'p':
-		// 	printf("Case p\n");
-		// 	if (flag_noproxy)
-		// 		usage();
-		// 	if (!get_proxy(&config.proxy_server, &config.proxy_port, optarg))
-		// 	{
-		// 		eprintf("%s: could not extract proxy info\n", optarg);
-		// 		return 1;
-		// 	}
-		// 	// Break the URL into host and port. This is a simplistic algorithm.
-		// 	break;
-
-		// case 'r':
-		// 	printf("Case r\n");
-		// 	config.apiver = atoi(optarg);
-		// 	if (config.apiver < IAS_MIN_VERSION || config.apiver >
-		// 											   IAS_MAX_VERSION)
-		// 	{
-
-		// 		eprintf("version must be between %d and %d\n",
-		// 				IAS_MIN_VERSION, IAS_MAX_VERSION);
-		// 		return 1;
-		// 	}
-		// 	break;
-
-		// case 's':
-		// 	printf("Case s\n");
-		// 	if (strlen(optarg) < 32)
-		// 	{
-		// 		eprintf("SPID must be 32-byte hex string\n");
-		// 		return 1;
-		// 	}
-		// 	if (!from_hexstring((unsigned char *)&config.spid, (unsigned char *)optarg, 16))
-		// 	{
-		// 		eprintf("SPID must be 32-byte hex string\n");
-		// 		return 1;
-		// 	}
-		// 	++flag_spid;
-		// 	break;
-
-		// case 'v':
-		// 	printf("Case v\n");
-		// 	verbose = 1;
-		// 	break;
-
-		// case 'x':
-		// 	printf("Case x\n");
-		// 	if (config.proxy_server != NULL)
-		// 		usage();
-		// 	flag_noproxy = 1;
-		// 	break;
-
-		// case 'z':
-		// 	printf("Case z\n");
-		// 	flag_stdio = 1;
-		// 	break;
-
-		// case 'h':
-		// case '?':
-		// default:
-		// 	usage();
-		// }
 	}
 
 	/* We should have zero or one command-line argument remaining */
@@ -631,34 +637,14 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if (debug)
-	{
-		eprintf("+++ IAS Primary Subscription Key set to '%c%c%c%c........................%c%c%c%c'\n",
-				config.pri_subscription_key[0],
-				config.pri_subscription_key[1],
-				config.pri_subscription_key[2],
-				config.pri_subscription_key[3],
-				config.pri_subscription_key[IAS_SUBSCRIPTION_KEY_SIZE - 4],
-				config.pri_subscription_key[IAS_SUBSCRIPTION_KEY_SIZE - 3],
-				config.pri_subscription_key[IAS_SUBSCRIPTION_KEY_SIZE - 2],
-				config.pri_subscription_key[IAS_SUBSCRIPTION_KEY_SIZE - 1]);
+	/* Initialize out support libraries */
 
-		eprintf("+++ IAS Secondary Subscription Key set to '%c%c%c%c........................%c%c%c%c'\n",
-				config.sec_subscription_key[0],
-				config.sec_subscription_key[1],
-				config.sec_subscription_key[2],
-				config.sec_subscription_key[3],
-				config.sec_subscription_key[IAS_SUBSCRIPTION_KEY_SIZE - 4],
-				config.sec_subscription_key[IAS_SUBSCRIPTION_KEY_SIZE - 3],
-				config.sec_subscription_key[IAS_SUBSCRIPTION_KEY_SIZE - 2],
-				config.sec_subscription_key[IAS_SUBSCRIPTION_KEY_SIZE - 1]);
-	}
+	crypto_init();
 
 	/* Use the default CA bundle unless one is provided */
 
 	if (config.ca_bundle == NULL)
 	{
-		printf("Using default CA bundle\n");
 		config.ca_bundle = strdup(DEFAULT_CA_BUNDLE);
 		if (config.ca_bundle == NULL)
 		{
@@ -678,7 +664,6 @@ int main(int argc, char *argv[])
 
 	if (config.service_private_key == NULL)
 	{
-		printf("Using default private key");
 		if (debug)
 		{
 			eprintf("Using default private key\n");
@@ -691,117 +676,140 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if (debug)
-	{
-		eprintf("+++ using private key:\n");
-		PEM_write_PrivateKey(stderr, config.service_private_key, NULL,
-							 NULL, 0, 0, NULL);
-		PEM_write_PrivateKey(fplog, config.service_private_key, NULL,
-							 NULL, 0, 0, NULL);
-	}
+	/*
+	 * Session tickets are encrypted with a key that only lives as long
+	 * as this process, so restarting the server invalidates them all.
+	 * A reload keeps it, so tickets survive a SIGHUP.
+	 */
 
-	if (!flag_spid)
+	if (RAND_bytes(config.ticket_key, sizeof(config.ticket_key)) != 1)
 	{
-		eprintf("--spid or --spid-file is required\n");
-		flag_usage = 1;
+		crypto_perror("RAND_bytes");
+		return 1;
 	}
 
-	if (!flag_ca)
-	{
-		eprintf("--ias-signing-cafile is required\n");
-		flag_usage = 1;
-	}
+	/*
+	 * Build the running configuration: the command line, with the
+	 * config file on top, except where the command line says otherwise.
+	 * A SIGHUP builds a new one the same way.
+	 */
 
-	if (!flag_isv_product_id)
-	{
-		eprintf("--isv-product-id is required\n");
-		flag_usage = 1;
-	}
+	cmdline_config = &config;
 
-	if (!flag_min_isvsvn)
-	{
-		eprintf("--min-isvsvn is required\n");
-		flag_usage = 1;
-	}
+	running = config_dup(&config);
+	if (running == NULL)
+		return 1;
 
-	if (!flag_mrsigner)
-	{
-		eprintf("--mrsigner is required\n");
-		flag_usage = 1;
-	}
+	if (!config_file_apply(running))
+		return 1;
 
-	if (flag_usage)
+	if (!config_check(running))
 		usage();
 
-	/* Initialize out support libraries */
+	if (!config_load_policy(running))
+		return 1;
 
-	crypto_init();
+	if (debug)
+	{
+		eprintf("+++ IAS Primary Subscription Key set to '%c%c%c%c........................%c%c%c%c'\n",
+				running->pri_subscription_key[0],
+				running->pri_subscription_key[1],
+				running->pri_subscription_key[2],
+				running->pri_subscription_key[3],
+				running->pri_subscription_key[IAS_SUBSCRIPTION_KEY_SIZE - 4],
+				running->pri_subscription_key[IAS_SUBSCRIPTION_KEY_SIZE - 3],
+				running->pri_subscription_key[IAS_SUBSCRIPTION_KEY_SIZE - 2],
+				running->pri_subscription_key[IAS_SUBSCRIPTION_KEY_SIZE - 1]);
 
-	/* Initialize our IAS request object */
+		eprintf("+++ IAS Secondary Subscription Key set to '%c%c%c%c........................%c%c%c%c'\n",
+				running->sec_subscription_key[0],
+				running->sec_subscription_key[1],
+				running->sec_subscription_key[2],
+				running->sec_subscription_key[3],
+				running->sec_subscription_key[IAS_SUBSCRIPTION_KEY_SIZE - 4],
+				running->sec_subscription_key[IAS_SUBSCRIPTION_KEY_SIZE - 3],
+				running->sec_subscription_key[IAS_SUBSCRIPTION_KEY_SIZE - 2],
+				running->sec_subscription_key[IAS_SUBSCRIPTION_KEY_SIZE - 1]);
 
-	try
-	{
-		ias = new IAS_Connection(
-			(flag_prod) ? IAS_SERVER_PRODUCTION : IAS_SERVER_DEVELOPMENT,
-			0,
-			(char *)(config.pri_subscription_key),
-			(char *)(config.sec_subscription_key));
+		eprintf("+++ using private key:\n");
+		PEM_write_PrivateKey(stderr, running->service_private_key, NULL,
+							 NULL, 0, 0, NULL);
+		PEM_write_PrivateKey(fplog, running->service_private_key, NULL,
+							 NULL, 0, 0, NULL);
 	}
-	catch (...)
-	{
-		oops = 1;
-		eprintf("exception while creating IAS request object\n");
+
+	atomic_store(&current_config,
+				 shared_ptr<const config_t>(running, config_free));
+
+	/*
+	 * The IAS caches are shared by all workers, so they have to be set
+	 * up before we fork any worker processes.
+	 */
+
+	if (!spcache_init())
 		return 1;
-	}
 
-	if (flag_noproxy)
-		ias->proxy_mode(IAS_PROXY_NONE);
-	else if (config.proxy_server != NULL)
-	{
-		ias->proxy_mode(IAS_PROXY_FORCE);
-		ias->proxy(config.proxy_server, config.proxy_port);
-	}
+#ifndef SO_REUSEPORT
+	config.workers = 1;
+	config.processes = 1;
+#endif
+	if (flag_stdio || config.workers == 0)
+		config.workers = 1;
+	else if (config.workers > SP_MAX_WORKERS)
+		config.workers = SP_MAX_WORKERS;
 
-	if (config.user_agent != NULL)
+#ifndef _WIN32
+	if (!flag_stdio && config.processes > 1)
 	{
-		if (!ias->agent(config.user_agent))
-		{
-			eprintf("%s: unknown user agent\n", config.user_agent);
-			return 0;
-		}
+		if (config.processes > SP_MAX_PROCESSES)
+			config.processes = SP_MAX_PROCESSES;
+
+		/* Only the worker processes come back from this */
+
+		if (!fork_workers(config.processes))
+			return 1;
 	}
+#endif
 
 	/*
-	 * Set the cert store for this connection. This is used for verifying
-	 * the IAS signing certificate, not the TLS connection with IAS (the
-	 * latter is handled using config.ca_bundle).
+	 * Each worker gets its own IAS connection, since they hold on to a
+	 * user agent between requests. A respawned worker process rereads
+	 * the configuration here rather than using the one it was forked
+	 * with, so the settings can't be from before a SIGHUP.
 	 */
-	ias->cert_store(config.store);
 
-	/*
-	 * Set the CA bundle for verifying the IAS server certificate used
-	 * for the TLS session. If this isn't set, then the user agent
-	 * will fall back to its default.
-	 */
-	if (strlen(config.ca_bundle))
-		ias->ca_bundle(config.ca_bundle);
+	{
+		shared_ptr<const config_t> current = config_current();
 
-	/* Get our message IO object. */
+		for (i = 0; i < config.workers; ++i)
+		{
+			ias[i] = ias_connect(current.get(), flag_prod, flag_noproxy);
+			if (ias[i] == NULL)
+				return 1;
+		}
+	}
+
+	/* Get our message IO objects, one listening socket per worker. */
 
 	if (flag_stdio)
 	{
-		printf("Yesssss\n");
-		msgio = new MsgIO();
+		listeners[nlisteners++] = new MsgIO();
 	}
 	else
 	{
-		try
-		{
-			msgio = new MsgIO(NULL, (port == NULL) ? DEFAULT_PORT : port);
-		}
-		catch (...)
+		for (i = 0; i < config.workers; ++i)
 		{
-			return 1;
+			try
+			{
+				listeners[nlisteners] = new MsgIO(NULL,
+					(port == NULL) ? DEFAULT_PORT : port, true,
+					config.backlog);
+			}
+			catch (...)
+			{
+				return 1;
+			}
+			++nlisteners;
 		}
 	}
 
@@ -816,36 +824,1082 @@ int main(int argc, char *argv[])
 	sact.sa_flags = 0;
 	sact.sa_handler = &cleanup_and_exit;
 
-	if (sigaction(SIGHUP, &sact, NULL) == -1)
-		perror("sigaction: SIGHUP");
 	if (sigaction(SIGINT, &sact, NULL) == -1)
-		perror("sigaction: SIGHUP");
+		perror("sigaction: SIGINT");
 	if (sigaction(SIGTERM, &sact, NULL) == -1)
-		perror("sigaction: SIGHUP");
+		perror("sigaction: SIGTERM");
 	if (sigaction(SIGQUIT, &sact, NULL) == -1)
-		perror("sigaction: SIGHUP");
-#endif
-
-	/* If we're running in server mode, we'll block here.  */
+		perror("sigaction: SIGQUIT");
 
-	while (msgio->server_loop())
-	{
-		ra_session_t session;
-		sgx_ra_msg1_t msg1;
-		sgx_ra_msg2_t msg2;
-		ra_msg4_t msg4;
+	/*
+	 * SIGHUP reloads our configuration. Restart interrupted system calls
+	 * so a reload doesn't disturb a worker that's waiting on a client.
+	 */
 
-		memset(&session, 0, sizeof(ra_session_t));
+	sact.sa_flags = SA_RESTART;
+	sact.sa_handler = &reload_config;
 
-		/* Read message 0 and 1, then generate message 2 */
+	if (sigaction(SIGHUP, &sact, NULL) == -1)
+		perror("sigaction: SIGHUP");
 
-		if (!process_msg01(msgio, ias, &msg1, &msg2, &sigrl, &config,
-						   &session))
-		{
+	/* A worker process gets these blocked from fork_workers() */
 
-			eprintf("error processing msg1\n");
-			goto disconnect;
-		}
+	sigemptyset(&sact.sa_mask);
+	sigaddset(&sact.sa_mask, SIGINT);
+	sigaddset(&sact.sa_mask, SIGTERM);
+	sigaddset(&sact.sa_mask, SIGQUIT);
+	sigaddset(&sact.sa_mask, SIGHUP);
+	sigprocmask(SIG_UNBLOCK, &sact.sa_mask, NULL);
+
+	/*
+	 * Answer new connections with a busy reply while every worker is
+	 * busy, instead of leaving them in the listen queue.
+	 */
+
+	if (!flag_stdio)
+	{
+		for (i = 0; i < nlisteners; ++i)
+		{
+			if (!listeners[i]->set_accept_nowait())
+				return 1;
+		}
+		thread(turn_away_clients).detach();
+	}
+#endif
+
+	/* If we're running in server mode, we'll block here.  */
+
+	for (i = 1; i < nlisteners; ++i)
+		workers.push_back(thread(serve_clients, listeners[i], ias[i]));
+
+	serve_clients(listeners[0], ias[0]);
+
+	for (i = 0; i < workers.size(); ++i)
+		workers[i].join();
+
+	crypto_destroy();
+
+	return 0;
+}
+
+/*
+ * Set one of the options that can also come from the config file. Anything
+ * the option replaces is freed, so this works on a copy made by
+ * config_dup() as well as on the command line settings.
+ */
+
+int config_set(config_t *config, int opt, const char *val)
+{
+	char *eptr = NULL;
+	unsigned long n;
+
+	switch (opt)
+	{
+
+	case 'A':
+	{
+		X509 *ca = NULL;
+		X509_STORE *store;
+		unsigned char hash[EVP_MAX_MD_SIZE];
+		unsigned int hashlen;
+
+		if (!cert_load_file(&ca, val))
+		{
+			crypto_perror("cert_load_file");
+			eprintf("%s: could not load IAS Signing Cert CA\n", val);
+			return 0;
+		}
+
+		store = cert_init_ca(ca);
+		if (store == NULL)
+		{
+			eprintf("%s: could not initialize certificate store\n", val);
+			X509_free(ca);
+			return 0;
+		}
+
+		if (X509_digest(ca, EVP_sha256(), hash, &hashlen) != 1)
+		{
+			crypto_perror("X509_digest");
+			X509_STORE_free(store);
+			X509_free(ca);
+			return 0;
+		}
+
+		X509_STORE_free(config->store);
+		X509_free(config->signing_ca);
+		config->signing_ca = ca;
+		memcpy(config->signing_ca_hash, hash, sizeof(config->signing_ca_hash));
+		config->store = store;
+		config->have |= CONFIG_HAVE_CA;
+
+		break;
+	}
+
+	case 'E':
+		free(config->policy_file);
+		config->policy_file = strdup(val);
+		if (config->policy_file == NULL)
+		{
+			perror("strdup");
+			return 0;
+		}
+		break;
+
+	case 'D':
+		config->allow_debug_enclave = 0;
+		break;
+
+	case 'K':
+	{
+		EVP_PKEY *key = NULL;
+
+		if (!key_load_file(&key, val, KEY_PRIVATE))
+		{
+			crypto_perror("key_load_file");
+			eprintf("%s: could not load EC private key\n", val);
+			return 0;
+		}
+
+		EVP_PKEY_free(config->service_private_key);
+		config->service_private_key = key;
+
+		break;
+	}
+
+	case 'N':
+		if (!from_hexstring((unsigned char *)&config->req_mrsigner,
+							val, 32))
+		{
+
+			eprintf("MRSIGNER must be 64-byte hex string\n");
+			return 0;
+		}
+		config->have |= CONFIG_HAVE_MRSIGNER;
+		break;
+
+	case 'R':
+		n = strtoul(val, &eptr, 10);
+		if (*eptr != '\0' || n > 0xFFFF)
+		{
+			eprintf("Product Id must be a positive integer <= 65535\n");
+			return 0;
+		}
+		config->req_isv_product_id = n;
+		config->have |= CONFIG_HAVE_PRODID;
+		break;
+
+	case 'T':
+		n = strtoul(val, &eptr, 10);
+		if (*eptr != '\0' || n > UINT_MAX)
+		{
+			eprintf("Report cache TTL must be a number of seconds\n");
+			return 0;
+		}
+		config->report_cache_ttl = (unsigned int)n;
+		break;
+
+	case 'V':
+		n = strtoul(val, &eptr, 10);
+		if (*eptr != '\0' || n > (unsigned long)0xFFFF)
+		{
+			eprintf("Minimum ISV SVN must be a positive integer <= 65535\n");
+			return 0;
+		}
+		config->min_isvsvn = n;
+		config->have |= CONFIG_HAVE_MIN_ISVSVN;
+		break;
+
+	case 'a':
+	{
+		/* A comma-separated list of advisory IDs */
+
+		string ids = val;
+		size_t pos = 0, end;
+
+		while (pos <= ids.length())
+		{
+			end = ids.find(',', pos);
+			if (end == string::npos)
+				end = ids.length();
+
+			if (end > pos &&
+				!quote_trust_allow(&config->trust, ids.substr(pos, end - pos).c_str()))
+			{
+				eprintf("%s: can't allow advisory (at most %d, of up to %d characters)\n",
+						ids.substr(pos, end - pos).c_str(),
+						QUOTE_TRUST_MAX_ADVISORIES, QUOTE_TRUST_ADVISORY_LEN - 1);
+				return 0;
+			}
+			pos = end + 1;
+		}
+
+		break;
+	}
+
+	case 'X':
+		config->strict_trust = 1;
+		break;
+
+	case 'i':
+		if (strlen(val) != IAS_SUBSCRIPTION_KEY_SIZE)
+		{
+			eprintf("IAS Subscription Key must be %d-byte hex string\n", IAS_SUBSCRIPTION_KEY_SIZE);
+			return 0;
+		}
+
+		strncpy((char *)config->pri_subscription_key, val, IAS_SUBSCRIPTION_KEY_SIZE);
+
+		break;
+
+	case 'j':
+		if (strlen(val) != IAS_SUBSCRIPTION_KEY_SIZE)
+		{
+			eprintf("IAS Secondary Subscription Key must be %d-byte hex string\n",
+					IAS_SUBSCRIPTION_KEY_SIZE);
+			return 0;
+		}
+
+		strncpy((char *)config->sec_subscription_key, val, IAS_SUBSCRIPTION_KEY_SIZE);
+
+		break;
+
+	case 'k':
+	{
+		EVP_PKEY *key = NULL;
+
+		if (!key_load(&key, val, KEY_PRIVATE))
+		{
+			crypto_perror("key_load");
+			eprintf("%s: could not load EC private key\n", val);
+			return 0;
+		}
+
+		EVP_PKEY_free(config->service_private_key);
+		config->service_private_key = key;
+
+		break;
+	}
+
+	case 'l':
+		config->quote_type = SGX_LINKABLE_SIGNATURE;
+		break;
+
+	case 's':
+		if (strlen(val) < 32)
+		{
+			eprintf("SPID must be 32-byte hex string\n");
+			return 0;
+		}
+		if (!from_hexstring((unsigned char *)&config->spid, val, 16))
+		{
+			eprintf("SPID must be 32-byte hex string\n");
+			return 0;
+		}
+		config->have |= CONFIG_HAVE_SPID;
+		break;
+
+	default:
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Config file keys, and the options they correspond to */
+
+static const struct
+{
+	const char *key;
+	int opt;
+} config_keys[] = {
+	{"IAS_REPORT_SIGNING_CA_FILE", 'A'},
+	{"ENCLAVE_POLICY_FILE", 'E'},
+	{"SERVICE_KEY_FILE", 'K'},
+	{"MRSIGNER", 'N'},
+	{"PRODID", 'R'},
+	{"REPORT_CACHE_TTL", 'T'},
+	{"MIN_ISVSVN", 'V'},
+	{"ALLOWED_ADVISORIES", 'a'},
+	{"IAS_PRIMARY_SUBSCRIPTION_KEY", 'i'},
+	{"IAS_SECONDARY_SUBSCRIPTION_KEY", 'j'},
+	{"SPID", 's'},
+	{NULL, 0}};
+
+/* A 0 or 1 setting. Like run-server, we treat an empty value as unset. */
+
+static int config_flag(const char *key, const char *val, int *flag)
+{
+	char *eptr = NULL;
+	long n;
+
+	if (*val == '\0')
+		return 1;
+
+	n = strtol(val, &eptr, 10);
+	if (*eptr != '\0')
+	{
+		eprintf("%s must be a number\n", key);
+		return 0;
+	}
+	*flag = (n != 0);
+
+	return 1;
+}
+
+/*
+ * Read a config file on top of the settings in config. It takes the
+ * same KEY=VALUE lines as the settings file that run-server reads, so
+ * the two can be shared, and keys that sp doesn't use are skipped.
+ */
+
+int config_load_file(config_t *config, const char *path)
+{
+	char line[1024];
+	int lineno = 0;
+	int rv = 1;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+	{
+		eprintf("%s: %s\n", path, strerror(errno));
+		return 0;
+	}
+
+	while (rv && fgets(line, sizeof(line), fp) != NULL)
+	{
+		char *key, *val, *end;
+		int flag;
+		unsigned int i;
+
+		++lineno;
+		if (strchr(line, '\n') == NULL && !feof(fp))
+		{
+			eprintf("%s:%d: line too long\n", path, lineno);
+			rv = 0;
+			break;
+		}
+
+		if ((end = strchr(line, '#')) != NULL)
+			*end = 0;
+
+		key = line + strspn(line, " \t");
+		end = key + strlen(key);
+		while (end > key && strchr(" \t\r\n", end[-1]) != NULL)
+			*--end = 0;
+		if (*key == '\0')
+			continue;
+
+		val = strchr(key, '=');
+		if (val == NULL)
+		{
+			eprintf("%s:%d: expected KEY=VALUE\n", path, lineno);
+			rv = 0;
+			break;
+		}
+		*val++ = 0;
+
+		/* Values can be quoted, as in a shell script */
+
+		if (end - val >= 2 && (*val == '"' || *val == '\'') &&
+			end[-1] == *val)
+		{
+			end[-1] = 0;
+			++val;
+		}
+
+		if (strcmp(key, "ALLOW_DEBUG_ENCLAVE") == 0)
+			rv = config_flag(key, val, &config->allow_debug_enclave);
+		else if (strcmp(key, "POLICY_STRICT_TRUST") == 0)
+			rv = config_flag(key, val, &config->strict_trust);
+		else if (strcmp(key, "LINKABLE") == 0)
+		{
+			flag = (config->quote_type == SGX_LINKABLE_SIGNATURE);
+			rv = config_flag(key, val, &flag);
+			config->quote_type = (flag) ? SGX_LINKABLE_SIGNATURE : SGX_UNLINKABLE_SIGNATURE;
+		}
+		else if (*val != '\0')
+		{
+			for (i = 0; config_keys[i].key != NULL; ++i)
+			{
+				if (strcmp(key, config_keys[i].key) == 0)
+				{
+					rv = config_set(config, config_keys[i].opt, val);
+					break;
+				}
+			}
+		}
+
+		if (!rv)
+			eprintf("%s:%d: invalid setting for %s\n", path, lineno, key);
+	}
+
+	fclose(fp);
+
+	return rv;
+}
+
+/* Make sure we have all the required settings */
+
+int config_check(const config_t *config)
+{
+	int rv = 1;
+
+	if (!(config->have & CONFIG_HAVE_SPID))
+	{
+		eprintf("--spid or --spid-file is required\n");
+		rv = 0;
+	}
+
+	if (!(config->have & CONFIG_HAVE_CA))
+	{
+		eprintf("--ias-signing-cafile is required\n");
+		rv = 0;
+	}
+
+	/* An enclave policy file takes the place of -N, -R and -V */
+
+	if (config->policy_file != NULL)
+		return rv;
+
+	if (!(config->have & CONFIG_HAVE_PRODID))
+	{
+		eprintf("--isv-product-id is required\n");
+		rv = 0;
+	}
+
+	if (!(config->have & CONFIG_HAVE_MIN_ISVSVN))
+	{
+		eprintf("--min-isvsvn is required\n");
+		rv = 0;
+	}
+
+	if (!(config->have & CONFIG_HAVE_MRSIGNER))
+	{
+		eprintf("--mrsigner is required\n");
+		rv = 0;
+	}
+
+	return rv;
+}
+
+/*
+ * Read the config file, if there is one, on top of the settings in
+ * config, and then apply the command line options that it can also
+ * set again, so that those on the command line win.
+ */
+
+int config_file_apply(config_t *config)
+{
+	size_t i;
+
+	if (config_file == NULL)
+		return 1;
+
+	if (!config_load_file(config, config_file))
+		return 0;
+
+	for (i = 0; i < cmdline_opts.size(); ++i)
+	{
+		if (!config_set(config, cmdline_opts[i].first,
+						cmdline_opts[i].second.c_str()))
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Build the enclave policy for a configuration from its settings */
+
+int config_load_policy(config_t *config)
+{
+#ifndef _WIN32
+	enclave_rule_t rule;
+
+	if (config->policy_file != NULL)
+	{
+		config->policy = enclave_policy_load(config->policy_file);
+		return (config->policy != NULL);
+	}
+
+	memset(&rule, 0, sizeof(rule));
+	rule.mr_signer = config->req_mrsigner;
+	rule.isv_prod_id = config->req_isv_product_id;
+	rule.min_isvsvn = config->min_isvsvn;
+	rule.allow_debug = 1;
+
+	config->policy = enclave_policy_new(&rule);
+
+	return (config->policy != NULL);
+#else
+	/* Windows implementation is not available yet */
+	return 1;
+#endif
+}
+
+/*
+ * Copy a configuration. The copy holds its own references to the keys
+ * and certificates, so either can be freed first.
+ */
+
+config_t *config_dup(const config_t *src)
+{
+	config_t *config;
+
+	config = (config_t *)malloc(sizeof(config_t));
+	if (config == NULL)
+	{
+		perror("malloc");
+		return NULL;
+	}
+
+	memcpy(config, src, sizeof(config_t));
+	config->policy = NULL;
+	config->proxy_server = (src->proxy_server) ? strdup(src->proxy_server) : NULL;
+	config->ca_bundle = (src->ca_bundle) ? strdup(src->ca_bundle) : NULL;
+	config->user_agent = (src->user_agent) ? strdup(src->user_agent) : NULL;
+	config->policy_file = (src->policy_file) ? strdup(src->policy_file) : NULL;
+
+	if (config->service_private_key != NULL)
+		EVP_PKEY_up_ref(config->service_private_key);
+	if (config->store != NULL)
+		X509_STORE_up_ref(config->store);
+	if (config->signing_ca != NULL)
+		X509_up_ref(config->signing_ca);
+
+	if ((src->proxy_server && !config->proxy_server) ||
+		(src->ca_bundle && !config->ca_bundle) ||
+		(src->user_agent && !config->user_agent) ||
+		(src->policy_file && !config->policy_file))
+	{
+		perror("strdup");
+		config_free(config);
+		return NULL;
+	}
+
+	return config;
+}
+
+void config_free(config_t *config)
+{
+	free(config->proxy_server);
+	free(config->ca_bundle);
+	free(config->user_agent);
+	free(config->policy_file);
+	EVP_PKEY_free(config->service_private_key);
+	X509_STORE_free(config->store);
+	X509_free(config->signing_ca);
+#ifndef _WIN32
+	enclave_policy_free(config->policy);
+#endif
+
+	memset(config, 0, sizeof(config_t));
+	free(config);
+}
+
+/*
+ * Build a new configuration from the command line and the config file,
+ * and swap it in. Requests in progress finish with the configuration
+ * they started with. If anything is wrong with the new one, we keep the
+ * one we have.
+ */
+
+int config_reload()
+{
+	lock_guard<mutex> lock(config_mutex);
+	config_t *config;
+
+	config = config_dup(cmdline_config);
+	if (config == NULL)
+		return 0;
+
+	if (!config_file_apply(config) || !config_check(config) ||
+		!config_load_policy(config))
+	{
+		eprintf("keeping the current configuration\n");
+		config_free(config);
+		return 0;
+	}
+
+	atomic_store(&current_config,
+				 shared_ptr<const config_t>(config, config_free));
+
+	eprintf("configuration reloaded\n");
+
+	return 1;
+}
+
+/*
+ * The configuration to use for a request. If we've had a SIGHUP, the
+ * first worker to get here reloads it.
+ */
+
+shared_ptr<const config_t> config_current()
+{
+	if (reload_requested.exchange(0))
+		config_reload();
+
+	return atomic_load(&current_config);
+}
+
+/*
+ * Create and configure an IAS request object. Each worker gets its own
+ * since the connection caches its user agent.
+ */
+
+IAS_Connection *ias_connect(const config_t *config, int production, int noproxy)
+{
+	IAS_Connection *ias = NULL;
+
+	try
+	{
+		ias = new IAS_Connection(
+			(production) ? IAS_SERVER_PRODUCTION : IAS_SERVER_DEVELOPMENT,
+			0,
+			(char *)(config->pri_subscription_key),
+			(char *)(config->sec_subscription_key));
+	}
+	catch (...)
+	{
+		eprintf("exception while creating IAS request object\n");
+		return NULL;
+	}
+
+	if (noproxy)
+		ias->proxy_mode(IAS_PROXY_NONE);
+	else if (config->proxy_server != NULL)
+	{
+		ias->proxy_mode(IAS_PROXY_FORCE);
+		ias->proxy(config->proxy_server, config->proxy_port);
+	}
+
+	if (config->user_agent != NULL)
+	{
+		if (!ias->agent(config->user_agent))
+		{
+			eprintf("%s: unknown user agent\n", config->user_agent);
+			delete ias;
+			return NULL;
+		}
+	}
+
+	/*
+	 * Set the cert store for this connection. This is used for verifying
+	 * the IAS signing certificate, not the TLS connection with IAS (the
+	 * latter is handled using config->ca_bundle).
+	 */
+	ias->cert_store(config->store, config->signing_ca_hash);
+
+	/*
+	 * Set the CA bundle for verifying the IAS server certificate used
+	 * for the TLS session. If this isn't set, then the user agent
+	 * will fall back to its default.
+	 */
+	if (strlen(config->ca_bundle))
+		ias->ca_bundle(config->ca_bundle);
+
+	return ias;
+}
+
+/*
+ * Give an IAS connection the subscription keys and signing CA from a
+ * new configuration. Proxy and user agent settings can't be reloaded.
+ */
+
+void ias_apply_config(IAS_Connection *ias, const config_t *config)
+{
+	ias->setSubscriptionKeys((char *)config->pri_subscription_key,
+							 (char *)config->sec_subscription_key);
+	ias->cert_store(config->store, config->signing_ca_hash);
+}
+
+/*
+ * Serve clients on one listening socket until it fails. Each worker
+ * runs one of these.
+ */
+
+void serve_clients(MsgIO *msgio, IAS_Connection *ias)
+{
+	shared_ptr<const config_t> config;
+	shared_ptr<const config_t> applied = config_current();
+	stream_set_t streams;
+	char *sigrl = NULL;
+
+	streams.active = 0;
+
+	msgio->set_write_timeout(SP_WRITE_TIMEOUT);
+
+	while (msgio->server_loop())
+	{
+		ra_conn_t conn;
+		int muxed = 0;
+
+		memset(&conn, 0, sizeof(ra_conn_t));
+		msgio->set_max_message(SP_REQUEST_MAX);
+
+		{
+			lock_guard<mutex> lock(busy_mutex);
+
+			if (++busy_workers == nlisteners)
+				all_busy.notify_one();
+		}
+
+		/*
+		 * A connection starts with msg0||msg1. Once the client has
+		 * been attested it can keep the connection open and send
+		 * extension requests (see protocol.h). A gateway can run many
+		 * of these on one connection as separate streams, which we
+		 * hand off to their own threads.
+		 */
+
+		while (1)
+		{
+			void *msg = NULL;
+			size_t sz = 0;
+			uint32_t id;
+			int rv;
+
+			if (!muxed)
+				fprintf(stderr, (conn.attested) ? "Waiting for request\n" :
+												  "Waiting for msg0||msg1\n");
+
+			/*
+			 * A new connection has to start attesting promptly. After
+			 * that, the client can sit idle between requests for a
+			 * while.
+			 */
+
+			if (muxed || conn.attested)
+				msgio->set_deadline(SP_IDLE_TIMEOUT);
+			else
+				msgio->set_deadline(SP_MSG01_TIMEOUT);
+
+			rv = msgio->read_stream(&id, &msg, &sz);
+			if (rv == -1)
+			{
+				eprintf("system error reading request\n");
+				goto disconnect;
+			}
+			else if (rv == 0)
+			{
+				/* EOF after a completed attestation is normal. */
+				if (!muxed && !conn.attested)
+					eprintf("protocol error reading msg0||msg1\n");
+				goto disconnect;
+			}
+
+			if (id != 0)
+			{
+				/* Any stream could be sending msg3 */
+				if (!muxed)
+					msgio->set_max_message(SP_MSG3_MAX);
+				muxed = 1;
+
+				/* msg is NULL if the client closed the stream */
+				if (msg != NULL && !start_stream(msgio, &streams, id, msg, sz))
+				{
+					if (msgio->close_stream(id) == -1)
+						goto disconnect;
+				}
+				continue;
+			}
+
+			/*
+			 * Each request runs under the latest configuration. Our IAS
+			 * connection points into the configuration it was last given,
+			 * so we keep a reference to that one.
+			 */
+
+			config = config_current();
+			if (config != applied)
+			{
+				ias_apply_config(ias, config.get());
+				applied = config;
+			}
+
+			if (!serve_message(msgio, ias, config.get(), &conn, &sigrl,
+							   msg, sz))
+				goto disconnect;
+		}
+
+	disconnect:
+		/*
+		 * The stream threads find out the connection is gone when they
+		 * next read from it. Wait for them before closing it.
+		 */
+		{
+			unique_lock<mutex> lock(streams.lock);
+
+			while (streams.active)
+				streams.done.wait(lock);
+		}
+		memset(&conn, 0, sizeof(ra_conn_t));
+		msgio->disconnect();
+		--busy_workers;
+	}
+}
+
+/*
+ * Start a thread for a new stream, which takes ownership of its first
+ * message. Returns 0 if the stream should be closed instead.
+ */
+
+int start_stream(MsgIO *msgio, stream_set_t *streams, uint32_t id,
+				 void *msg, size_t sz)
+{
+	MsgIO *stream;
+
+	if (sz / 2 > SP_REQUEST_MAX)
+	{
+		eprintf("stream %u: message too large\n", id);
+		free(msg);
+		return 0;
+	}
+
+	stream = msgio->open_stream(id);
+	if (stream == NULL)
+	{
+		free(msg);
+		return 0;
+	}
+
+	{
+		lock_guard<mutex> lock(streams->lock);
+
+		++streams->active;
+	}
+
+	try
+	{
+		thread(serve_stream, stream, streams, msg, sz).detach();
+	}
+	catch (...)
+	{
+		/* Deleting the stream's MsgIO closes the stream */
+		eprintf("stream %u: could not start a thread\n", id);
+		free(msg);
+		delete stream;
+
+		lock_guard<mutex> lock(streams->lock);
+
+		--streams->active;
+	}
+
+	return 1;
+}
+
+/*
+ * Serve one stream of a multiplexed connection until it's closed, or
+ * sits idle for too long. Runs in its own thread, with its own IAS
+ * connection.
+ */
+
+void serve_stream(MsgIO *stream, stream_set_t *streams, void *msg, size_t sz)
+{
+	shared_ptr<const config_t> config;
+	ias_slot_t slot;
+	ra_conn_t conn;
+	char *sigrl = NULL;
+
+	slot.ias = NULL;
+	{
+		lock_guard<mutex> lock(streams->lock);
+
+		if (!streams->idle.empty())
+		{
+			slot = streams->idle.back();
+			streams->idle.pop_back();
+		}
+	}
+
+	memset(&conn, 0, sizeof(ra_conn_t));
+	stream->set_max_message(SP_REQUEST_MAX);
+
+	do
+	{
+		config = config_current();
+		if (slot.ias == NULL)
+		{
+			slot.ias = ias_connect(config.get(), flag_prod, flag_noproxy);
+			if (slot.ias == NULL)
+			{
+				free(msg);
+				break;
+			}
+			slot.applied = config;
+		}
+		else if (config != slot.applied)
+		{
+			ias_apply_config(slot.ias, config.get());
+			slot.applied = config;
+		}
+
+		if (!serve_message(stream, slot.ias, config.get(), &conn, &sigrl,
+						   msg, sz))
+			break;
+
+		stream->set_deadline(SP_IDLE_TIMEOUT);
+	} while (stream->read(&msg, &sz) == 1);
+
+	memset(&conn, 0, sizeof(ra_conn_t));
+	free(sigrl);
+
+	/* This closes the stream */
+	delete stream;
+
+	lock_guard<mutex> lock(streams->lock);
+
+	if (slot.ias != NULL)
+		streams->idle.push_back(slot);
+	--streams->active;
+	streams->done.notify_all();
+}
+
+#ifndef _WIN32
+
+/*
+ * Turn away new connections while every worker in this process is busy.
+ * Each worker serves one connection at a time, so until one of them
+ * finishes, a new connection would just sit in a listen queue where
+ * admit_session() can't tell it to come back later. Runs in its own
+ * thread.
+ */
+
+void turn_away_clients()
+{
+	struct pollfd pfd[SP_MAX_WORKERS];
+	unsigned int i;
+
+	for (i = 0; i < nlisteners; ++i)
+	{
+		pfd[i].fd = listeners[i]->listen_socket();
+		pfd[i].events = POLLIN;
+	}
+
+	while (1)
+	{
+		{
+			unique_lock<mutex> lock(busy_mutex);
+
+			while (busy_workers < nlisteners)
+				all_busy.wait(lock);
+		}
+
+		/* Check again now and then, since a worker may have freed up */
+
+		if (poll(pfd, nlisteners, SP_RETRY_AFTER) == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			return;
+		}
+
+		for (i = 0; i < nlisteners && busy_workers == nlisteners; ++i)
+		{
+			MsgIO *client;
+			void *msg = NULL;
+			size_t sz;
+			uint32_t id;
+
+			if (!(pfd[i].revents & POLLIN))
+				continue;
+
+			/* NULL if a worker that just freed up got there first */
+
+			client = listeners[i]->accept_client();
+			if (client == NULL)
+				continue;
+
+			/*
+			 * Wait for the client's first message, so the reply isn't
+			 * lost to a reset when we close on the data we didn't read.
+			 */
+
+			client->set_write_timeout(SP_WRITE_TIMEOUT);
+			client->set_max_message(SP_REQUEST_MAX);
+			client->set_deadline(SP_BUSY_READ_TIMEOUT);
+			if (client->read_stream(&id, &msg, &sz) == 1 && msg != NULL)
+			{
+				if (verbose)
+					eprintf("busy: turning away a new connection\n");
+				client->set_stream(id);
+				send_busy(client);
+			}
+			free(msg);
+			client->disconnect();
+			delete client;
+		}
+	}
+}
+
+#endif
+
+/*
+ * Handle one message from a client, which we take ownership of.
+ * Returns 0 if the connection (or stream) should be closed.
+ */
+
+int serve_message(MsgIO *msgio, IAS_Connection *ias, const config_t *config,
+				  ra_conn_t *conn, char **sigrl, void *msg, size_t sz)
+{
+	sgx_ra_msg1_t msg1;
+	sgx_ra_msg2_t msg2;
+	ra_msg4_t msg4;
+	msgio_iov_t iov[2];
+	uint32_t type;
+	int rv;
+
+	if (sz / 2 < sizeof(uint32_t))
+	{
+		eprintf("protocol error: short message\n");
+		free(msg);
+		return 0;
+	}
+
+	type = *(uint32_t *)msg;
+
+	if (!conn->attested && type == RA_MSG_TYPE_RESUME &&
+		sz / 2 == sizeof(ra_resume_request_t))
+	{
+		rv = process_resume(msgio, (ra_resume_request_t *)msg,
+							config, &conn->session);
+		free(msg);
+		if (!rv)
+		{
+			eprintf("error resuming session\n");
+			return 0;
+		}
+
+		conn->attested = 1;
+	}
+	else if (!conn->attested)
+	{
+		if (sz / 2 != sizeof(ra_msg01_t))
+		{
+			eprintf("protocol error: bad msg0||msg1 size\n");
+			free(msg);
+			return 0;
+		}
+
+		if (!admit_session(msgio, config))
+		{
+			free(msg);
+			return 0;
+		}
+
+		/* Read message 0 and 1, then generate message 2 */
+
+		rv = process_msg01((ra_msg01_t *)msg, ias, &msg1, &msg2,
+						   sigrl, config, &conn->session);
+		free(msg);
+		if (!rv)
+		{
+			--sessions_inflight;
+			eprintf("error processing msg1\n");
+			return 0;
+		}
 
 		/* Send message 2 */
 
@@ -858,46 +1912,135 @@ int main(int argc, char *argv[])
 		 * portion and the array portion by hand.
 		 */
 
-		dividerWithText(stderr, "Copy/Paste Msg2 Below to Client");
-		dividerWithText(fplog, "Msg2 (send to Client)");
+		dividerWithText(stderr, "Copy/Paste Msg2 Below to Client");
+		dividerWithText(fplog, "Msg2 (send to Client)");
+
+		iov[0].base = &msg2;
+		iov[0].len = sizeof(sgx_ra_msg2_t);
+		iov[1].base = *sigrl;
+		iov[1].len = msg2.sig_rl_size;
+		if (msgio->sendv(iov, 2) == -1)
+		{
+			--sessions_inflight;
+			eprintf("system error sending msg2\n");
+			return 0;
+		}
+
+		fsend_msg_partial(fplog, (void *)&msg2, sizeof(sgx_ra_msg2_t));
+		fsend_msg(fplog, *sigrl, msg2.sig_rl_size);
+
+		edivider();
+
+		/* Read message 3, and generate message 4 */
+
+		rv = process_msg3(msgio, ias, &msg1, &msg4, config,
+						  &conn->session);
+		--sessions_inflight;
+		if (!rv)
+		{
+			eprintf("error processing msg3\n");
+			return 0;
+		}
+
+		conn->session.status = msg4.status;
+		conn->attested = 1;
+	}
+	else if (type == RA_MSG_TYPE_PROOF &&
+			 sz / 2 == sizeof(ra_proof_request_t))
+	{
+		rv = process_proof(msgio, (ra_proof_request_t *)msg,
+						   &conn->session);
+		free(msg);
+		if (!rv)
+		{
+			eprintf("error processing proof\n");
+			return 0;
+		}
+	}
+	else if (type == RA_MSG_TYPE_CHANNEL &&
+			 sz / 2 == sizeof(ra_channel_request_t))
+	{
+		rv = process_channel(msgio, (ra_channel_request_t *)msg,
+							 &conn->session);
+		free(msg);
+		if (!rv)
+		{
+			eprintf("error opening secure channel\n");
+			return 0;
+		}
+	}
+	else if (type == RA_MSG_TYPE_RECORD &&
+			 sz / 2 >= sizeof(ra_record_header_t) &&
+			 sz / 2 == sizeof(ra_record_header_t) +
+						   ((ra_record_header_t *)msg)->len)
+	{
+		rv = process_record(msgio, (ra_record_header_t *)msg,
+							&conn->session);
+		free(msg);
+		if (!rv)
+		{
+			eprintf("error processing record\n");
+			return 0;
+		}
+	}
+	else
+	{
+		eprintf("protocol error: unexpected message type %08x\n",
+				type);
+		free(msg);
+		return 0;
+	}
+
+	return 1;
+}
 
-		msgio->send_partial((void *)&msg2, sizeof(sgx_ra_msg2_t));
-		fsend_msg_partial(fplog, (void *)&msg2, sizeof(sgx_ra_msg2_t));
+/*
+ * Admission control. Take a slot for a new attestation if we're under
+ * our limits, otherwise tell the client to come back later. The caller
+ * gives the slot back once msg4 is sent or the attestation fails.
+ */
 
-		msgio->send(sigrl, msg2.sig_rl_size);
-		fsend_msg(fplog, sigrl, msg2.sig_rl_size);
+int admit_session(MsgIO *msgio, const config_t *config)
+{
+	if (ias_inflight < config->max_ias_requests)
+	{
+		if (++sessions_inflight <= config->max_sessions)
+			return 1;
+		--sessions_inflight;
+	}
 
-		edivider();
+	if (verbose)
+		eprintf("busy: turning away a new attestation\n");
 
-		/* Read message 3, and generate message 4 */
+	send_busy(msgio);
 
-		if (!process_msg3(msgio, ias, &msg1, &msg4, &config, &session))
-		{
-			eprintf("error processing msg3\n");
-			goto disconnect;
-		}
+	return 0;
+}
 
-	disconnect:
-		msgio->disconnect();
-	}
+/* Ask the client to come back later (see ra_busy_t) */
 
-	crypto_destroy();
+void send_busy(MsgIO *msgio)
+{
+	ra_busy_t busy;
 
-	return 0;
+	busy.type = RA_MSG_TYPE_BUSY;
+	busy.retry_after = SP_RETRY_AFTER;
+	if (msgio->send(&busy, sizeof(busy)) == -1)
+		eprintf("system error sending busy\n");
 }
 
 int process_msg3(MsgIO *msgio, IAS_Connection *ias, sgx_ra_msg1_t *msg1,
-				 ra_msg4_t *msg4, config_t *config, ra_session_t *session)
+				 ra_msg4_t *msg4, const config_t *config, ra_session_t *session)
 {
 	sgx_ra_msg3_t *msg3;
-	size_t blen = 0;
 	size_t sz;
 	int rv;
 	uint32_t quote_sz;
-	char *buffer = NULL;
 	char *b64quote;
 	sgx_mac_t vrfymac;
 	sgx_quote_t *q;
+	ra_ticket_t ticket;
+	msgio_iov_t iov[3];
 
 	/*
 	 * Read our incoming message. We're using base16 encoding/hex strings
@@ -917,7 +2060,11 @@ int process_msg3(MsgIO *msgio, IAS_Connection *ias, sgx_ra_msg1_t *msg1,
 	 *
 	 */
 
+	msgio->set_deadline(SP_MSG3_TIMEOUT);
+	msgio->set_max_message(SP_MSG3_MAX);
+
 	rv = msgio->read((void **)&msg3, &sz);
+	msgio->set_max_message(SP_REQUEST_MAX);
 	if (rv == -1)
 	{
 		eprintf("system error reading msg3\n");
@@ -1055,8 +2202,13 @@ int process_msg3(MsgIO *msgio, IAS_Connection *ias, sgx_ra_msg1_t *msg1,
 		return 0;
 	}
 
-	if (get_attestation_report(ias, config->apiver, b64quote,
-							   msg3->ps_sec_prop, msg4, config->strict_trust))
+	++ias_inflight;
+	rv = get_attestation_report(ias, config->apiver, b64quote, msg4,
+								config->strict_trust, &config->trust,
+								config->report_cache_ttl);
+	--ias_inflight;
+
+	if (rv)
 	{
 
 		unsigned char vfy_rdata[64];
@@ -1124,17 +2276,16 @@ int process_msg3(MsgIO *msgio, IAS_Connection *ias, sgx_ra_msg1_t *msg1,
 		 * prevent outdated/deprecated software from successfully
 		 * attesting, and ensuring the TCB is not out of date.
 		 *
-		 * A real-world service provider might allow multiple ISV_SVN
-		 * values, but for this sample we only allow the enclave that
-		 * is compiled.
+		 * The enclave policy (-E) can allow several signers, products
+		 * and builds, each with its own minimum ISV_SVN. Without one
+		 * we only allow the enclave that is compiled.
 		 */
 
 #ifndef _WIN32
 		/* Windows implementation is not available yet */
 
-		if (!verify_enclave_identity(config->req_mrsigner,
-									 config->req_isv_product_id, config->min_isvsvn,
-									 config->allow_debug_enclave, r))
+		if (!enclave_policy_verify(config->policy, r,
+								   config->allow_debug_enclave))
 		{
 
 			eprintf("Invalid enclave.\n");
@@ -1167,19 +2318,6 @@ int process_msg3(MsgIO *msgio, IAS_Connection *ias, sgx_ra_msg1_t *msg1,
 					hexstring(&r->report_data, sizeof(sgx_report_data_t)));
 		}
 
-		edividerWithText("Copy/Paste Msg4 Below to Client");
-
-		/* Serialize the members of the Msg4 structure independently */
-		/* vs. the entire structure as one send_msg() */
-
-		msgio->send_partial(&msg4->status, sizeof(msg4->status));
-		msgio->send(&msg4->platformInfoBlob, sizeof(msg4->platformInfoBlob));
-
-		fsend_msg_partial(fplog, &msg4->status, sizeof(msg4->status));
-		fsend_msg(fplog, &msg4->platformInfoBlob,
-				  sizeof(msg4->platformInfoBlob));
-		edivider();
-
 		/*
 		 * If the enclave is trusted, derive the MK and SK. Also get
 		 * SHA256 hashes of these so we can verify there's a shared
@@ -1211,6 +2349,45 @@ int process_msg3(MsgIO *msgio, IAS_Connection *ias, sgx_ra_msg1_t *msg1,
 				eprintf("SHA256(SK) = %s\n", hexstring(hashsk, 32));
 			}
 		}
+
+		edividerWithText("Copy/Paste Msg4 Below to Client");
+
+		/* Serialize the members of the Msg4 structure independently */
+		/* vs. the entire structure as one send_msg() */
+
+		iov[0].base = &msg4->status;
+		iov[0].len = sizeof(msg4->status);
+		iov[1].base = &msg4->platformInfoBlob;
+		iov[1].len = sizeof(msg4->platformInfoBlob);
+		fsend_msg_partial(fplog, &msg4->status, sizeof(msg4->status));
+
+		/* A Trusted msg4 carries a session ticket after the PIB */
+
+		if (msg4->status == Trusted && ticket_issue(config, session, r, &ticket))
+		{
+			iov[2].base = &ticket;
+			iov[2].len = sizeof(ticket);
+			rv = msgio->sendv(iov, 3);
+
+			fsend_msg_partial(fplog, &msg4->platformInfoBlob,
+							  sizeof(msg4->platformInfoBlob));
+			fsend_msg(fplog, &ticket, sizeof(ticket));
+		}
+		else
+		{
+			rv = msgio->sendv(iov, 2);
+			fsend_msg(fplog, &msg4->platformInfoBlob,
+					  sizeof(msg4->platformInfoBlob));
+		}
+		edivider();
+
+		if (rv == -1)
+		{
+			eprintf("system error sending msg4\n");
+			free(msg3);
+			free(b64quote);
+			return 0;
+		}
 	}
 	else
 	{
@@ -1227,45 +2404,20 @@ int process_msg3(MsgIO *msgio, IAS_Connection *ias, sgx_ra_msg1_t *msg1,
 }
 
 /*
- * Read and process message 0 and message 1. These messages are sent by
- * the client concatenated together for efficiency (msg0||msg1).
+ * Process message 0 and message 1. These messages are sent by the
+ * client concatenated together for efficiency (msg0||msg1).
  */
 
-int process_msg01(MsgIO *msgio, IAS_Connection *ias, sgx_ra_msg1_t *msg1,
-				  sgx_ra_msg2_t *msg2, char **sigrl, config_t *config, ra_session_t *session)
+int process_msg01(ra_msg01_t *msg01, IAS_Connection *ias,
+				  sgx_ra_msg1_t *msg1, sgx_ra_msg2_t *msg2, char **sigrl,
+				  const config_t *config, ra_session_t *session)
 {
-	struct msg01_struct
-	{
-		uint32_t msg0_extended_epid_group_id;
-		sgx_ra_msg1_t msg1;
-	} * msg01;
-	size_t blen = 0;
-	char *buffer = NULL;
 	unsigned char digest[32], r[32], s[32], gb_ga[128];
 	EVP_PKEY *Gb;
 	int rv;
 
 	memset(msg2, 0, sizeof(sgx_ra_msg2_t));
 
-	/*
-	 * Read our incoming message. We're using base16 encoding/hex strings
-	 * so we should end up with sizeof(msg)*2 bytes.
-	 */
-
-	fprintf(stderr, "Waiting for msg0||msg1\n");
-
-	rv = msgio->read((void **)&msg01, NULL);
-	if (rv == -1)
-	{
-		eprintf("system error reading msg0||msg1\n");
-		return 0;
-	}
-	else if (rv == 0)
-	{
-		eprintf("protocol error reading msg0||msg1\n");
-		return 0;
-	}
-
 	if (verbose)
 	{
 		edividerWithText("Msg0 Details (from Client)");
@@ -1283,7 +2435,6 @@ int process_msg01(MsgIO *msgio, IAS_Connection *ias, sgx_ra_msg1_t *msg1,
 	if (msg01->msg0_extended_epid_group_id != 0)
 	{
 		eprintf("msg0 Extended Epid Group ID is not zero.  Exiting.\n");
-		free(msg01);
 		return 0;
 	}
 
@@ -1311,7 +2462,6 @@ int process_msg01(MsgIO *msgio, IAS_Connection *ias, sgx_ra_msg1_t *msg1,
 	if (Gb == NULL)
 	{
 		eprintf("Could not create a session key\n");
-		free(msg01);
 		return 0;
 	}
 
@@ -1327,7 +2477,6 @@ int process_msg01(MsgIO *msgio, IAS_Connection *ias, sgx_ra_msg1_t *msg1,
 	if (!derive_kdk(Gb, session->kdk, msg1->g_a, config))
 	{
 		eprintf("Could not derive the KDK\n");
-		free(msg01);
 		return 0;
 	}
 
@@ -1388,76 +2537,473 @@ int process_msg01(MsgIO *msgio, IAS_Connection *ias, sgx_ra_msg1_t *msg1,
 	 * structure definition in sgx_ra_msg2_t
 	 */
 
-	key_to_sgx_ec256(&msg2->g_b, Gb);
-	memcpy(&msg2->spid, &config->spid, sizeof(sgx_spid_t));
-	msg2->quote_type = config->quote_type;
-	msg2->kdf_id = 1;
+	key_to_sgx_ec256(&msg2->g_b, Gb);
+	memcpy(&msg2->spid, &config->spid, sizeof(sgx_spid_t));
+	msg2->quote_type = config->quote_type;
+	msg2->kdf_id = 1;
+
+	/* Get the sigrl */
+
+	++ias_inflight;
+	rv = get_sigrl(ias, config->apiver, msg1->gid, sigrl,
+				   &msg2->sig_rl_size);
+	--ias_inflight;
+
+	if (!rv)
+	{
+
+		eprintf("could not retrieve the sigrl\n");
+		return 0;
+	}
+
+	memcpy(gb_ga, &msg2->g_b, 64);
+	memcpy(session->g_b, &msg2->g_b, 64);
+
+	memcpy(&gb_ga[64], &msg1->g_a, 64);
+	memcpy(session->g_a, &msg1->g_a, 64);
+
+	if (debug)
+		eprintf("+++ GbGa = %s\n", hexstring(gb_ga, 128));
+
+	ecdsa_sign(gb_ga, 128, config->service_private_key, r, s, digest);
+	reverse_bytes(&msg2->sign_gb_ga.x, r, 32);
+	reverse_bytes(&msg2->sign_gb_ga.y, s, 32);
+
+	if (debug)
+	{
+		eprintf("+++ sha256(GbGa) = %s\n", hexstring(digest, 32));
+		eprintf("+++ r = %s\n", hexstring(r, 32));
+		eprintf("+++ s = %s\n", hexstring(s, 32));
+	}
+
+	/* The "A" component is conveniently at the start of sgx_ra_msg2_t */
+
+	cmac128(session->smk, (unsigned char *)msg2, 148,
+			(unsigned char *)&msg2->mac);
+
+	if (verbose)
+	{
+		edividerWithText("Msg2 Details");
+		eprintf("msg2.g_b.gx      = %s\n",
+				hexstring(&msg2->g_b.gx, sizeof(msg2->g_b.gx)));
+		eprintf("msg2.g_b.gy      = %s\n",
+				hexstring(&msg2->g_b.gy, sizeof(msg2->g_b.gy)));
+		eprintf("msg2.spid        = %s\n",
+				hexstring(&msg2->spid, sizeof(msg2->spid)));
+		eprintf("msg2.quote_type  = %s\n",
+				hexstring(&msg2->quote_type, sizeof(msg2->quote_type)));
+		eprintf("msg2.kdf_id      = %s\n",
+				hexstring(&msg2->kdf_id, sizeof(msg2->kdf_id)));
+		eprintf("msg2.sign_ga_gb  = %s\n",
+				hexstring(&msg2->sign_gb_ga, sizeof(msg2->sign_gb_ga)));
+		eprintf("msg2.mac         = %s\n",
+				hexstring(&msg2->mac, sizeof(msg2->mac)));
+		eprintf("msg2.sig_rl_size = %s\n",
+				hexstring(&msg2->sig_rl_size, sizeof(msg2->sig_rl_size)));
+		edivider();
+	}
+
+	return 1;
+}
+
+/* proof.mac = AES-CMAC(SK, ROLE || challenge || proof.nonce) */
+
+static void proof_mac(unsigned char sk[16], uint32_t role,
+					  sgx_quote_nonce_t *challenge, sgx_quote_nonce_t *nonce,
+					  sgx_mac_t mac)
+{
+	unsigned char msg[sizeof(uint32_t) + 2 * sizeof(sgx_quote_nonce_t)];
+
+	memcpy(msg, &role, sizeof(uint32_t));
+	memcpy(&msg[sizeof(uint32_t)], challenge, sizeof(sgx_quote_nonce_t));
+	memcpy(&msg[sizeof(uint32_t) + sizeof(sgx_quote_nonce_t)], nonce,
+		   sizeof(sgx_quote_nonce_t));
+
+	cmac128(sk, msg, sizeof(msg), (unsigned char *)mac);
+}
+
+/*
+ * Run one proof-of-possession round (see protocol.h). We answer the
+ * client's challenge, and our own nonce becomes the challenge the
+ * client has to answer.
+ */
+
+int process_proof(MsgIO *msgio, ra_proof_request_t *req,
+				  ra_session_t *session)
+{
+	ra_proof_t proof;
+	ra_proof_t *client_proof;
+	sgx_mac_t vrfymac;
+	attestation_status_t result = NotTrusted;
+	size_t sz;
+	int rv;
+
+	if (session->status != Trusted)
+	{
+		eprintf("proof requested on an untrusted session\n");
+		return 0;
+	}
+
+	if (RAND_bytes((unsigned char *)&proof.nonce, sizeof(proof.nonce)) != 1)
+	{
+		crypto_perror("RAND_bytes");
+		return 0;
+	}
+
+	proof_mac(session->sk, RA_PROOF_ROLE_SERVER, &req->challenge,
+			  &proof.nonce, proof.mac);
+
+	if (msgio->send(&proof, sizeof(proof)) == -1)
+	{
+		eprintf("system error sending proof\n");
+		return 0;
+	}
+
+	rv = msgio->read((void **)&client_proof, &sz);
+	if (rv == -1)
+	{
+		eprintf("system error reading proof\n");
+		return 0;
+	}
+	else if (rv == 0)
+	{
+		eprintf("protocol error reading proof\n");
+		return 0;
+	}
+	if (sz / 2 != sizeof(ra_proof_t))
+	{
+		eprintf("protocol error: bad proof size\n");
+		free(client_proof);
+		return 0;
+	}
+
+	proof_mac(session->sk, RA_PROOF_ROLE_CLIENT, &proof.nonce,
+			  &client_proof->nonce, vrfymac);
+
+	if (!CRYPTO_memcmp(vrfymac, client_proof->mac, sizeof(sgx_mac_t)))
+		result = Trusted;
+
+	free(client_proof);
+
+	if (debug)
+		eprintf("+++ client proof of possession %s\n",
+				(result == Trusted) ? "verified" : "FAILED");
+
+	if (msgio->send(&result, sizeof(result)) == -1)
+	{
+		eprintf("system error sending proof result\n");
+		return 0;
+	}
+
+	return (result == Trusted);
+}
+
+/*
+ * Open the secure channel (see protocol.h) by deriving a record key
+ * that is unique to this connection.
+ */
+
+int process_channel(MsgIO *msgio, ra_channel_request_t *req,
+					ra_session_t *session)
+{
+	sgx_quote_nonce_t nonce;
+	unsigned char msg[3 + 2 * sizeof(sgx_quote_nonce_t)];
+
+	if (session->status != Trusted)
+	{
+		eprintf("secure channel requested on an untrusted session\n");
+		return 0;
+	}
+
+	if (RAND_bytes((unsigned char *)&nonce, sizeof(nonce)) != 1)
+	{
+		crypto_perror("RAND_bytes");
+		return 0;
+	}
+
+	/* RK = AES-CMAC(SK, 0x01 || "RK" || Nc || Ns) */
+
+	memcpy(msg, "\x01RK", 3);
+	memcpy(&msg[3], &req->nonce, sizeof(sgx_quote_nonce_t));
+	memcpy(&msg[3 + sizeof(sgx_quote_nonce_t)], &nonce,
+		   sizeof(sgx_quote_nonce_t));
+
+	if (!cmac128(session->sk, msg, sizeof(msg), session->rk))
+	{
+		crypto_perror("cmac128");
+		return 0;
+	}
+
+	session->have_rk = 1;
+	session->send_seq = 0;
+	session->recv_seq = 0;
+
+	if (msgio->send(&nonce, sizeof(nonce)) == -1)
+	{
+		eprintf("system error sending channel nonce\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+/* IV = sender role (32 bits) || seq (64 bits) */
+
+static void record_iv(uint32_t role, uint64_t seq, unsigned char iv[12])
+{
+	memcpy(iv, &role, sizeof(uint32_t));
+	memcpy(&iv[sizeof(uint32_t)], &seq, sizeof(uint64_t));
+}
+
+/*
+ * Handle one application record. This sample just echoes the payload
+ * back to the client over the channel.
+ */
+
+int process_record(MsgIO *msgio, ra_record_header_t *rec,
+				   ra_session_t *session)
+{
+	ra_record_header_t hdr;
+	unsigned char iv[12];
+	unsigned char *buf;
+	uint32_t len = rec->len;
+	int rv;
+
+	if (!session->have_rk)
+	{
+		eprintf("record received before the secure channel was opened\n");
+		return 0;
+	}
+	if (len > RA_RECORD_MAX_LEN)
+	{
+		eprintf("record too long\n");
+		return 0;
+	}
+	if (rec->seq != session->recv_seq)
+	{
+		eprintf("record out of sequence\n");
+		return 0;
+	}
+
+	buf = (unsigned char *)malloc(len ? len : 1);
+	if (buf == NULL)
+	{
+		perror("malloc");
+		return 0;
+	}
+
+	record_iv(RA_PROOF_ROLE_CLIENT, rec->seq, iv);
+	if (!aes128gcm_decrypt(session->rk, iv, (unsigned char *)rec,
+						   RA_RECORD_AAD_SIZE, (unsigned char *)(rec + 1), len,
+						   buf, (unsigned char *)rec->tag))
+	{
+		eprintf("record failed authentication\n");
+		free(buf);
+		return 0;
+	}
+	++session->recv_seq;
+
+	/* Echo it back, encrypting in place */
+
+	hdr.type = RA_MSG_TYPE_RECORD;
+	hdr.len = len;
+	hdr.seq = session->send_seq;
+
+	record_iv(RA_PROOF_ROLE_SERVER, hdr.seq, iv);
+	if (!aes128gcm_encrypt(session->rk, iv, (unsigned char *)&hdr,
+						   RA_RECORD_AAD_SIZE, buf, len, buf,
+						   (unsigned char *)hdr.tag))
+	{
+		crypto_perror("aes128gcm_encrypt");
+		free(buf);
+		return 0;
+	}
+	++session->send_seq;
+
+	rv = msgio->send_record(&hdr, buf);
+	free(buf);
+	if (rv == -1)
+	{
+		eprintf("system error sending record\n");
+		return 0;
+	}
 
-	/* Get the sigrl */
+	return 1;
+}
+
+/*
+ * Issue a session ticket (see protocol.h) for a session that has just
+ * been attested.
+ */
 
-	if (!get_sigrl(ias, config->apiver, msg1->gid, sigrl,
-				   &msg2->sig_rl_size))
+int ticket_issue(const config_t *config, ra_session_t *session,
+				 sgx_report_body_t *r, ra_ticket_t *ticket)
+{
+	ra_ticket_body_t body;
+	int rv;
+
+	memcpy(body.sk, session->sk, 16);
+	memcpy(body.mk, session->mk, 16);
+	body.expires = (uint64_t)time(NULL) + config->ticket_lifetime;
+	memcpy(&body.report_body, r, sizeof(sgx_report_body_t));
+
+	if (RAND_bytes((unsigned char *)&ticket->id, sizeof(ticket->id)) != 1)
 	{
+		crypto_perror("RAND_bytes");
+		return 0;
+	}
 
-		eprintf("could not retrieve the sigrl\n");
-		free(msg01);
+	rv = aes128gcm_encrypt((unsigned char *)config->ticket_key, (unsigned char *)&ticket->id,
+						   (unsigned char *)&ticket->id, sizeof(ticket->id),
+						   (unsigned char *)&body, sizeof(body), ticket->body,
+						   (unsigned char *)ticket->tag);
+
+	memset(&body, 0, sizeof(body));
+
+	if (!rv)
+		crypto_perror("aes128gcm_encrypt");
+
+	return rv;
+}
+
+/* Decrypt a session ticket. Returns 0 if it's forged or expired. */
+
+int ticket_open(const config_t *config, ra_ticket_t *ticket,
+				ra_ticket_body_t *body)
+{
+	if (!aes128gcm_decrypt((unsigned char *)config->ticket_key, (unsigned char *)&ticket->id,
+						   (unsigned char *)&ticket->id, sizeof(ticket->id),
+						   ticket->body, sizeof(ticket->body),
+						   (unsigned char *)body, (unsigned char *)ticket->tag))
+	{
+		memset(body, 0, sizeof(ra_ticket_body_t));
 		return 0;
 	}
 
-	memcpy(gb_ga, &msg2->g_b, 64);
-	memcpy(session->g_b, &msg2->g_b, 64);
+	if (body->expires <= (uint64_t)time(NULL))
+	{
+		memset(body, 0, sizeof(ra_ticket_body_t));
+		return 0;
+	}
 
-	memcpy(&gb_ga[64], &msg1->g_a, 64);
-	memcpy(session->g_a, &msg1->g_a, 64);
+	return 1;
+}
 
-	if (debug)
-		eprintf("+++ GbGa = %s\n", hexstring(gb_ga, 128));
+/*
+ * Resume a session from a ticket. The client has to prove it holds the
+ * SK sealed in the ticket by answering a fresh challenge, and the
+ * enclave identity in the ticket has to pass our current policy, which
+ * may have changed since the ticket was issued.
+ */
 
-	ecdsa_sign(gb_ga, 128, config->service_private_key, r, s, digest);
-	reverse_bytes(&msg2->sign_gb_ga.x, r, 32);
-	reverse_bytes(&msg2->sign_gb_ga.y, s, 32);
+int process_resume(MsgIO *msgio, ra_resume_request_t *req, const config_t *config,
+				   ra_session_t *session)
+{
+	ra_ticket_body_t body;
+	ra_resume_challenge_t challenge;
+	ra_resume_response_t response;
+	ra_proof_t *client_proof = NULL;
+	sgx_mac_t vrfymac;
+	size_t sz;
+	int rv;
 
-	if (debug)
+	memset(&response, 0, sizeof(response));
+	response.status = NotTrusted;
+
+	if (!ticket_open(config, &req->ticket, &body))
 	{
-		eprintf("+++ sha256(GbGa) = %s\n", hexstring(digest, 32));
-		eprintf("+++ r = %s\n", hexstring(r, 32));
-		eprintf("+++ s = %s\n", hexstring(s, 32));
+		eprintf("invalid or expired session ticket\n");
+		goto done;
 	}
 
-	/* The "A" component is conveniently at the start of sgx_ra_msg2_t */
+#ifndef _WIN32
+	if (!enclave_policy_verify(config->policy, &body.report_body,
+							   config->allow_debug_enclave))
+	{
+		eprintf("Invalid enclave.\n");
+		goto done;
+	}
+#endif
 
-	cmac128(session->smk, (unsigned char *)msg2, 148,
-			(unsigned char *)&msg2->mac);
+	if (RAND_bytes((unsigned char *)&challenge.challenge,
+				   sizeof(challenge.challenge)) != 1)
+	{
+		crypto_perror("RAND_bytes");
+		goto done;
+	}
+
+	if (msgio->send(&challenge, sizeof(challenge)) == -1)
+	{
+		eprintf("system error sending resume challenge\n");
+		goto fail;
+	}
+
+	rv = msgio->read((void **)&client_proof, &sz);
+	if (rv == -1)
+	{
+		eprintf("system error reading resume proof\n");
+		goto fail;
+	}
+	else if (rv == 0)
+	{
+		eprintf("protocol error reading resume proof\n");
+		goto fail;
+	}
+	if (sz / 2 != sizeof(ra_proof_t))
+	{
+		eprintf("protocol error: bad resume proof size\n");
+		free(client_proof);
+		goto fail;
+	}
+
+	proof_mac(body.sk, RA_PROOF_ROLE_CLIENT, &challenge.challenge,
+			  &client_proof->nonce, vrfymac);
+	rv = CRYPTO_memcmp(vrfymac, client_proof->mac, sizeof(sgx_mac_t));
+	free(client_proof);
+	if (rv)
+	{
+		eprintf("session ticket proof of possession FAILED\n");
+		goto done;
+	}
+
+	if (RAND_bytes((unsigned char *)&response.proof.nonce,
+				   sizeof(response.proof.nonce)) != 1)
+	{
+		crypto_perror("RAND_bytes");
+		goto done;
+	}
+
+	memcpy(session->sk, body.sk, 16);
+	memcpy(session->mk, body.mk, 16);
+	session->status = Trusted;
+
+	response.status = Trusted;
+	proof_mac(session->sk, RA_PROOF_ROLE_SERVER, &req->challenge,
+			  &response.proof.nonce, response.proof.mac);
 
 	if (verbose)
+		eprintf("Session resumed from ticket %s\n",
+				hexstring(&req->ticket.id, sizeof(req->ticket.id)));
+
+done:
+	memset(&body, 0, sizeof(body));
+
+	if (msgio->send(&response, sizeof(response)) == -1)
 	{
-		edividerWithText("Msg2 Details");
-		eprintf("msg2.g_b.gx      = %s\n",
-				hexstring(&msg2->g_b.gx, sizeof(msg2->g_b.gx)));
-		eprintf("msg2.g_b.gy      = %s\n",
-				hexstring(&msg2->g_b.gy, sizeof(msg2->g_b.gy)));
-		eprintf("msg2.spid        = %s\n",
-				hexstring(&msg2->spid, sizeof(msg2->spid)));
-		eprintf("msg2.quote_type  = %s\n",
-				hexstring(&msg2->quote_type, sizeof(msg2->quote_type)));
-		eprintf("msg2.kdf_id      = %s\n",
-				hexstring(&msg2->kdf_id, sizeof(msg2->kdf_id)));
-		eprintf("msg2.sign_ga_gb  = %s\n",
-				hexstring(&msg2->sign_gb_ga, sizeof(msg2->sign_gb_ga)));
-		eprintf("msg2.mac         = %s\n",
-				hexstring(&msg2->mac, sizeof(msg2->mac)));
-		eprintf("msg2.sig_rl_size = %s\n",
-				hexstring(&msg2->sig_rl_size, sizeof(msg2->sig_rl_size)));
-		edivider();
+		eprintf("system error sending resume response\n");
+		return 0;
 	}
 
-	free(msg01);
+	return (response.status == Trusted);
 
-	return 1;
+fail:
+	memset(&body, 0, sizeof(body));
+
+	return 0;
 }
 
 int derive_kdk(EVP_PKEY *Gb, unsigned char kdk[16], sgx_ec256_public_t g_a,
-			   config_t *config)
+			   const config_t *config)
 {
 	unsigned char *Gab_x;
 	size_t slen;
@@ -1515,6 +3061,18 @@ int get_sigrl(IAS_Connection *ias, int version, sgx_epid_group_id_t gid,
 	int oops = 1;
 	string sigrlstr;
 
+	/* Our buffer from the last msg1 on this worker, if any */
+
+	free(*sig_rl);
+	*sig_rl = NULL;
+
+	if (spcache_sigrl_get(*(uint32_t *)gid, sig_rl, sig_rl_size))
+	{
+		if (debug)
+			eprintf("+++ using cached SigRL\n");
+		return 1;
+	}
+
 	try
 	{
 		oops = 0;
@@ -1579,18 +3137,58 @@ int get_sigrl(IAS_Connection *ias, int version, sgx_epid_group_id_t gid,
 	*sig_rl_size = (uint32_t)size;
 	delete req;
 
+	spcache_sigrl_put(*(uint32_t *)gid, *sig_rl, *sig_rl_size);
+
 	return 1;
 }
 
 int get_attestation_report(IAS_Connection *ias, int version,
-						   const char *b64quote, sgx_ps_sec_prop_desc_t secprop, ra_msg4_t *msg4,
-						   int strict_trust)
+						   const char *b64quote, ra_msg4_t *msg4,
+						   int strict_trust, const quote_trust_t *trust,
+						   unsigned int cache_ttl)
 {
 	IAS_Request *req = NULL;
 	map<string, string> payload;
 	vector<string> messages;
 	ias_error_t status;
 	string content;
+	string keystr;
+	unsigned char key[32];
+	char *cached = NULL;
+	unsigned int i;
+
+	/*
+	 * Reuse a recent result for the same quote. The API version and our
+	 * trust policy are part of the key since they shape the result.
+	 */
+
+	keystr = b64quote;
+	keystr += (char)version;
+	keystr += (char)strict_trust;
+	for (i = 0; i < trust->nadvisories; ++i)
+	{
+		keystr += ',';
+		keystr += trust->advisories[i];
+	}
+
+	if (!sha256_digest((const unsigned char *)keystr.data(), keystr.length(),
+					   key))
+	{
+		crypto_perror("sha256_digest");
+		return 0;
+	}
+
+	if (cache_ttl && spcache_report_get(key, cache_ttl, msg4, &cached))
+	{
+		if (verbose)
+		{
+			edividerWithText("Report Body (cached)");
+			eprintf("%s\n", (cached == NULL) ? "(not kept)" : cached);
+			edivider();
+		}
+		free(cached);
+		return 1;
+	}
 
 	try
 	{
@@ -1609,7 +3207,7 @@ int get_attestation_report(IAS_Connection *ias, int version,
 	status = req->report(payload, content, messages);
 	if (status == IAS_OK)
 	{
-		JSON reportObj = JSON::Load(content);
+		ias_report_t report;
 
 		if (verbose)
 		{
@@ -1629,50 +3227,53 @@ int get_attestation_report(IAS_Connection *ias, int version,
 			}
 		}
 
+		if (!ias_report_parse(&report, content.data(), content.length()))
+		{
+			eprintf("Could not parse the attestation report\n");
+			delete req;
+			return 0;
+		}
+
 		if (verbose)
 		{
 			edividerWithText("IAS Report - JSON - Required Fields");
 			if (version >= 3)
 			{
-				eprintf("version               = %d\n",
-						reportObj["version"].ToInt());
+				eprintf("version               = %u\n", report.version);
 			}
-			eprintf("id:                   = %s\n",
-					reportObj["id"].ToString().c_str());
-			eprintf("timestamp             = %s\n",
-					reportObj["timestamp"].ToString().c_str());
-			eprintf("isvEnclaveQuoteStatus = %s\n",
-					reportObj["isvEnclaveQuoteStatus"].ToString().c_str());
-			eprintf("isvEnclaveQuoteBody   = %s\n",
-					reportObj["isvEnclaveQuoteBody"].ToString().c_str());
+			eprintf("id:                   = %.*s\n", REPORT_FIELD(report.id));
+			eprintf("timestamp             = %.*s\n",
+					REPORT_FIELD(report.timestamp));
+			eprintf("isvEnclaveQuoteStatus = %.*s\n",
+					REPORT_FIELD(report.isvEnclaveQuoteStatus));
+			eprintf("isvEnclaveQuoteBody   = %.*s\n",
+					REPORT_FIELD(report.isvEnclaveQuoteBody));
 
 			edividerWithText("IAS Report - JSON - Optional Fields");
 
-			eprintf("platformInfoBlob  = %s\n",
-					reportObj["platformInfoBlob"].ToString().c_str());
-			eprintf("revocationReason  = %s\n",
-					reportObj["revocationReason"].ToString().c_str());
-			eprintf("pseManifestStatus = %s\n",
-					reportObj["pseManifestStatus"].ToString().c_str());
-			eprintf("pseManifestHash   = %s\n",
-					reportObj["pseManifestHash"].ToString().c_str());
-			eprintf("nonce             = %s\n",
-					reportObj["nonce"].ToString().c_str());
-			eprintf("epidPseudonym     = %s\n",
-					reportObj["epidPseudonym"].ToString().c_str());
+			eprintf("platformInfoBlob  = %.*s\n",
+					REPORT_FIELD(report.platformInfoBlob));
+			eprintf("revocationReason  = %.*s\n",
+					REPORT_FIELD(report.revocationReason));
+			eprintf("pseManifestStatus = %.*s\n",
+					REPORT_FIELD(report.pseManifestStatus));
+			eprintf("pseManifestHash   = %.*s\n",
+					REPORT_FIELD(report.pseManifestHash));
+			eprintf("nonce             = %.*s\n",
+					REPORT_FIELD(report.nonce));
+			eprintf("epidPseudonym     = %.*s\n",
+					REPORT_FIELD(report.epidPseudonym));
 			if (version >= 4)
 			{
-				int i;
-
-				eprintf("advisoryURL       = %s\n",
-						reportObj["advisoryURL"].ToString().c_str());
+				eprintf("advisoryURL       = %.*s\n",
+						REPORT_FIELD(report.advisoryURL));
 				eprintf("advisoryIDs       = ");
-				/* This is a JSON array */
-				for (i = 0; i < reportObj["advisoryIDs"].length(); ++i)
+				for (i = 0; i < report.nadvisories; ++i)
 				{
-					eprintf("%s%s", (i) ? "," : "", reportObj["advisoryIDs"][i].ToString().c_str());
+					eprintf("%s%.*s", (i) ? "," : "",
+							REPORT_FIELD(report.advisoryIDs[i]));
 				}
-				eprintf("\n");
+				eprintf("%s\n", (report.advisories_truncated) ? ",..." : "");
 			}
 			edivider();
 		}
@@ -1684,15 +3285,14 @@ int get_attestation_report(IAS_Connection *ias, int version,
 		 * For API v3 and up, this field MUST be in the report.
 		 */
 
-		if (reportObj.hasKey("version"))
+		if (report.have_version)
 		{
-			unsigned int rversion = (unsigned int)reportObj["version"].ToInt();
 			if (verbose)
 				eprintf("+++ Verifying report version against API version\n");
-			if (version != rversion)
+			if ((unsigned int)version != report.version)
 			{
 				eprintf("Report version %u does not match API version %u\n",
-						rversion, version);
+						report.version, version);
 				delete req;
 				return 0;
 			}
@@ -1705,30 +3305,9 @@ int get_attestation_report(IAS_Connection *ias, int version,
 		}
 
 		/*
-		 * This sample's attestion policy is based on isvEnclaveQuoteStatus:
-		 *
-		 *   1) if "OK" then return "Trusted"
-		 *
-		 *   2) if "CONFIGURATION_NEEDED", "SW_HARDENING_NEEDED", or
-		 *      "CONFIGURATION_AND_SW_HARDENING_NEEDED", then return
-				"NotTrusted_ItsComplicated" when in --strict-trust-mode
-				 and "Trusted_ItsComplicated" otherwise
-		 *
-		 *   3) return "NotTrusted" for all other responses
-		 *
-		 * In case #2, this is ultimatly a policy decision. Do you want to
-		 * trust a client that is running with a configuration that weakens
-		 * its security posture? Even if you ultimately choose to trust the
-		 * client, the "Trusted_ItsComplicated" response is intended to
-		 * tell the client "I'll trust you (for now), but inform the user
-		 * that I may not trust them in the future unless they take some
-		 * action". A real service would provide some guidance to the
-		 * end user based on the advisory URLs and advisory IDs.
-		 */
-
-		/*
-		 * Simply check to see if status is OK, else enclave considered
-		 * not trusted
+		 * The trust decision is made by a table, indexed by the quote
+		 * status and the advisories that came with it. See
+		 * quote_trust.c for the policy.
 		 */
 
 		memset(msg4, 0, sizeof(ra_msg4_t));
@@ -1736,48 +3315,51 @@ int get_attestation_report(IAS_Connection *ias, int version,
 		if (verbose)
 			edividerWithText("ISV Enclave Trust Status");
 
-		if (!(reportObj["isvEnclaveQuoteStatus"].ToString().compare("OK")))
 		{
-			msg4->status = Trusted;
-			if (verbose)
-				eprintf("Enclave TRUSTED\n");
-		}
-		else if (!(reportObj["isvEnclaveQuoteStatus"].ToString().compare("CONFIGURATION_NEEDED")))
-		{
-			if (strict_trust)
+			ias_report_str_t *qstatus = &report.isvEnclaveQuoteStatus;
+			uint64_t advisories = 0;
+
+			/* Advisories we had no room for can't have been allowed */
+
+			if (report.advisories_truncated)
+				advisories = QUOTE_TRUST_OTHER_ADVISORY;
+
+			for (i = 0; i < report.nadvisories; ++i)
 			{
-				msg4->status = NotTrusted_ItsComplicated;
-				if (verbose)
-					eprintf("Enclave NOT TRUSTED and COMPLICATED - Reason: %s\n",
-							reportObj["isvEnclaveQuoteStatus"].ToString().c_str());
+				advisories |= quote_trust_advisory(trust,
+												   report.advisoryIDs[i].str, report.advisoryIDs[i].len);
 			}
-			else
+
+			msg4->status = quote_trust_decide(trust, strict_trust,
+											  (qstatus->str == NULL) ? QUOTE_STATUS_UNKNOWN : quote_status_lookup(qstatus->str, qstatus->len),
+											  advisories);
+
+			if (verbose)
 			{
-				if (verbose)
-					eprintf("Enclave TRUSTED and COMPLICATED - Reason: %s\n",
-							reportObj["isvEnclaveQuoteStatus"].ToString().c_str());
-				msg4->status = Trusted_ItsComplicated;
+				switch (msg4->status)
+				{
+				case Trusted:
+					eprintf("Enclave TRUSTED\n");
+					break;
+				case Trusted_ItsComplicated:
+					eprintf("Enclave TRUSTED and COMPLICATED - Reason: %.*s\n",
+							REPORT_FIELD(*qstatus));
+					break;
+				case NotTrusted_ItsComplicated:
+					eprintf("Enclave NOT TRUSTED and COMPLICATED - Reason: %.*s\n",
+							REPORT_FIELD(*qstatus));
+					break;
+				default:
+					eprintf("Enclave NOT TRUSTED - Reason: %.*s\n",
+							REPORT_FIELD(*qstatus));
+				}
 			}
 		}
-		else if (!(reportObj["isvEnclaveQuoteStatus"].ToString().compare("GROUP_OUT_OF_DATE")))
-		{
-			msg4->status = NotTrusted_ItsComplicated;
-			if (verbose)
-				eprintf("Enclave NOT TRUSTED and COMPLICATED - Reason: %s\n",
-						reportObj["isvEnclaveQuoteStatus"].ToString().c_str());
-		}
-		else
-		{
-			msg4->status = NotTrusted;
-			if (verbose)
-				eprintf("Enclave NOT TRUSTED - Reason: %s\n",
-						reportObj["isvEnclaveQuoteStatus"].ToString().c_str());
-		}
 
 		/* Check to see if a platformInfoBlob was sent back as part of the
 		 * response */
 
-		if (!reportObj["platformInfoBlob"].IsNull())
+		if (report.platformInfoBlob.str != NULL)
 		{
 			if (verbose)
 				eprintf("A Platform Info Blob (PIB) was provided by the IAS\n");
@@ -1785,15 +3367,19 @@ int get_attestation_report(IAS_Connection *ias, int version,
 			/* The platformInfoBlob has two parts, a TVL Header (4 bytes),
 			 * and TLV Payload (variable) */
 
-			string pibBuff = reportObj["platformInfoBlob"].ToString();
+			/* skip the TLV Header (8 base16 chars, ie. 4 bytes) in the
+			 * PIB. */
 
-			/* remove the TLV Header (8 base16 chars, ie. 4 bytes) from
-			 * the PIB Buff. */
+			if (report.platformInfoBlob.len > 4 * 2)
+			{
+				size_t pibsz = (report.platformInfoBlob.len - 4 * 2) / 2;
 
-			pibBuff.erase(pibBuff.begin(), pibBuff.begin() + (4 * 2));
+				if (pibsz > sizeof(sgx_platform_info_t))
+					pibsz = sizeof(sgx_platform_info_t);
 
-			int ret = from_hexstring((unsigned char *)&msg4->platformInfoBlob,
-									 pibBuff.c_str(), pibBuff.length() / 2);
+				from_hexstring((unsigned char *)&msg4->platformInfoBlob,
+							   report.platformInfoBlob.str + 4 * 2, pibsz);
+			}
 		}
 		else
 		{
@@ -1801,6 +3387,15 @@ int get_attestation_report(IAS_Connection *ias, int version,
 				eprintf("A Platform Info Blob (PIB) was NOT provided by the IAS\n");
 		}
 
+		/*
+		 * Only keep results we trust. Anything else should be asked
+		 * about again, in case it was a transient problem.
+		 */
+
+		if (cache_ttl && (msg4->status == Trusted ||
+						  msg4->status == Trusted_ItsComplicated))
+			spcache_report_put(key, msg4, content.c_str());
+
 		delete req;
 		return 1;
 	}
@@ -1923,20 +3518,197 @@ int get_proxy(char **server, unsigned int *port, const char *url)
 
 #ifndef _WIN32
 
+/*
+ * Fork a worker process into slot i of children[]. Returns 0 in the
+ * child, and -1 if the fork fails.
+ */
+
+static pid_t fork_worker(unsigned int i)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid == -1)
+	{
+		perror("fork");
+		return -1;
+	}
+	if (pid == 0)
+	{
+		nchildren = 0;
+		return 0;
+	}
+
+	children[i] = pid;
+	started[i] = time(NULL);
+
+	return pid;
+}
+
+/*
+ * Fork n worker processes. Each child returns 1 and goes on to set up
+ * its own IAS connections and listening sockets. The parent passes
+ * shutdown and reload signals on to the children, replaces any that
+ * exit, and exits when they're all gone after a shutdown.
+ * It returns 0 if the first fork fails.
+ *
+ * Shutdown and reload signals are blocked whenever we fork, so neither
+ * side of the fork can get one before its handlers are in place. A
+ * child leaves them blocked until main() has installed its own.
+ *
+ * Our configuration is the one from startup, so a replacement worker
+ * always reloads it before serving anyone.
+ */
+
+int fork_workers(unsigned int n)
+{
+	struct sigaction sact;
+	sigset_t sigs, oldsigs;
+	unsigned int i;
+	int status;
+	pid_t pid;
+
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	sigaddset(&sigs, SIGQUIT);
+	sigaddset(&sigs, SIGHUP);
+	sigprocmask(SIG_BLOCK, &sigs, &oldsigs);
+
+	sigemptyset(&sact.sa_mask);
+	sact.sa_flags = 0;
+	sact.sa_handler = &stop_workers;
+
+	sigaction(SIGINT, &sact, NULL);
+	sigaction(SIGTERM, &sact, NULL);
+	sigaction(SIGQUIT, &sact, NULL);
+
+	sact.sa_handler = &reload_workers;
+	sigaction(SIGHUP, &sact, NULL);
+
+	for (i = 0; i < n; ++i)
+	{
+		pid = fork_worker(nchildren);
+		if (pid == 0)
+			return 1;
+		if (pid == -1)
+		{
+			if (nchildren == 0)
+			{
+				sigprocmask(SIG_SETMASK, &oldsigs, NULL);
+				return 0;
+			}
+			break;
+		}
+		++nchildren;
+	}
+
+	sigprocmask(SIG_SETMASK, &oldsigs, NULL);
+
+	while (nchildren)
+	{
+		pid = wait(&status);
+		if (pid == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("wait");
+			break;
+		}
+
+		if (verbose)
+			eprintf("worker process %d exited\n", (int)pid);
+
+		for (i = 0; i < nchildren; ++i)
+		{
+			if (children[i] == pid)
+				break;
+		}
+		if (i == nchildren)
+			continue;
+
+		/* Replace it, giving one that died straight away a moment */
+
+		if (!stopping && time(NULL) - started[i] < SP_RESPAWN_DELAY)
+			sleep(SP_RESPAWN_DELAY);
+
+		sigprocmask(SIG_BLOCK, &sigs, NULL);
+		if (stopping || (pid = fork_worker(i)) == -1)
+		{
+			children[i] = children[--nchildren];
+			started[i] = started[nchildren];
+		}
+		else if (pid == 0)
+		{
+			reload_requested = 1;
+			return 1;
+		}
+		else if (verbose)
+		{
+			eprintf("started worker process %d\n", (int)pid);
+		}
+		sigprocmask(SIG_SETMASK, &oldsigs, NULL);
+	}
+
+	crypto_destroy();
+	exit(0);
+}
+
+/* Pass a shutdown signal on to the worker processes */
+
+void stop_workers(int signo)
+{
+	unsigned int i;
+
+	(void)signo;
+	stopping = 1;
+	for (i = 0; i < nchildren; ++i)
+		kill(children[i], SIGTERM);
+}
+
+/*
+ * Pass a SIGHUP on to the worker processes, which each reload. Note it
+ * here too, so a worker we fork later doesn't start from our stale
+ * copy of the configuration.
+ */
+
+void reload_workers(int signo)
+{
+	unsigned int i;
+
+	(void)signo;
+	reload_requested = 1;
+	for (i = 0; i < nchildren; ++i)
+		kill(children[i], SIGHUP);
+}
+
+/* Have the workers reload the configuration before their next request */
+
+void reload_config(int signo)
+{
+	(void)signo;
+	reload_requested = 1;
+}
+
 /* We don't care which signal it is since we're shutting down regardless */
 
 void cleanup_and_exit(int signo)
 {
+	(void)signo;
+
 	/* Signal-safe, and we don't care if it fails or is a partial write. */
 
-	ssize_t bytes = write(STDERR_FILENO, "\nterminating\n", 13);
+	if (write(STDERR_FILENO, "\nterminating\n", 13) == -1)
+	{
+	}
 
 	/*
 	 * This destructor consists of signal-safe system calls (close,
 	 * shutdown).
 	 */
 
-	delete msgio;
+	for (unsigned int i = 0; i < nlisteners; ++i)
+		delete listeners[i];
 
 	exit(1);
 }
@@ -1988,7 +3760,7 @@ void usage()
 			"  -B, --ca-bundle-file=FILE" NL
 			"                           Use the CA certificate bundle at FILE (default:" NL
 			"                           "
-		 << DEFAULT_CA_BUNDLE << ")" NNL "  -D, --no-debug-enclave   Reject Debug-mode enclaves (default: accept)" NNL "  -G, --list-agents        List available user agent names for --user-agent" NNL "  -K, --service-key-file=FILE" NL "                           The private key file for the service in PEM" NL "                           format (default: use hardcoded key). The " NL "                           client must be given the corresponding public" NL "                           key. Can't combine with --key." NNL "  -P, --production         Query the production IAS server instead of dev." NNL "  -X, --strict-trust-mode  Don't trust enclaves that receive a " NL "                           CONFIGURATION_NEEDED response from IAS " NL "                           (default: trust)" NNL "  -d, --debug              Print debug information to stderr." NNL "  -g, --user-agent=NAME    Use NAME as the user agent for contacting IAS." NNL "  -k, --key=HEXSTRING      The private key as a hex string. See --key-file" NL "                           for notes. Can't combine with --key-file." NNL "  -l, --linkable           Request a linkable quote (default: unlinkable)." NNL "  -p, --proxy=PROXYURL     Use the proxy server at PROXYURL when contacting" NL "                           IAS. Can't combine with --no-proxy" NNL "  -r, --api-version=N      Use version N of the IAS API (default: " << to_string(IAS_API_DEF_VERSION) << ")" NNL "  -v, --verbose            Be verbose. Print message structure details and" NL "                           the results of intermediate operations to stderr." NNL "  -x, --no-proxy           Do not use a proxy (force a direct connection), " NL "                           overriding environment." NNL "  -z  --stdio              Read from stdin and write to stdout instead of" NL "                           running as a network server." << endl;
+		 << DEFAULT_CA_BUNDLE << ")" NNL "  -C, --config-file=FILE   Read settings from FILE, which uses the same" NL "                           KEY=VALUE lines as the run-server settings file." NL "                           Options given on the command line override it." NL "                           On SIGHUP, sp rereads it and switches to the new" NL "                           settings without dropping clients. Keys: SPID," NL "                           IAS_PRIMARY_SUBSCRIPTION_KEY," NL "                           IAS_SECONDARY_SUBSCRIPTION_KEY," NL "                           IAS_REPORT_SIGNING_CA_FILE, SERVICE_KEY_FILE," NL "                           MRSIGNER, PRODID, MIN_ISVSVN, ENCLAVE_POLICY_FILE," NL "                           ALLOWED_ADVISORIES, ALLOW_DEBUG_ENCLAVE," NL "                           POLICY_STRICT_TRUST, REPORT_CACHE_TTL and" NL "                           LINKABLE." NNL "  -D, --no-debug-enclave   Reject Debug-mode enclaves (default: accept)" NNL "  -E, --enclave-policy=FILE" NL "                           Accept the enclaves listed in the policy FILE" NL "                           instead of those given by -N, -R and -V. FILE" NL "                           is reloaded when it changes." NNL "  -G, --list-agents        List available user agent names for --user-agent" NNL "  -K, --service-key-file=FILE" NL "                           The private key file for the service in PEM" NL "                           format (default: use hardcoded key). The " NL "                           client must be given the corresponding public" NL "                           key. Can't combine with --key." NNL "  -M, --max-sessions=N     Turn away new attestations while N are in" NL "                           progress in a process (default: " << to_string(SP_MAX_SESSIONS) << ")" NNL "  -P, --production         Query the production IAS server instead of dev." NNL "  -Q, --max-ias-requests=N Turn away new attestations while N requests to" NL "                           IAS are in progress in a process (default: " << to_string(SP_MAX_IAS_REQUESTS) << ")" NNL "  -T, --report-cache-ttl=SECS" NL "                           Reuse a trusted attestation result for the same" NL "                           quote for up to SECS seconds without asking IAS" NL "                           again, or never with 0 (default: " << to_string(SP_REPORT_CACHE_TTL) << ")" NNL "  -X, --strict-trust-mode  Don't trust enclaves that receive a " NL "                           CONFIGURATION_NEEDED response from IAS " NL "                           (default: trust)" NNL "  -a, --allow-advisory=ID[,ID...]" NL "                           In strict trust mode, still trust enclaves whose" NL "                           IAS report lists only these advisory IDs." NNL "  -b, --backlog=N          Queue up to N pending connections on each" NL "                           listening socket (default: " << to_string(SP_LISTEN_BACKLOG) << ")" NNL "  -d, --debug              Print debug information to stderr." NNL "  -g, --user-agent=NAME    Use NAME as the user agent for contacting IAS." NNL "  -k, --key=HEXSTRING      The private key as a hex string. See --key-file" NL "                           for notes. Can't combine with --key-file." NNL "  -l, --linkable           Request a linkable quote (default: unlinkable)." NNL "  -n, --processes=N        Fork N worker processes (default: " << to_string(SP_PROCESSES) << ")" NNL "  -p, --proxy=PROXYURL     Use the proxy server at PROXYURL when contacting" NL "                           IAS. Can't combine with --no-proxy" NNL "  -r, --api-version=N      Use version N of the IAS API (default: " << to_string(IAS_API_DEF_VERSION) << ")" NNL "  -v, --verbose            Be verbose. Print message structure details and" NL "                           the results of intermediate operations to stderr." NNL "  -w, --workers=N          Serve clients from N threads in each process" NL "                           (default: " << to_string(SP_WORKERS) << ")" NNL "  -x, --no-proxy           Do not use a proxy (force a direct connection), " NL "                           overriding environment." NNL "  -z  --stdio              Read from stdin and write to stdout instead of" NL "                           running as a network server." NNL "The port can instead be a Unix domain socket, given as unix:PATH (or" NL "unixpacket:PATH for SOCK_SEQPACKET), with an @ at the start of PATH for" NL "the abstract namespace." << endl;
 
 	::exit(1);
 }
@@ -0,0 +1,306 @@
+/*
+
+Copyright 2018 Intel Corporation
+
+This software and the related documents are Intel copyrighted materials,
+and your use of them is governed by the express license under which they
+were provided to you (License). Unless the License provides otherwise,
+you may not use, modify, copy, publish, distribute, disclose or transmit
+this software or the related documents without Intel's prior written
+permission.
+
+This software and the related documents are provided as is, with no
+express or implied warranties, other than those that are expressly stated
+in the License.
+
+*/
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+# include <mutex>
+#else
+# include <sys/mman.h>
+# include <pthread.h>
+# include <errno.h>
+#endif
+#include "spcache.h"
+#include "settings.h"
+
+using namespace std;
+
+/*
+ * The cache is a single fixed-size segment. When sp forks worker
+ * processes it is a shared anonymous mapping, and its lock lives in
+ * the segment too. Tables are small enough to search linearly. A full
+ * table evicts its oldest entry, or for reports, the one that was used
+ * least recently.
+ */
+
+typedef struct spcache_sigrl_struct {
+	time_t fetched;		/* 0 if the slot is free */
+	uint32_t gid;
+	uint32_t size;
+	char data[SP_SIGRL_CACHE_SIZE];
+} spcache_sigrl_t;
+
+typedef struct spcache_chain_struct {
+	time_t verified;	/* 0 if the slot is free */
+	unsigned char hash[32];
+} spcache_chain_t;
+
+typedef struct spcache_report_struct {
+	time_t stored;		/* 0 if the slot is free */
+	uint64_t used;
+	unsigned char key[32];
+	ra_msg4_t msg4;
+	uint32_t size;		/* of report, 0 if it wasn't kept */
+	char report[SP_REPORT_CACHE_SIZE];
+} spcache_report_t;
+
+typedef struct spcache_struct {
+#ifndef _WIN32
+	pthread_mutex_t lock;
+#endif
+	uint64_t clock;		/* ticks on every report lookup or store */
+	spcache_sigrl_t sigrl[SP_SIGRL_CACHE_SLOTS];
+	spcache_chain_t chain[SP_CHAIN_CACHE_SLOTS];
+	spcache_report_t report[SP_REPORT_CACHE_SLOTS];
+} spcache_t;
+
+static spcache_t *cache= NULL;
+#ifdef _WIN32
+static mutex cache_mutex;
+#endif
+
+int spcache_init()
+{
+#ifdef _WIN32
+	cache= (spcache_t *) calloc(1, sizeof(spcache_t));
+	if ( cache == NULL ) {
+		perror("calloc");
+		return 0;
+	}
+#else
+	pthread_mutexattr_t attr;
+	void *seg;
+
+	seg= mmap(NULL, sizeof(spcache_t), PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if ( seg == MAP_FAILED ) {
+		perror("mmap");
+		return 0;
+	}
+
+	/* mmap() gives us zeroed memory, so every slot starts out free */
+
+	cache= (spcache_t *) seg;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+# ifdef __linux__
+	/* Don't let a worker that dies holding the lock take the rest down */
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+# endif
+	pthread_mutex_init(&cache->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+#endif
+
+	return 1;
+}
+
+static void cache_lock()
+{
+#ifdef _WIN32
+	cache_mutex.lock();
+#else
+	int rv= pthread_mutex_lock(&cache->lock);
+
+# ifdef __linux__
+	/*
+	 * Every entry is written before its timestamp, so whatever the
+	 * owner left behind is either complete or still marked free.
+	 */
+	if ( rv == EOWNERDEAD ) pthread_mutex_consistent(&cache->lock);
+# endif
+#endif
+}
+
+static void cache_unlock()
+{
+#ifdef _WIN32
+	cache_mutex.unlock();
+#else
+	pthread_mutex_unlock(&cache->lock);
+#endif
+}
+
+int spcache_sigrl_get(uint32_t gid, char **sigrl, uint32_t *size)
+{
+	time_t now= time(NULL);
+	int i, found= 0;
+
+	if ( cache == NULL ) return 0;
+
+	cache_lock();
+	for (i= 0; i< SP_SIGRL_CACHE_SLOTS; ++i) {
+		spcache_sigrl_t *slot= &cache->sigrl[i];
+
+		if ( slot->fetched == 0 || slot->gid != gid ) continue;
+		if ( now - slot->fetched >= SP_SIGRL_TTL ) break;
+
+		/* Allocate at least a byte so an empty SigRL isn't NULL */
+		*sigrl= (char *) malloc(slot->size ? slot->size : 1);
+		if ( *sigrl != NULL ) {
+			memcpy(*sigrl, slot->data, slot->size);
+			*size= slot->size;
+			found= 1;
+		}
+		break;
+	}
+	cache_unlock();
+
+	return found;
+}
+
+void spcache_sigrl_put(uint32_t gid, const char *sigrl, uint32_t size)
+{
+	spcache_sigrl_t *slot= NULL;
+	int i;
+
+	if ( cache == NULL || size > SP_SIGRL_CACHE_SIZE ) return;
+
+	cache_lock();
+	for (i= 0; i< SP_SIGRL_CACHE_SLOTS; ++i) {
+		spcache_sigrl_t *s= &cache->sigrl[i];
+
+		if ( s->fetched && s->gid == gid ) {
+			slot= s;
+			break;
+		}
+		if ( slot == NULL || s->fetched < slot->fetched ) slot= s;
+	}
+
+	slot->fetched= 0;
+	slot->gid= gid;
+	slot->size= size;
+	memcpy(slot->data, sigrl, size);
+	slot->fetched= time(NULL);
+	cache_unlock();
+}
+
+int spcache_chain_verified(const unsigned char hash[32])
+{
+	time_t now= time(NULL);
+	int i, found= 0;
+
+	if ( cache == NULL ) return 0;
+
+	cache_lock();
+	for (i= 0; i< SP_CHAIN_CACHE_SLOTS; ++i) {
+		spcache_chain_t *slot= &cache->chain[i];
+
+		if ( slot->verified && memcmp(slot->hash, hash, 32) == 0 ) {
+			found= ( now - slot->verified < SP_CHAIN_TTL );
+			break;
+		}
+	}
+	cache_unlock();
+
+	return found;
+}
+
+void spcache_chain_put(const unsigned char hash[32])
+{
+	spcache_chain_t *slot= NULL;
+	int i;
+
+	if ( cache == NULL ) return;
+
+	cache_lock();
+	for (i= 0; i< SP_CHAIN_CACHE_SLOTS; ++i) {
+		spcache_chain_t *s= &cache->chain[i];
+
+		if ( s->verified && memcmp(s->hash, hash, 32) == 0 ) {
+			slot= s;
+			break;
+		}
+		if ( slot == NULL || s->verified < slot->verified ) slot= s;
+	}
+
+	slot->verified= 0;
+	memcpy(slot->hash, hash, 32);
+	slot->verified= time(NULL);
+	cache_unlock();
+}
+
+int spcache_report_get(const unsigned char key[32], unsigned int ttl,
+	ra_msg4_t *msg4, char **report)
+{
+	time_t now= time(NULL);
+	int i, found= 0;
+
+	if ( cache == NULL ) return 0;
+
+	cache_lock();
+	for (i= 0; i< SP_REPORT_CACHE_SLOTS; ++i) {
+		spcache_report_t *slot= &cache->report[i];
+
+		if ( slot->stored == 0 || memcmp(slot->key, key, 32) ) continue;
+		if ( now - slot->stored >= (time_t) ttl ) {
+			slot->stored= 0;
+			break;
+		}
+
+		*report= NULL;
+		if ( slot->size ) {
+			*report= (char *) malloc(slot->size+1);
+			if ( *report == NULL ) break;
+			memcpy(*report, slot->report, slot->size);
+			(*report)[slot->size]= 0;
+		}
+
+		memcpy(msg4, &slot->msg4, sizeof(ra_msg4_t));
+		slot->used= ++cache->clock;
+		found= 1;
+		break;
+	}
+	cache_unlock();
+
+	return found;
+}
+
+void spcache_report_put(const unsigned char key[32], const ra_msg4_t *msg4,
+	const char *report)
+{
+	spcache_report_t *slot= NULL;
+	size_t size= strlen(report);
+	int i;
+
+	if ( cache == NULL ) return;
+
+	cache_lock();
+	for (i= 0; i< SP_REPORT_CACHE_SLOTS; ++i) {
+		spcache_report_t *s= &cache->report[i];
+
+		if ( s->stored && memcmp(s->key, key, 32) == 0 ) {
+			slot= s;
+			break;
+		}
+		if ( slot == NULL || s->stored == 0 ||
+			(slot->stored && s->used < slot->used) ) slot= s;
+	}
+
+	slot->stored= 0;
+	memcpy(slot->key, key, 32);
+	memcpy(&slot->msg4, msg4, sizeof(ra_msg4_t));
+	if ( size > SP_REPORT_CACHE_SIZE ) size= 0;
+	slot->size= (uint32_t) size;
+	memcpy(slot->report, report, size);
+	slot->used= ++cache->clock;
+	slot->stored= time(NULL);
+	cache_unlock();
+}
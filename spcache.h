@@ -0,0 +1,59 @@
+/*
+
+Copyright 2018 Intel Corporation
+
+This software and the related documents are Intel copyrighted materials,
+and your use of them is governed by the express license under which they
+were provided to you (License). Unless the License provides otherwise,
+you may not use, modify, copy, publish, distribute, disclose or transmit
+this software or the related documents without Intel's prior written
+permission.
+
+This software and the related documents are provided as is, with no
+express or implied warranties, other than those that are expressly stated
+in the License.
+
+*/
+
+#ifndef __SPCACHE__H
+#define __SPCACHE__H
+
+#include <sys/types.h>
+#include <inttypes.h>
+#include <time.h>
+#include "protocol.h"
+
+/*
+ * A cache of IAS results that is shared by all of sp's workers,
+ * including worker processes. Call spcache_init() before forking.
+ * Until it is called, every lookup misses and every store is a no-op.
+ */
+
+int spcache_init();
+
+/* SigRLs by EPID group ID. A hit returns a malloc'd copy. */
+
+int spcache_sigrl_get(uint32_t gid, char **sigrl, uint32_t *size);
+void spcache_sigrl_put(uint32_t gid, const char *sigrl, uint32_t size);
+
+/*
+ * IAS report signing certificate chains that verified, by a SHA-256 of
+ * the CA they verified against and the chain.
+ */
+
+int spcache_chain_verified(const unsigned char hash[32]);
+void spcache_chain_put(const unsigned char hash[32]);
+
+/*
+ * Attestation results, keyed by a SHA-256 of the quote. A hit has to be
+ * less than ttl seconds old. report gets a malloc'd copy of the IAS
+ * report body, or NULL if it was too large to keep. Least recently used
+ * results are evicted first.
+ */
+
+int spcache_report_get(const unsigned char key[32], unsigned int ttl,
+	ra_msg4_t *msg4, char **report);
+void spcache_report_put(const unsigned char key[32], const ra_msg4_t *msg4,
+	const char *report);
+
+#endif